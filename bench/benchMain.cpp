@@ -0,0 +1,1255 @@
+// Micro benchmarks for the editor internals.
+//
+//   ./build/benchEditor            run everything
+//   ./build/benchEditor replace    run the benchmarks whose name contains "replace"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "utils/replaceUtils.hpp"
+#include "utils/json11.hpp"
+#include "utils/utf8Utils.hpp"
+#include "utils/lineDiff.hpp"
+#include "Highlighter.h"
+#include "LineWidths.h"
+#include "LineStore.h"
+#include "LineRope.h"
+#include "FileViewer.h"
+#include "CompressedFile.h"
+#include "SyntaxConfig.h"
+#include "FileIo.h"
+#include "EventLoop.h"
+#include "TermWriter.h"
+#include "ncurses/curses.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+
+// every write() of the process goes through here (-Wl,--wrap=write), so the
+// ncurses and TermWriter paths are counted the same way
+static size_t g_writeCalls = 0;
+static size_t g_writeBytes = 0;
+
+extern "C" ssize_t __real_write(int fd, const void* buf, size_t count);
+extern "C" ssize_t __wrap_write(int fd, const void* buf, size_t count)
+{
+    g_writeCalls++;
+    g_writeBytes += count;
+    return __real_write(fd, buf, count);
+}
+
+struct Bench
+{
+    const char* name;
+    std::function<void()> run;
+};
+
+static std::vector<Bench>& benchList()
+{
+    static std::vector<Bench> list;
+    return list;
+}
+
+static void benchReport(const char* what, double ms, size_t items)
+{
+    printf("  %-40s %10.2f ms", what, ms);
+    if(items > 0)
+        printf("  (%zu items, %.1f ns/item)", items, ms * 1e6 / items);
+    printf("\n");
+}
+
+template <typename F>
+static double benchTime(F func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchReplaceAll()
+{
+    std::vector<std::string> text;
+    for(int i = 0; i < 500000; i++)
+        text.push_back("    foo = bar(foo, " + std::to_string(i) + "); // foo");
+
+    std::vector<std::string> result;
+    size_t count = 0;
+
+    double ms = benchTime([&](){
+        ReplaceEngine engine("foo", "fooBar", false);
+        count = engine.replaceAll(text, result);
+    });
+    benchReport("literal replace all", ms, count);
+
+    ms = benchTime([&](){
+        ReplaceEngine engine(R"((\w+)\((\w+), (\d+)\))", "$1($3, $2)", true);
+        count = engine.replaceAll(text, result);
+    });
+    benchReport("regex replace all (capture groups)", ms, count);
+
+    // F6 with an operator free pattern runs the literal search
+    ms = benchTime([&](){
+        ReplaceEngine engine("foo", "[$&]", true);
+        count = engine.replaceAll(text, result);
+    });
+    benchReport("regex replace all (plain word)", ms, count);
+}
+
+// ---------------------------------------------------------------------------
+
+static std::vector<TokenRule> benchRules()
+{
+    std::string err;
+    auto json = json11::Json::parse(R"({ "rules": [
+        { "name": "comment",       "pattern": "//.*",                            "color": 14 },
+        { "name": "block_comment", "pattern": "/\\*([^*]|\\*+[^*/])*\\*+/",        "color": 14 },
+        { "name": "string",        "pattern": "\"([^\"\\\\\\n]|\\\\(.|\\n))*\"?", "color": 2 },
+        { "name": "number",        "pattern": "[0-9]+(\\.[0-9]+)?[fFuUlL]*" },
+        { "name": "identifier",    "pattern": "[A-Za-z_][A-Za-z0-9_]*",          "keywords": true }
+    ]})", err);
+
+    std::vector<TokenRule> rules;
+    for(auto& iRule : json["rules"].array_items())
+        rules.push_back({iRule["name"].string_value(), iRule["pattern"].string_value(),
+                         (short)iRule["color"].int_value(), iRule["keywords"].bool_value()});
+    return rules;
+}
+
+static void benchLexer()
+{
+    std::vector<std::string> text;
+    for(int i = 0; i < 200000; i++)
+    {
+        text.push_back("    int value" + std::to_string(i) + " = compute(\"text\", 42); // note");
+        text.push_back("    /* block " + std::to_string(i) + " */ float x = 1.5f;");
+    }
+
+    size_t bytes = 0;
+    for(auto& line : text)
+        bytes += line.size();
+
+    std::vector<TokenSpan> spans;
+    Highlighter builtin;
+    double ms = benchTime([&](){
+        LexState state = 0;
+        for(auto& line : text)
+        {
+            spans.clear();
+            state = builtin.lexSpans(line, state, &spans);
+        }
+    });
+    benchReport("builtin Lexer (bytes)", ms, bytes);
+
+    DfaLexer dfa;
+    ms = benchTime([&](){ dfa.compile(benchRules()); });
+    benchReport("compile DFA (states)", ms, dfa.stateCount());
+
+    Highlighter table;
+    table.setDfa(dfa);
+    ms = benchTime([&](){
+        LexState state = 0;
+        for(auto& line : text)
+        {
+            spans.clear();
+            state = table.lexSpans(line, state, &spans);
+        }
+    });
+    benchReport("DFA lexer (bytes)", ms, bytes);
+}
+
+static void benchLongLine()
+{
+    // one line of minified JSON, about 50 MB
+    std::string line = "[";
+    while(line.size() < 50 * 1024 * 1024)
+        line += "{\"id\":" + std::to_string(line.size()) + ",\"name\":\"item\",\"tags\":[1,2,3]},";
+    line += "{}]";
+    TextBuffer text;
+    text.push_back(line);
+
+    std::mutex mutex;
+    Highlighter highlighter;
+    highlighter.setDfa([](){ DfaLexer dfa; dfa.compile(benchRules()); return dfa; }());
+    highlighter.attach(&mutex, &text);
+    highlighter.reset(1);
+
+    double ms = benchTime([&](){ highlighter.update(0); });
+    benchReport("checkpoint long line (bytes)", ms, line.size());
+
+    std::vector<TokenSpan> spans;
+    size_t windows = 0;
+    ms = benchTime([&](){
+        for(size_t col = 0; col < line.size(); col += line.size() / 1000, windows++)
+            highlighter.lexWindow(0, line, col, 200, spans);
+    });
+    benchReport("lex 200 col window (windows)", ms, windows);
+
+    ms = benchTime([&](){
+        spans.clear();
+        highlighter.lexSpans(line, 0, &spans);
+    });
+    benchReport("lex the full line once", ms, 1);
+}
+
+static void benchViewport()
+{
+    // jump into the middle of a big file while the worker is still busy
+    TextBuffer text;
+    for(int i = 0; i < 1000000; i++)
+        text.push_back(i % 50 == 0 ? "/* block" : i % 50 == 1 ? "   comment */" :
+                       "int value_" + std::to_string(i) + " = \"text\" + 42; // note");
+
+    std::mutex mutex;
+    Highlighter highlighter;
+    highlighter.setDfa([](){ DfaLexer dfa; dfa.compile(benchRules()); return dfa; }());
+    highlighter.attach(&mutex, &text);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        highlighter.reset(text.size());
+    }
+
+    double ms = benchTime([&](){
+        highlighter.setViewport(0, 50);
+        highlighter.startWorker();
+        while(!highlighter.waitViewport(1)) {}
+    });
+    benchReport("first screen highlighted (rows)", ms, 50);
+
+    ms = benchTime([&](){
+        highlighter.setViewport(text.size() / 2, 50);
+        while(!highlighter.waitViewport(1)) {}
+    });
+    benchReport("jump to the middle (rows)", ms, 50);
+
+    highlighter.stop();
+}
+
+struct FrameSegment
+{
+    int   start;
+    int   length;
+    short color;
+};
+
+static void benchFrame()
+{
+    const int rows   = 50;
+    const int cols   = 160;
+    const int frames = 300;
+
+    // highlighted once up front, only the output is measured
+    DfaLexer dfa;
+    dfa.compile(benchRules());
+    std::vector<std::string> text;
+    std::vector<std::vector<FrameSegment>> segments;
+    LexState state = 0;
+    for(int i = 0; i < 2000; i++)
+    {
+        std::string line = i % 3 ? "    int value" + std::to_string(i) + " = compute(\"text\", 42); // note"
+                                 : "    /* block " + std::to_string(i) + " */ float x = 1.5f; return x;";
+        std::vector<TokenSpan> spans;
+        state = dfa.lex(line.c_str(), line.size(), state, &spans);
+
+        std::vector<FrameSegment> segs;
+        int printed = 0;
+        for(auto& span : spans)
+        {
+            if(span.start > printed)
+                segs.push_back({printed, span.start - printed, 0});
+            segs.push_back({span.start, span.length, (short)(span.isWord ? 3 : span.color)});
+            printed = span.start + span.length;
+        }
+        if(printed < (int)line.size())
+            segs.push_back({printed, (int)line.size() - printed, 0});
+
+        text.push_back(line);
+        segments.push_back(segs);
+    }
+
+    // scroll : every row changes, typing : one row changes
+    auto rowOf = [&](int frame, int row, bool isScroll) {
+        return isScroll ? (frame + row) % text.size() : row;
+    };
+    auto typed = [&](int frame, int row, std::string& line) {
+        if(row == rows / 2)
+            line.insert(10, std::string(frame % 40, 'x'));
+    };
+
+    int devNull = open("/dev/null", O_WRONLY);
+    FILE* out = fdopen(devNull, "w");
+    FILE* in  = fopen("/dev/null", "r");
+    const char* term = getenv("TERM") ? getenv("TERM") : "xterm-256color";
+    setenv("LINES", std::to_string(rows).c_str(), 1);
+    setenv("COLUMNS", std::to_string(cols).c_str(), 1);
+    SCREEN* screen = newterm(term, out, in);
+    if(!screen)
+    {
+        printf("  ncurses                                  skipped, no terminfo for %s\n", term);
+    }
+    else
+    {
+        start_color();
+        use_default_colors();
+        for(short i = 1; i < 8; i++)
+            init_pair(i, i, -1);
+        WINDOW* win = newwin(rows, cols, 0, 0);
+        idlok(win, TRUE);
+
+        for(int isScroll = 1; isScroll >= 0; isScroll--)
+        {
+            g_writeCalls = 0;
+            g_writeBytes = 0;
+            double ms = benchTime([&](){
+                for(int frame = 0; frame < frames; frame++)
+                {
+                    for(int row = 0; row < rows; row++)
+                    {
+                        int index = rowOf(frame, row, isScroll);
+                        std::string line = text[index];
+                        typed(frame, row, line);
+                        wmove(win, row, 0);
+                        for(auto& seg : segments[index])
+                        {
+                            wattron(win, COLOR_PAIR(seg.color));
+                            waddnstr(win, line.c_str() + seg.start, seg.length);
+                            wattroff(win, COLOR_PAIR(seg.color));
+                        }
+                        wclrtoeol(win);
+                    }
+                    wmove(win, rows / 2, 10);
+                    wrefresh(win);
+                }
+            });
+            printf("  ncurses %-6s     %8.3f ms/frame  %6.2f write/frame  %8zu bytes/frame\n",
+                   isScroll ? "scroll" : "typing", ms / frames,
+                   (double)g_writeCalls / frames, g_writeBytes / frames);
+        }
+
+        delwin(win);
+        endwin();
+        delscreen(screen);
+    }
+
+    TermWriter writer(devNull);
+    writer.setSyncOutput(true);
+    for(int isScroll = 1; isScroll >= 0; isScroll--)
+    {
+        g_writeCalls = 0;
+        g_writeBytes = 0;
+        double ms = benchTime([&](){
+            for(int frame = 0; frame < frames; frame++)
+            {
+                writer.beginFrame();
+                if(isScroll && frame > 0)
+                    writer.scrollRows(0, rows - 1, 1);
+                for(int row = 0; row < rows; row++)
+                {
+                    int index = rowOf(frame, row, isScroll);
+                    std::string line = text[index];
+                    typed(frame, row, line);
+                    writer.beginRow(row, 0);
+                    for(auto& seg : segments[index])
+                    {
+                        writer.setColor(seg.color ? seg.color : TermWriter::kDefaultColor,
+                                        TermWriter::kDefaultColor);
+                        writer.text(line.c_str() + seg.start, seg.length);
+                    }
+                    writer.setColor(TermWriter::kDefaultColor, TermWriter::kDefaultColor);
+                    writer.fill(' ', cols - line.size());
+                    writer.endRow();
+                }
+                writer.endFrame(rows / 2, 10);
+            }
+        });
+        printf("  direct  %-6s     %8.3f ms/frame  %6.2f write/frame  %8zu bytes/frame\n",
+               isScroll ? "scroll" : "typing", ms / frames,
+               (double)g_writeCalls / frames, g_writeBytes / frames);
+    }
+
+    fclose(in);
+    fclose(out);
+}
+
+// ---------------------------------------------------------------------------
+
+// bytes one at a time, what utf8_validate does without the ASCII skip
+static bool scalarValidate(const char* data, size_t len)
+{
+    for(size_t i = 0; i < len; )
+    {
+        int n = utf8_char_length(data + i, len - i);
+        if(n == 0)
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+static void benchUtf8()
+{
+    // 32 MB of source : all ASCII, then with a UTF-8 comment every 8 lines
+    std::string ascii;
+    std::string mixed;
+    for(int i = 0; ascii.size() < 32 * 1024 * 1024; i++)
+    {
+        std::string line = "    value = compute(value, " + std::to_string(i) + "); // next step\n";
+        ascii += line;
+        mixed += i % 8 == 0 ? "    // h\xc3\xa9llo w\xc3\xb6rld \xe2\x80\x94 \xe6\x97\xa5\xe6\x9c\xac\n" : line;
+    }
+
+    for(auto* text : {&ascii, &mixed})
+    {
+        const char* what = text == &ascii ? "ascii" : "mixed";
+        bool isValid = false;
+        bool isAscii = false;
+        double ms = benchTime([&](){ isValid = scalarValidate(text->data(), text->size()); });
+        printf("  validate %-5s scalar  %8.2f ms  %6.2f GB/s  valid %d\n", what, ms, text->size() / ms / 1e6, isValid);
+
+        ms = benchTime([&](){ isValid = utf8_validate(text->data(), text->size(), &isAscii); });
+        printf("  validate %-5s simd    %8.2f ms  %6.2f GB/s  valid %d ascii %d\n", what, ms, text->size() / ms / 1e6,
+               isValid, isAscii);
+    }
+
+    // column to byte on a long line, the cursor math of a non ASCII line
+    std::string line;
+    for(int i = 0; i < 1000; i++)
+        line += "abcdefgh\xc3\xa9";
+    size_t sum = 0;
+    double ms = benchTime([&](){
+        for(int col = 0; col < 9000; col += 7)
+            sum += utf8_offset(line.data(), line.size(), col);
+    });
+    benchReport("utf8_offset, 9000 column line", ms, 9000 / 7 + 1);
+    if(sum == 0)
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+// column to byte from the line start, what a cursor step cost before the index
+static size_t scanByteAt(const std::string& line, size_t col)
+{
+    size_t i = 0;
+    size_t c = 0;
+    while(i < line.size())
+    {
+        int width = utf8_char_width(line.data() + i, line.size() - i);
+        if(width > 0 && c + width > col)
+            break;
+        c += width;
+        i += utf8_step(line.data() + i, line.size() - i);
+    }
+    return i;
+}
+
+static void benchWidth()
+{
+    // a 1 MB line of mixed width text : the cursor walks to its end and back
+    std::string line;
+    while(line.size() < 1024 * 1024)
+        line += "abc \xe4\xb8\xad\xe6\x96\x87 e\xcc\x81 ";
+    TextBuffer text;
+    text.push_back(line);
+
+    LineWidths widths;
+    widths.attach(&text);
+    widths.reset(1);
+    int columns = widths.columns(0);
+
+    // the scan is slow, it gets fewer lookups
+    const int scans = 100;
+    size_t sum = 0;
+    double ms = benchTime([&](){
+        for(int i = 0; i < scans; i++)
+            sum += scanByteAt(line, (size_t)columns * i / scans);
+    });
+    benchReport("column -> byte, scan from line start", ms, scans);
+
+    const int steps = 2000;
+
+    ms = benchTime([&](){
+        for(int i = 0; i < steps; i++)
+            sum += widths.byteAt(0, (long)columns * i / steps);
+    });
+    benchReport("column -> byte, checkpoints", ms, steps);
+
+    ms = benchTime([&](){
+        int col = columns;
+        for(int i = 0; i < steps; i++)
+            col = widths.prevColumn(0, col);
+        sum += col;
+    });
+    benchReport("prevColumn from the line end", ms, steps);
+
+    // an edit near the end keeps the checkpoints before it
+    ms = benchTime([&](){
+        for(int i = 0; i < steps; i++)
+        {
+            widths.lineChanged(0, line.size() - 64);
+            sum += widths.byteAt(0, columns - 1);
+        }
+    });
+    benchReport("edit at the end + lookup", ms, steps);
+    if(sum == 0)
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+// big blocks are mmap'd by malloc, they count too
+static size_t heapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static void benchLines()
+{
+    // 5M lines shaped like source code : blank ones, short ones, long ones
+    const int lineCount = 5000000;
+    std::string content;
+    for(int i = 0; i < lineCount; i++)
+    {
+        int kind = i % 10;
+        if(kind == 0)
+            content += "";
+        else if(kind < 3)
+            content += "    }";
+        else if(kind < 7)
+            content += "    value_" + std::to_string(i) + " = compute(value, 42);";
+        else
+            content += "    // a longer comment line that explains the step " + std::to_string(i);
+        if(i + 1 < lineCount)
+            content += '\n';
+    }
+    size_t textBytes = content.size() - (lineCount - 1);
+    printf("  %d lines, %.1f MB of text\n", lineCount, textBytes / 1e6);
+
+    size_t sum = 0;
+    {
+        size_t before = heapInUse();
+        std::vector<std::string> text;
+        text.reserve(lineCount);
+        double ms = benchTime([&](){
+            size_t begin = 0;
+            for(int i = 0; i < lineCount; i++)
+            {
+                size_t end = std::min(content.find('\n', begin), content.size());
+                text.push_back(content.substr(begin, end - begin));
+                begin = end + 1;
+            }
+        });
+        size_t bytes = heapInUse() - before;
+        benchReport("std::vector<std::string> load", ms, lineCount);
+        printf("  %-40s %10.1f MB  %5.1f bytes/line over the text\n", "  heap", bytes / 1e6,
+               (double)(bytes - textBytes) / lineCount);
+
+        ms = benchTime([&](){
+            for(size_t row = 0; row < text.size(); row += 7)
+                sum += text[row].size();
+        });
+        benchReport("  read every 7th line", ms, text.size() / 7);
+    }
+
+    {
+        size_t before = heapInUse();
+        LineStore text;
+        std::string copy = content;
+        double ms = benchTime([&](){ text.appendText(std::move(copy)); });
+        size_t bytes = heapInUse() - before;
+        benchReport("LineStore load (buffer kept)", ms, lineCount);
+        printf("  %-40s %10.1f MB  %5.1f bytes/line over the text\n", "  heap", bytes / 1e6,
+               (double)(bytes - textBytes) / lineCount);
+
+        ms = benchTime([&](){
+            for(size_t row = 0; row < text.size(); row += 7)
+                sum += text[row].size();
+        });
+        benchReport("  read every 7th line", ms, text.size() / 7);
+
+        // typing on 1% of the lines moves them to the pool
+        ms = benchTime([&](){
+            for(size_t row = 5; row < text.size(); row += 100)
+                text.insertBytes(row, text[row].size(), "x");
+        });
+        benchReport("  edit 1% of the lines", ms, text.size() / 100);
+        printf("  %-40s %10.1f MB  %5.1f MB dead in the arena\n", "  heap", (heapInUse() - before) / 1e6,
+               text.deadBytes() / 1e6);
+    }
+
+    {
+        size_t before = heapInUse();
+        LineStore text;
+        text.reserve(lineCount);
+        double ms = benchTime([&](){
+            size_t begin = 0;
+            for(int i = 0; i < lineCount; i++)
+            {
+                size_t end = std::min(content.find('\n', begin), content.size());
+                text.push_back(std::string_view(content).substr(begin, end - begin));
+                begin = end + 1;
+            }
+        });
+        size_t bytes = heapInUse() - before;
+        benchReport("LineStore push_back", ms, lineCount);
+        printf("  %-40s %10.1f MB  %5.1f bytes/line over the text\n", "  heap", bytes / 1e6,
+               (double)(bytes - textBytes) / lineCount);
+    }
+
+    {
+        size_t before = heapInUse();
+        LineRope text;
+        std::string copy = content;
+        double ms = benchTime([&](){ text.appendText(std::move(copy)); });
+        size_t bytes = heapInUse() - before;
+        benchReport("LineRope load", ms, lineCount);
+        printf("  %-40s %10.1f MB  %5.1f bytes/line over the text\n", "  heap", bytes / 1e6,
+               (double)(bytes - textBytes) / lineCount);
+    }
+
+    if(sum == 0)
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchRope()
+{
+    // 2M lines, a wide one now and then
+    const int lineCount = 2000000;
+    std::string content;
+    for(int i = 0; i < lineCount; i++)
+    {
+        content += "    value_" + std::to_string(i) + " = compute(value, 42);";
+        if(i % 1000 == 0)
+            content += " // \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e" + std::string(i % 7000 / 100, '-');
+        if(i + 1 < lineCount)
+            content += '\n';
+    }
+
+    LineStore store;
+    LineRope  rope;
+    double ms = benchTime([&](){ store.appendText(std::string(content)); });
+    benchReport("LineStore load", ms, lineCount);
+    ms = benchTime([&](){ rope.appendText(std::string(content)); });
+    benchReport("LineRope load", ms, lineCount);
+
+    size_t sum = 0;
+    const int lookups = 100000;
+    ms = benchTime([&](){
+        for(int i = 0; i < lookups; i++)
+            sum += store[(size_t)i * 7919 % lineCount].size();
+    });
+    benchReport("LineStore row lookup", ms, lookups);
+    ms = benchTime([&](){
+        for(int i = 0; i < lookups; i++)
+            sum += rope[(size_t)i * 7919 % lineCount].size();
+    });
+    benchReport("LineRope row lookup", ms, lookups);
+
+    // row -> byte offset : the store adds the lines up, the rope its summaries
+    const int scans = 20;
+    ms = benchTime([&](){
+        for(int i = 0; i < scans; i++)
+        {
+            size_t row = (size_t)i * 7919 % lineCount;
+            for(size_t r = 0; r < row; r++)
+                sum += store[r].size() + 1;
+        }
+    });
+    benchReport("LineStore row -> offset (scan)", ms, scans);
+    ms = benchTime([&](){
+        for(int i = 0; i < lookups; i++)
+            sum += rope.byteOffset((size_t)i * 7919 % lineCount);
+    });
+    benchReport("LineRope row -> offset", ms, lookups);
+    ms = benchTime([&](){
+        for(int i = 0; i < lookups; i++)
+            sum += rope.rowAtByte((uint64_t)i * 104729 % rope.byteCount());
+    });
+    benchReport("LineRope offset -> row", ms, lookups);
+    ms = benchTime([&](){
+        for(int i = 0; i < lookups; i++)
+            sum += rope.rowAtUtf16((uint64_t)i * 104729 % rope.byteCount());
+    });
+    benchReport("LineRope UTF-16 offset -> row", ms, lookups);
+
+    int widest = 0;
+    ms = benchTime([&](){
+        for(size_t r = 0; r < store.size(); r++)
+            widest = std::max<int>(widest, utf8_width(store[r].data(), store[r].size()));
+    });
+    benchReport("LineStore longest line (scan)", ms, 1);
+    int ropeWidest = 0;
+    ms = benchTime([&](){ sum += rope.longestLine(&ropeWidest); });
+    benchReport("LineRope longest line", ms, 1);
+    if(widest != ropeWidest)
+        printf("  (longest line differs : %d %d)\n", widest, ropeWidest);
+
+    // a worker snapshot, then typing goes on in the original
+    ms = benchTime([&](){ LineStore copy = store; sum += copy.size(); });
+    benchReport("LineStore copy", ms, 1);
+    LineRope snapshot;
+    ms = benchTime([&](){ snapshot = rope; });
+    benchReport("LineRope copy (shared)", ms, 1);
+
+    const int edits = 10000;
+    ms = benchTime([&](){
+        for(int i = 0; i < edits; i++)
+            store.insertBytes((size_t)i * 7919 % lineCount, 4, "x");
+    });
+    benchReport("LineStore type a char", ms, edits);
+    size_t before = heapInUse();
+    ms = benchTime([&](){
+        for(int i = 0; i < edits; i++)
+            rope.insertBytes((size_t)i * 7919 % lineCount, 4, "x");
+    });
+    benchReport("LineRope type a char (copies paths)", ms, edits);
+    printf("  %-40s %10.1f MB rope, %.1f MB more for the copied paths\n", "  memory", rope.memoryUsage() / 1e6,
+           (heapInUse() - before) / 1e6);
+
+    if(sum == 0 || snapshot.byteCount() + edits != rope.byteCount())
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+// resident set of the process, mapped file pages included
+static size_t residentBytes()
+{
+    size_t pages = 0, resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if(file)
+    {
+        if(fscanf(file, "%zu %zu", &pages, &resident) != 2)
+            resident = 0;
+        fclose(file);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void benchViewer()
+{
+    // 512 MB of log lines in a temporary file
+    char path[] = "/tmp/benchViewerXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+        return;
+
+    std::string block;
+    for(int i = 0; i < 100000; i++)
+        block += "2024-01-01 12:00:00 worker " + std::to_string(i) + " request handled in 12 ms\n";
+    size_t fileBytes = 0;
+    while(fileBytes < (512u << 20))
+        fileBytes += write(fd, block.data(), block.size());
+    close(fd);
+    printf("  %.1f MB file\n", fileBytes / 1e6);
+
+    FileViewer viewer;
+    std::string error;
+    viewer.open(path, &error);
+    size_t before = residentBytes();
+
+    std::string line;
+    size_t sum = 0;
+    double ms = benchTime([&](){
+        uint64_t offset = viewer.lineStart(viewer.size() / 2);
+        for(int i = 0; i < 1000; i++)
+        {
+            offset = viewer.nextLine(offset, &line);
+            sum += line.size();
+        }
+    });
+    benchReport("jump to 50% + read a slice (lines)", ms, 1000);
+
+    ms = benchTime([&](){
+        uint64_t offset = viewer.size();
+        for(int i = 0; i < 1000; i++)
+            offset = viewer.prevLine(offset);
+        sum += offset;
+    });
+    benchReport("read back from the end (lines)", ms, 1000);
+
+    ms = benchTime([&](){
+        while(!viewer.isIndexComplete())
+            viewer.extendIndex(viewer.size());
+    });
+    benchReport("count every line (MB)", ms, viewer.size() >> 20);
+
+    ms = benchTime([&](){
+        for(uint64_t i = 0; i < 1000; i++)
+            sum += viewer.lineOffset(i * 7919 % viewer.indexedLines());
+    });
+    benchReport("line -> offset", ms, 1000);
+    printf("  %-40s %10.1f MB  %zu lines, index %.1f KB\n", "  resident growth", (double)(residentBytes() - before) / 1e6,
+           (size_t)viewer.indexedLines(), viewer.memoryUsage() / 1e3);
+
+    viewer.close();
+    unlink(path);
+    if(sum == 0)
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+// what F2 holds the document lock for : a copy, the lines are joined on the
+// FileIo thread
+static void benchSnapshot()
+{
+    const int lineCount = 5000000;
+    std::string content;
+    for(int i = 0; i < lineCount; i++)
+        content += "    value_" + std::to_string(i) + " = compute(value, 42);\n";
+
+    LineStore store;
+    LineRope  rope;
+    store.appendText(std::string(content));
+    rope.appendText(std::string(content));
+    for(size_t row = 5; row < store.size(); row += 100)
+    {
+        store.insertBytes(row, 0, "x");
+        rope.insertBytes(row, 0, "x");
+    }
+
+    std::string joined;
+    double ms = benchTime([&](){
+        joined.reserve(store.byteCount() + 1);
+        for(auto line : store)
+        {
+            joined.append(line);
+            joined.push_back('\n');
+        }
+    });
+    benchReport("join the lines (lines)", ms, lineCount);
+
+    LineStore storeCopy;
+    ms = benchTime([&](){ storeCopy = store; });
+    benchReport("LineStore copy (lines)", ms, lineCount);
+
+    LineRope ropeCopy;
+    ms = benchTime([&](){ ropeCopy = rope; });
+    benchReport("LineRope copy", ms, 1);
+
+    if(storeCopy.byteCount() != joined.size() - 1 || ropeCopy.byteCount() != store.byteCount())
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchFollow()
+{
+    // a log written 4 MB at a time, taken in after each write as the
+    // follow mode does : refresh, count the new lines, read the last screen
+    char path[] = "/tmp/benchFollowXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+        return;
+
+    std::string block;
+    for(int i = 0; block.size() < (4u << 20); i++)
+        block += "2024-01-01 12:00:00 worker " + std::to_string(i) + " request handled in 12 ms\n";
+
+    FileViewer viewer;
+    std::string error;
+    viewer.open(path, &error);
+
+    const int writes = 64;
+    std::string line;
+    size_t sum = 0;
+    double takeMs = 0;
+    double ms = benchTime([&](){
+        for(int i = 0; i < writes; i++)
+        {
+            if(write(fd, block.data(), block.size()) != (ssize_t)block.size())
+                break;
+            takeMs += benchTime([&](){
+                viewer.refresh();
+                viewer.extendIndex(viewer.size());
+                uint64_t offset = viewer.size();
+                for(int row = 0; row < 50; row++)
+                    offset = viewer.prevLine(offset);
+                while(offset < viewer.size())
+                {
+                    offset = viewer.nextLine(offset, &line);
+                    sum += line.size();
+                }
+            });
+        }
+    });
+    close(fd);
+    benchReport("write + follow 4 MB blocks (MB)", ms, (size_t)writes * block.size() >> 20);
+    benchReport("  follow only (MB)", takeMs, (size_t)writes * block.size() >> 20);
+    printf("  %-40s %10.0f MB/s  %zu lines\n", "  follow rate", viewer.size() / 1e3 / takeMs,
+           (size_t)viewer.indexedLines());
+
+    viewer.close();
+    unlink(path);
+    if(sum == 0)
+        printf("  (unexpected)\n");
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchCompressed()
+{
+    std::string text;
+    for(int i = 0; text.size() < (256u << 20); i++)
+        text += "2024-01-01 12:00:00 worker " + std::to_string(i) + " request handled in " + std::to_string(i % 97) + " ms\n";
+
+    for(Compression format : {Compression::Gzip, Compression::Zstd})
+    {
+        const char* name = format == Compression::Gzip ? "gzip" : "zstd";
+        char path[] = "/tmp/benchCompressedXXXXXX";
+        int fd = mkstemp(path);
+        if(fd < 0)
+            return;
+
+        // written the way a save writes it
+        size_t at = 0;
+        CompressedFile::Source source = CompressedFile::compressing(format, [&](char* buffer, size_t capacity){
+            size_t count = std::min(capacity, text.size() - at);
+            memcpy(buffer, text.data() + at, count);
+            at += count;
+            return count;
+        });
+        std::vector<char> block(8 << 20);
+        size_t fileBytes = 0;
+        double ms = benchTime([&](){
+            while(size_t count = source(block.data(), block.size()))
+                fileBytes += write(fd, block.data(), count);
+        });
+        close(fd);
+        printf("  %s, %.1f MB of text in %.1f MB\n", name, text.size() / 1e6, fileBytes / 1e6);
+        benchReport("  compress (MB)", ms, text.size() >> 20);
+
+        CompressedFile file;
+        std::string error;
+        ms = benchTime([&](){
+            if(!file.open(path, &error))
+                return;
+            while(!file.isComplete())
+                usleep(1000);
+        });
+        if(!file.isComplete() || file.size() != text.size())
+        {
+            printf("  %s\n", error.empty() ? "(unexpected size)" : error.c_str());
+            unlink(path);
+            continue;
+        }
+        benchReport("  decompress + checkpoints (MB)", ms, text.size() >> 20);
+
+        // far jumps decompress from the nearest checkpoint
+        std::string got(4096, '\0');
+        size_t mismatches = 0;
+        ms = benchTime([&](){
+            for(uint64_t i = 0; i < 100; i++)
+            {
+                uint64_t offset = i * 7919 * 104729 % (text.size() - got.size());
+                size_t count = file.read(offset, &got[0], got.size());
+                mismatches += count != got.size() || text.compare(offset, count, got) != 0;
+            }
+        });
+        benchReport("  random 4 KB reads", ms, 100);
+        printf("  %-40s %10.1f KB\n", "  checkpoints", file.memoryUsage() / 1e3);
+        if(mismatches)
+            printf("  (%zu reads differ)\n", mismatches);
+
+        file.close();
+        unlink(path);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchReload()
+{
+    const int lineCount = 1000000;
+    std::string content;
+    for(int i = 0; i < lineCount; i++)
+        content += "    value_" + std::to_string(i) + " = compute(value, 42);\n";
+
+    LineStore store;
+    store.appendText(std::string(content));
+
+    // the file as someone else saved it : 100 places changed
+    std::vector<std::string_view> lines;
+    std::vector<std::string> changed;
+    changed.reserve(100);
+    for(size_t row = 0; row < store.size(); row++)
+    {
+        lines.push_back(store[row]);
+        if(row % (lineCount / 100) == 7)
+        {
+            changed.push_back("    changed_" + std::to_string(row));
+            lines.back() = changed.back();
+        }
+    }
+
+    std::vector<DiffHunk> hunks;
+    double ms = benchTime([&](){ hunks = diff_lines(store, lines); });
+    benchReport("diff, 100 lines changed (lines)", ms, lineCount);
+    if(hunks.size() != 100)
+        printf("  (unexpected %zu hunks)\n", hunks.size());
+
+    lines.insert(lines.begin() + lineCount / 2 + 3, 500, "    inserted");
+    ms = benchTime([&](){ hunks = diff_lines(store, lines); });
+    benchReport("  and 500 inserted in the middle", ms, lineCount);
+    if(hunks.size() != 101)
+        printf("  (unexpected %zu hunks)\n", hunks.size());
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchConfig()
+{
+    // a theme of 64 color pairs with 32 keywords each, read at startup
+    std::string json = "{ \"comment\": 14, \"string\": 2, \"user_def\": 5, \"configurations\": [";
+    for(int pair = 0; pair < 64; pair++)
+    {
+        json += pair ? ", { \"keys\": [" : "{ \"keys\": [";
+        for(int key = 0; key < 32; key++)
+            json += (key ? ", \"" : "\"") + std::string("keyword_") + std::to_string(pair * 32 + key) + "\"";
+        json += "], \"fg\": " + std::to_string(pair % 16) + " }";
+    }
+    json += "], \"rules\": [ { \"name\": \"identifier\", \"pattern\": \"[A-Za-z_][A-Za-z0-9_]*\", "
+            "\"keywords\": true } ] }";
+
+    std::string jsonPath  = "/tmp/benchConfig.json";
+    std::string cachePath = "/tmp/benchConfig.cache";
+    FILE* file = fopen(jsonPath.c_str(), "w");
+    if(!file)
+        return;
+    fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+    remove(cachePath.c_str());
+
+    // what the constructor did before the cache : parse, walk, fill a map
+    const int runs = 100;
+    std::map<std::string, int> colorMap;
+    double ms = benchTime([&](){
+        for(int run = 0; run < runs; run++)
+        {
+            std::ifstream in(jsonPath);
+            std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::string err;
+            auto config = json11::Json::parse(text, err);
+            colorMap.clear();
+            int idColor = 1;
+            for(auto& item : config["configurations"].array_items())
+            {
+                for(auto& key : item["keys"].array_items())
+                    colorMap[key.string_value()] = idColor;
+                idColor++;
+            }
+        }
+    });
+    benchReport("json11 parse + maps (loads)", ms, runs);
+
+    std::string error;
+    ms = benchTime([&](){
+        SyntaxConfig config;
+        config.load(jsonPath, cachePath, &error);
+    });
+    benchReport("  compile + write the cache (loads)", ms, 1);
+
+    size_t pairs = 0;
+    ms = benchTime([&](){
+        for(int run = 0; run < runs; run++)
+        {
+            SyntaxConfig config;
+            config.load(jsonPath, cachePath, &error);
+            pairs += config.pairCount();
+        }
+    });
+    benchReport("  mapped cache (loads)", ms, runs);
+
+    SyntaxConfig config;
+    config.load(jsonPath, cachePath, &error);
+    size_t sum = 0;
+    std::vector<std::string> words;
+    for(int i = 0; i < 4096; i++)
+        words.push_back("keyword_" + std::to_string(i * 7 % 2500));
+    ms = benchTime([&](){
+        for(int run = 0; run < 100; run++)
+            for(auto& word : words)
+            {
+                auto it = colorMap.find(word);
+                sum += it != colorMap.end() ? it->second : 0;
+            }
+    });
+    benchReport("keyword lookup, std::map (words)", ms, 100 * words.size());
+    ms = benchTime([&](){
+        for(int run = 0; run < 100; run++)
+            for(auto& word : words)
+                sum -= config.colorOf(word);
+    });
+    benchReport("keyword lookup, cache table (words)", ms, 100 * words.size());
+    if(sum != 0 || !config.isFromCache() || pairs != runs * 64)
+        printf("  (unexpected)\n");
+
+    remove(jsonPath.c_str());
+    remove(cachePath.c_str());
+}
+
+template <typename Lines>
+static double benchAppendChunks(Lines& lines, const std::string& chunk, int chunks)
+{
+    return benchTime([&](){
+        for(int i = 0; i < chunks; i++)
+            lines.appendText(std::string(chunk));
+    });
+}
+
+static void benchStream()
+{
+    // "cmd | kceditor -" : 1 MB of complete lines at a time, as the loop
+    // reads them, appended to a document that keeps growing
+    std::string chunk;
+    int chunkLines = 0;
+    for(int i = 0; chunk.size() < (1u << 20); i++, chunkLines++)
+        chunk += "2024-01-01 12:00:00 worker " + std::to_string(i) + " request handled in 12 ms\n";
+    chunk.pop_back();
+    const int chunks = 128;
+    size_t lineCount = 1 + (size_t)chunks * chunkLines;
+
+    LineStore store;
+    store.push_back("");
+    double ms = benchAppendChunks(store, chunk, chunks);
+    benchReport("append 1 MB chunks, store (MB)", ms, chunks);
+
+    LineRope rope;
+    rope.push_back("");
+    ms = benchAppendChunks(rope, chunk, chunks);
+    benchReport("append 1 MB chunks, rope (MB)", ms, chunks);
+    if(store.size() != lineCount || rope.size() != lineCount || rope[lineCount - 2] != store[lineCount - 2])
+        printf("  (unexpected %zu %zu lines)\n", store.size(), rope.size());
+
+    // what the editor does per chunk : the text, then the caches learn the new rows
+    std::mutex mutex;
+    TextBuffer text;
+    text.push_back("");
+    Highlighter highlighter;
+    highlighter.attach(&mutex, &text);
+    LineWidths widths;
+    widths.attach(&text);
+    highlighter.reset(text.size());
+    widths.reset(text.size());
+    ms = benchTime([&](){
+        for(int i = 0; i < chunks; i++)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int row = text.size();
+            text.appendText(std::string(chunk));
+            highlighter.linesInserted(row, text.size() - row);
+            widths.linesInserted(row, text.size() - row);
+        }
+    });
+    benchReport("  with highlighter and widths (MB)", ms, chunks);
+    printf("  %-40s %10.0f MB/s  %zu lines\n", "  stream rate", chunks / ms * 1e3, (size_t)text.size());
+}
+
+// ---------------------------------------------------------------------------
+
+static void benchFileIo()
+{
+    std::string data;
+    for(int i = 0; data.size() < (256u << 20); i++)
+        data += "    value_" + std::to_string(i) + " = compute(value, 42);\n";
+    char path[] = "/tmp/benchFileIoXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+        return;
+
+    close(fd);
+
+    // the callbacks come through the loop, as in the editor
+    EventLoop loop;
+
+    // the first write of the file pays for its blocks, not timed
+    {
+        FileIo io(loop);
+        bool isDone = false;
+        io.write(path, std::string(data), nullptr, [&](int){ isDone = true; });
+        while(!isDone)
+            loop.dispatch();
+    }
+
+    for(bool useRing : {true, false})
+    {
+        FileIo io(loop, useRing);
+        const char* backend = io.usesRing() ? "io_uring" : "thread pool";
+        if(useRing && !io.usesRing())
+            printf("  io_uring is not available\n");
+
+        bool isDone = false;
+        int  progress = 0;
+        double ms = benchTime([&](){
+            io.write(path, std::string(data), [&](uint64_t, uint64_t){ progress++; },
+                     [&](int error){ isDone = true; if(error) printf("  write: %s\n", strerror(error)); });
+            while(!isDone)
+                loop.dispatch();
+        });
+        std::string what = std::string("write 256 MB, ") + backend + " (MB)";
+        benchReport(what.c_str(), ms, data.size() >> 20);
+
+        // from the page cache : the cost of the layer, not of the disk
+        std::string content;
+        isDone = false;
+        ms = benchTime([&](){
+            io.read(path, [&](uint64_t, uint64_t){ progress++; },
+                    [&](std::string&& text, int){ content = std::move(text); isDone = true; });
+            while(!isDone)
+                loop.dispatch();
+        });
+        what = std::string("read 256 MB, ") + backend + " (MB)";
+        benchReport(what.c_str(), ms, content.size() >> 20);
+        if(content != data || progress == 0)
+            printf("  (unexpected)\n");
+    }
+
+    unlink(path);
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char** args)
+{
+    benchList().push_back({"replace", benchReplaceAll});
+    benchList().push_back({"lexer", benchLexer});
+    benchList().push_back({"longline", benchLongLine});
+    benchList().push_back({"viewport", benchViewport});
+    benchList().push_back({"frame", benchFrame});
+    benchList().push_back({"utf8", benchUtf8});
+    benchList().push_back({"width", benchWidth});
+    benchList().push_back({"lines", benchLines});
+    benchList().push_back({"rope", benchRope});
+    benchList().push_back({"viewer", benchViewer});
+    benchList().push_back({"snapshot", benchSnapshot});
+    benchList().push_back({"follow", benchFollow});
+    benchList().push_back({"compressed", benchCompressed});
+    benchList().push_back({"reload", benchReload});
+    benchList().push_back({"stream", benchStream});
+    benchList().push_back({"config", benchConfig});
+    benchList().push_back({"fileio", benchFileIo});
+
+    const char* filter = argc > 1 ? args[1] : nullptr;
+    for(auto& bench : benchList())
+    {
+        if(filter && !strstr(bench.name, filter))
+            continue;
+
+        printf("[%s]\n", bench.name);
+        bench.run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef __COMPRESSED_FILE__
+#define __COMPRESSED_FILE__
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// .gz (zlib) and .zst files, told by their first bytes. libzstd.so.1 is
+// loaded when a zstd file is first met, without it they do not open.
+enum class Compression
+{
+    None,
+    Gzip,
+    Zstd,
+};
+
+// Random access to the text of a compressed file, for FileViewer.
+//
+// m_thread decompresses the file once, from start to end, and keeps a
+// checkpoint every m_span bytes of text : where to start decompressing
+// again to get there. For gzip a checkpoint is a deflate block boundary
+// and the 32 KB of text before it; zstd can only start again at a frame,
+// so a file of one frame has one checkpoint. There are at most
+// kMaxCheckpoints, the span doubles when they are full, so the memory is
+// bounded whatever the size of the file.
+//
+// read() goes on from where the last read stopped, else from the nearest
+// checkpoint before offset. size() is the text decompressed so far, up to
+// its last full line; it grows until isComplete(). read() is called from
+// one thread.
+class CompressedFile
+{
+private:
+    struct Checkpoint
+    {
+        uint64_t in;        // file offset
+        uint64_t out;       // text offset
+        int      bits;      // gzip : bits of the byte before in still to read
+        bool     isStart;   // a gzip member or a zstd frame starts at in
+        std::vector<unsigned char> window;
+    };
+
+    struct Decoder;
+
+    std::string m_fileName;
+    int         m_fd;
+    Compression m_format;
+
+    // written by m_thread, guarded by m_mutex
+    std::mutex  m_mutex;
+    std::condition_variable m_grown;
+    std::vector<Checkpoint> m_checkpoints;
+    uint64_t    m_span;
+    std::string m_error;
+
+    std::atomic<uint64_t> m_size;
+    std::atomic<bool>     m_isComplete;
+    std::atomic<bool>     m_isRunning;
+    std::thread m_thread;
+
+    std::unique_ptr<Decoder> m_reader;
+
+    void indexLoop();
+    void addCheckpoint(Checkpoint&& checkpoint);
+
+public:
+    static constexpr size_t   kWindowBytes    = 32 << 10;
+    static constexpr uint64_t kFirstSpan      = 1 << 20;
+    static constexpr size_t   kMaxCheckpoints = 1024;
+
+    static Compression detect(const char* head, size_t size);
+    static Compression detect(const std::string& fileName);
+
+    // Decompresses content in place. Returns an errno : EFBIG past limit
+    // bytes, EILSEQ for corrupt data, ENOSYS without libzstd.
+    static int decompress(Compression format, std::string& content, uint64_t limit);
+
+    // a source (as FileIo::Source) giving the compressed bytes of source
+    using Source = std::function<size_t(char* buffer, size_t capacity)>;
+    static Source compressing(Compression format, Source source);
+
+    // returns once the first kFirstSpan bytes of text (or all) are there
+    bool open(const std::string& fileName, std::string* error);
+    void close();
+    Compression format() const { return m_format; }
+
+    uint64_t size() const { return m_size; }
+    bool isComplete() const { return m_isComplete; }
+    std::string error();
+
+    // text [offset, offset + count), returns the bytes read
+    size_t read(uint64_t offset, char* buffer, size_t count);
+
+    // heap bytes of the checkpoints
+    size_t memoryUsage();
+
+    CompressedFile();
+    ~CompressedFile();
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __DFA_LEXER__
+#define __DFA_LEXER__
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Colored range of a line produced by the lexers
+struct TokenSpan
+{
+    int   start;
+    int   length;
+    short color;
+    bool  isWord;   // color comes from the keyword tables at paint time
+};
+
+// Position inside a long line where lexing can restart with state
+struct LexCheckpoint
+{
+    int      offset;
+    uint32_t state;
+};
+
+// One "rules" entry of syntax.json
+struct TokenRule
+{
+    std::string name;
+    std::string pattern;
+    short       color;
+    bool        isWord;
+};
+
+// Lexer driven by a dense transition table compiled from the token rules
+// (regex subset : literals, [classes], ., \d \w \s, groups, | * + ?).
+//
+// The table has 256 entries per state so lexing is one lookup per byte.
+// Rules are matched longest first, ties go to the rule listed first.
+// A token still alive at the end of a line (the DFA accepts '\n') is carried
+// to the next line, its state is the line exit state.
+class DfaLexer
+{
+private:
+    std::vector<TokenRule> m_rules;
+    std::vector<uint16_t>  m_table;       // m_stateCount * 256
+    std::vector<int16_t>   m_accept;      // rule accepted in a state, -1 none
+    std::vector<int16_t>   m_tentative;   // rule a partial token is heading to
+    int         m_stateCount;
+    std::string m_error;
+
+public:
+    static constexpr uint16_t kDeadState  = 0;
+    static constexpr uint16_t kStartState = 1;
+
+    bool compile(const std::vector<TokenRule>& rules);
+
+    // the cache is only used when it was built from the same patterns, a
+    // color edit keeps it
+    bool load(const std::string& path, const std::vector<TokenRule>& rules);
+    bool save(const std::string& path) const;
+
+    static uint64_t hashRules(const std::vector<TokenRule>& rules);
+
+    bool isReady() const { return m_stateCount > 0; }
+    const std::vector<TokenRule>& rules() const { return m_rules; }
+    int  stateCount() const { return m_stateCount; }
+    const std::string& error() const { return m_error; }
+
+    // Returns the exit state, 0 when the line ends outside of a token.
+    // When checkpoints is set a token boundary is recorded about every
+    // interval bytes.
+    uint32_t lex(const char* line, int len, uint32_t entry, std::vector<TokenSpan>* spans,
+                 std::vector<LexCheckpoint>* checkpoints = nullptr, int interval = 0) const;
+
+    DfaLexer();
+};
+
+#endif
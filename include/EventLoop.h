@@ -0,0 +1,84 @@
+#ifndef __EVENT_LOOP__
+#define __EVENT_LOOP__
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// The main thread's event loop : one epoll set over the terminal input,
+// timers (timerfd), signals (signalfd), file watches (inotify) and an
+// eventfd other threads post tasks through.
+//
+// dispatch() sleeps in epoll_wait without a timeout, timers are one shot,
+// so an idle editor does not wake up at all.
+class EventLoop
+{
+private:
+    struct Handler
+    {
+        std::function<void()> callback;
+        bool isOwned;       // the fd was created here and is closed here
+    };
+
+    int m_epollFd;
+    int m_wakeFd;
+    int m_inotifyFd;
+    // watches share the inotify descriptor of their path, each one gets
+    // the events of its own mask
+    struct Watch
+    {
+        int      descriptor;
+        uint32_t mask;
+        std::function<void(uint32_t, const std::string&)> onEvent;
+    };
+
+    std::map<int, Handler> m_handlers;
+    std::map<int, Watch> m_watches;     // by watch id
+    int m_nextWatch;
+
+    std::mutex m_postMutex;
+    std::vector<std::function<void()>> m_posted;
+
+    void add(int fd, std::function<void()> callback, bool isOwned);
+    void runPosted();
+    void readWatches();
+
+public:
+    static const int kMaxEvents = 16;
+
+    // calls onReadable on the loop thread each time fd is readable
+    void addFd(int fd, std::function<void()> onReadable);
+
+    // unregisters fd, and closes it when it came from addTimer/addSignal
+    void removeFd(int fd);
+
+    // a disarmed timer, returns its fd
+    int  addTimer(std::function<void()> onExpired);
+
+    // one shot after ms milliseconds, rearming restarts it, 0 disarms
+    void armTimer(int timer, int ms);
+
+    // Blocks signo for the calling thread and receives it through a
+    // signalfd. Call it before other threads start, they inherit the mask.
+    int  addSignal(int signo, std::function<void()> onSignal);
+
+    // inotify watch, returns the watch id or -1. onEvent gets the event
+    // mask and, for a directory, the name of the entry; IN_IGNORED always
+    // comes through and ends the watch.
+    int  watchPath(const std::string& path, uint32_t mask,
+                   std::function<void(uint32_t, const std::string&)> onEvent);
+    void unwatch(int watch);
+
+    // runs task on the loop thread, callable from any thread
+    void post(std::function<void()> task);
+
+    // waits for the next events and runs their handlers
+    void dispatch();
+
+    EventLoop();
+    ~EventLoop();
+};
+
+#endif
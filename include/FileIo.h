@@ -0,0 +1,133 @@
+#ifndef __FILE_IO__
+#define __FILE_IO__
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "EventLoop.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Whole file reads and writes off the UI thread.
+//
+// Jobs run one after another on m_thread, in the order they were asked
+// for. A file moves in kBlockBytes blocks at block aligned offsets,
+// kQueueDepth blocks in flight at a time : through io_uring when the
+// kernel has it (raw syscalls, no liburing), else through a pool of
+// threads doing pread / pwrite. A short read or write goes again from
+// where it stopped.
+//
+// The callbacks run on the EventLoop thread (posted), the caller needs no
+// lock. Progress is only reported for files of more than one batch.
+// Queued jobs still run when FileIo is destroyed, their callbacks do not.
+class FileIo
+{
+public:
+    using Progress  = std::function<void(uint64_t done, uint64_t total)>;
+    using ReadDone  = std::function<void(std::string&& content, int error)>;   // error : an errno, 0 if none
+    using WriteDone = std::function<void(int error)>;
+
+    // fills buffer with the next bytes to write, returns how many, 0 at the end
+    using Source = std::function<size_t(char* buffer, size_t capacity)>;
+
+    // turns the bytes read into what ReadDone gets, returns an errno
+    using Decode = std::function<int(std::string& content)>;
+
+private:
+    struct Block
+    {
+        char*    data;
+        size_t   length;
+        uint64_t offset;
+        ssize_t  result;    // bytes, or -errno
+    };
+
+    struct Job
+    {
+        bool        isWrite;
+        std::string path;
+        std::string data;
+        Source      source;
+        Decode      decode;
+        uint64_t    total;
+        Progress    onProgress;
+        ReadDone    onRead;
+        WriteDone   onWrite;
+    };
+
+    EventLoop& m_loop;
+
+    std::thread m_thread;
+    std::mutex  m_jobMutex;
+    std::condition_variable m_jobWakeup;
+    std::deque<Job> m_jobs;
+    bool m_isRunning;
+
+    // io_uring, the rings are shared with the kernel
+    int       m_ringFd;
+    void*     m_sqRing;
+    size_t    m_sqRingBytes;
+    void*     m_cqRing;
+    size_t    m_cqRingBytes;
+    unsigned* m_sqTail;
+    unsigned* m_sqMask;
+    unsigned* m_sqArray;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqMask;
+    io_uring_sqe* m_sqes;
+    size_t        m_sqesBytes;
+    io_uring_cqe* m_cqes;
+
+    // fallback : m_poolPending blocks of the batch are not done yet
+    std::vector<std::thread> m_pool;
+    std::mutex m_poolMutex;
+    std::condition_variable m_poolWakeup;
+    std::condition_variable m_poolDone;
+    std::deque<Block*> m_poolQueue;
+    size_t m_poolPending;
+    int    m_poolFd;
+    bool   m_poolIsWrite;
+    bool   m_isPoolRunning;
+
+    bool setupRing();
+    void closeRing();
+    bool ringBatch(int fd, bool isWrite, std::vector<Block>& blocks);
+    void poolBatch(int fd, bool isWrite, std::vector<Block>& blocks);
+    void poolLoop();
+
+    void workerLoop();
+    int  transfer(int fd, bool isWrite, char* data, uint64_t size, uint64_t fileOffset, uint64_t* done,
+                  const Progress& onProgress);
+    void runRead(Job& job);
+    void runWrite(Job& job);
+
+public:
+    static constexpr size_t kBlockBytes = 1 << 20;
+    static constexpr int    kQueueDepth = 8;
+
+    // reads the whole file, decode runs on the FileIo thread after it
+    void read(const std::string& path, Progress onProgress, ReadDone onDone, Decode decode = nullptr);
+
+    // writes data over the file, created if needed
+    void write(const std::string& path, std::string&& data, Progress onProgress, WriteDone onDone);
+
+    // Writes what source gives, a batch at a time, source is called on the
+    // FileIo thread and destroyed there. total is how much it will give,
+    // for the progress.
+    void write(const std::string& path, uint64_t total, Source source, Progress onProgress, WriteDone onDone);
+
+    bool usesRing() const { return m_ringFd >= 0; }
+
+    // useRing false : the thread pool even where io_uring works
+    explicit FileIo(EventLoop& loop, bool useRing = true);
+    ~FileIo();
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef __FILE_VIEWER__
+#define __FILE_VIEWER__
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "CompressedFile.h"
+
+// Read only access to a file of any size, for the viewer mode of TextArea.
+//
+// The file is never read whole : a window of kWindowBytes is mapped around
+// the bytes asked for and mapped again elsewhere when they move out of it,
+// so the memory used is the same for a 1 MB or a 100 GB file.
+//
+// Lines are found from a byte offset, forward or backward, so any part of
+// the file can be shown (a jump to a percentage) before the lines are
+// counted. The line index counts lines from the start of the file, only as
+// far as it is asked to : it keeps the offset of every m_stride-th line,
+// at most kMaxCheckpoints of them, the stride doubles when they are full.
+//
+// A file that grows (a log being written) is followed by refresh() : the
+// new bytes are mapped and counted when they are asked for, like the rest.
+//
+// A .gz or .zst file is read through CompressedFile instead : the window
+// is kCompressedWindowBytes of text decompressed into m_buffer, and the
+// file grows (refresh) while it is decompressed the first time.
+//
+// Lines longer than kMaxLineBytes are cut there. Not thread safe.
+class FileViewer
+{
+private:
+    int         m_fd;
+    uint64_t    m_size;
+    const char* m_window;
+    uint64_t    m_windowStart;
+    size_t      m_windowBytes;
+
+    std::vector<uint64_t> m_checkpoints;    // where line i * m_stride starts
+    uint64_t m_stride;
+    uint64_t m_indexedEnd;      // lines are counted up to this offset
+    uint64_t m_indexedLines;    // '\n' before m_indexedEnd
+
+    std::unique_ptr<CompressedFile> m_compressed;
+    std::string m_buffer;
+
+    void remap(uint64_t offset);
+    void decompressWindow(uint64_t offset);
+    const char* bytes(uint64_t offset, size_t count);
+    void addCheckpoint(uint64_t offset);
+
+public:
+    static constexpr size_t   kWindowBytes    = 64 << 20;
+    static constexpr size_t   kScanBytes      = 1 << 20;
+    static constexpr size_t   kMaxLineBytes   = 64 << 10;
+    static constexpr size_t   kMaxCheckpoints = 1 << 16;
+    static constexpr uint64_t kIndexStepBytes = 64 << 20;
+    static constexpr size_t   kCompressedWindowBytes = 4 << 20;
+
+    bool open(const std::string& fileName, std::string* error);
+    void close();
+    bool isOpen() const { return m_fd >= 0; }
+    uint64_t size() const { return m_size; }
+
+    // Takes the current size of the file. Returns false when it got
+    // shorter (truncated) : open it again, the lines read are gone.
+    bool refresh();
+
+    bool isCompressed() const { return m_compressed != nullptr; }
+    bool isDecompressing() const { return m_compressed && !m_compressed->isComplete(); }
+
+    // start of the line holding offset
+    uint64_t lineStart(uint64_t offset);
+
+    // Reads the line starting at offset into *line (cut at kMaxLineBytes,
+    // without its '\n'), returns where the next one starts, size() after
+    // the last line.
+    uint64_t nextLine(uint64_t offset, std::string* line);
+
+    // start of the line before the one starting at offset, 0 stays 0
+    uint64_t prevLine(uint64_t offset) { return offset == 0 ? 0 : lineStart(offset - 1); }
+
+    // Counts lines up to offset, at most kIndexStepBytes more per call.
+    // Returns whether offset is indexed now.
+    bool extendIndex(uint64_t offset);
+    bool isIndexed(uint64_t offset) const { return offset <= m_indexedEnd; }
+    uint64_t indexedEnd() const { return m_indexedEnd; }
+    bool isIndexComplete() const { return m_indexedEnd == m_size; }
+    uint64_t indexedLines() const { return m_indexedLines; }
+
+    // line number (0 based) of the line starting at offset, which must be
+    // indexed, and back; lineOffset returns size() past the indexed lines
+    uint64_t lineNumber(uint64_t offset);
+    uint64_t lineOffset(uint64_t line);
+
+    // heap bytes of the index (and of the decompression), the window is
+    // kWindowBytes of address space
+    size_t memoryUsage() const;
+
+    FileViewer();
+    ~FileViewer();
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef __HIGHLIGHTER__
+#define __HIGHLIGHTER__
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+#include "utils/lexerUtils.hpp"
+#include "DfaLexer.h"
+#include "TextBuffer.h"
+
+// Keeps the lexer entry state of every line so multi line tokens can be
+// highlighted without lexing the whole file.
+//
+// Edits only mark lines dirty. Re-lexing starts from the first dirty line
+// and stops as soon as a line's exit state matches the cached entry state of
+// the next line.
+//
+// Lines are lexed by the DFA compiled from the syntax.json rules when there
+// is one, otherwise by the built in C like Lexer.
+//
+// Lines longer than kLongLineBytes also keep a lexer checkpoint about every
+// kCheckpointBytes, so painting a horizontal window only lexes from the
+// nearest checkpoint instead of from the start of the line.
+//
+// The lexing runs on a worker thread, by priority : the visible rows, then
+// a prefetch band of one page above and below, then the rest of the file.
+// Rows are copied out under the document lock and lexed unlocked; results
+// are dropped if the document changed meanwhile. Spans are cached for the
+// band only, a row without spans yet is painted plain.
+//
+// The lexer and its colors (Lexing) are replaced whole, a batch keeps the
+// one it was taken with. setLexing() swaps them while running : new
+// patterns start over, new colors only drop the cached spans that have a
+// color that changed.
+class Highlighter
+{
+private:
+    struct Lexing
+    {
+        DfaLexer dfa;
+        short    colorComment = 0;
+        short    colorString  = 0;
+    };
+
+    struct CachedSpans
+    {
+        LexState entry;
+        std::vector<TokenSpan> spans;
+    };
+
+    // consecutive rows copied out of the document so they can be lexed unlocked
+    struct LexBatch
+    {
+        int  firstRow;
+        bool propagate;     // carry exit states to the next rows
+        int  spanTop;       // spans are kept for rows in [spanTop, spanBottom]
+        int  spanBottom;
+        std::vector<std::string> lines;
+        std::vector<LexState>    entries;   // one more than lines : the next row
+        std::vector<uint8_t>     dirty;
+        std::vector<std::vector<TokenSpan>>     spans;
+        std::vector<std::vector<LexCheckpoint>> checkpoints;
+        bool carry;
+        std::shared_ptr<const Lexing> lexing;
+    };
+
+    std::vector<LexState> m_entryStates;
+    std::vector<uint8_t>  m_dirty;
+    int m_pendingRow;       // every row before this one is up to date
+
+    std::map<int, std::vector<LexCheckpoint>> m_checkpoints;   // long lines only
+    std::map<int, CachedSpans> m_spanCache;
+
+    std::shared_ptr<const Lexing> m_lexing;
+
+    // shared with the document owner, guards everything above
+    std::mutex* m_docMutex;
+    const TextBuffer* m_text;
+
+    std::thread m_worker;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_viewportReady;
+    bool m_isRunning;
+    uint64_t m_editVersion;
+    std::function<void()> m_onUpdate;
+    int m_viewTop;
+    int m_viewRows;
+
+    template <typename RowMap>
+    static void shiftRows(RowMap& rows, int fromRow, int delta);
+
+    void edited();
+    bool takePropagateBatch(int lastRow, int spanTop, int spanBottom, LexBatch& batch);
+    bool takeSpanBatch(int fromRow, int toRow, LexBatch& batch);
+    void lexBatch(LexBatch& batch) const;
+    static LexState lexWith(const Lexing& lexing, const char* text, int len, LexState entry,
+                            std::vector<TokenSpan>* spans, std::vector<LexCheckpoint>* checkpoints);
+    bool applyBatch(LexBatch& batch);
+    bool hasValidSpans(int row) const;
+    bool isViewportReady() const;
+    bool workerStep(std::unique_lock<std::mutex>& lock);
+    void workerLoop();
+
+public:
+    static const int kLongLineBytes   = 16 * 1024;
+    static const int kCheckpointBytes = 4 * 1024;
+    static const int kWindowSlack     = 256;
+    static const int kBatchRows       = 256;
+
+    // the caller holds the document lock
+    void reset(int lineCount);
+    void lineChanged(int row);
+    void linesInserted(int row, int count);
+    void linesErased(int row, int count);
+
+    void attach(std::mutex* docMutex, const TextBuffer* text);
+    void startWorker();
+    void stop();
+
+    // lexes synchronously up to lastRow, for when there is no worker
+    void update(int lastRow);
+
+    void setViewport(int top, int rows);
+
+    // Gives the worker a short head start on the viewport so a frame right
+    // after an edit is not painted plain. Returns false on timeout.
+    bool waitViewport(int timeoutMs);
+
+    // Called from the worker, without the document lock, each time it
+    // produced spans for visible rows.
+    void setUpdateCallback(std::function<void()> callback);
+
+    // Spans covering [col, col + width) of line row, with line offsets.
+    // Returns false when the row is not highlighted yet. The caller holds
+    // the document lock.
+    bool windowSpans(int row, std::string_view line, int col, int width,
+                     std::vector<TokenSpan>& spans);
+
+    LexState entryState(int row) const;
+
+    // Lexes one line from its entry state, spans may be null when only the
+    // exit state is wanted.
+    LexState lexSpans(std::string_view line, LexState entry, std::vector<TokenSpan>* spans) const;
+    LexState lexSpans(const char* text, int len, LexState entry, std::vector<TokenSpan>* spans,
+                      std::vector<LexCheckpoint>* checkpoints = nullptr) const;
+
+    // Same as windowSpans without the cache, the caller holds the lock
+    void lexWindow(int row, std::string_view line, int col, int width,
+                   std::vector<TokenSpan>& spans) const;
+
+    void setDfa(DfaLexer dfa);
+    void setBuiltinColors(short comment, short string);
+
+    // The caller holds the document lock. Returns the cached rows dropped,
+    // -1 when the patterns changed and every row is lexed again.
+    int setLexing(DfaLexer dfa, short comment, short string);
+
+    Highlighter();
+    ~Highlighter();
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __INPUT_DECODER__
+#define __INPUT_DECODER__
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// One decoded key. Named keys use the ncurses KEY_* codes so the editor
+// handles them the same whichever decoder produced them.
+struct KeyEvent
+{
+    int key;
+    int mods;           // KeyEvent::kShift | kAlt | kCtrl
+    std::string text;   // the pasted text for kKeyPaste, the bytes for kKeyChar
+
+    static const int kShift = 1;
+    static const int kAlt   = 2;
+    static const int kCtrl  = 4;
+
+    static const int kKeyPaste = 01000;     // past ncurses' KEY_MAX
+    static const int kKeyChar  = 01001;     // one non ASCII UTF-8 character
+};
+
+// Turns raw terminal input into key events.
+//
+// Bytes are fed in bulk as read() returns them. Fixed sequences (the
+// terminfo keys plus the usual xterm, vt and rxvt ones) are matched in a
+// byte trie; CSI sequences with parameters (modifiers "CSI 1;5A",
+// "CSI 15;2~") are parsed generically. A sequence cut at the end of a
+// read stays pending until the rest arrives.
+//
+// Bracketed paste ("CSI 200~" .. "CSI 201~") becomes one kKeyPaste event.
+// A multi byte UTF-8 character becomes one kKeyChar event, bytes that do
+// not form one are dropped.
+//
+// A lone ESC cannot be told from the start of a sequence by looking at the
+// bytes. Instead of waiting ESCDELAY, the caller sends a device status
+// request (kStatusQuery) when feed() says so. The terminal answers after
+// the bytes it already sent, so when the reply comes in behind the ESC the
+// ESC was the Esc key. Replies to queries are swallowed.
+class InputDecoder
+{
+private:
+    struct TrieNode
+    {
+        int key;
+        std::vector<std::pair<unsigned char, int>> children;
+    };
+
+    std::vector<TrieNode> m_trie;
+    std::string m_pending;
+    bool m_isPaste;
+    std::string m_paste;
+    bool m_isQuerySent;
+
+    int  child(int node, unsigned char byte) const;
+    int  decodeEscape(const char* data, int len, std::vector<KeyEvent>& events);
+    int  decodeCsi(const char* data, int len, std::vector<KeyEvent>& events);
+    int  decodePaste(const char* data, int len, std::vector<KeyEvent>& events);
+    int  decodeUtf8(const char* data, int len, std::vector<KeyEvent>& events);
+
+public:
+    static const char* kStatusQuery;
+
+    void addSequence(const std::string& sequence, int key);
+
+    // adds the key strings of the current terminal, after setupterm/initscr
+    void loadTerminfo();
+
+    // Appends the decoded events. Returns true when a lone ESC is pending
+    // and kStatusQuery should be sent to resolve it.
+    bool feed(const char* data, int len, std::vector<KeyEvent>& events);
+
+    // the terminal did not answer : a pending ESC is the Esc key
+    void flushEscape(std::vector<KeyEvent>& events);
+
+    bool hasPendingEscape() const;
+
+    InputDecoder();
+};
+
+#endif
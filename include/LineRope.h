@@ -0,0 +1,155 @@
+#ifndef __LINE_ROPE__
+#define __LINE_ROPE__
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+
+// The document lines as a B-tree rope, the alternative to LineStore
+// (cmake -DTEXT_ROPE=ON, see TextBuffer.h).
+//
+// Leaves hold up to kLeafLines lines, about kLeafBytes, back to back in one
+// string; a longer line gets a leaf of its own. Inner nodes have up to
+// kMaxChildren children. Every node caches a summary of its lines : bytes
+// and UTF-16 code units (a '\n' counted after each line), the line count
+// and the widest line in terminal columns. So row -> offset, offset -> row
+// and the longest line are O(log n), like the row lookup itself.
+//
+// Nodes are shared, never changed once shared : a copy of the rope is O(1)
+// and an edit copies the path from the root to its leaf (copy on write).
+// A worker takes a copy under the document lock and reads it without.
+//
+// Byte positions given to insertBytes / eraseBytes are on character
+// boundaries, the widths are kept up to date from the edited bytes only
+// (the whole line when a tab may move to another tab stop).
+//
+// The caller guards it with the document lock.
+class LineRope
+{
+private:
+    struct Summary
+    {
+        uint64_t bytes      = 0;
+        uint64_t utf16      = 0;
+        uint64_t lines      = 0;
+        uint32_t maxColumns = 0;
+    };
+
+    struct Node
+    {
+        Summary summary;
+        bool    isLeaf = true;
+        std::vector<std::shared_ptr<Node>> children;
+
+        // leaf : line i is text[ends[i - 1], ends[i])
+        std::string           text;
+        std::vector<uint32_t> ends;
+        std::vector<uint32_t> columns;
+        std::vector<uint32_t> utf16;
+    };
+
+    using NodePtr = std::shared_ptr<Node>;
+    using Nodes   = std::vector<NodePtr>;
+
+    NodePtr m_root;
+
+    static Node* own(NodePtr& node);
+    static void  summarize(Node* node);
+    static uint32_t lineStart(const Node* leaf, size_t index) { return index == 0 ? 0 : leaf->ends[index - 1]; }
+    static void  leafAppend(Node* leaf, std::string_view line);
+    static Nodes splitLeaf(Node* leaf);
+    static Nodes splitInner(Node* node);
+    static void  mergeChildren(Node* node);
+
+    // the changed subtree may split, the extra right siblings are returned
+    Nodes insertLines(NodePtr& node, size_t row, std::vector<std::string>& lines);
+    Nodes changeLine(NodePtr& node, size_t row, size_t byte, size_t eraseCount, std::string_view text);
+    void  eraseLines(NodePtr& node, size_t row, size_t count);
+    void  growRoot(Nodes extras);
+    static size_t  height(const Node* node);
+    static NodePtr buildTree(Nodes level);
+    Nodes hangTree(NodePtr& node, size_t depth, NodePtr tree);
+    const Node* leafAt(size_t row, size_t* firstRow) const;
+
+public:
+    static constexpr size_t kLeafBytes   = 4096;
+    static constexpr size_t kLeafLines   = 256;
+    static constexpr size_t kMaxChildren = 16;
+
+    class const_iterator
+    {
+    private:
+        const LineRope* m_rope;
+        size_t m_row;
+        mutable const Node* m_leaf = nullptr;   // cached, iterating is O(1) per line
+        mutable size_t m_leafFirst = 0;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = std::string_view;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const std::string_view*;
+        using reference         = std::string_view;
+
+        const_iterator(const LineRope* rope, size_t row) : m_rope(rope), m_row(row) {}
+
+        std::string_view operator*() const;
+        std::string_view operator[](difference_type n) const { return (*m_rope)[m_row + n]; }
+        const_iterator& operator++() { m_row++; return *this; }
+        const_iterator& operator--() { m_row--; return *this; }
+        const_iterator  operator++(int) { const_iterator old = *this; m_row++; return old; }
+        const_iterator  operator--(int) { const_iterator old = *this; m_row--; return old; }
+        const_iterator& operator+=(difference_type n) { m_row += n; return *this; }
+        const_iterator& operator-=(difference_type n) { m_row -= n; return *this; }
+        const_iterator  operator+(difference_type n) const { return {m_rope, m_row + n}; }
+        const_iterator  operator-(difference_type n) const { return {m_rope, m_row - n}; }
+        difference_type operator-(const const_iterator& other) const { return m_row - other.m_row; }
+        bool operator==(const const_iterator& other) const { return m_row == other.m_row; }
+        bool operator!=(const const_iterator& other) const { return m_row != other.m_row; }
+        bool operator<(const const_iterator& other) const { return m_row < other.m_row; }
+    };
+
+    size_t size() const { return m_root->summary.lines; }
+    bool   empty() const { return size() == 0; }
+    void   reserve(size_t) {}
+    void   clear();
+    void   swap(LineRope& other) { m_root.swap(other.m_root); }
+
+    std::string_view operator[](size_t row) const;
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size()}; }
+
+    void push_back(std::string_view line);
+
+    // Splits text on '\n' and appends the lines, built bottom up; O(lines
+    // of text + log n). There is always one more line than there are '\n'.
+    void appendText(std::string&& text);
+
+    void set(size_t row, std::string line);
+    void insert(size_t row, std::string line);
+    void insert(size_t row, std::vector<std::string>&& lines);
+    void erase(size_t row, size_t count = 1);
+
+    // text must not point into the rope
+    void insertBytes(size_t row, size_t byte, std::string_view text);
+    void eraseBytes(size_t row, size_t byte, size_t count = std::string::npos);
+
+    // '\n' after every line but the last one
+    uint64_t byteCount() const { return m_root->summary.bytes - (empty() ? 0 : 1); }
+    uint64_t byteOffset(size_t row) const;
+    size_t   rowAtByte(uint64_t offset) const;
+    uint64_t utf16Offset(size_t row) const;
+    size_t   rowAtUtf16(uint64_t offset) const;
+
+    // the widest line, its columns in *columns
+    size_t longestLine(int* columns = nullptr) const;
+
+    size_t memoryUsage() const;
+
+    LineRope();
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef __LINE_STORE__
+#define __LINE_STORE__
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+// The document lines, about 8 bytes per line plus the text.
+//
+// Each line is one 64 bit word, its top byte tells where the bytes are :
+//
+//   0xxxxxxx  arena : bits 40-62 the length, bits 0-39 the arena address
+//   10000nnn  inline : n (0-7) bytes in the low 7 bytes of the word
+//   11000000  pool : bits 0-31 a slot of the mutable pool
+//
+// Loaded and appended lines are packed back to back in large arena chunks;
+// a loaded file becomes a chunk as it is, no copy. The arena is append
+// only : a line that gets edited moves to a std::string of the pool, its
+// arena bytes stay (counted as dead) until the store is rebuilt (open,
+// replace all). Short lines, the empty ones first, fit inline.
+//
+// The arena address space is cut in 16 MB pages, every chunk starts on a
+// page, so address -> chunk is a table lookup.
+//
+// A copy shares the arena chunks, which no store appends to after that :
+// it copies the line table and the edited lines only.
+//
+// A line is read as a std::string_view, valid until the store changes.
+// The byte after it can be read too (the lexer peeks there).
+// The caller guards it with the document lock.
+class LineStore
+{
+private:
+    static constexpr int      kPageBits    = 24;
+    static constexpr uint64_t kAddressMask = (1ull << 40) - 1;
+    static constexpr uint64_t kLengthMask  = (1ull << 23) - 1;
+    static constexpr uint8_t  kInlineTag   = 0x80;
+    static constexpr uint8_t  kPoolTag     = 0xC0;
+    static constexpr size_t   kInlineBytes = 7;
+
+    std::vector<uint64_t>    m_lines;
+    std::vector<std::shared_ptr<std::string>> m_chunks;
+    std::vector<uint64_t>    m_chunkBases;  // arena address of each chunk
+    std::vector<uint32_t>    m_pageChunks;  // chunk of each page
+    mutable bool m_isLastChunkOpen;         // appended lines may go there, a copy closes it
+    std::vector<std::string> m_pool;
+    std::vector<uint32_t>    m_freeSlots;
+    size_t   m_deadBytes;
+    uint64_t m_textBytes;                   // of all the lines
+
+    uint64_t packArena(std::string_view line);
+    uint64_t packOwned(std::string&& line);
+    void     release(uint64_t entry);
+    uint32_t takeSlot();
+    size_t   addChunk(std::string&& chunk);
+
+    // the line as a std::string of the pool, valid until the next change
+    std::string& edit(size_t row);
+
+public:
+    // longer lines go to the pool
+    static constexpr size_t kMaxArenaLine = kLengthMask;
+    static constexpr size_t kChunkBytes   = 1 << kPageBits;
+
+    class const_iterator
+    {
+    private:
+        const LineStore* m_store;
+        size_t m_row;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = std::string_view;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const std::string_view*;
+        using reference         = std::string_view;
+
+        const_iterator(const LineStore* store, size_t row) : m_store(store), m_row(row) {}
+
+        std::string_view operator*() const { return (*m_store)[m_row]; }
+        std::string_view operator[](difference_type n) const { return (*m_store)[m_row + n]; }
+        const_iterator& operator++() { m_row++; return *this; }
+        const_iterator& operator--() { m_row--; return *this; }
+        const_iterator  operator++(int) { const_iterator old = *this; m_row++; return old; }
+        const_iterator  operator--(int) { const_iterator old = *this; m_row--; return old; }
+        const_iterator& operator+=(difference_type n) { m_row += n; return *this; }
+        const_iterator& operator-=(difference_type n) { m_row -= n; return *this; }
+        const_iterator  operator+(difference_type n) const { return {m_store, m_row + n}; }
+        const_iterator  operator-(difference_type n) const { return {m_store, m_row - n}; }
+        difference_type operator-(const const_iterator& other) const { return m_row - other.m_row; }
+        bool operator==(const const_iterator& other) const { return m_row == other.m_row; }
+        bool operator!=(const const_iterator& other) const { return m_row != other.m_row; }
+        bool operator<(const const_iterator& other) const { return m_row < other.m_row; }
+    };
+
+    size_t size() const { return m_lines.size(); }
+    bool   empty() const { return m_lines.empty(); }
+    void   reserve(size_t lineCount) { m_lines.reserve(lineCount); }
+    void   clear();
+    void   swap(LineStore& other);
+
+    std::string_view operator[](size_t row) const;
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, m_lines.size()}; }
+
+    // packed into the arena
+    void push_back(std::string_view line);
+
+    // Splits text on '\n' and appends the lines, text becomes an arena
+    // chunk. There is always one more line than there are '\n'.
+    void appendText(std::string&& text);
+
+    void set(size_t row, std::string line);
+
+    // text must not point into the store
+    void insertBytes(size_t row, size_t byte, std::string_view text);
+    void eraseBytes(size_t row, size_t byte, size_t count = std::string::npos);
+
+    void insert(size_t row, std::string line);
+    void insert(size_t row, std::vector<std::string>&& lines);
+    void erase(size_t row, size_t count = 1);
+
+    // '\n' after every line but the last one, as LineRope
+    uint64_t byteCount() const { return m_textBytes + (empty() ? 0 : m_lines.size() - 1); }
+
+    // heap bytes held, and arena bytes of lines edited or erased since
+    size_t memoryUsage() const;
+    size_t deadBytes() const { return m_deadBytes; }
+
+    LineStore();
+    LineStore(const LineStore& other);
+    LineStore(LineStore&& other) = default;
+    LineStore& operator=(const LineStore& other);
+    LineStore& operator=(LineStore&& other) = default;
+};
+
+inline std::string_view LineStore::operator[](size_t row) const
+{
+    const uint64_t& entry = m_lines[row];
+    uint8_t tag = entry >> 56;
+    if(tag < kInlineTag)
+    {
+        uint64_t address = entry & kAddressMask;
+        uint32_t chunk   = m_pageChunks[address >> kPageBits];
+        return {m_chunks[chunk]->data() + (address - m_chunkBases[chunk]), (entry >> 40) & kLengthMask};
+    }
+
+    if(tag == kPoolTag)
+        return m_pool[entry & 0xFFFFFFFF];
+
+    // the low bytes of the word come first in memory
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "inline lines need a little endian word");
+    return {reinterpret_cast<const char*>(&entry), static_cast<size_t>(tag & 7)};
+}
+
+#endif
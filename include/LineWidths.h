@@ -0,0 +1,81 @@
+#ifndef __LINE_WIDTHS__
+#define __LINE_WIDTHS__
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "TextBuffer.h"
+
+// Terminal columns of the document lines, and the way between a column and
+// its byte.
+//
+// ASCII lines without tabs (flagged per line, the common case) are plain
+// byte math. Other lines are walked char by char, a tab reaching the next
+// tab stop; lines of kIndexedLineBytes or more keep a (byte, column)
+// checkpoint about every kCheckpointBytes, so a lookup walks at most that
+// far whatever the line length. Checkpoints are laid down lazily up to the
+// furthest position asked for, an edit drops those after the edited byte.
+//
+// A zero width character (combining mark) belongs to the character before
+// it : a column never points between them.
+//
+// The caller guards it and the text with the same lock.
+class LineWidths
+{
+private:
+    struct Checkpoint
+    {
+        int byte;
+        int col;
+    };
+
+    struct Index
+    {
+        std::vector<Checkpoint> points;     // points[0] is {0, 0}
+        bool isComplete = false;            // points reach the line end
+        int  columns    = 0;                // when isComplete
+    };
+
+    enum : uint8_t { kUnknown, kAscii, kUtf8 };
+
+    const TextBuffer* m_text;
+    std::vector<uint8_t> m_kinds;
+    std::map<int, Index> m_indexes;     // by line, long non ASCII lines only
+
+    Checkpoint startFor(int row, int byte, int col);
+    void extend(Index& index, std::string_view line, int byte, int col);
+    void shiftIndexes(int row, int delta);
+
+public:
+    static const int kIndexedLineBytes = 4096;
+    static const int kCheckpointBytes  = 512;
+
+    void attach(const TextBuffer* text);
+
+    // isAllAscii : the whole document is known to be ASCII without tabs
+    void reset(int lineCount, bool isAllAscii = false);
+
+    // fromByte : the line did not change before it
+    void lineChanged(int row, int fromByte = 0);
+    void linesInserted(int row, int count);
+    void linesErased(int row, int count);
+
+    bool isAscii(int row);
+    int  columns(int row);
+
+    // The character covering col, or the first one after it, and the column
+    // it starts at. Past the end : the line size and its columns.
+    int byteAt(int row, int col, int* startCol = nullptr, int* charWidth = nullptr);
+    int columnAt(int row, int byte);
+
+    // cursor steps, over whole characters
+    int nextColumn(int row, int col);
+    int prevColumn(int row, int col);
+
+    // the start of the character covering col
+    int snapColumn(int row, int col);
+
+    LineWidths();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __SYNTAX_CONFIG__
+#define __SYNTAX_CONFIG__
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "DfaLexer.h"
+
+struct SyntaxCacheHeader;
+
+// syntax.json as TextArea uses it : the color pairs, the keyword table,
+// the token rules and the options.
+//
+// It is compiled into one binary image (SyntaxCacheHeader, then the
+// tables and their strings), which is also the cache file : load() maps
+// the cache and reads nothing else while the json has the mtime and size
+// it was made from. Otherwise the json is read; with the same hash
+// (touched, copied back) the cache still holds, else the json is parsed
+// and the cache written again. The keywords are sorted in the image,
+// colorOf() searches them there, no map is built.
+class SyntaxConfig
+{
+private:
+    struct Keyword
+    {
+        uint32_t offset;    // in the strings
+        uint32_t length;
+        int32_t  color;     // color pair
+    };
+
+    struct Rule
+    {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint32_t patternOffset;
+        uint32_t patternLength;
+        int32_t  color;
+        uint32_t isWord;
+    };
+
+    // the image is mapped (m_map) or held (m_image)
+    void*       m_map;
+    size_t      m_mapBytes;
+    std::string m_image;
+
+    const SyntaxCacheHeader* m_header;
+    const int16_t* m_pairs;
+    const Keyword* m_keywords;
+    const Rule*    m_rules;
+    const char*    m_strings;
+    bool           m_isFromCache;
+
+    bool bind(const char* data, size_t size);
+    void unmap();
+    static std::string compile(const std::string& json, std::string* error);
+
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    // false with error when the json does not parse, the config is then
+    // empty as for a missing json
+    bool load(const std::string& jsonPath, const std::string& cachePath, std::string* error);
+
+    bool isFromCache() const { return m_isFromCache; }
+    uint64_t hash() const;
+
+    int  colorComment() const;
+    int  colorString() const;
+    int  colorUserDef() const;
+    bool isDirectOutput() const;
+    bool isSoftWrap() const;
+    int  viewerMinMb() const;
+
+    // foreground of color pair i + 1
+    size_t pairCount() const;
+    int    pairColor(size_t i) const { return m_pairs[i]; }
+
+    // the color pair of a keyword, 0 if it is none
+    int colorOf(std::string_view word) const;
+    std::vector<TokenRule> rules() const;
+
+    SyntaxConfig();
+    ~SyntaxConfig();
+    SyntaxConfig(const SyntaxConfig&) = delete;
+    SyntaxConfig& operator=(const SyntaxConfig&) = delete;
+};
+
+#endif
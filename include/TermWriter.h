@@ -0,0 +1,89 @@
+#ifndef __TERM_WRITER__
+#define __TERM_WRITER__
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Output backend that bypasses the ncurses screen update.
+//
+// A frame is built as one escape sequence stream (xterm/ANSI : CUP, SGR)
+// in a preallocated buffer and flushed with a single write(). Rows are
+// self contained, they start and end with default colors, so a row whose
+// bytes did not change since the last frame is dropped from the buffer.
+//
+// On terminals that advertise it the frame is wrapped in the synchronized
+// output mode (DEC private mode 2026) so it is shown at once, no tearing.
+//
+// A vertical scroll of a few rows is sent as a scroll region (DECSTBM)
+// plus SU/SD, the row hashes move along with the rows so only the newly
+// exposed rows are painted.
+class TermWriter
+{
+private:
+    int m_fd;
+    std::string m_buffer;
+    bool m_isSyncOutput;
+
+    short m_fg;     // colors the terminal has now, kDefaultColor : none
+    short m_bg;
+
+    std::vector<uint64_t> m_rowHashes;
+    size_t m_rowStart;
+    size_t m_rowBody;       // after the cursor move of the row
+    int    m_rowCol;
+    int    m_row;
+    int    m_cursorRow;
+    int    m_cursorCol;
+    size_t m_frameStart;
+
+    size_t m_frames;
+    size_t m_writes;
+    size_t m_bytes;
+
+    void appendNumber(int value);
+    void appendColor(short color, int base);
+    bool flush();
+
+public:
+    static const short  kDefaultColor = -1;
+    static const size_t kBufferBytes  = 256 * 1024;
+
+    // Asks the terminal for mode 2026 (DECRQM) followed by a primary device
+    // attributes request every terminal answers, so there is no need to wait
+    // for the timeout on terminals that ignore DECRQM. Input that is not part
+    // of the replies is returned in pending.
+    bool probeSyncOutput(int inFd, int timeoutMs, std::string& pending);
+
+    void setSyncOutput(bool isSyncOutput) { m_isSyncOutput = isSyncOutput; }
+    bool isSyncOutput() const { return m_isSyncOutput; }
+
+    // forgets what is on screen, the next frame repaints every row
+    void invalidate();
+
+    void beginFrame();
+    void beginRow(int row, int col);
+    void setColor(short fg, short bg);
+    void text(const char* str, int len);
+    void fill(char ch, int count);
+
+    // chars from the DEC line drawing set, "x" is a vertical line
+    void lineDrawing(const char* chars);
+
+    // Scrolls the full width screen rows [top, bottom] by count, positive
+    // moves the content up. Must come before the rows of the frame.
+    void scrollRows(int top, int bottom, int count);
+    void endRow();
+
+    // places the cursor and writes the frame, nothing is written when
+    // neither the rows nor the cursor changed
+    bool endFrame(int cursorRow, int cursorCol);
+
+    size_t frames() const { return m_frames; }
+    size_t writes() const { return m_writes; }
+    size_t bytes() const { return m_bytes; }
+
+    explicit TermWriter(int fd = 1);
+};
+
+#endif
@@ -3,8 +3,25 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
 #include "ncurses/curses.h"
+#include "Highlighter.h"
+#include "TermWriter.h"
+#include "InputDecoder.h"
+#include "EventLoop.h"
+#include "WrapLayout.h"
+#include "LineWidths.h"
+#include "TextBuffer.h"
+#include "FileViewer.h"
+#include "FileIo.h"
+#include "CompressedFile.h"
+#include "SyntaxConfig.h"
 
 struct Point
 {
@@ -24,10 +41,74 @@ struct Rect
     Size  size;
 };
 
+// Undo entry : rows [row, row + rowCount) are replaced by lines, or the
+// whole document by document. Records of one group (a reload's hunks)
+// are undone together.
+struct UndoRecord
+{
+    int  row;
+    int  rowCount;
+    bool isTyping;
+    bool isDocument = false;
+    uint64_t group  = 0;
+    uint64_t bytes  = 0;    // held text, counted against UNDO_MAX_BYTES
+    std::vector<std::string> lines;
+    TextBuffer document;
+    Point cursor;
+    Rect  scrollView;
+};
+
+// a changed place of a file reloaded from disk : rows [row, row + rowCount)
+// become lines
+struct ReloadHunk
+{
+    int row;
+    int rowCount;
+    std::vector<std::string> lines;
+};
+
+// A colored part of a FrameRow
+struct FrameSegment
+{
+    int start;
+    int length;
+    int colorId;
+};
+
+struct FrameRow
+{
+    std::string text;       // already clipped to the window, UTF-8
+    std::vector<FrameSegment> segments;     // byte offsets in text
+    int  columns = 0;       // terminal columns of text
+    bool isAscii = true;
+};
+
+// Everything the renderer needs for one frame, copied out under the locks
+// so the painting and the terminal write happen without them
+struct FrameSnapshot
+{
+    uint64_t version;
+    Point    cursor;
+    Rect     scrollView;
+    int      scrollRows;    // rows the content moved up since the last frame
+    std::string status;
+    bool     isPrompt;      // the cursor goes to the end of the status line
+    bool     isRelayout;    // the terminal was resized, termSize is new
+    Size     termSize;
+    std::vector<FrameRow> rows;
+};
+
+// what a file looked like on disk, to tell our own writes from others'
+struct FileStamp
+{
+    int64_t mtimeNs;
+    int64_t size;
+};
 
 class TextArea
 {
 private:
+    EventLoop& m_loop;
     WINDOW* m_window;
     Point   m_cursor;
     Point   m_windPos;
@@ -35,25 +116,176 @@ private:
     Rect    m_scrollView;
 
     int mypadpos = 0;
-    std::vector<std::string> m_text;
+    TextBuffer       m_text;
     std::string      m_fileName;
     std::vector<int> m_linesShouldRender;
 
 
     int colorComment;
-    int colorUserDef;
-    std::map<std::string, int> m_colorMap;
+    int colorString;
+    int colorUserDef;       // guarded by m_userDefMutex
+
+    // syntax.json, swapped whole under m_viewMutex when it changes on disk:
+    // m_configWatch sees the directory change, m_configTimer waits for the
+    // writes to settle and m_configThread parses and compiles it, one load
+    // at a time (m_isConfigLoading), a change meanwhile waits for it
+    std::shared_ptr<const SyntaxConfig> m_syntax;
+    std::string m_configDir;
+    FileStamp   m_configStamp;
+    int         m_configWatch;
+    int         m_configTimer;
+    std::thread m_configThread;
+    bool        m_isConfigLoading;
+    bool        m_isConfigPending;
     std::map<std::string, int> m_cmUserTypeDef;
 
     int lineNumberWidth;
 
+    // user types are parsed on m_threadParseSyntax, a while after the last
+    // edit (m_userDefTimer), both guarded by m_userDefMutex
     std::thread m_threadParseSyntax;
     bool m_isRunThreadPraseSyntax;
+    bool m_isUserDefRequested;
+    std::condition_variable m_userDefWakeup;
+    int      m_userDefTimer;
+    uint64_t m_editCount;       // bumped by every change of m_text
+    uint64_t m_parsedEditCount;
+
+    // held by the UI thread while it changes m_text, and by the workers
+    // while they read it
+    std::mutex m_docMutex;
+    std::mutex m_userDefMutex;
+
+    // Input and edits run on the main thread, frames on m_renderThread.
+    // m_viewMutex guards the cursor, the scroll view, the status and
+    // m_version; it is taken before m_docMutex. Every change bumps
+    // m_version, the renderer paints the newest version and skips the
+    // ones it did not get to.
+    std::mutex  m_viewMutex;
+    std::condition_variable m_frameRequested;
+    uint64_t    m_version;
+    uint64_t    m_paintedVersion;
+    bool        m_isRenderRunning;
+    std::thread m_renderThread;
+
+    // ncurses is not thread safe : held around output
+    std::mutex  m_termMutex;
+
+    // status line prompt, keys go to it while m_onPromptDone is set
+    std::string m_prompt;       // painted, guarded by m_viewMutex
+    std::string m_promptLabel;
+    std::string m_promptInput;
+    std::function<void(const std::string&)> m_onPromptDone;
+
+    // keys are read from stdin and decoded here, ncurses only paints
+    InputDecoder m_inputDecoder;
+    std::deque<KeyEvent> m_keys;
+    int m_escTimer;
+    int m_resizeSignal;
+
+    Highlighter m_highlighter;
+
+    // "soft_wrap" : long lines continue on the next rows. m_scrollView.pos
+    // is then the top line, m_wrapTopRow its first visible row, the column
+    // is all in m_cursor.col. Guarded by m_viewMutex.
+    WrapLayout m_wrap;
+    bool       m_isSoftWrap;
+    int        m_wrapTopRow;
+
+    // m_cursor and m_scrollView count terminal columns, m_text holds UTF-8
+    // bytes, m_widths maps between them. Guarded by m_viewMutex.
+    LineWidths m_widths;
+
+    // the oldest records are dropped past UNDO_MAX_RECORDS / UNDO_MAX_BYTES;
+    // pushUndo puts records into m_undoGroup while it is not 0
+    std::deque<UndoRecord> m_undoStack;
+    uint64_t m_undoGroupCount;
+    uint64_t m_undoGroup;
+    uint64_t m_undoBytes;
+    std::string m_status;
+
+    // "direct_output" : frames bypass ncurses, see TermWriter
+    bool       m_isDirectOutput;
+    TermWriter m_termWriter;
+    Point      m_paintedPos;    // m_scrollView.pos of the last frame
+    int        m_paintedSubRow; // m_wrapTopRow of the last frame, -1 : no wrap
+
+    // a resize is laid out by the UI thread, the renderer resizes the
+    // screen and the window in the next frame
+    Size       m_termSize;
+    bool       m_isRelayout;
+
+    // m_fileWatch is on the file's directory, a save that renames a new
+    // file over it is seen too; m_fileTimer checks the stamp once the
+    // events of one save are in
+    int       m_fileWatch;
+    int       m_fileTimer;
+    FileStamp m_savedStamp;
+
+    // files are read and written on m_fileIo's thread; the text is read
+    // only until the load is done, inotify events are ignored while our
+    // own saves are in flight. A compressed file is decompressed there and
+    // saved in its m_compression again.
+    FileIo    m_fileIo;
+    bool      m_isLoading;
+    int       m_savesInFlight;
+    Compression m_compression;
+
+    // A file changed by someone else is read again and diffed against a
+    // copy of m_text on m_reloadThread; only the changed hunks are applied,
+    // as undoable edits. With unsaved edits it waits for F9, F2 asks twice.
+    uint64_t    m_savedEditCount;   // m_editCount when m_text was the file
+    bool        m_isDiskChanged;
+    bool        m_isOverwriteAsked;
+    bool        m_isReloading;
+    bool        m_isReloadPending;
+    std::thread m_reloadThread;
+
+    // replace-all runs over a copy of m_text on m_replaceThread, the result
+    // is swapped in if the text did not change meanwhile (else it runs again)
+    bool        m_isReplacing;
+    std::thread m_replaceThread;
+
+    // Viewer mode (OpenViewer) : a read only file of any size. m_text is a
+    // slice of its lines, m_viewLines where each one starts in the file and
+    // m_viewEnd where the slice ends; followViewer moves the slice along
+    // with the view. Guarded by m_viewMutex.
+    bool       m_isViewer;
+    FileViewer m_viewer;
+    std::deque<uint64_t> m_viewLines;
+    uint64_t   m_viewEnd;
+    uint64_t   m_viewCursor;        // the cursor line in the status
+    uint64_t   m_viewerMinBytes;    // "viewer_min_mb" : larger files open in it
+
+    // Follow mode of the viewer (tail -f) : inotify tells the file grew,
+    // m_followTimer takes the new bytes in at most every FOLLOW_DELAY_MS,
+    // so a fast writer costs one slice update and one frame per tick.
+    // With the cursor on the last line the view goes along.
+    bool       m_isFollowing;
+    bool       m_isFollowArmed;
+    int        m_followTimer;
+
+    // OpenStream ("kceditor -") : the text comes from a pipe as it is
+    // written. m_streamPending is read but not in m_text yet, its complete
+    // lines go to the end of it on m_streamTimer, so a fast writer costs
+    // one insert and one frame per tick. Editing goes on meanwhile; F2
+    // asks for a name.
+    int         m_streamFd;         // -1 once the pipe is closed
+    std::string m_streamPending;
+    bool        m_isStreaming;      // until the last line is in
+    bool        m_isStreamArmed;
+    bool        m_isStreamValid;
+    int         m_streamError;
+    int         m_streamTimer;
 
 private:
     void moveCursor(int row, int col);
     void appendChar(int row, int col, char ch);
     bool appendCharCurPos(char ch);
+    bool insertCharCurPos(const std::string& ch);
+    void setCursorColumn(int col);
+    void snapCursor();
+    int  wrapColumn(int line, int subRow, int x);
     bool deleteCharCurPos();
 
     void moveCurUp();
@@ -61,23 +293,94 @@ private:
     void moveCurLeft();
     void moveCurRight();
 
+    void wrapMove(int key);
+    void wrapFollowCursor();
+    void movePage(int direction);
+    void setSoftWrap(bool isSoftWrap);
+
     void breakNewLine();
     void clearRow(int row);
     void clearScreen(int fromRow, int toRow);
 
     void renderRow(int row);
+    void beginPaintRow(int row);
+    void paintText(const char* text, int len, int colorId);
+    void writeText(const char* text, int len, int colorId);
+    void overlayUtf8(const FrameSnapshot& frame);
+    void endPaintRow(int width, int windowWidth);
+    void paintBorder(Size windSize);
+    void relayout();
+    void paintStatus(const std::string& text);
+    void snapshotRow(FrameRow& frameRow, std::string_view line, int start, int length,
+                     int leftPad, int col, bool isAscii, const std::vector<TokenSpan>* spans);
+    void takeSnapshot(FrameSnapshot& frame);
+    void paintFrame(const FrameSnapshot& frame);
+    void renderLoop();
+    void requestFrame();
+
+    KeyEvent nextKey();
+    void onInput();
+    void onEscTimer();
+    void onResize();
+    void processKeys();
+    void applyEvent(const KeyEvent& event);
+    void applyKey(int c);
+    void insertText(const std::string& text);
+    void postStatus(const std::string& status);
+    int  wordColor(const std::string& word);
+    static DfaLexer loadSyntaxRules(const std::vector<TokenRule>& rules, const std::string& cachePath,
+                                    std::string* error);
+    void reloadConfig();
+    void applyConfig(std::shared_ptr<const SyntaxConfig> syntax, DfaLexer&& dfa);
+
+    void pushUndo(int row, int rowCount, std::vector<std::string> lines, bool isTyping = false);
+    void pushUndo(TextBuffer document);
+    void trimUndo();
+    void undo();
+    void clampCursor();
+    void replaceAll(bool useRegex);
+    void applyReplace(const std::string& pattern, const std::string& replacement, bool useRegex);
+    void finishReplace(std::shared_ptr<TextBuffer> result, size_t count, uint64_t editCount,
+                       const std::string& pattern, const std::string& replacement, bool useRegex);
+
+    void beginPrompt(const std::string& label, std::function<void(const std::string&)> onDone);
+    void promptKey(const KeyEvent& event);
+    void watchFile();
+    void onFileEvent(uint32_t mask);
+    void checkFileStamp();
+    void onFileLoaded(std::string&& content, int error);
+    FileIo::Decode fileDecoder();
+    void reloadFile();
+    void diffReload(std::string&& content, int error);
+    void applyReload(std::vector<ReloadHunk>&& hunks, uint64_t editCount, FileStamp stamp);
+    void postProgress(const std::string& label, uint64_t done, uint64_t total);
+    void setStatus(const std::string& status);
+
+    void jumpViewer(uint64_t offset);
+    void followViewer();
+    void viewerInsert(int row, std::vector<std::string>&& lines);
+    void viewerErase(int row, int count);
+    void viewerStatus();
+    void viewerGoTo();
+    void setFollow(bool isFollowing);
+    void onFollowEvent(uint32_t mask);
+    void followTail();
+    void onStreamInput();
+    void takeStream();
+    bool startsPrompt(int key) const;
+    void saveAs();
 
 public:
 
-    void HanldeEvents();
-    void Render();
     void DrawBoder();
     void SaveToFile(std::string fileName);
     void OpenFile(std::string fileName);
+    void OpenViewer(std::string fileName, bool isFollowing = false);
+    void OpenStream(int fd);
 
-    void parseUserDefColor();
+    bool parseUserDefColor();
 
-    TextArea(/* args */);
+    explicit TextArea(EventLoop& loop);
     ~TextArea();
 };
 
@@ -0,0 +1,16 @@
+#ifndef __TEXT_BUFFER__
+#define __TEXT_BUFFER__
+
+// The document backend, chosen when building : LineStore (packed arena,
+// the default) or LineRope (B-tree rope, cmake -DTEXT_ROPE=ON). Both have
+// the same interface for the editor; the rope adds its summary queries and
+// O(1) copies.
+#ifdef TEXT_ROPE
+#include "LineRope.h"
+using TextBuffer = LineRope;
+#else
+#include "LineStore.h"
+using TextBuffer = LineStore;
+#endif
+
+#endif
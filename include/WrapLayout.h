@@ -0,0 +1,98 @@
+#ifndef __WRAP_LAYOUT__
+#define __WRAP_LAYOUT__
+#include <string>
+#include <vector>
+#include <utility>
+#include "LineWidths.h"
+
+// Visual rows of the document lines when they are soft wrapped.
+//
+// Each line keeps its visual row count, 0 when it is not laid out for the
+// current width yet. Lines are laid out on demand, when they are painted
+// or walked over; a row is width terminal columns (LineWidths), a wide
+// character at its end runs into the spare column of the window.
+//
+// The lines are held in chunks of about kChunkLines. Two Fenwick trees over
+// the chunks (lines, rows) map a line to its chunk and a visual row to its
+// line in O(log n); an edit touches its chunk and one path of the trees,
+// only a chunk split or removal rebuilds them, O(chunks). A chunk counts
+// its lines that are not laid out at an estimated height : one row after
+// a load, its old rows scaled to the new width after a resize. So a resize
+// costs O(chunks) and the view is laid out first; a global position lays
+// out the chunk it lands in, the rows elsewhere stay estimates.
+//
+// The caller guards it and the text with the same lock.
+class WrapLayout
+{
+private:
+    static constexpr int kChunkLines  = 1024;
+    static constexpr int kEstimateOne = 256;    // estimates are in 1/256 rows
+
+    struct Chunk
+    {
+        std::vector<int> counts;        // rows per line, 0 : not laid out
+        bool isStale   = false;         // counts are for an old width
+        int  laidLines = 0;
+        int  laidRows  = 0;
+        int  estimate  = kEstimateOne;  // rows of a line not laid out
+        int  rows      = 0;             // laidRows and the estimated rest
+    };
+
+    const TextBuffer* m_text;
+    LineWidths* m_widths;
+    int m_width;
+
+    std::vector<Chunk> m_chunks;
+    std::vector<int> m_lineTree;        // 1 based, lines per chunk
+    std::vector<int> m_rowTree;         // 1 based, rows per chunk
+    int m_lineCount;
+    int m_hintChunk;                    // the chunk last found, -1 none
+    int m_hintStart;
+
+    int  layoutLine(int line) const;
+    void rebuildTrees();
+    void treeAdd(std::vector<int>& tree, int chunk, int delta);
+    int  treePrefix(const std::vector<int>& tree, int chunk) const;
+    int  treeFind(const std::vector<int>& tree, int value, int& prefix) const;
+    int  findChunk(int line, int& start);
+    void freshen(Chunk& chunk);
+    static int chunkRows(const Chunk& chunk);
+    void refresh(int chunk);
+    void layoutChunk(int chunk, int start);
+
+public:
+    void attach(const TextBuffer* text, LineWidths* widths);
+
+    // a new width lays every line out again, lazily
+    void setWidth(int width);
+    int  width() const { return m_width; }
+
+    void reset(int lineCount);
+    void lineChanged(int line);
+    void linesInserted(int line, int count);
+    void linesErased(int line, int count);
+
+    int rowCount(int line);
+
+    // the visual row of col inside its line, and where that row starts
+    int subRow(int line, int col) const;
+    int rowStart(int line, int subRow) const;
+
+    // Moves (line, subRow) by delta visual rows, stops at the document
+    // ends. Walks the lines, for short distances.
+    void advance(int& line, int& subRow, int delta);
+
+    // Visual rows from one position to another, negative when "to" is
+    // above. Stops counting at limit rows.
+    int distance(int fromLine, int fromSub, int toLine, int toSub, int limit);
+
+    // global positions, O(log n) and O(kChunkLines) for the chunk they
+    // land in; exact there, estimated for the chunks not laid out
+    int visualRow(int line);
+    int lineAt(int visualRow, int& subRow);
+    int totalRows();
+
+    WrapLayout();
+};
+
+#endif
@@ -5,8 +5,41 @@
 // J. Arrieta
 // (C) 2018 Nabla Zero Labs
 
+#ifndef __LEXER_UTILS__
+#define __LEXER_UTILS__
+
+#include <cstdint>
 #include <string>
 
+// State carried from the end of one line to the start of the next one, so
+// block comments, continued strings and raw strings can span lines.
+// The low byte is the mode, the upper bits hold a hash of the raw string
+// delimiter (raw strings only).
+enum class LexMode : std::uint8_t {
+  Normal,
+  BlockComment,
+  String,
+  RawString,
+};
+
+using LexState = std::uint32_t;
+
+inline LexState make_lex_state(LexMode mode, std::uint32_t delim_hash = 0) noexcept {
+  return static_cast<LexState>(mode) | (delim_hash << 8);
+}
+
+inline LexMode lex_mode(LexState state) noexcept {
+  return static_cast<LexMode>(state & 0xff);
+}
+
+inline std::uint32_t lex_delim_hash(const char* beg, std::size_t len) noexcept {
+  std::uint32_t hash = 2166136261u;
+  for (std::size_t i = 0; i < len; i++) {
+    hash = (hash ^ static_cast<unsigned char>(beg[i])) * 16777619u;
+  }
+  return hash & 0xffffff;
+}
+
 class Token {
  public:
   enum class Kind {
@@ -38,6 +71,7 @@ class Token {
     Unexpected,
     Space,
     NewLine,
+    String,
   };
 
   Token(Kind kind) noexcept : m_kind{kind} {}
@@ -76,23 +110,32 @@ class Token {
 
 class Lexer {
  public:
-  Lexer(const char* beg) noexcept : m_beg{beg} {}
+  Lexer(const char* beg, LexState state = 0) noexcept
+      : m_beg{beg}, m_state{state} {}
 
   Token next() noexcept;
 
+  // State at the current position, after End this is the line exit state.
+  LexState state() const noexcept { return m_state; }
+
  private:
   Token identifier() noexcept;
   Token number() noexcept;
   Token slash_or_comment() noexcept;
   Token atom(Token::Kind) noexcept;
+  Token block_comment(const char* start) noexcept;
+  Token string(const char* start, char quote) noexcept;
+  Token raw_string(const char* start) noexcept;
+  Token raw_string_body(const char* start, std::uint32_t delim_hash) noexcept;
 
   char peek() const noexcept { return *m_beg; }
   char get() noexcept { return *m_beg++; }
 
   const char* m_beg = nullptr;
+  LexState    m_state = 0;
 };
 
-bool is_space(char c) noexcept {
+inline bool is_space(char c) noexcept {
   switch (c) {
     case ' ':
     case '\t':
@@ -104,7 +147,7 @@ bool is_space(char c) noexcept {
   }
 }
 
-bool is_digit(char c) noexcept {
+inline bool is_digit(char c) noexcept {
   switch (c) {
     case '0':
     case '1':
@@ -122,7 +165,7 @@ bool is_digit(char c) noexcept {
   }
 }
 
-bool is_identifier_char(char c) noexcept {
+inline bool is_identifier_char(char c) noexcept {
   switch (c) {
     case 'a':
     case 'b':
@@ -193,11 +236,24 @@ bool is_identifier_char(char c) noexcept {
   }
 }
 
-Token Lexer::atom(Token::Kind kind) noexcept { return Token(kind, m_beg++, 1); }
+inline Token Lexer::atom(Token::Kind kind) noexcept { return Token(kind, m_beg++, 1); }
 
-Token Lexer::next() noexcept {
+inline Token Lexer::next() noexcept {
   // while (is_space(peek())) get();
 
+  if (peek() != '\0') {
+    switch (lex_mode(m_state)) {
+      case LexMode::BlockComment:
+        return block_comment(m_beg);
+      case LexMode::String:
+        return string(m_beg, '"');
+      case LexMode::RawString:
+        return raw_string_body(m_beg, m_state >> 8);
+      default:
+        break;
+    }
+  }
+
   switch (peek()) {
     case '\0':
       return Token(Token::Kind::End, m_beg, 1);
@@ -308,32 +364,44 @@ Token Lexer::next() noexcept {
     case ';':
       return atom(Token::Kind::Semicolon);
     case '\'':
-      return atom(Token::Kind::SingleQuote);
+      return string(m_beg, '\'');
     case '"':
-      return atom(Token::Kind::DoubleQuote);
+      return string(m_beg, '"');
     case '|':
       return atom(Token::Kind::Pipe);
   }
 }
 
-Token Lexer::identifier() noexcept {
+inline Token Lexer::identifier() noexcept {
   const char* start = m_beg;
   get();
   while (is_identifier_char(peek())) get();
+
+  // R"delim( ... )delim" with the u8, u, U and L prefixes
+  if (peek() == '"' && m_beg[-1] == 'R') {
+    std::size_t len = std::distance(start, m_beg);
+    if (len == 1 || (len == 2 && (*start == 'u' || *start == 'U' || *start == 'L')) ||
+        (len == 3 && start[0] == 'u' && start[1] == '8')) {
+      return raw_string(start);
+    }
+  }
   return Token(Token::Kind::Identifier, start, m_beg);
 }
 
-Token Lexer::number() noexcept {
+inline Token Lexer::number() noexcept {
   const char* start = m_beg;
   get();
   while (is_digit(peek())) get();
   return Token(Token::Kind::Number, start, m_beg);
 }
 
-Token Lexer::slash_or_comment() noexcept {
+inline Token Lexer::slash_or_comment() noexcept {
   const char* start      = m_beg;
   get();
-  if (peek() == '/') {
+  if (peek() == '*') {
+    get();
+    return block_comment(start);
+  } else if (peek() == '/') {
     get();
     while (peek() != '\0') {
       if (get() == '\n') {
@@ -347,17 +415,83 @@ Token Lexer::slash_or_comment() noexcept {
   }
 }
 
+// Scans up to "*/" or the end of the line, start is where the token began.
+inline Token Lexer::block_comment(const char* start) noexcept {
+  while (peek() != '\0') {
+    if (get() == '*' && peek() == '/') {
+      get();
+      m_state = make_lex_state(LexMode::Normal);
+      return Token(Token::Kind::Comment, start, m_beg);
+    }
+  }
+  m_state = make_lex_state(LexMode::BlockComment);
+  return Token(Token::Kind::Comment, start, m_beg);
+}
+
+// Quoted literal. A double quoted string ending the line with a backslash
+// continues on the next line, anything else unterminated stops at the end.
+inline Token Lexer::string(const char* start, char quote) noexcept {
+  if (lex_mode(m_state) != LexMode::String) get();
+
+  m_state = make_lex_state(LexMode::Normal);
+  while (peek() != '\0') {
+    char c = get();
+    if (c == '\\') {
+      if (peek() == '\0') {
+        if (quote == '"') m_state = make_lex_state(LexMode::String);
+        break;
+      }
+      get();
+    } else if (c == quote) {
+      break;
+    }
+  }
+  return Token(Token::Kind::String, start, m_beg);
+}
+
+inline Token Lexer::raw_string(const char* start) noexcept {
+  get();  // '"'
+  const char* delim = m_beg;
+  while (peek() != '\0' && peek() != '(' && std::distance(delim, m_beg) < 16) get();
+  if (peek() != '(') {
+    // not a valid raw string, leave it to the normal string rules
+    m_beg = delim - 1;
+    return Token(Token::Kind::Identifier, start, m_beg);
+  }
+  std::uint32_t hash = lex_delim_hash(delim, std::distance(delim, m_beg));
+  get();  // '('
+  return raw_string_body(start, hash);
+}
+
+// Looks for )delim" where delim hashes to delim_hash.
+inline Token Lexer::raw_string_body(const char* start, std::uint32_t delim_hash) noexcept {
+  while (peek() != '\0') {
+    if (get() != ')') continue;
+
+    const char* delim = m_beg;
+    const char* end   = m_beg;
+    while (*end != '\0' && *end != '"' && std::distance(delim, end) < 16) end++;
+    if (*end == '"' && lex_delim_hash(delim, std::distance(delim, end)) == delim_hash) {
+      m_beg   = end + 1;
+      m_state = make_lex_state(LexMode::Normal);
+      return Token(Token::Kind::String, start, m_beg);
+    }
+  }
+  m_state = make_lex_state(LexMode::RawString, delim_hash);
+  return Token(Token::Kind::String, start, m_beg);
+}
+
 #include <iomanip>
 #include <iostream>
 
-std::ostream& operator<<(std::ostream& os, const Token::Kind& kind) {
+inline std::ostream& operator<<(std::ostream& os, const Token::Kind& kind) {
   static const char* const names[]{
       "Number",      "Identifier",  "LeftParen",  "RightParen", "LeftSquare",
       "RightSquare", "LeftCurly",   "RightCurly", "LessThan",   "GreaterThan",
       "Equal",       "Plus",        "Minus",      "Asterisk",   "Slash",
       "Hash",        "Dot",         "Comma",      "Colon",      "Semicolon",
       "SingleQuote", "DoubleQuote", "Comment",    "Pipe",       "End",
-      "Unexpected",  "Space",       "NewLine"
+      "Unexpected",  "Space",       "NewLine",    "String"
   };
   return os << names[static_cast<int>(kind)];
 }
@@ -386,3 +520,5 @@ std::ostream& operator<<(std::ostream& os, const Token::Kind& kind) {
 //               << "|\n";
 //   }
 // }
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __LINE_DIFF__
+#define __LINE_DIFF__
+// Line diff of two documents (Myers, O((n + m) d)), for reloading a file
+// that changed on disk without replacing the lines that did not change.
+//
+// The common head and tail are cut off first, so a change in one place of
+// a large file only diffs that place. The lines are hashed once; lines are
+// compared by hash, then by bytes. Past maxEdits inserted plus erased
+// lines the search stops and the rest becomes one hunk, the memory of the
+// search is O(maxEdits^2).
+
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+
+// old lines [oldRow, oldRow + oldCount) become new lines [newRow, newRow + newCount)
+struct DiffHunk
+{
+    size_t oldRow;
+    size_t oldCount;
+    size_t newRow;
+    size_t newCount;
+};
+
+// Lines : size() and operator[] giving something a std::string_view is made from
+template <typename OldLines, typename NewLines>
+std::vector<DiffHunk> diff_lines(const OldLines& before, const NewLines& after, int maxEdits = 1024)
+{
+    size_t n = before.size();
+    size_t m = after.size();
+    size_t head = 0;
+    while(head < n && head < m && std::string_view(before[head]) == std::string_view(after[head]))
+        head++;
+    size_t tail = 0;
+    while(tail < n - head && tail < m - head &&
+          std::string_view(before[n - 1 - tail]) == std::string_view(after[m - 1 - tail]))
+        tail++;
+
+    int oldCount = n - head - tail;
+    int newCount = m - head - tail;
+    if(oldCount == 0 && newCount == 0)
+        return {};
+    if(oldCount == 0 || newCount == 0)
+        return {{head, (size_t)oldCount, head, (size_t)newCount}};
+
+    std::hash<std::string_view> hasher;
+    std::vector<size_t> oldHashes(oldCount);
+    std::vector<size_t> newHashes(newCount);
+    for(int i = 0; i < oldCount; i++)
+        oldHashes[i] = hasher(std::string_view(before[head + i]));
+    for(int i = 0; i < newCount; i++)
+        newHashes[i] = hasher(std::string_view(after[head + i]));
+
+    auto isSame = [&](int x, int y) {
+        return oldHashes[x] == newHashes[y] &&
+               std::string_view(before[head + x]) == std::string_view(after[head + y]);
+    };
+
+    // v[k] : furthest x on diagonal k = x - y; trace[d] holds v[-d - 1 .. d + 1]
+    // as it was before step d
+    int maxD = std::min(oldCount + newCount, maxEdits);
+    int offset = maxD + 1;
+    std::vector<int> v(2 * maxD + 3, 0);
+    std::vector<std::vector<int>> trace;
+    int found = -1;
+    for(int d = 0; d <= maxD && found < 0; d++)
+    {
+        trace.emplace_back(v.begin() + offset - d - 1, v.begin() + offset + d + 2);
+        for(int k = -d; k <= d; k += 2)
+        {
+            int x = (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])) ?
+                    v[offset + k + 1] : v[offset + k - 1] + 1;
+            int y = x - k;
+            while(x < oldCount && y < newCount && isSame(x, y))
+            {
+                x++;
+                y++;
+            }
+            v[offset + k] = x;
+            if(x >= oldCount && y >= newCount)
+            {
+                found = d;
+                break;
+            }
+        }
+    }
+
+    if(found < 0)
+        return {{head, (size_t)oldCount, head, (size_t)newCount}};
+
+    // back from the end : each step is one erased (x) or inserted (y) line
+    struct Edit
+    {
+        int  x;
+        int  y;
+        bool isInsert;
+    };
+    std::vector<Edit> edits;
+    int x = oldCount;
+    int y = newCount;
+    for(int d = found; d > 0; d--)
+    {
+        const std::vector<int>& prev = trace[d];
+        auto at = [&](int k) { return prev[k + d + 1]; };
+        int k = x - y;
+        int prevK = (k == -d || (k != d && at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+        int prevX = at(prevK);
+        int prevY = prevX - prevK;
+        x = prevX;
+        y = prevY;
+        edits.push_back({x, y, prevK == k + 1});
+    }
+    std::reverse(edits.begin(), edits.end());
+
+    // edits that touch each other make one hunk
+    std::vector<DiffHunk> hunks;
+    for(const Edit& edit : edits)
+    {
+        if(!hunks.empty())
+        {
+            DiffHunk& last = hunks.back();
+            if(last.oldRow + last.oldCount == head + edit.x && last.newRow + last.newCount == head + edit.y)
+            {
+                (edit.isInsert ? last.newCount : last.oldCount)++;
+                continue;
+            }
+        }
+        hunks.push_back({head + edit.x, edit.isInsert ? 0u : 1u, head + edit.y, edit.isInsert ? 1u : 0u});
+    }
+    return hunks;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef __REPLACE_UTILS__
+#define __REPLACE_UTILS__
+// Single pass find/replace over a list of lines.
+//
+// The engine is built once per replace-all (pattern compiled, replacement
+// template split into parts) and then streamed over the document, producing
+// a new line list. Lines without a match are copied as-is so the caller can
+// swap the result in as a single edit.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <regex>
+#include <functional>
+
+class ReplaceEngine
+{
+private:
+    struct Part
+    {
+        int         group;   // -1 : literal text
+        std::string literal;
+    };
+
+    std::string       m_pattern;
+    bool              m_useRegex;
+    bool              m_valid;
+    std::string       m_error;
+    std::regex        m_regex;
+    std::vector<Part> m_parts;
+    std::string       m_replacement;
+
+    // "$1".."$99", "$&"/"$0" and "$$" are expanded, anything else is literal
+    void parseReplacement(const std::string& repl)
+    {
+        std::string literal;
+        for(size_t i = 0; i < repl.size(); i++)
+        {
+            char c = repl[i];
+            if(c != '$' || i + 1 >= repl.size())
+            {
+                literal.push_back(c);
+                continue;
+            }
+
+            char n = repl[i + 1];
+            int group = -1;
+            if(n == '$')
+            {
+                literal.push_back('$');
+                i++;
+                continue;
+            }
+            else if(n == '&')
+            {
+                group = 0;
+                i++;
+            }
+            else if(n >= '0' && n <= '9')
+            {
+                group = n - '0';
+                i++;
+                if(i + 1 < repl.size() && repl[i + 1] >= '0' && repl[i + 1] <= '9')
+                {
+                    group = group * 10 + (repl[i + 1] - '0');
+                    i++;
+                }
+            }
+            else
+            {
+                literal.push_back(c);
+                continue;
+            }
+
+            if(!literal.empty())
+            {
+                m_parts.push_back({-1, literal});
+                literal.clear();
+            }
+            m_parts.push_back({group, ""});
+        }
+
+        if(!literal.empty())
+            m_parts.push_back({-1, literal});
+    }
+
+    using Match = std::match_results<std::string_view::const_iterator>;
+
+    void expand(const Match& match, std::string& out) const
+    {
+        for(auto& part : m_parts)
+        {
+            if(part.group < 0)
+                out.append(part.literal);
+            else if(part.group < (int)match.size() && match[part.group].matched)
+                out.append(match[part.group].first, match[part.group].second);
+        }
+    }
+
+public:
+    ReplaceEngine(const std::string& pattern, const std::string& replacement, bool useRegex)
+        : m_pattern(pattern), m_useRegex(useRegex), m_valid(true), m_replacement(replacement)
+    {
+        if(pattern.empty())
+        {
+            m_valid = false;
+            m_error = "empty pattern";
+            return;
+        }
+
+        // without an operator the pattern matches itself : the literal
+        // search finds the same matches, far faster than std::regex
+        if(m_useRegex && pattern.find_first_of("^$\\.*+?()[]{}|") == std::string::npos)
+        {
+            parseReplacement(replacement);
+            m_replacement.clear();
+            for(auto& part : m_parts)
+            {
+                if(part.group < 0)
+                    m_replacement += part.literal;
+                else if(part.group == 0)
+                    m_replacement += pattern;
+            }
+            m_parts.clear();
+            m_useRegex = false;
+        }
+
+        if(m_useRegex)
+        {
+            try
+            {
+                m_regex = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+            }
+            catch(const std::regex_error& e)
+            {
+                m_valid = false;
+                m_error = e.what();
+                return;
+            }
+            parseReplacement(replacement);
+        }
+    }
+
+    bool isValid() const { return m_valid; }
+    const std::string& error() const { return m_error; }
+
+    // Appends the substituted line to out. Returns the number of matches,
+    // out is left untouched when there is none.
+    size_t replaceLine(std::string_view in, std::string& out) const
+    {
+        size_t count = 0;
+
+        if(!m_useRegex)
+        {
+            size_t hit = in.find(m_pattern);
+            if(hit == std::string::npos)
+                return 0;
+
+            size_t pos = 0;
+            while(hit != std::string::npos)
+            {
+                out.append(in, pos, hit - pos);
+                out.append(m_replacement);
+                pos = hit + m_pattern.size();
+                count++;
+                hit = in.find(m_pattern, pos);
+            }
+            out.append(in.substr(pos));
+            return count;
+        }
+
+        Match match;
+        auto searchFrom = in.cbegin();
+        auto flags = std::regex_constants::match_default;
+        while(std::regex_search(searchFrom, in.cend(), match, m_regex, flags))
+        {
+            out.append(searchFrom, match[0].first);
+            expand(match, out);
+            count++;
+
+            searchFrom = match[0].second;
+            if(match[0].length() == 0)
+            {
+                // step over the empty match so we don't loop forever
+                if(searchFrom == in.cend())
+                    break;
+                out.push_back(*searchFrom);
+                searchFrom++;
+            }
+            flags = flags | std::regex_constants::match_prev_avail;
+        }
+
+        if(count == 0)
+            return 0;
+
+        out.append(searchFrom, in.cend());
+        return count;
+    }
+
+    // Streams the whole document once. dst receives the new line list;
+    // both are a std::vector<std::string> or a TextBuffer. onProgress, if
+    // set, is called every kProgressLines lines with (done, total).
+    static constexpr size_t kProgressLines = 1 << 16;
+
+    template <typename Lines, typename Out>
+    size_t replaceAll(const Lines& src, Out& dst,
+                      const std::function<void(size_t, size_t)>& onProgress = nullptr) const
+    {
+        size_t total = 0;
+        dst.clear();
+        dst.reserve(src.size());
+
+        std::string buffer;
+        size_t done = 0;
+        for(const auto& line : src)
+        {
+            if(onProgress && ++done % kProgressLines == 0)
+                onProgress(done, src.size());
+            buffer.clear();
+            size_t n = replaceLine(line, buffer);
+            if(n == 0)
+            {
+                dst.push_back(line);
+            }
+            else
+            {
+                dst.push_back(buffer);
+                total += n;
+            }
+        }
+
+        return total;
+    }
+};
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef __UTF8_UTILS__
+#define __UTF8_UTILS__
+// UTF-8 helpers. The document is kept as UTF-8 bytes. A byte that does not
+// start a valid sequence counts as one character of its own, one column
+// wide. Terminal widths come from charWidth.hpp, a tab reaches the next
+// tab stop so its width depends on the column it starts at.
+//
+// ASCII runs are skipped 16 bytes at a time with SSE2 (part of x86-64), the
+// multi byte sequences are checked one by one. Text is mostly ASCII, so
+// that is where the time goes.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "charWidth.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// offset of the first non ASCII byte, len when there is none
+inline std::size_t utf8_ascii_prefix(const char* data, std::size_t len) noexcept {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for(; i + 64 <= len; i += 64) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(data + i);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                   _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+        if(_mm_movemask_epi8(any) != 0)
+            break;
+    }
+    for(; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for(; i < len; i++) {
+        if(static_cast<unsigned char>(data[i]) >= 0x80)
+            return i;
+    }
+    return len;
+}
+
+// length of the valid sequence at data, 0 when it is not one (overlong
+// forms, surrogates and code points past U+10FFFF are not)
+inline int utf8_char_length(const char* data, std::size_t left) noexcept {
+    unsigned char c = data[0];
+    if(c < 0x80)
+        return 1;
+    if(c < 0xC2)
+        return 0;
+
+    int n = c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+    if(n == 0 || left < static_cast<std::size_t>(n))
+        return 0;
+
+    unsigned char c1 = data[1];
+    if((c1 & 0xC0) != 0x80)
+        return 0;
+    if((c == 0xE0 && c1 < 0xA0) || (c == 0xED && c1 > 0x9F) ||
+       (c == 0xF0 && c1 < 0x90) || (c == 0xF4 && c1 > 0x8F))
+        return 0;
+
+    for(int k = 2; k < n; k++) {
+        if((static_cast<unsigned char>(data[k]) & 0xC0) != 0x80)
+            return 0;
+    }
+    return n;
+}
+
+// decodes the valid sequence at data into cp, returns its length or 0
+inline int utf8_decode(const char* data, std::size_t left, std::uint32_t* cp) noexcept {
+    int n = utf8_char_length(data, left);
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    switch(n) {
+    case 1: *cp = p[0]; break;
+    case 2: *cp = (p[0] & 0x1F) << 6 | (p[1] & 0x3F); break;
+    case 3: *cp = (p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F); break;
+    case 4: *cp = (p[0] & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F); break;
+    }
+    return n;
+}
+
+// terminal columns of the character at data, an invalid byte takes one
+inline int utf8_char_width(const char* data, std::size_t left) noexcept {
+    std::uint32_t cp;
+    return utf8_decode(data, left, &cp) > 0 ? char_width(cp) : 1;
+}
+
+// tab stops every kTabWidth columns, as the terminal puts them
+constexpr int kTabWidth = 8;
+
+// columns of a tab starting at col
+inline int utf8_tab_width(std::size_t col) noexcept {
+    return kTabWidth - static_cast<int>(col % kTabWidth);
+}
+
+// terminal columns of the character at data when it starts at col
+inline int utf8_column_width(const char* data, std::size_t left, std::size_t col) noexcept {
+    return data[0] == '\t' ? utf8_tab_width(col) : utf8_char_width(data, left);
+}
+
+// the ASCII run at data up to its first tab, one column per byte
+inline std::size_t utf8_plain_prefix(const char* data, std::size_t len) noexcept {
+    std::size_t run = utf8_ascii_prefix(data, len);
+    const void* tab = std::memchr(data, '\t', run);
+    return tab ? static_cast<const char*>(tab) - data : run;
+}
+
+// bytes of the character at data, an invalid byte is one of its own
+inline int utf8_step(const char* data, std::size_t left) noexcept {
+    int n = utf8_char_length(data, left);
+    return n > 0 ? n : 1;
+}
+
+inline bool utf8_validate(const char* data, std::size_t len, bool* is_ascii = nullptr) noexcept {
+    std::size_t i = utf8_ascii_prefix(data, len);
+    if(is_ascii)
+        *is_ascii = i == len;
+
+    while(i < len) {
+        int n = utf8_char_length(data + i, len - i);
+        if(n == 0)
+            return false;
+        i += n;
+        i += utf8_ascii_prefix(data + i, len - i);
+    }
+    return true;
+}
+
+// characters in [data, data + len)
+inline std::size_t utf8_length(const char* data, std::size_t len) noexcept {
+    std::size_t i    = utf8_ascii_prefix(data, len);
+    std::size_t cols = i;
+    while(i < len) {
+        i += utf8_step(data + i, len - i);
+        cols++;
+
+        std::size_t run = utf8_ascii_prefix(data + i, len - i);
+        i    += run;
+        cols += run;
+    }
+    return cols;
+}
+
+// terminal columns of [data, data + len), data being a line start
+inline std::size_t utf8_width(const char* data, std::size_t len) noexcept {
+    std::size_t i    = utf8_plain_prefix(data, len);
+    std::size_t cols = i;
+    while(i < len) {
+        cols += utf8_column_width(data + i, len - i, cols);
+        i    += utf8_step(data + i, len - i);
+
+        std::size_t run = utf8_plain_prefix(data + i, len - i);
+        i    += run;
+        cols += run;
+    }
+    return cols;
+}
+
+// UTF-16 code units of [data, data + len), an invalid byte takes one
+inline std::size_t utf8_utf16_length(const char* data, std::size_t len) noexcept {
+    std::size_t i     = utf8_ascii_prefix(data, len);
+    std::size_t units = i;
+    while(i < len) {
+        int n = utf8_step(data + i, len - i);
+        units += n == 4 ? 2 : 1;
+        i     += n;
+
+        std::size_t run = utf8_ascii_prefix(data + i, len - i);
+        i     += run;
+        units += run;
+    }
+    return units;
+}
+
+// bytes of the longest prefix that fits in columns, data being a line start
+inline std::size_t utf8_width_prefix(const char* data, std::size_t len, std::size_t columns) noexcept {
+    std::size_t i   = 0;
+    std::size_t col = 0;
+    while(i < len) {
+        int width = utf8_column_width(data + i, len - i, col);
+        if(col + width > columns)
+            break;
+        col += width;
+        i   += utf8_step(data + i, len - i);
+    }
+    return i;
+}
+
+// byte offset of character col, len past the end
+inline std::size_t utf8_offset(const char* data, std::size_t len, std::size_t col) noexcept {
+    std::size_t i = utf8_ascii_prefix(data, len);
+    if(col <= i)
+        return col;
+
+    col -= i;
+    while(i < len && col > 0) {
+        i += utf8_step(data + i, len - i);
+        col--;
+    }
+    return i;
+}
+
+// the bytes of one typed or pasted character : 1 for ASCII, else the lead
+// byte tells, 0 for a byte that cannot start a sequence
+inline int utf8_sequence_length(unsigned char lead) noexcept {
+    if(lead < 0x80)
+        return 1;
+    if(lead < 0xC2)
+        return 0;
+    return lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 0;
+}
+
+// invalid bytes become '?', the length and every offset stay the same
+inline void utf8_sanitize(std::string& text) noexcept {
+    std::size_t i = utf8_ascii_prefix(text.data(), text.size());
+    while(i < text.size()) {
+        int n = utf8_char_length(text.data() + i, text.size() - i);
+        if(n == 0) {
+            text[i] = '?';
+            n = 1;
+        }
+        i += n;
+        i += utf8_ascii_prefix(text.data() + i, text.size() - i);
+    }
+}
+
+// one ASCII char per terminal column, non ASCII ones become '?'
+inline std::string utf8_placeholder(const char* data, std::size_t len) {
+    std::string out;
+    out.reserve(len);
+    for(std::size_t i = 0; i < len; ) {
+        unsigned char c = data[i];
+        if(c < 0x80) {
+            out.push_back(c);
+            i++;
+            continue;
+        }
+        out.append(utf8_char_width(data + i, len - i), '?');
+        i += utf8_step(data + i, len - i);
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,607 @@
+#include "CompressedFile.h"
+#include <zlib.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+// zstd, the part of its stable ABI used here (zstd.h is not needed to build)
+struct ZSTD_inBuffer
+{
+    const void* src;
+    size_t size;
+    size_t pos;
+};
+
+struct ZSTD_outBuffer
+{
+    void*  dst;
+    size_t size;
+    size_t pos;
+};
+
+enum ZSTD_EndDirective
+{
+    ZSTD_e_continue = 0,
+    ZSTD_e_flush    = 1,
+    ZSTD_e_end      = 2,
+};
+
+struct ZstdApi
+{
+    void*    (*createDStream)();
+    size_t   (*freeDStream)(void*);
+    size_t   (*initDStream)(void*);
+    size_t   (*decompressStream)(void*, ZSTD_outBuffer*, ZSTD_inBuffer*);
+    void*    (*createCStream)();
+    size_t   (*freeCStream)(void*);
+    size_t   (*initCStream)(void*, int level);
+    size_t   (*compressStream2)(void*, ZSTD_outBuffer*, ZSTD_inBuffer*, ZSTD_EndDirective);
+    unsigned (*isError)(size_t);
+};
+
+// nullptr when libzstd.so.1 is not there
+static const ZstdApi* zstdApi()
+{
+    static ZstdApi api;
+    static bool isLoaded = [](){
+        void* library = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+        if(!library)
+            return false;
+
+        bool isComplete = true;
+        auto load = [&](auto& function, const char* name) {
+            function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(dlsym(library, name));
+            isComplete = isComplete && function;
+        };
+        load(api.createDStream,    "ZSTD_createDStream");
+        load(api.freeDStream,      "ZSTD_freeDStream");
+        load(api.initDStream,      "ZSTD_initDStream");
+        load(api.decompressStream, "ZSTD_decompressStream");
+        load(api.createCStream,    "ZSTD_createCStream");
+        load(api.freeCStream,      "ZSTD_freeCStream");
+        load(api.initCStream,      "ZSTD_initCStream");
+        load(api.compressStream2,  "ZSTD_compressStream2");
+        load(api.isError,          "ZSTD_isError");
+        return isComplete;
+    }();
+    return isLoaded ? &api : nullptr;
+}
+
+static constexpr size_t kInputBytes  = 256 << 10;
+static constexpr size_t kBufferBytes = 256 << 10;
+static constexpr int    kZstdLevel   = 3;
+
+// a zstd file is written as frames of this much text, each one is a
+// checkpoint when it is read again
+static constexpr size_t kZstdFrameBytes = 4 << 20;
+
+// One decompression stream over the file (fd) or over memory, from a
+// checkpoint on. decode() is one step of it.
+struct CompressedFile::Decoder
+{
+    Compression format;
+    int         fd;
+    const std::string* memory = nullptr;
+
+    z_stream zs;
+    bool     isZsOpen = false;
+    bool     isRaw    = false;      // no gzip header and trailer
+    void*    zstd     = nullptr;
+
+    std::vector<unsigned char> input;
+    size_t   inPos  = 0;
+    size_t   inEnd  = 0;
+    uint64_t inNext = 0;        // file offset of input[inEnd]
+    uint64_t out    = 0;        // text offset of the next byte
+    bool     isStarted = false;
+    bool     isEnd     = false;
+    int      error     = 0;
+
+    // after the last decode()
+    bool isBlockEnd    = false; // gzip : a deflate block ended, not the last
+    int  bits          = 0;     // of the byte before inOffset() not read yet
+    bool isStreamStart = false; // a gzip member or a zstd frame starts at inOffset()
+
+    Decoder(Compression format, int fd) : format(format), fd(fd), input(kInputBytes)
+    {
+        memset(&zs, 0, sizeof(zs));
+    }
+
+    ~Decoder()
+    {
+        if(isZsOpen)
+            inflateEnd(&zs);
+        if(zstd)
+            zstdApi()->freeDStream(zstd);
+    }
+
+    uint64_t inOffset() const { return inNext - (inEnd - inPos); }
+
+    // more input after what is left, false at the end of the file
+    bool fill()
+    {
+        memmove(input.data(), input.data() + inPos, inEnd - inPos);
+        inEnd -= inPos;
+        inPos  = 0;
+
+        ssize_t count;
+        if(memory)
+        {
+            count = std::min<uint64_t>(input.size() - inEnd, memory->size() - std::min<uint64_t>(inNext, memory->size()));
+            memcpy(input.data() + inEnd, memory->data() + inNext, count);
+        }
+        else
+        {
+            count = pread(fd, input.data() + inEnd, input.size() - inEnd, inNext);
+        }
+
+        if(count <= 0)
+            return false;
+        inEnd  += count;
+        inNext += count;
+        return true;
+    }
+
+    bool start(const Checkpoint& at)
+    {
+        inPos  = 0;
+        inEnd  = 0;
+        inNext = at.in;
+        out    = at.out;
+        isStarted = true;
+        isEnd     = false;
+        error     = 0;
+
+        if(format == Compression::Zstd)
+        {
+            if(!zstd)
+                zstd = zstdApi()->createDStream();
+            zstdApi()->initDStream(zstd);
+            return true;
+        }
+
+        if(isZsOpen)
+            inflateEnd(&zs);
+        memset(&zs, 0, sizeof(zs));
+        isZsOpen = true;
+        isRaw    = !at.isStart;
+        if(at.isStart)
+            return inflateInit2(&zs, 15 + 32) == Z_OK;     // gzip header
+
+        // raw deflate from a block boundary, the text before it as dictionary
+        inflateInit2(&zs, -15);
+        if(at.bits)
+        {
+            inNext = at.in - 1;
+            if(!fill())
+                return false;
+            inflatePrime(&zs, at.bits, input[inPos++] >> (8 - at.bits));
+        }
+        return inflateSetDictionary(&zs, at.window.data(), at.window.size()) == Z_OK;
+    }
+
+    // Decompresses some into buffer, returns how much (may be 0 before
+    // the end). Sets the flags of a checkpoint.
+    size_t decode(char* buffer, size_t capacity)
+    {
+        isBlockEnd    = false;
+        isStreamStart = false;
+        if(isEnd)
+            return 0;
+        if(inPos == inEnd && !fill())
+        {
+            isEnd = true;
+            return 0;
+        }
+
+        return format == Compression::Zstd ? decodeZstd(buffer, capacity) : decodeGzip(buffer, capacity);
+    }
+
+    size_t decodeZstd(char* buffer, size_t capacity)
+    {
+        ZSTD_inBuffer  in  = {input.data() + inPos, inEnd - inPos, 0};
+        ZSTD_outBuffer dst = {buffer, capacity, 0};
+        size_t result = zstdApi()->decompressStream(zstd, &dst, &in);
+        inPos += in.pos;
+        out   += dst.pos;
+        if(zstdApi()->isError(result))
+        {
+            error = EILSEQ;
+            isEnd = true;
+        }
+        else if(result == 0)
+        {
+            // the frame is done, the next one starts right after
+            isStreamStart = inPos < inEnd || fill();
+            isEnd = !isStreamStart;
+        }
+        return dst.pos;
+    }
+
+    size_t decodeGzip(char* buffer, size_t capacity)
+    {
+        zs.next_in   = input.data() + inPos;
+        zs.avail_in  = inEnd - inPos;
+        zs.next_out  = reinterpret_cast<unsigned char*>(buffer);
+        zs.avail_out = capacity;
+        int result = inflate(&zs, Z_BLOCK);
+        inPos = inEnd - zs.avail_in;
+        size_t count = capacity - zs.avail_out;
+        out += count;
+
+        if(result == Z_OK || result == Z_BUF_ERROR)
+        {
+            isBlockEnd = (zs.data_type & 128) && !(zs.data_type & 64);
+            bits = zs.data_type & 7;
+            return count;
+        }
+        if(result != Z_STREAM_END)
+        {
+            error = EILSEQ;
+            isEnd = true;
+            return count;
+        }
+
+        // raw deflate leaves the member trailer (crc, size), then another
+        // member may follow (cat a.gz b.gz)
+        size_t trailer = isRaw ? 8 : 0;
+        while(inEnd - inPos < trailer + 2 && fill())
+            ;
+        inPos += std::min(trailer, inEnd - inPos);
+        if(inEnd - inPos >= 2 && input[inPos] == 0x1f && input[inPos + 1] == 0x8b)
+        {
+            inflateReset2(&zs, 15 + 32);
+            isRaw = false;
+            isStreamStart = true;
+        }
+        else
+        {
+            isEnd = true;
+        }
+        return count;
+    }
+};
+
+CompressedFile::CompressedFile()
+{
+    m_fd     = -1;
+    m_format = Compression::None;
+    m_span   = kFirstSpan;
+    m_size       = 0;
+    m_isComplete = false;
+    m_isRunning  = false;
+}
+
+CompressedFile::~CompressedFile()
+{
+    close();
+}
+
+Compression CompressedFile::detect(const char* head, size_t size)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(head);
+    if(size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+        return Compression::Gzip;
+    if(size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd)
+        return Compression::Zstd;
+    return Compression::None;
+}
+
+Compression CompressedFile::detect(const std::string& fileName)
+{
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return Compression::None;
+
+    char head[4];
+    ssize_t count = pread(fd, head, sizeof(head), 0);
+    ::close(fd);
+    return detect(head, count > 0 ? count : 0);
+}
+
+int CompressedFile::decompress(Compression format, std::string& content, uint64_t limit)
+{
+    if(format == Compression::Zstd && !zstdApi())
+        return ENOSYS;
+
+    Decoder decoder(format, -1);
+    decoder.memory = &content;
+    if(!decoder.start({0, 0, 0, true, {}}))
+        return EILSEQ;
+
+    std::string text;
+    while(!decoder.isEnd)
+    {
+        size_t used = text.size();
+        text.resize(used + kBufferBytes);
+        text.resize(used + decoder.decode(&text[used], kBufferBytes));
+        if(text.size() > limit)
+            return EFBIG;
+    }
+    if(decoder.error)
+        return decoder.error;
+
+    content.swap(text);
+    return 0;
+}
+
+CompressedFile::Source CompressedFile::compressing(Compression format, Source source)
+{
+    struct Encoder
+    {
+        Compression format;
+        Source   source;
+        z_stream zs;
+        void*    zstd = nullptr;
+        std::vector<char> input;
+        size_t   inPos = 0;
+        size_t   inEnd = 0;
+        size_t   frameBytes  = 0;
+        bool     isSourceEnd = false;
+        bool     isDone      = false;
+
+        ~Encoder()
+        {
+            if(format == Compression::Gzip)
+                deflateEnd(&zs);
+            else if(zstd)
+                zstdApi()->freeCStream(zstd);
+        }
+    };
+
+    auto encoder = std::make_shared<Encoder>();
+    encoder->format = format;
+    encoder->source = std::move(source);
+    encoder->input.resize(kInputBytes);
+    memset(&encoder->zs, 0, sizeof(encoder->zs));
+    if(format == Compression::Gzip)
+    {
+        deflateInit2(&encoder->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+    else if(format == Compression::Zstd && zstdApi())
+    {
+        encoder->zstd = zstdApi()->createCStream();
+        zstdApi()->initCStream(encoder->zstd, kZstdLevel);
+    }
+    else
+    {
+        return encoder->source;
+    }
+
+    return [encoder](char* buffer, size_t capacity) {
+        Encoder& e = *encoder;
+        size_t filled = 0;
+        while(filled < capacity && !e.isDone)
+        {
+            if(e.inPos == e.inEnd && !e.isSourceEnd)
+            {
+                e.inPos = 0;
+                e.inEnd = e.source(e.input.data(), e.input.size());
+                e.isSourceEnd = e.inEnd == 0;
+            }
+
+            if(e.format == Compression::Gzip)
+            {
+                e.zs.next_in   = reinterpret_cast<unsigned char*>(e.input.data() + e.inPos);
+                e.zs.avail_in  = e.inEnd - e.inPos;
+                e.zs.next_out  = reinterpret_cast<unsigned char*>(buffer + filled);
+                e.zs.avail_out = capacity - filled;
+                int result = deflate(&e.zs, e.isSourceEnd ? Z_FINISH : Z_NO_FLUSH);
+                e.inPos = e.inEnd - e.zs.avail_in;
+                filled  = capacity - e.zs.avail_out;
+                e.isDone = result == Z_STREAM_END || result == Z_STREAM_ERROR;
+            }
+            else
+            {
+                // fed up to the end of the frame, which is then flushed
+                size_t available = e.inEnd - e.inPos;
+                bool isFrameEnd = e.isSourceEnd || e.frameBytes + available >= kZstdFrameBytes;
+                size_t feed = std::min(available, kZstdFrameBytes - e.frameBytes);
+                ZSTD_inBuffer  in  = {e.input.data() + e.inPos, feed, 0};
+                ZSTD_outBuffer dst = {buffer, capacity, filled};
+                size_t result = zstdApi()->compressStream2(e.zstd, &dst, &in, isFrameEnd ? ZSTD_e_end : ZSTD_e_continue);
+                e.inPos      += in.pos;
+                e.frameBytes += in.pos;
+                filled        = dst.pos;
+                if(isFrameEnd && result == 0)
+                {
+                    e.isDone     = e.isSourceEnd;
+                    e.frameBytes = 0;
+                }
+                e.isDone = e.isDone || zstdApi()->isError(result);
+            }
+        }
+        return filled;
+    };
+}
+
+bool CompressedFile::open(const std::string& fileName, std::string* error)
+{
+    close();
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        *error = fileName + ": " + strerror(errno);
+        return false;
+    }
+
+    char head[4];
+    ssize_t count = pread(fd, head, sizeof(head), 0);
+    Compression format = detect(head, count > 0 ? count : 0);
+    if(format == Compression::None || (format == Compression::Zstd && !zstdApi()))
+    {
+        *error = fileName + (format == Compression::None ? ": not compressed" : ": zstd needs libzstd.so.1");
+        ::close(fd);
+        return false;
+    }
+
+    m_fileName = fileName;
+    m_fd       = fd;
+    m_format   = format;
+    m_checkpoints.push_back({0, 0, 0, true, {}});
+    m_span       = kFirstSpan;
+    m_size       = 0;
+    m_isComplete = false;
+    m_isRunning  = true;
+    m_reader = std::make_unique<Decoder>(format, fd);
+    m_thread = std::thread([this](){ indexLoop(); });
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_grown.wait(lock, [this](){ return m_isComplete || m_size >= kFirstSpan; });
+    return true;
+}
+
+void CompressedFile::close()
+{
+    m_isRunning = false;
+    if(m_thread.joinable())
+        m_thread.join();
+    m_reader.reset();
+    if(m_fd >= 0)
+        ::close(m_fd);
+
+    m_fd     = -1;
+    m_format = Compression::None;
+    m_checkpoints.clear();
+    m_checkpoints.shrink_to_fit();
+    m_error.clear();
+    m_size       = 0;
+    m_isComplete = false;
+}
+
+std::string CompressedFile::error()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+void CompressedFile::addCheckpoint(Checkpoint&& checkpoint)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_checkpoints.push_back(std::move(checkpoint));
+    if(m_checkpoints.size() <= kMaxCheckpoints)
+        return;
+
+    // every other one is kept, they are then 2 * m_span apart
+    for(size_t i = 0; 2 * i < m_checkpoints.size(); i++)
+        m_checkpoints[i] = std::move(m_checkpoints[2 * i]);
+    m_checkpoints.resize((m_checkpoints.size() + 1) / 2);
+    m_span *= 2;
+}
+
+// the whole file once : checkpoints, and the size as it goes
+void CompressedFile::indexLoop()
+{
+    Decoder decoder(m_format, m_fd);
+    decoder.start(m_checkpoints.front());
+
+    // the last kWindowBytes of text, a ring
+    std::vector<unsigned char> history(kWindowBytes);
+    uint64_t last = 0;
+    std::vector<char> buffer(kBufferBytes);
+    while(m_isRunning && !decoder.isEnd)
+    {
+        size_t count = decoder.decode(buffer.data(), buffer.size());
+        const char* text = buffer.data();
+        size_t tailBytes = std::min(count, kWindowBytes);
+        uint64_t tailStart = decoder.out - tailBytes;
+        for(size_t done = 0; done < tailBytes; )
+        {
+            size_t at   = (tailStart + done) % kWindowBytes;
+            size_t part = std::min(tailBytes - done, kWindowBytes - at);
+            memcpy(history.data() + at, text + count - tailBytes + done, part);
+            done += part;
+        }
+
+        uint64_t span;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            span = m_span;
+        }
+        if(decoder.out - last >= span && (decoder.isStreamStart || decoder.isBlockEnd))
+        {
+            Checkpoint checkpoint = {decoder.inOffset(), decoder.out, 0, decoder.isStreamStart, {}};
+            if(!decoder.isStreamStart)
+            {
+                // the window in text order
+                size_t bytes = std::min<uint64_t>(decoder.out, kWindowBytes);
+                size_t at    = decoder.out % kWindowBytes;
+                checkpoint.bits = decoder.bits;
+                checkpoint.window.resize(bytes);
+                if(bytes < kWindowBytes)
+                {
+                    memcpy(checkpoint.window.data(), history.data(), bytes);
+                }
+                else
+                {
+                    memcpy(checkpoint.window.data(), history.data() + at, kWindowBytes - at);
+                    memcpy(checkpoint.window.data() + kWindowBytes - at, history.data(), at);
+                }
+            }
+            addCheckpoint(std::move(checkpoint));
+            last = decoder.out;
+        }
+
+        // up to the last full line
+        const char* newline = count ? static_cast<const char*>(memrchr(text, '\n', count)) : nullptr;
+        if(newline || decoder.isEnd)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_size = decoder.isEnd ? decoder.out : decoder.out - count + (newline - text) + 1;
+        }
+        m_grown.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_size = decoder.out;
+        m_isComplete = true;
+        if(decoder.error)
+            m_error = m_fileName + ": corrupt data after " + std::to_string(decoder.out) + " bytes";
+    }
+    m_grown.notify_all();
+}
+
+size_t CompressedFile::read(uint64_t offset, char* buffer, size_t count)
+{
+    uint64_t size = m_size;
+    if(offset >= size)
+        return 0;
+    count = std::min<uint64_t>(count, size - offset);
+
+    // on from the last read, unless a checkpoint is nearer
+    Decoder& reader = *m_reader;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto next = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), offset,
+            [](uint64_t value, const Checkpoint& checkpoint){ return value < checkpoint.out; });
+        const Checkpoint& nearest = *(next - 1);
+        if(!reader.isStarted || reader.error || offset < reader.out || nearest.out > reader.out)
+        {
+            if(!reader.start(nearest))
+                return 0;
+        }
+    }
+
+    char skip[64 << 10];
+    while(reader.out < offset && !reader.isEnd)
+        reader.decode(skip, std::min<uint64_t>(sizeof(skip), offset - reader.out));
+
+    size_t done = 0;
+    while(done < count && !reader.isEnd && reader.out == offset + done)
+        done += reader.decode(buffer + done, count - done);
+    return done;
+}
+
+size_t CompressedFile::memoryUsage()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t bytes = m_checkpoints.capacity() * sizeof(Checkpoint);
+    for(const Checkpoint& checkpoint : m_checkpoints)
+        bytes += checkpoint.window.capacity();
+    return bytes;
+}
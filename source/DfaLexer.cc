@@ -0,0 +1,685 @@
+#include "DfaLexer.h"
+#include <bitset>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#define DFA_CACHE_MAGIC   0x4644434b  // "KCDF"
+#define DFA_CACHE_VERSION 1
+#define DFA_MAX_STATES    65535
+
+namespace
+{
+
+enum NfaType
+{
+    NfaChar,    // consumes one byte of cls, then goes to out1
+    NfaSplit,   // epsilon to out1 and out2 (-1 : unused)
+    NfaAccept,
+};
+
+struct NfaState
+{
+    int type;
+    std::bitset<256> cls;
+    int out1;
+    int out2;
+    int rule;
+};
+
+struct Frag
+{
+    int start;
+    int end;    // always an epsilon state with out1 free
+};
+
+// Thompson construction of one pattern into a shared state list
+class RegexParser
+{
+private:
+    std::vector<NfaState>& m_states;
+    const std::string& m_pattern;
+    size_t m_pos;
+    std::string m_error;
+
+    int addState(int type)
+    {
+        NfaState st;
+        st.type = type;
+        st.out1 = -1;
+        st.out2 = -1;
+        st.rule = -1;
+        m_states.push_back(st);
+        return m_states.size() - 1;
+    }
+
+    Frag empty()
+    {
+        int e = addState(NfaSplit);
+        return {e, e};
+    }
+
+    Frag single(const std::bitset<256>& cls)
+    {
+        int s = addState(NfaChar);
+        int e = addState(NfaSplit);
+        m_states[s].cls  = cls;
+        m_states[s].out1 = e;
+        return {s, e};
+    }
+
+    Frag concat(Frag a, Frag b)
+    {
+        m_states[a.end].out1 = b.start;
+        return {a.start, b.end};
+    }
+
+    Frag alternate(Frag a, Frag b)
+    {
+        int s = addState(NfaSplit);
+        int e = addState(NfaSplit);
+        m_states[s].out1 = a.start;
+        m_states[s].out2 = b.start;
+        m_states[a.end].out1 = e;
+        m_states[b.end].out1 = e;
+        return {s, e};
+    }
+
+    Frag repeat(Frag a, char op)
+    {
+        int s = addState(NfaSplit);
+        int e = addState(NfaSplit);
+        m_states[s].out1 = a.start;
+        m_states[s].out2 = e;
+        if(op == '?')
+        {
+            m_states[a.end].out1 = e;
+            return {s, e};
+        }
+
+        m_states[a.end].out1 = s;
+        if(op == '*')
+            return {s, e};
+
+        return {a.start, e};    // '+'
+    }
+
+    bool atEnd() const { return m_pos >= m_pattern.size(); }
+    char peek() const { return m_pattern[m_pos]; }
+
+    bool fail(const std::string& error)
+    {
+        if(m_error.empty())
+            m_error = error + " at " + std::to_string(m_pos) + " in " + m_pattern;
+        return false;
+    }
+
+    static unsigned char escapeChar(char c)
+    {
+        switch (c)
+        {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        default:  return c;
+        }
+    }
+
+    static void classEscape(char c, std::bitset<256>& cls)
+    {
+        std::bitset<256> set;
+        switch (c)
+        {
+        case 'd':
+        case 'D':
+            for(int b = '0'; b <= '9'; b++) set.set(b);
+            break;
+
+        case 'w':
+        case 'W':
+            for(int b = 0; b < 256; b++)
+                if(isalnum(b) || b == '_') set.set(b);
+            break;
+
+        case 's':
+        case 'S':
+            for(char b : {' ', '\t', '\r', '\n', '\f', '\v'}) set.set((unsigned char)b);
+            break;
+
+        default:
+            set.set(escapeChar(c));
+            break;
+        }
+
+        if(c == 'D' || c == 'W' || c == 'S')
+            set.flip();
+
+        cls |= set;
+    }
+
+    bool parseClass(std::bitset<256>& cls)
+    {
+        bool negate = false;
+        if(!atEnd() && peek() == '^')
+        {
+            negate = true;
+            m_pos++;
+        }
+
+        bool first = true;
+        while(!atEnd() && (peek() != ']' || first))
+        {
+            first = false;
+            unsigned char lo = m_pattern[m_pos++];
+            if(lo == '\\')
+            {
+                if(atEnd())
+                    return fail("dangling escape");
+
+                char e = m_pattern[m_pos++];
+                if(strchr("dDwWsS", e))
+                {
+                    classEscape(e, cls);
+                    continue;
+                }
+                lo = escapeChar(e);
+            }
+
+            unsigned char hi = lo;
+            if(m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']')
+            {
+                m_pos++;
+                hi = m_pattern[m_pos++];
+                if(hi == '\\' && !atEnd())
+                    hi = escapeChar(m_pattern[m_pos++]);
+            }
+
+            for(int b = lo; b <= hi; b++)
+                cls.set(b);
+        }
+
+        if(atEnd())
+            return fail("missing ]");
+
+        m_pos++;
+        if(negate)
+            cls.flip();
+
+        return true;
+    }
+
+    bool parseAtom(Frag& out)
+    {
+        char c = m_pattern[m_pos++];
+        std::bitset<256> cls;
+        switch (c)
+        {
+        case '(':
+            if(m_pattern.compare(m_pos, 2, "?:") == 0)
+                m_pos += 2;
+            if(!parseAlternate(out))
+                return false;
+            if(atEnd() || peek() != ')')
+                return fail("missing )");
+            m_pos++;
+            return true;
+
+        case '[':
+            if(!parseClass(cls))
+                return false;
+            break;
+
+        case '.':
+            cls.set();
+            cls.reset('\n');
+            break;
+
+        case '\\':
+            if(atEnd())
+                return fail("dangling escape");
+            classEscape(m_pattern[m_pos++], cls);
+            break;
+
+        case '*':
+        case '+':
+        case '?':
+            return fail("nothing to repeat");
+
+        default:
+            cls.set((unsigned char)c);
+            break;
+        }
+
+        out = single(cls);
+        return true;
+    }
+
+    bool parseConcat(Frag& out)
+    {
+        out = empty();
+        while(!atEnd() && peek() != '|' && peek() != ')')
+        {
+            Frag atom;
+            if(!parseAtom(atom))
+                return false;
+
+            while(!atEnd() && (peek() == '*' || peek() == '+' || peek() == '?'))
+                atom = repeat(atom, m_pattern[m_pos++]);
+
+            out = concat(out, atom);
+        }
+        return true;
+    }
+
+    bool parseAlternate(Frag& out)
+    {
+        if(!parseConcat(out))
+            return false;
+
+        while(!atEnd() && peek() == '|')
+        {
+            m_pos++;
+            Frag right;
+            if(!parseConcat(right))
+                return false;
+            out = alternate(out, right);
+        }
+        return true;
+    }
+
+public:
+    RegexParser(std::vector<NfaState>& states, const std::string& pattern)
+        : m_states(states), m_pattern(pattern), m_pos(0)
+    {
+    }
+
+    const std::string& error() const { return m_error; }
+
+    // returns the start state, -1 on error
+    int build(int rule)
+    {
+        Frag frag;
+        if(!parseAlternate(frag))
+            return -1;
+
+        if(!atEnd())
+        {
+            fail("unbalanced )");
+            return -1;
+        }
+
+        int accept = addState(NfaAccept);
+        m_states[accept].rule = rule;
+        m_states[frag.end].out1 = accept;
+        return frag.start;
+    }
+};
+
+void closure(const std::vector<NfaState>& states, std::vector<int>& set)
+{
+    std::vector<int>  stack(set);
+    std::vector<bool> seen(states.size(), false);
+    for(int s : set)
+        seen[s] = true;
+
+    while(!stack.empty())
+    {
+        int s = stack.back();
+        stack.pop_back();
+        if(states[s].type != NfaSplit)
+            continue;
+
+        for(int next : {states[s].out1, states[s].out2})
+        {
+            if(next >= 0 && !seen[next])
+            {
+                seen[next] = true;
+                set.push_back(next);
+                stack.push_back(next);
+            }
+        }
+    }
+
+    std::sort(set.begin(), set.end());
+}
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+struct DfaCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint32_t stateCount;
+    uint32_t ruleCount;
+};
+
+}
+
+DfaLexer::DfaLexer()
+{
+    m_stateCount = 0;
+}
+
+// the table only depends on the patterns, colors come from the rules
+// given to load()
+uint64_t DfaLexer::hashRules(const std::vector<TokenRule>& rules)
+{
+    uint64_t hash = 14695981039346656037ull;
+    int version = DFA_CACHE_VERSION;
+    hash = fnv1a(hash, &version, sizeof(version));
+    for(auto& rule : rules)
+    {
+        hash = fnv1a(hash, rule.pattern.c_str(), rule.pattern.size() + 1);
+    }
+    return hash;
+}
+
+bool DfaLexer::compile(const std::vector<TokenRule>& rules)
+{
+    m_stateCount = 0;
+    m_error.clear();
+
+    if(rules.empty())
+    {
+        m_error = "no rules";
+        return false;
+    }
+
+    // one NFA for all the rules, joined by a split chain
+    std::vector<NfaState> nfa;
+    std::vector<int> starts;
+    for(int i = 0; i < (int)rules.size(); i++)
+    {
+        RegexParser parser(nfa, rules[i].pattern);
+        int start = parser.build(i);
+        if(start < 0)
+        {
+            m_error = rules[i].name + ": " + parser.error();
+            return false;
+        }
+        starts.push_back(start);
+    }
+
+    // byte classes, every byte of a class moves the NFA the same way
+    std::vector<int> classOf(256, 0);
+    int classCount = 1;
+    for(auto& st : nfa)
+    {
+        if(st.type != NfaChar)
+            continue;
+
+        std::map<std::pair<int, bool>, int> remap;
+        for(int b = 0; b < 256; b++)
+        {
+            auto key = std::make_pair(classOf[b], (bool)st.cls[b]);
+            auto it  = remap.find(key);
+            if(it == remap.end())
+                it = remap.insert({key, (int)remap.size()}).first;
+            classOf[b] = it->second;
+        }
+        classCount = remap.size();
+    }
+
+    std::vector<int> classByte(classCount, 0);
+    for(int b = 255; b >= 0; b--)
+        classByte[classOf[b]] = b;
+
+    // subset construction
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int>> sets;
+
+    sets.push_back({});                 // dead
+    ids[sets[0]] = kDeadState;
+    std::vector<int> startSet(starts);
+    closure(nfa, startSet);
+    sets.push_back(startSet);
+    ids[startSet] = kStartState;
+
+    std::vector<uint16_t> table(2 * 256, kDeadState);
+    for(int s = kStartState; s < (int)sets.size(); s++)
+    {
+        for(int c = 0; c < classCount; c++)
+        {
+            int byte = classByte[c];
+            std::vector<int> next;
+            for(int n : sets[s])
+            {
+                if(nfa[n].type == NfaChar && nfa[n].cls[byte])
+                    next.push_back(nfa[n].out1);
+            }
+
+            if(next.empty())
+                continue;
+
+            closure(nfa, next);
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+
+            auto it = ids.find(next);
+            int  id;
+            if(it == ids.end())
+            {
+                if(sets.size() >= DFA_MAX_STATES)
+                {
+                    m_error = "grammar too large";
+                    return false;
+                }
+                id = sets.size();
+                ids[next] = id;
+                sets.push_back(next);
+                table.resize(sets.size() * 256, kDeadState);
+            }
+            else
+            {
+                id = it->second;
+            }
+
+            for(int b = 0; b < 256; b++)
+                if(classOf[b] == c)
+                    table[s * 256 + b] = id;
+        }
+    }
+
+    int stateCount = sets.size();
+    m_accept.assign(stateCount, -1);
+    for(int s = 0; s < stateCount; s++)
+    {
+        for(int n : sets[s])
+        {
+            if(nfa[n].type == NfaAccept
+                && (m_accept[s] < 0 || nfa[n].rule < m_accept[s]))
+                m_accept[s] = nfa[n].rule;
+        }
+    }
+
+    // for a token cut by the end of a line : best rule it can still become
+    m_tentative = m_accept;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int s = kStartState; s < stateCount; s++)
+        {
+            if(m_accept[s] >= 0)
+                continue;
+
+            for(int c = 0; c < classCount; c++)
+            {
+                int next = table[s * 256 + classByte[c]];
+                int rule = m_tentative[next];
+                if(next != kDeadState && rule >= 0
+                    && (m_tentative[s] < 0 || rule < m_tentative[s]))
+                {
+                    m_tentative[s] = rule;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    table.resize(stateCount * 256, kDeadState);
+    m_table.swap(table);
+    m_rules = rules;
+    m_stateCount = stateCount;
+    return true;
+}
+
+bool DfaLexer::load(const std::string& path, const std::vector<TokenRule>& rules)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file)
+        return false;
+
+    DfaCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == DFA_CACHE_MAGIC
+        && header.version == DFA_CACHE_VERSION
+        && header.hash == hashRules(rules)
+        && header.ruleCount == rules.size()
+        && header.stateCount > kStartState
+        && header.stateCount <= DFA_MAX_STATES;
+
+    // read into locals, a failed load leaves the lexer as it was
+    std::vector<uint16_t> table;
+    std::vector<int16_t>  accept;
+    std::vector<int16_t>  tentative;
+    if(ok)
+    {
+        table.resize(header.stateCount * 256);
+        accept.resize(header.stateCount);
+        tentative.resize(header.stateCount);
+        ok = fread(table.data(), sizeof(uint16_t), table.size(), file) == table.size()
+            && fread(accept.data(), sizeof(int16_t), accept.size(), file) == accept.size()
+            && fread(tentative.data(), sizeof(int16_t), tentative.size(), file) == tentative.size();
+    }
+    fclose(file);
+
+    // a damaged body is compiled again rather than lexed out of bounds
+    for(size_t i = 0; ok && i < table.size(); i++)
+        ok = table[i] < header.stateCount;
+    for(size_t i = 0; ok && i < accept.size(); i++)
+    {
+        ok = accept[i] >= -1 && accept[i] < (int)header.ruleCount
+            && tentative[i] >= -1 && tentative[i] < (int)header.ruleCount;
+    }
+
+    if(!ok)
+        return false;
+
+    m_table.swap(table);
+    m_accept.swap(accept);
+    m_tentative.swap(tentative);
+    m_rules      = rules;
+    m_stateCount = header.stateCount;
+    return true;
+}
+
+bool DfaLexer::save(const std::string& path) const
+{
+    if(!isReady())
+        return false;
+
+    std::string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if(!file)
+        return false;
+
+    DfaCacheHeader header;
+    header.magic      = DFA_CACHE_MAGIC;
+    header.version    = DFA_CACHE_VERSION;
+    header.hash       = hashRules(m_rules);
+    header.stateCount = m_stateCount;
+    header.ruleCount  = m_rules.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(m_table.data(), sizeof(uint16_t), m_table.size(), file) == m_table.size()
+        && fwrite(m_accept.data(), sizeof(int16_t), m_accept.size(), file) == m_accept.size()
+        && fwrite(m_tentative.data(), sizeof(int16_t), m_tentative.size(), file) == m_tentative.size();
+    ok = fclose(file) == 0 && ok;
+
+    // rename so a concurrent start never reads a half written cache
+    if(!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint32_t DfaLexer::lex(const char* line, int len, uint32_t entry, std::vector<TokenSpan>* spans,
+                       std::vector<LexCheckpoint>* checkpoints, int interval) const
+{
+    const uint16_t* table = m_table.data();
+    if(entry >= (uint32_t)m_stateCount)
+        entry = 0;
+
+    if(len == 0 && entry != 0)
+        return table[entry * 256 + '\n'];
+
+    int pos = 0;
+    int nextCheckpoint = interval;
+    uint32_t carried = entry;
+    while(pos < len)
+    {
+        if(checkpoints && pos >= nextCheckpoint && !carried)
+        {
+            checkpoints->push_back({pos, 0});
+            nextCheckpoint = pos + interval;
+        }
+
+        bool wasCarried = carried != 0;
+        uint32_t state  = wasCarried ? carried : kStartState;
+        carried = 0;
+
+        int lastRule = -1;
+        int lastEnd  = pos;
+        int i = pos;
+        while(i < len)
+        {
+            state = table[state * 256 + (unsigned char)line[i]];
+            if(state == kDeadState)
+                break;
+
+            i++;
+            if(m_accept[state] >= 0)
+            {
+                lastRule = m_accept[state];
+                lastEnd  = i;
+            }
+        }
+
+        if(state != kDeadState)
+        {
+            // end of line inside a token, carry it over if it spans lines
+            uint16_t next = table[state * 256 + '\n'];
+            if(next != kDeadState)
+            {
+                int rule = m_tentative[next];
+                if(spans && rule >= 0)
+                    spans->push_back({pos, len - pos, m_rules[rule].color, m_rules[rule].isWord});
+                return next;
+            }
+        }
+
+        if(lastRule >= 0)
+        {
+            if(spans && (m_rules[lastRule].color != 0 || m_rules[lastRule].isWord))
+                spans->push_back({pos, lastEnd - pos, m_rules[lastRule].color, m_rules[lastRule].isWord});
+            pos = lastEnd;
+        }
+        else if(!wasCarried)
+        {
+            pos++;
+        }
+        // a carried token that dies unmatched is rescanned from the start state
+    }
+
+    return 0;
+}
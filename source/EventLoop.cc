@@ -0,0 +1,216 @@
+#include "EventLoop.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+EventLoop::EventLoop()
+{
+    m_epollFd   = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeFd    = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_inotifyFd = -1;
+    m_nextWatch = 0;
+    add(m_wakeFd, [this](){ runPosted(); }, true);
+}
+
+EventLoop::~EventLoop()
+{
+    for(auto& item : m_handlers)
+    {
+        if(item.second.isOwned)
+            close(item.first);
+    }
+    close(m_epollFd);
+}
+
+void EventLoop::add(int fd, std::function<void()> callback, bool isOwned)
+{
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    m_handlers[fd] = Handler{callback, isOwned};
+}
+
+void EventLoop::addFd(int fd, std::function<void()> onReadable)
+{
+    add(fd, onReadable, false);
+}
+
+void EventLoop::removeFd(int fd)
+{
+    auto it = m_handlers.find(fd);
+    if(it == m_handlers.end())
+        return;
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    if(it->second.isOwned)
+        close(fd);
+    m_handlers.erase(it);
+}
+
+int EventLoop::addTimer(std::function<void()> onExpired)
+{
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timer < 0)
+        return -1;
+
+    add(timer, [timer, onExpired](){
+        uint64_t expirations;
+        if(read(timer, &expirations, sizeof(expirations)) == sizeof(expirations))
+            onExpired();
+    }, true);
+    return timer;
+}
+
+void EventLoop::armTimer(int timer, int ms)
+{
+    itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec  = ms / 1000;
+    spec.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+    timerfd_settime(timer, 0, &spec, nullptr);
+}
+
+int EventLoop::addSignal(int signo, std::function<void()> onSignal)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    add(fd, [fd, onSignal](){
+        signalfd_siginfo info;
+        bool isRaised = false;
+        while(read(fd, &info, sizeof(info)) == sizeof(info))
+            isRaised = true;
+        if(isRaised)
+            onSignal();
+    }, true);
+    return fd;
+}
+
+int EventLoop::watchPath(const std::string& path, uint32_t mask,
+                         std::function<void(uint32_t, const std::string&)> onEvent)
+{
+    if(m_inotifyFd < 0)
+    {
+        m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(m_inotifyFd < 0)
+            return -1;
+        add(m_inotifyFd, [this](){ readWatches(); }, true);
+    }
+
+    // IN_MASK_ADD : a second watch on the same path keeps the first one's events
+    int descriptor = inotify_add_watch(m_inotifyFd, path.c_str(), mask | IN_MASK_ADD);
+    if(descriptor < 0)
+        return -1;
+
+    int watch = m_nextWatch++;
+    m_watches[watch] = {descriptor, mask, onEvent};
+    return watch;
+}
+
+void EventLoop::unwatch(int watch)
+{
+    auto it = m_watches.find(watch);
+    if(it == m_watches.end())
+        return;
+
+    int descriptor = it->second.descriptor;
+    m_watches.erase(it);
+    for(auto& item : m_watches)
+    {
+        if(item.second.descriptor == descriptor)
+            return;
+    }
+    inotify_rm_watch(m_inotifyFd, descriptor);
+}
+
+void EventLoop::readWatches()
+{
+    alignas(inotify_event) char buffer[4096];
+    while(true)
+    {
+        ssize_t count = read(m_inotifyFd, buffer, sizeof(buffer));
+        if(count <= 0)
+            break;
+
+        for(char* pos = buffer; pos < buffer + count; )
+        {
+            inotify_event* event = (inotify_event*)pos;
+            pos += sizeof(inotify_event) + event->len;
+
+            // the handlers may unwatch, keep copies
+            std::vector<std::function<void(uint32_t, const std::string&)>> handlers;
+            for(auto it = m_watches.begin(); it != m_watches.end(); )
+            {
+                const Watch& watch = it->second;
+                if(watch.descriptor == event->wd && (event->mask & (watch.mask | IN_IGNORED)))
+                    handlers.push_back(watch.onEvent);
+
+                if(watch.descriptor == event->wd && (event->mask & IN_IGNORED))
+                    it = m_watches.erase(it);
+                else
+                    ++it;
+            }
+
+            std::string name = event->len > 0 ? std::string(event->name) : std::string();
+            for(auto& onEvent : handlers)
+                onEvent(event->mask, name);
+        }
+    }
+}
+
+void EventLoop::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        m_posted.push_back(std::move(task));
+    }
+
+    uint64_t one = 1;
+    write(m_wakeFd, &one, sizeof(one));
+}
+
+void EventLoop::runPosted()
+{
+    uint64_t count;
+    read(m_wakeFd, &count, sizeof(count));
+
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_postMutex);
+        tasks.swap(m_posted);
+    }
+
+    for(auto& task : tasks)
+        task();
+}
+
+void EventLoop::dispatch()
+{
+    epoll_event events[kMaxEvents];
+    int count = epoll_wait(m_epollFd, events, kMaxEvents, -1);
+    for(int i = 0; i < count; i++)
+    {
+        // an earlier handler of this round may have removed it
+        auto it = m_handlers.find(events[i].data.fd);
+        if(it == m_handlers.end())
+            continue;
+
+        std::function<void()> callback = it->second.callback;
+        callback();
+    }
+}
@@ -0,0 +1,397 @@
+#include "FileIo.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+
+FileIo::FileIo(EventLoop& loop, bool useRing) : m_loop(loop)
+{
+    m_ringFd      = -1;
+    m_sqRing      = nullptr;
+    m_sqRingBytes = 0;
+    m_cqRing      = nullptr;
+    m_cqRingBytes = 0;
+    m_sqes        = nullptr;
+    m_sqesBytes   = 0;
+
+    m_poolPending   = 0;
+    m_poolFd        = -1;
+    m_poolIsWrite   = false;
+    m_isPoolRunning = true;
+
+    if(useRing)
+        setupRing();
+
+    m_isRunning = true;
+    m_thread = std::thread([this](){ workerLoop(); });
+}
+
+FileIo::~FileIo()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_isRunning = false;
+    }
+    m_jobWakeup.notify_one();
+    m_thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_isPoolRunning = false;
+    }
+    m_poolWakeup.notify_all();
+    for(auto& thread : m_pool)
+        thread.join();
+
+    closeRing();
+}
+
+void FileIo::read(const std::string& path, Progress onProgress, ReadDone onDone, Decode decode)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_jobs.push_back({false, path, std::string(), nullptr, std::move(decode), 0, onProgress, onDone, nullptr});
+    }
+    m_jobWakeup.notify_one();
+}
+
+void FileIo::write(const std::string& path, std::string&& data, Progress onProgress, WriteDone onDone)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_jobs.push_back({true, path, std::move(data), nullptr, nullptr, 0, onProgress, nullptr, onDone});
+    }
+    m_jobWakeup.notify_one();
+}
+
+void FileIo::write(const std::string& path, uint64_t total, Source source, Progress onProgress, WriteDone onDone)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_jobs.push_back({true, path, std::string(), std::move(source), nullptr, total, onProgress, nullptr, onDone});
+    }
+    m_jobWakeup.notify_one();
+}
+
+// The submission and completion rings and the submission entries are
+// mapped from the ring fd, one mapping for both rings on 5.4+ kernels
+bool FileIo::setupRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, kQueueDepth, &params);
+    if(fd < 0)
+        return false;
+
+    m_ringFd      = fd;
+    m_sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool isSingleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(isSingleMap)
+        m_sqRingBytes = m_cqRingBytes = std::max(m_sqRingBytes, m_cqRingBytes);
+
+    void* sqRing = mmap(nullptr, m_sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    m_sqRing = sqRing == MAP_FAILED ? nullptr : sqRing;
+    if(isSingleMap)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        void* cqRing = mmap(nullptr, m_cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        m_cqRing = cqRing == MAP_FAILED ? nullptr : cqRing;
+    }
+
+    m_sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    m_sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+
+    if(!m_sqRing || !m_cqRing || !m_sqes)
+    {
+        closeRing();
+        return false;
+    }
+
+    char* sq  = static_cast<char*>(m_sqRing);
+    char* cq  = static_cast<char*>(m_cqRing);
+    m_sqTail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_cqHead  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+void FileIo::closeRing()
+{
+    if(m_sqes)
+        munmap(m_sqes, m_sqesBytes);
+    if(m_cqRing && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingBytes);
+    if(m_sqRing)
+        munmap(m_sqRing, m_sqRingBytes);
+    if(m_ringFd >= 0)
+        close(m_ringFd);
+
+    m_ringFd = -1;
+    m_sqRing = nullptr;
+    m_cqRing = nullptr;
+    m_sqes   = nullptr;
+}
+
+// Queues every block, then waits for all of them. False when the ring does
+// not work (a kernel without IORING_OP_READ / WRITE) : it is closed, the
+// pool takes over.
+bool FileIo::ringBatch(int fd, bool isWrite, std::vector<Block>& blocks)
+{
+    unsigned tail = *m_sqTail;
+    for(size_t i = 0; i < blocks.size(); i++)
+    {
+        unsigned index = tail & *m_sqMask;
+        io_uring_sqe* sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd        = fd;
+        sqe->addr      = reinterpret_cast<uint64_t>(blocks[i].data);
+        sqe->len       = blocks[i].length;
+        sqe->off       = blocks[i].offset;
+        sqe->user_data = i;
+        m_sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+    unsigned toSubmit  = blocks.size();
+    size_t   completed = 0;
+    bool     isValid   = true;
+    while(completed < blocks.size())
+    {
+        int submitted = syscall(__NR_io_uring_enter, m_ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(submitted < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            closeRing();
+            return false;
+        }
+        toSubmit -= submitted;
+
+        unsigned head = *m_cqHead;
+        unsigned cqTail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for(; head != cqTail; head++)
+        {
+            io_uring_cqe* cqe = &m_cqes[head & *m_cqMask];
+            blocks[cqe->user_data].result = cqe->res;
+            isValid = isValid && cqe->res != -EINVAL && cqe->res != -EOPNOTSUPP;
+            completed++;
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if(!isValid)
+        closeRing();
+    return isValid;
+}
+
+// the pool threads start with the first batch that needs them
+void FileIo::poolBatch(int fd, bool isWrite, std::vector<Block>& blocks)
+{
+    std::unique_lock<std::mutex> lock(m_poolMutex);
+    if(m_pool.empty())
+    {
+        for(int i = 0; i < kQueueDepth; i++)
+            m_pool.emplace_back([this](){ poolLoop(); });
+    }
+
+    m_poolFd      = fd;
+    m_poolIsWrite = isWrite;
+    for(auto& block : blocks)
+        m_poolQueue.push_back(&block);
+    m_poolPending = blocks.size();
+    m_poolWakeup.notify_all();
+    m_poolDone.wait(lock, [this](){ return m_poolPending == 0; });
+}
+
+void FileIo::poolLoop()
+{
+    std::unique_lock<std::mutex> lock(m_poolMutex);
+    while(true)
+    {
+        m_poolWakeup.wait(lock, [this](){ return !m_poolQueue.empty() || !m_isPoolRunning; });
+        if(m_poolQueue.empty())
+            break;
+
+        Block* block = m_poolQueue.front();
+        m_poolQueue.pop_front();
+        int  fd      = m_poolFd;
+        bool isWrite = m_poolIsWrite;
+        lock.unlock();
+
+        ssize_t result;
+        do
+        {
+            result = isWrite ? pwrite(fd, block->data, block->length, block->offset)
+                             : pread(fd, block->data, block->length, block->offset);
+        } while(result < 0 && errno == EINTR);
+        block->result = result < 0 ? -errno : result;
+
+        lock.lock();
+        if(--m_poolPending == 0)
+            m_poolDone.notify_one();
+    }
+}
+
+// Moves data[0, size) from or to the file at fileOffset, a batch at a
+// time. *done is where it stopped : size, or less on an error or when a
+// read hits the file end. Returns an errno, 0 if none.
+int FileIo::transfer(int fd, bool isWrite, char* data, uint64_t size, uint64_t fileOffset, uint64_t* done,
+                     const Progress& onProgress)
+{
+    bool isReported = size > (uint64_t)kBlockBytes * kQueueDepth;
+    uint64_t pos = 0;
+    std::vector<Block> blocks;
+    while(pos < size)
+    {
+        // up to block boundaries, a transfer resumed after a short one
+        // gets back on them with its first block
+        blocks.clear();
+        for(uint64_t next = pos; next < size && blocks.size() < kQueueDepth; )
+        {
+            uint64_t offset = fileOffset + next;
+            size_t length = std::min<uint64_t>(kBlockBytes - offset % kBlockBytes, size - next);
+            blocks.push_back({data + next, length, offset, 0});
+            next += length;
+        }
+
+        if(m_ringFd < 0 || !ringBatch(fd, isWrite, blocks))
+            poolBatch(fd, isWrite, blocks);
+
+        for(auto& block : blocks)
+        {
+            if(block.result == -EINTR || block.result == -EAGAIN)
+                break;
+            if(block.result < 0)
+            {
+                *done = pos;
+                return -block.result;
+            }
+            if(block.result == 0)
+            {
+                *done = pos;
+                return isWrite ? EIO : 0;
+            }
+
+            pos = block.offset - fileOffset + block.result;
+            if((size_t)block.result < block.length)
+                break;
+        }
+
+        if(isReported && onProgress)
+            m_loop.post([onProgress, pos, size](){ onProgress(pos, size); });
+    }
+
+    *done = pos;
+    return 0;
+}
+
+void FileIo::runRead(Job& job)
+{
+    std::string content;
+    int error = 0;
+    int fd = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+        error = errno;
+    }
+    else
+    {
+        uint64_t done = 0;
+        content.resize(info.st_size);
+        error = transfer(fd, false, &content[0], content.size(), 0, &done, job.onProgress);
+        content.resize(done);
+    }
+    if(fd >= 0)
+        close(fd);
+    if(error == 0 && job.decode)
+        error = job.decode(content);
+
+    ReadDone onDone = std::move(job.onRead);
+    m_loop.post([onDone, content = std::move(content), error]() mutable {
+        onDone(std::move(content), error);
+    });
+}
+
+void FileIo::runWrite(Job& job)
+{
+    int error = 0;
+    int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0)
+    {
+        error = errno;
+    }
+    else if(job.source)
+    {
+        // filled from the source, then written, a batch at a time
+        std::string buffer(kBlockBytes * kQueueDepth, '\0');
+        uint64_t written = 0;
+        while(error == 0)
+        {
+            size_t filled = 0;
+            for(size_t count = 1; count > 0 && filled < buffer.size(); filled += count)
+                count = job.source(&buffer[filled], buffer.size() - filled);
+            if(filled == 0)
+                break;
+
+            uint64_t done = 0;
+            error = transfer(fd, true, &buffer[0], filled, written, &done, nullptr);
+            written += done;
+            if(job.total > buffer.size() && job.onProgress)
+                m_loop.post([onProgress = job.onProgress, written, total = job.total](){ onProgress(written, total); });
+            if(filled < buffer.size())
+                break;
+        }
+    }
+    else
+    {
+        uint64_t done = 0;
+        error = transfer(fd, true, &job.data[0], job.data.size(), 0, &done, job.onProgress);
+    }
+
+    if(fd >= 0 && close(fd) != 0 && error == 0)
+        error = errno;
+
+    std::string().swap(job.data);
+    job.source = nullptr;
+    WriteDone onDone = std::move(job.onWrite);
+    m_loop.post([onDone, error](){ onDone(error); });
+}
+
+// jobs queued before the destructor still run
+void FileIo::workerLoop()
+{
+    while(true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_jobMutex);
+            m_jobWakeup.wait(lock, [this](){ return !m_jobs.empty() || !m_isRunning; });
+            if(m_jobs.empty())
+                break;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        if(job.isWrite)
+            runWrite(job);
+        else
+            runRead(job);
+    }
+}
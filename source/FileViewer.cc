@@ -0,0 +1,288 @@
+#include "FileViewer.h"
+#include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+FileViewer::FileViewer()
+{
+    m_fd          = -1;
+    m_size        = 0;
+    m_window      = nullptr;
+    m_windowStart = 0;
+    m_windowBytes = 0;
+    m_checkpoints.assign(1, 0);
+    m_stride       = 1;
+    m_indexedEnd   = 0;
+    m_indexedLines = 0;
+}
+
+FileViewer::~FileViewer()
+{
+    close();
+}
+
+bool FileViewer::open(const std::string& fileName, std::string* error)
+{
+    close();
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        *error = fileName + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        *error = fileName + ": not a regular file";
+        ::close(fd);
+        return false;
+    }
+
+    m_fd   = fd;
+    m_size = info.st_size;
+
+    char head[4];
+    ssize_t count = pread(fd, head, sizeof(head), 0);
+    if(CompressedFile::detect(head, count > 0 ? count : 0) != Compression::None)
+    {
+        m_compressed = std::make_unique<CompressedFile>();
+        if(!m_compressed->open(fileName, error))
+        {
+            close();
+            return false;
+        }
+        m_size = m_compressed->size();
+    }
+    return true;
+}
+
+void FileViewer::close()
+{
+    if(m_window && !m_compressed)
+        munmap(const_cast<char*>(m_window), m_windowBytes);
+    if(m_fd >= 0)
+        ::close(m_fd);
+    m_compressed.reset();
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+
+    m_fd          = -1;
+    m_size        = 0;
+    m_window      = nullptr;
+    m_windowStart = 0;
+    m_windowBytes = 0;
+    m_checkpoints.assign(1, 0);
+    m_checkpoints.shrink_to_fit();
+    m_stride       = 1;
+    m_indexedEnd   = 0;
+    m_indexedLines = 0;
+}
+
+bool FileViewer::refresh()
+{
+    if(m_compressed)
+    {
+        m_size = m_compressed->size();
+        return true;
+    }
+
+    struct stat info;
+    if(m_fd < 0 || fstat(m_fd, &info) != 0)
+        return true;
+    if((uint64_t)info.st_size < m_size)
+        return false;
+
+    // a window short of the old end is mapped again by bytes()
+    m_size = info.st_size;
+    return true;
+}
+
+// maps the window with offset in its middle, the old one goes : the pages
+// read so far leave the process
+void FileViewer::remap(uint64_t offset)
+{
+    static const uint64_t pageBytes = sysconf(_SC_PAGESIZE);
+
+    if(m_compressed)
+    {
+        decompressWindow(offset);
+        return;
+    }
+
+    if(m_window)
+        munmap(const_cast<char*>(m_window), m_windowBytes);
+    m_window = nullptr;
+
+    uint64_t start = offset > kWindowBytes / 2 ? offset - kWindowBytes / 2 : 0;
+    start -= start % pageBytes;
+    size_t length = std::min<uint64_t>(kWindowBytes, m_size - start);
+    void* window = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, m_fd, start);
+    if(window == MAP_FAILED)
+        return;
+
+    m_window      = static_cast<const char*>(window);
+    m_windowStart = start;
+    m_windowBytes = length;
+}
+
+// compressed : the window starts at offset when reading forward, the
+// decompression goes on from the last one; backward it ends after the
+// kScanBytes from offset
+void FileViewer::decompressWindow(uint64_t offset)
+{
+    uint64_t start = offset;
+    if(m_window && offset < m_windowStart)
+        start = offset + kScanBytes > kCompressedWindowBytes ? offset + kScanBytes - kCompressedWindowBytes : 0;
+
+    m_buffer.resize(kCompressedWindowBytes);
+    m_window      = m_buffer.data();
+    m_windowStart = start;
+    m_windowBytes = m_compressed->read(start, &m_buffer[0], std::min<uint64_t>(kCompressedWindowBytes, m_size - start));
+}
+
+// [offset, offset + count) through the window, count is at most kScanBytes
+// and stops at the end of the file; nullptr when the mapping failed
+const char* FileViewer::bytes(uint64_t offset, size_t count)
+{
+    count = std::min<uint64_t>(count, m_size - offset);
+    if(!m_window || offset < m_windowStart || offset + count > m_windowStart + m_windowBytes)
+        remap(offset);
+    if(!m_window || offset < m_windowStart || offset + count > m_windowStart + m_windowBytes)
+        return nullptr;
+    return m_window + (offset - m_windowStart);
+}
+
+uint64_t FileViewer::lineStart(uint64_t offset)
+{
+    uint64_t end = std::min(offset, m_size);
+    while(end > 0)
+    {
+        uint64_t begin = end > kScanBytes ? end - kScanBytes : 0;
+        const char* text = bytes(begin, end - begin);
+        if(!text)
+            return 0;
+
+        const char* newline = static_cast<const char*>(memrchr(text, '\n', end - begin));
+        if(newline)
+            return begin + (newline - text) + 1;
+        end = begin;
+    }
+    return 0;
+}
+
+uint64_t FileViewer::nextLine(uint64_t offset, std::string* line)
+{
+    line->clear();
+    uint64_t pos = offset;
+    while(pos < m_size)
+    {
+        size_t count = std::min<uint64_t>(kScanBytes, m_size - pos);
+        const char* text = bytes(pos, count);
+        if(!text)
+            return m_size;
+
+        const char* newline = static_cast<const char*>(memchr(text, '\n', count));
+        size_t length = newline ? newline - text : count;
+        if(line->size() < kMaxLineBytes)
+            line->append(text, std::min(length, kMaxLineBytes - line->size()));
+        if(newline)
+            return pos + length + 1;
+        pos += count;
+    }
+    return m_size;
+}
+
+void FileViewer::addCheckpoint(uint64_t offset)
+{
+    m_checkpoints.push_back(offset);
+    if(m_checkpoints.size() <= kMaxCheckpoints)
+        return;
+
+    // every other one is kept, they are then 2 * m_stride lines apart
+    for(size_t i = 0; 2 * i < m_checkpoints.size(); i++)
+        m_checkpoints[i] = m_checkpoints[2 * i];
+    m_checkpoints.resize((m_checkpoints.size() + 1) / 2);
+    m_stride *= 2;
+}
+
+bool FileViewer::extendIndex(uint64_t offset)
+{
+    offset = std::min(offset, m_size);
+    uint64_t limit = std::min(offset, m_indexedEnd + kIndexStepBytes);
+    while(m_indexedEnd < limit)
+    {
+        size_t count = std::min<uint64_t>(kScanBytes, limit - m_indexedEnd);
+        const char* text = bytes(m_indexedEnd, count);
+        if(!text)
+            break;
+
+        const char* end = text + count;
+        for(const char* p = text; (p = static_cast<const char*>(memchr(p, '\n', end - p))); p++)
+        {
+            m_indexedLines++;
+            if(m_indexedLines % m_stride == 0)
+                addCheckpoint(m_indexedEnd + (p - text) + 1);
+        }
+        m_indexedEnd += count;
+    }
+    return offset <= m_indexedEnd;
+}
+
+uint64_t FileViewer::lineNumber(uint64_t offset)
+{
+    size_t index = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), offset) - m_checkpoints.begin() - 1;
+    uint64_t line = index * m_stride;
+    for(uint64_t pos = m_checkpoints[index]; pos < offset; )
+    {
+        size_t count = std::min<uint64_t>(kScanBytes, offset - pos);
+        const char* text = bytes(pos, count);
+        if(!text)
+            break;
+
+        const char* end = text + count;
+        for(const char* p = text; (p = static_cast<const char*>(memchr(p, '\n', end - p))); p++)
+            line++;
+        pos += count;
+    }
+    return line;
+}
+
+uint64_t FileViewer::lineOffset(uint64_t line)
+{
+    if(line > m_indexedLines)
+        return m_size;
+
+    size_t index = std::min<uint64_t>(line / m_stride, m_checkpoints.size() - 1);
+    uint64_t pos  = m_checkpoints[index];
+    uint64_t left = line - index * m_stride;
+    while(left > 0 && pos < m_size)
+    {
+        size_t count = std::min<uint64_t>(kScanBytes, m_size - pos);
+        const char* text = bytes(pos, count);
+        if(!text)
+            return m_size;
+
+        const char* end = text + count;
+        const char* p = text;
+        while(left > 0 && (p = static_cast<const char*>(memchr(p, '\n', end - p))))
+        {
+            p++;
+            left--;
+        }
+        pos += left == 0 ? p - text : count;
+    }
+    return pos;
+}
+
+size_t FileViewer::memoryUsage() const
+{
+    size_t bytes = m_checkpoints.capacity() * sizeof(uint64_t);
+    if(m_compressed)
+        bytes += m_buffer.capacity() + m_compressed->memoryUsage();
+    return bytes;
+}
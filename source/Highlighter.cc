@@ -0,0 +1,582 @@
+#include "Highlighter.h"
+#include <algorithm>
+#include <chrono>
+
+Highlighter::Highlighter()
+{
+    m_lexing       = std::make_shared<Lexing>();
+    m_docMutex     = nullptr;
+    m_text         = nullptr;
+    m_isRunning    = false;
+    m_editVersion  = 0;
+    m_viewTop      = 0;
+    m_viewRows     = 0;
+    reset(1);
+}
+
+Highlighter::~Highlighter()
+{
+    stop();
+}
+
+void Highlighter::attach(std::mutex* docMutex, const TextBuffer* text)
+{
+    m_docMutex = docMutex;
+    m_text     = text;
+}
+
+void Highlighter::startWorker()
+{
+    if(m_worker.joinable() || !m_docMutex)
+        return;
+
+    m_isRunning = true;
+    m_worker = std::thread([this](){ workerLoop(); });
+}
+
+void Highlighter::stop()
+{
+    if(!m_worker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(*m_docMutex);
+        m_isRunning = false;
+    }
+    m_wakeup.notify_all();
+    m_worker.join();
+}
+
+void Highlighter::setDfa(DfaLexer dfa)
+{
+    auto lexing = std::make_shared<Lexing>(*m_lexing);
+    lexing->dfa = std::move(dfa);
+    m_lexing = lexing;
+    reset(m_entryStates.size());
+}
+
+void Highlighter::setBuiltinColors(short comment, short string)
+{
+    auto lexing = std::make_shared<Lexing>(*m_lexing);
+    lexing->colorComment = comment;
+    lexing->colorString  = string;
+    m_lexing = lexing;
+}
+
+int Highlighter::setLexing(DfaLexer dfa, short comment, short string)
+{
+    auto lexing = std::make_shared<Lexing>();
+    lexing->dfa          = std::move(dfa);
+    lexing->colorComment = comment;
+    lexing->colorString  = string;
+
+    const std::vector<TokenRule>& oldRules = m_lexing->dfa.rules();
+    const std::vector<TokenRule>& newRules = lexing->dfa.rules();
+    bool isSamePatterns = m_lexing->dfa.isReady() == lexing->dfa.isReady()
+                       && oldRules.size() == newRules.size();
+    for(size_t i = 0; isSamePatterns && i < oldRules.size(); i++)
+        isSamePatterns = oldRules[i].pattern == newRules[i].pattern;
+
+    if(!isSamePatterns)
+    {
+        m_lexing = lexing;
+        reset(m_entryStates.size());
+        return -1;
+    }
+
+    // the entry states still hold, only spans of a changed color are stale
+    std::vector<TokenSpan> stale;
+    for(size_t i = 0; i < oldRules.size(); i++)
+    {
+        if(oldRules[i].color != newRules[i].color || oldRules[i].isWord != newRules[i].isWord)
+            stale.push_back({0, 0, oldRules[i].color, oldRules[i].isWord});
+    }
+    if(!lexing->dfa.isReady() && comment != m_lexing->colorComment)
+        stale.push_back({0, 0, m_lexing->colorComment, false});
+    if(!lexing->dfa.isReady() && string != m_lexing->colorString)
+        stale.push_back({0, 0, m_lexing->colorString, false});
+    m_lexing = lexing;
+
+    // an uncolored rule left no spans to find, every cached row may hold
+    // its tokens
+    bool isUncolored = std::any_of(stale.begin(), stale.end(), [](const TokenSpan& old) {
+        return old.color == 0 && !old.isWord;
+    });
+
+    int dropped = 0;
+    for(auto it = m_spanCache.begin(); !stale.empty() && it != m_spanCache.end(); )
+    {
+        bool isStale = isUncolored || std::any_of(it->second.spans.begin(), it->second.spans.end(), [&](const TokenSpan& span) {
+            return std::any_of(stale.begin(), stale.end(), [&](const TokenSpan& old) {
+                return span.isWord == old.isWord && (span.isWord || span.color == old.color);
+            });
+        });
+        if(isStale)
+        {
+            it = m_spanCache.erase(it);
+            dropped++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // a batch lexed with the old colors is not taken in, long lines are
+    // lexed at paint time with the new ones
+    if(!stale.empty())
+        edited();
+    return dropped;
+}
+
+template <typename RowMap>
+void Highlighter::shiftRows(RowMap& rows, int fromRow, int delta)
+{
+    if(rows.empty())
+        return;
+
+    RowMap shifted;
+    for(auto& item : rows)
+    {
+        int row = item.first;
+        if(row >= fromRow)
+            row += delta;
+        shifted[row] = std::move(item.second);
+    }
+    rows.swap(shifted);
+}
+
+void Highlighter::edited()
+{
+    m_editVersion++;
+    m_wakeup.notify_one();
+}
+
+void Highlighter::reset(int lineCount)
+{
+    m_entryStates.assign(lineCount, make_lex_state(LexMode::Normal));
+    m_dirty.assign(lineCount, 1);
+    m_pendingRow = 0;
+    m_checkpoints.clear();
+    m_spanCache.clear();
+    edited();
+}
+
+void Highlighter::lineChanged(int row)
+{
+    if(row < 0 || row >= (int)m_dirty.size())
+        return;
+
+    m_dirty[row] = 1;
+    m_pendingRow = std::min(m_pendingRow, row);
+    m_checkpoints.erase(row);
+    m_spanCache.erase(row);
+    edited();
+}
+
+void Highlighter::linesInserted(int row, int count)
+{
+    if(row < 0 || row > (int)m_entryStates.size() || count <= 0)
+        return;
+
+    // the old entry state at row is the exit state of row - 1, which is
+    // still right for the first inserted line
+    LexState entry = row < (int)m_entryStates.size() ? m_entryStates[row]
+                                               : make_lex_state(LexMode::Normal);
+
+    m_entryStates.insert(m_entryStates.begin() + row, count, entry);
+    m_dirty.insert(m_dirty.begin() + row, count, 1);
+    m_pendingRow = std::min(m_pendingRow, row);
+
+    shiftRows(m_checkpoints, row, count);
+    shiftRows(m_spanCache, row, count);
+    edited();
+}
+
+void Highlighter::linesErased(int row, int count)
+{
+    if(row < 0 || row >= (int)m_entryStates.size() || count <= 0)
+        return;
+
+    count = std::min<int>(count, m_entryStates.size() - row);
+    LexState entry = m_entryStates[row];
+
+    m_entryStates.erase(m_entryStates.begin() + row, m_entryStates.begin() + row + count);
+    m_dirty.erase(m_dirty.begin() + row, m_dirty.begin() + row + count);
+
+    if(row < (int)m_entryStates.size())
+    {
+        m_entryStates[row] = entry;
+        m_dirty[row] = 1;
+    }
+    m_pendingRow = std::min(m_pendingRow, row);
+
+    m_checkpoints.erase(m_checkpoints.lower_bound(row), m_checkpoints.lower_bound(row + count));
+    m_spanCache.erase(m_spanCache.lower_bound(row), m_spanCache.lower_bound(row + count));
+    shiftRows(m_checkpoints, row + count, -count);
+    shiftRows(m_spanCache, row + count, -count);
+    edited();
+}
+
+bool Highlighter::takePropagateBatch(int lastRow, int spanTop, int spanBottom, LexBatch& batch)
+{
+    int lineCount = std::min(m_text->size(), m_entryStates.size());
+    lastRow = std::min(lastRow, lineCount - 1);
+
+    // clean rows keep their exit state, nothing to carry past them
+    while(m_pendingRow <= lastRow && !m_dirty[m_pendingRow])
+        m_pendingRow++;
+
+    if(m_pendingRow > lastRow)
+        return false;
+
+    int first = m_pendingRow;
+    int last  = std::min(lastRow, first + kBatchRows - 1);
+
+    batch.firstRow   = first;
+    batch.propagate  = true;
+    batch.spanTop    = spanTop;
+    batch.spanBottom = spanBottom;
+    batch.lines.assign(m_text->begin() + first, m_text->begin() + last + 1);
+    batch.entries.assign(m_entryStates.begin() + first, m_entryStates.begin() + last + 1);
+    batch.entries.push_back(last + 1 < lineCount ? m_entryStates[last + 1] : 0);
+    batch.dirty.assign(m_dirty.begin() + first, m_dirty.begin() + last + 1);
+    batch.lexing = m_lexing;
+    return true;
+}
+
+bool Highlighter::takeSpanBatch(int fromRow, int toRow, LexBatch& batch)
+{
+    int lineCount = std::min(m_text->size(), m_entryStates.size());
+    toRow = std::min(toRow, lineCount - 1);
+
+    int first = fromRow;
+    while(first <= toRow
+        && ((*m_text)[first].size() >= kLongLineBytes || hasValidSpans(first)))
+        first++;
+
+    if(first > toRow)
+        return false;
+
+    int last = std::min(toRow, first + kBatchRows - 1);
+
+    // lexed with the entry states as they are now, the propagation fixes
+    // these rows later if a state was stale
+    batch.firstRow   = first;
+    batch.propagate  = false;
+    batch.spanTop    = fromRow;
+    batch.spanBottom = toRow;
+    batch.lines.assign(m_text->begin() + first, m_text->begin() + last + 1);
+    batch.entries.assign(m_entryStates.begin() + first, m_entryStates.begin() + last + 1);
+    batch.entries.push_back(0);
+    batch.dirty.assign(batch.lines.size(), 0);
+    batch.lexing = m_lexing;
+    return true;
+}
+
+void Highlighter::lexBatch(LexBatch& batch) const
+{
+    int count = batch.lines.size();
+    batch.spans.assign(count, std::vector<TokenSpan>());
+    batch.checkpoints.assign(count, std::vector<LexCheckpoint>());
+
+    bool carry = false;
+    for(int i = 0; i < count; i++)
+    {
+        int  row       = batch.firstRow + i;
+        auto& line     = batch.lines[i];
+        bool isLong    = line.size() >= kLongLineBytes;
+        bool wantSpans = !isLong && row >= batch.spanTop && row <= batch.spanBottom;
+
+        if(!batch.dirty[i] && !carry && !wantSpans)
+            continue;
+
+        LexState exit = lexWith(*batch.lexing, line.c_str(), line.size(), batch.entries[i],
+                                wantSpans ? &batch.spans[i] : nullptr,
+                                isLong ? &batch.checkpoints[i] : nullptr);
+        batch.dirty[i] = 2;     // lexed
+
+        if(batch.propagate)
+        {
+            carry = batch.entries[i + 1] != exit;
+            batch.entries[i + 1] = exit;
+        }
+    }
+
+    batch.carry = carry;
+}
+
+// true when visible rows got new spans
+bool Highlighter::applyBatch(LexBatch& batch)
+{
+    int count  = batch.lines.size();
+    int bottom = m_viewTop + m_viewRows - 1;
+    bool isVisibleDone = false;
+
+    for(int i = 0; i < count; i++)
+    {
+        if(batch.dirty[i] != 2)
+            continue;
+
+        int row = batch.firstRow + i;
+        if(batch.propagate)
+        {
+            m_dirty[row] = 0;
+            if(row + 1 < (int)m_entryStates.size())
+                m_entryStates[row + 1] = batch.entries[i + 1];
+
+            if(batch.lines[i].size() >= kLongLineBytes)
+            {
+                m_checkpoints[row] = std::move(batch.checkpoints[i]);
+                isVisibleDone |= row >= m_viewTop && row <= bottom;
+            }
+        }
+
+        if(batch.lines[i].size() < kLongLineBytes
+            && row >= batch.spanTop && row <= batch.spanBottom)
+        {
+            m_spanCache[row] = {batch.entries[i], std::move(batch.spans[i])};
+            isVisibleDone |= row >= m_viewTop && row <= bottom;
+        }
+    }
+
+    if(batch.propagate)
+    {
+        int next = batch.firstRow + count;
+        if(batch.carry && next < (int)m_dirty.size())
+            m_dirty[next] = 1;
+        m_pendingRow = next;
+    }
+
+    if(isVisibleDone)
+        m_viewportReady.notify_all();
+    return isVisibleDone;
+}
+
+bool Highlighter::hasValidSpans(int row) const
+{
+    auto it = m_spanCache.find(row);
+    return it != m_spanCache.end() && it->second.entry == m_entryStates[row];
+}
+
+bool Highlighter::isViewportReady() const
+{
+    int lineCount = std::min(m_text->size(), m_entryStates.size());
+    int bottom    = std::min(m_viewTop + m_viewRows, lineCount) - 1;
+    for(int row = m_viewTop; row <= bottom; row++)
+    {
+        if((*m_text)[row].size() >= kLongLineBytes)
+        {
+            if(m_checkpoints.find(row) == m_checkpoints.end())
+                return false;
+        }
+        else if(!hasValidSpans(row))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Highlighter::workerStep(std::unique_lock<std::mutex>& lock)
+{
+    int lineCount  = std::min(m_text->size(), m_entryStates.size());
+    int top        = m_viewTop;
+    int bottom     = std::min(top + m_viewRows, lineCount) - 1;
+    int bandTop    = std::max(0, top - m_viewRows);
+    int bandBottom = std::min(lineCount - 1, bottom + m_viewRows);
+
+    LexBatch batch;
+    bool hasJob = takeSpanBatch(top, bottom, batch)
+        || takePropagateBatch(bandBottom, bandTop, bandBottom, batch)
+        || takeSpanBatch(bandTop, bandBottom, batch)
+        || takePropagateBatch(lineCount - 1, bandTop, bandBottom, batch);
+
+    if(!hasJob)
+    {
+        // idle, only keep the spans of the band
+        m_spanCache.erase(m_spanCache.begin(), m_spanCache.lower_bound(bandTop));
+        m_spanCache.erase(m_spanCache.upper_bound(bandBottom), m_spanCache.end());
+        return false;
+    }
+
+    uint64_t version = m_editVersion;
+    lock.unlock();
+    lexBatch(batch);
+    lock.lock();
+
+    if(version == m_editVersion && applyBatch(batch) && m_onUpdate)
+    {
+        lock.unlock();
+        m_onUpdate();
+        lock.lock();
+    }
+
+    return true;
+}
+
+void Highlighter::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(*m_docMutex);
+    while(m_isRunning)
+    {
+        if(!workerStep(lock))
+            m_wakeup.wait(lock);
+    }
+}
+
+void Highlighter::update(int lastRow)
+{
+    std::unique_lock<std::mutex> lock(*m_docMutex);
+    LexBatch batch;
+    while(takePropagateBatch(lastRow, -1, -1, batch))
+    {
+        lexBatch(batch);
+        applyBatch(batch);
+    }
+}
+
+void Highlighter::setViewport(int top, int rows)
+{
+    std::lock_guard<std::mutex> lock(*m_docMutex);
+    if(top == m_viewTop && rows == m_viewRows)
+        return;
+
+    m_viewTop  = top;
+    m_viewRows = rows;
+    m_wakeup.notify_one();
+}
+
+bool Highlighter::waitViewport(int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(*m_docMutex);
+    return m_viewportReady.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                    [this](){ return isViewportReady(); });
+}
+
+void Highlighter::setUpdateCallback(std::function<void()> callback)
+{
+    m_onUpdate = std::move(callback);
+}
+
+bool Highlighter::windowSpans(int row, std::string_view line, int col, int width,
+                              std::vector<TokenSpan>& spans)
+{
+    spans.clear();
+    if(row < 0 || row >= (int)m_entryStates.size())
+        return false;
+
+    if(line.size() >= kLongLineBytes)
+    {
+        // bounded : at most kCheckpointBytes + width are lexed
+        if(m_checkpoints.find(row) == m_checkpoints.end())
+            return false;
+
+        lexWindow(row, line, col, width, spans);
+        return true;
+    }
+
+    if(!hasValidSpans(row))
+        return false;
+
+    spans = m_spanCache[row].spans;
+    return true;
+}
+
+LexState Highlighter::entryState(int row) const
+{
+    if(row < 0 || row >= (int)m_entryStates.size())
+        return make_lex_state(LexMode::Normal);
+
+    return m_entryStates[row];
+}
+
+void Highlighter::lexWindow(int row, std::string_view line, int col, int width,
+                            std::vector<TokenSpan>& spans) const
+{
+    spans.clear();
+    if(col >= (int)line.size())
+        return;
+
+    if(line.size() < kLongLineBytes)
+    {
+        lexSpans(line, entryState(row), &spans);
+        return;
+    }
+
+    int      from  = 0;
+    LexState state = entryState(row);
+    auto it = m_checkpoints.find(row);
+    if(it != m_checkpoints.end())
+    {
+        auto& checkpoints = it->second;
+        auto cp = std::upper_bound(checkpoints.begin(), checkpoints.end(), col,
+                    [](int offset, const LexCheckpoint& item){ return offset < item.offset; });
+        if(cp != checkpoints.begin())
+        {
+            --cp;
+            from  = cp->offset;
+            state = cp->state;
+        }
+    }
+
+    // a little past the right edge so the last visible token is complete
+    int to = std::min<int>(line.size(), col + width + kWindowSlack);
+    lexSpans(line.data() + from, to - from, state, &spans);
+    for(auto& span : spans)
+        span.start += from;
+}
+
+LexState Highlighter::lexSpans(std::string_view line, LexState entry, std::vector<TokenSpan>* spans) const
+{
+    return lexSpans(line.data(), line.size(), entry, spans);
+}
+
+LexState Highlighter::lexSpans(const char* text, int len, LexState entry, std::vector<TokenSpan>* spans,
+                               std::vector<LexCheckpoint>* checkpoints) const
+{
+    return lexWith(*m_lexing, text, len, entry, spans, checkpoints);
+}
+
+LexState Highlighter::lexWith(const Lexing& lexing, const char* text, int len, LexState entry,
+                              std::vector<TokenSpan>* spans, std::vector<LexCheckpoint>* checkpoints)
+{
+    if(lexing.dfa.isReady())
+        return lexing.dfa.lex(text, len, entry, spans, checkpoints, kCheckpointBytes);
+
+    // the builtin Lexer stops at '\0'
+    std::string copy;
+    if(text[len] != '\0')
+    {
+        copy.assign(text, len);
+        text = copy.c_str();
+    }
+
+    int pos = 0;
+    int nextCheckpoint = kCheckpointBytes;
+    Lexer lex(text, entry);
+    for (auto token = lex.next();
+        token.is_not(Token::Kind::End);
+        token = lex.next())
+    {
+        int length = token.lexeme().size();
+        if(spans)
+        {
+            if(token.kind() == Token::Kind::Comment)
+                spans->push_back({pos, length, lexing.colorComment, false});
+            else if(token.kind() == Token::Kind::String)
+                spans->push_back({pos, length, lexing.colorString, false});
+            else if(token.kind() == Token::Kind::Identifier)
+                spans->push_back({pos, length, 0, true});
+        }
+        pos += length;
+
+        if(checkpoints && pos >= nextCheckpoint)
+        {
+            checkpoints->push_back({pos, lex.state()});
+            nextCheckpoint = pos + kCheckpointBytes;
+        }
+    }
+
+    return lex.state();
+}
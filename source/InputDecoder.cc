@@ -0,0 +1,359 @@
+#include "InputDecoder.h"
+#include "ncurses/curses.h"
+#include "utils/utf8Utils.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define KEY_ESCAPE 27
+#define PASTE_END  "\x1b[201~"
+
+const char* InputDecoder::kStatusQuery = "\x1b[5n";
+
+namespace
+{
+
+struct SequenceKey
+{
+    const char* sequence;
+    int key;
+};
+
+// xterm, vt100/220, rxvt and the linux console
+const SequenceKey s_defaultKeys[] =
+{
+    {"\x1b[A", KEY_UP},    {"\x1b[B", KEY_DOWN},  {"\x1b[C", KEY_RIGHT}, {"\x1b[D", KEY_LEFT},
+    {"\x1bOA", KEY_UP},    {"\x1bOB", KEY_DOWN},  {"\x1bOC", KEY_RIGHT}, {"\x1bOD", KEY_LEFT},
+    {"\x1b[H", KEY_HOME},  {"\x1b[F", KEY_END},   {"\x1bOH", KEY_HOME},  {"\x1bOF", KEY_END},
+    {"\x1b[1~", KEY_HOME}, {"\x1b[2~", KEY_IC},   {"\x1b[3~", KEY_DC},   {"\x1b[4~", KEY_END},
+    {"\x1b[5~", KEY_PPAGE},{"\x1b[6~", KEY_NPAGE},{"\x1b[7~", KEY_HOME}, {"\x1b[8~", KEY_END},
+    {"\x1bOP", KEY_F(1)},  {"\x1bOQ", KEY_F(2)},  {"\x1bOR", KEY_F(3)},  {"\x1bOS", KEY_F(4)},
+    {"\x1b[11~", KEY_F(1)},{"\x1b[12~", KEY_F(2)},{"\x1b[13~", KEY_F(3)},{"\x1b[14~", KEY_F(4)},
+    {"\x1b[15~", KEY_F(5)},{"\x1b[17~", KEY_F(6)},{"\x1b[18~", KEY_F(7)},{"\x1b[19~", KEY_F(8)},
+    {"\x1b[20~", KEY_F(9)},{"\x1b[21~", KEY_F(10)},{"\x1b[23~", KEY_F(11)},{"\x1b[24~", KEY_F(12)},
+    {"\x1b[[A", KEY_F(1)}, {"\x1b[[B", KEY_F(2)}, {"\x1b[[C", KEY_F(3)}, {"\x1b[[D", KEY_F(4)},
+    {"\x1b[[E", KEY_F(5)}, {"\x1b[Z", KEY_BTAB},
+};
+
+// terminfo capability name of each named key
+const struct { const char* capname; int key; } s_terminfoKeys[] =
+{
+    {"kcuu1", KEY_UP},   {"kcud1", KEY_DOWN}, {"kcub1", KEY_LEFT}, {"kcuf1", KEY_RIGHT},
+    {"khome", KEY_HOME}, {"kend", KEY_END},   {"kpp", KEY_PPAGE},  {"knp", KEY_NPAGE},
+    {"kich1", KEY_IC},   {"kdch1", KEY_DC},   {"kcbt", KEY_BTAB},
+    {"kf1", KEY_F(1)},   {"kf2", KEY_F(2)},   {"kf3", KEY_F(3)},   {"kf4", KEY_F(4)},
+    {"kf5", KEY_F(5)},   {"kf6", KEY_F(6)},   {"kf7", KEY_F(7)},   {"kf8", KEY_F(8)},
+    {"kf9", KEY_F(9)},   {"kf10", KEY_F(10)}, {"kf11", KEY_F(11)}, {"kf12", KEY_F(12)},
+};
+
+// "CSI n ~" keys
+int tildeKey(int number)
+{
+    switch(number)
+    {
+    case 1: case 7: return KEY_HOME;
+    case 2:         return KEY_IC;
+    case 3:         return KEY_DC;
+    case 4: case 8: return KEY_END;
+    case 5:         return KEY_PPAGE;
+    case 6:         return KEY_NPAGE;
+    }
+
+    if(number >= 11 && number <= 15)
+        return KEY_F(number - 10);
+    if(number >= 17 && number <= 21)
+        return KEY_F(number - 11);
+    if(number == 23 || number == 24)
+        return KEY_F(number - 12);
+    return 0;
+}
+
+// "CSI 1;mod X" and "SS3 X" keys
+int letterKey(char final)
+{
+    switch(final)
+    {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case 'P': return KEY_F(1);
+    case 'Q': return KEY_F(2);
+    case 'R': return KEY_F(3);
+    case 'S': return KEY_F(4);
+    case 'Z': return KEY_BTAB;
+    }
+    return 0;
+}
+
+}
+
+InputDecoder::InputDecoder()
+{
+    m_trie.push_back(TrieNode{0, {}});
+    m_isPaste     = false;
+    m_isQuerySent = false;
+
+    for(auto& item : s_defaultKeys)
+        addSequence(item.sequence, item.key);
+}
+
+int InputDecoder::child(int node, unsigned char byte) const
+{
+    for(auto& item : m_trie[node].children)
+    {
+        if(item.first == byte)
+            return item.second;
+    }
+    return -1;
+}
+
+void InputDecoder::addSequence(const std::string& sequence, int key)
+{
+    int node = 0;
+    for(unsigned char byte : sequence)
+    {
+        int next = child(node, byte);
+        if(next < 0)
+        {
+            next = m_trie.size();
+            m_trie.push_back(TrieNode{0, {}});
+            m_trie[node].children.push_back({byte, next});
+        }
+        node = next;
+    }
+    m_trie[node].key = key;
+}
+
+void InputDecoder::loadTerminfo()
+{
+    for(auto& item : s_terminfoKeys)
+    {
+        char* sequence = tigetstr(item.capname);
+        if(sequence && sequence != (char*)-1 && sequence[0] == KEY_ESCAPE)
+            addSequence(sequence, item.key);
+    }
+}
+
+bool InputDecoder::feed(const char* data, int len, std::vector<KeyEvent>& events)
+{
+    m_pending.append(data, len);
+
+    const char* bytes = m_pending.c_str();
+    int size = m_pending.size();
+    int pos  = 0;
+    while(pos < size)
+    {
+        int used;
+        if(m_isPaste)
+        {
+            used = decodePaste(bytes + pos, size - pos, events);
+        }
+        else if((unsigned char)bytes[pos] >= 0x80)
+        {
+            used = decodeUtf8(bytes + pos, size - pos, events);
+        }
+        else if(bytes[pos] != KEY_ESCAPE)
+        {
+            events.push_back({(unsigned char)bytes[pos], 0, ""});
+            used = 1;
+        }
+        else
+        {
+            used = decodeEscape(bytes + pos, size - pos, events);
+        }
+
+        if(used == 0)
+            break;      // the rest of a sequence is still on its way
+        pos += used;
+    }
+    m_pending.erase(0, pos);
+
+    if(!hasPendingEscape() || m_isQuerySent)
+        return false;
+
+    m_isQuerySent = true;
+    return true;
+}
+
+bool InputDecoder::hasPendingEscape() const
+{
+    return !m_isPaste && m_pending.size() == 1 && m_pending[0] == KEY_ESCAPE;
+}
+
+void InputDecoder::flushEscape(std::vector<KeyEvent>& events)
+{
+    if(!hasPendingEscape())
+        return;
+
+    events.push_back({KEY_ESCAPE, 0, ""});
+    m_pending.clear();
+    m_isQuerySent = false;
+}
+
+// returns the bytes used, 0 when the sequence is not complete yet
+int InputDecoder::decodeEscape(const char* data, int len, std::vector<KeyEvent>& events)
+{
+    if(len < 2)
+        return 0;
+
+    // ESC ESC : the first one was the Esc key (also how a status reply
+    // resolves a pending ESC)
+    if(data[1] == KEY_ESCAPE)
+    {
+        events.push_back({KEY_ESCAPE, 0, ""});
+        return 1;
+    }
+
+    // longest fixed sequence
+    int node     = child(0, KEY_ESCAPE);
+    int matchKey = 0;
+    int matchLen = 0;
+    int pos      = 1;
+    while(node >= 0 && pos < len)
+    {
+        int next = child(node, data[pos]);
+        if(next < 0)
+            break;
+
+        node = next;
+        pos++;
+        if(m_trie[node].key)
+        {
+            matchKey = m_trie[node].key;
+            matchLen = pos;
+        }
+    }
+
+    if(node >= 0 && pos == len && !m_trie[node].children.empty())
+        return 0;
+
+    if(matchKey)
+    {
+        events.push_back({matchKey, 0, ""});
+        return matchLen;
+    }
+
+    if(data[1] == '[')
+        return decodeCsi(data, len, events);
+
+    if(data[1] == 'O')
+    {
+        if(len < 3)
+            return 0;
+
+        int key = letterKey(data[2]);
+        if(key)
+            events.push_back({key, 0, ""});
+        return 3;
+    }
+
+    // ESC + key : Alt
+    events.push_back({(unsigned char)data[1], KeyEvent::kAlt, ""});
+    return 2;
+}
+
+int InputDecoder::decodeCsi(const char* data, int len, std::vector<KeyEvent>& events)
+{
+    // ESC [ parameters(0x30-0x3f) intermediates(0x20-0x2f) final(0x40-0x7e)
+    int pos = 2;
+    while(pos < len && data[pos] >= 0x30 && data[pos] <= 0x3f)
+        pos++;
+    int paramEnd = pos;
+    while(pos < len && data[pos] >= 0x20 && data[pos] <= 0x2f)
+        pos++;
+    if(pos >= len)
+        return 0;
+
+    char final = data[pos];
+    int  used  = pos + 1;
+    if(final < 0x40 || final > 0x7e)
+        return used;    // not a sequence we know how to skip better
+
+    std::string params(data + 2, paramEnd - 2);
+    bool hasIntermediate = paramEnd != pos;
+
+    // replies to our queries : DECRPM, DA1, DSR
+    if(!params.empty() && (params[0] == '?' || params[0] == '>'))
+        return used;
+    if(final == 'n')
+    {
+        m_isQuerySent = false;
+        return used;
+    }
+    if(hasIntermediate)
+        return used;
+
+    int first  = atoi(params.c_str());
+    int mods   = 0;
+    size_t sep = params.find(';');
+    if(sep != std::string::npos)
+        mods = std::max(0, atoi(params.c_str() + sep + 1) - 1);
+
+    if(final == '~')
+    {
+        if(first == 200)
+        {
+            m_isPaste = true;
+            m_paste.clear();
+            return used;
+        }
+
+        int key = tildeKey(first);
+        if(key)
+            events.push_back({key, mods, ""});
+        return used;
+    }
+
+    int key = letterKey(final);
+    if(key)
+        events.push_back({key, mods, ""});
+    return used;
+}
+
+int InputDecoder::decodePaste(const char* data, int len, std::vector<KeyEvent>& events)
+{
+    const char* end = (const char*)memmem(data, len, PASTE_END, strlen(PASTE_END));
+    if(end)
+    {
+        m_paste.append(data, end - data);
+        events.push_back({KeyEvent::kKeyPaste, 0, m_paste});
+        m_paste.clear();
+        m_isPaste = false;
+        return end - data + strlen(PASTE_END);
+    }
+
+    // keep what could be the start of the end marker
+    int keep = strlen(PASTE_END) - 1;
+    if(len <= keep)
+        return 0;
+
+    m_paste.append(data, len - keep);
+    return len - keep;
+}
+
+int InputDecoder::decodeUtf8(const char* data, int len, std::vector<KeyEvent>& events)
+{
+    int need = utf8_sequence_length(data[0]);
+    if(need == 0)
+        return 1;
+    if(len < need)
+    {
+        // wait for the rest, unless what came already is not part of it
+        for(int i = 1; i < len; i++)
+        {
+            if(((unsigned char)data[i] & 0xC0) != 0x80)
+                return i;
+        }
+        return 0;
+    }
+
+    int valid = utf8_char_length(data, len);
+    if(valid == 0)
+        return 1;
+
+    events.push_back({KeyEvent::kKeyChar, 0, std::string(data, valid)});
+    return valid;
+}
@@ -0,0 +1,677 @@
+#include "LineRope.h"
+#include "utils/utf8Utils.hpp"
+#include <algorithm>
+#include <cstring>
+
+LineRope::LineRope()
+{
+    m_root = std::make_shared<Node>();
+}
+
+void LineRope::clear()
+{
+    m_root = std::make_shared<Node>();
+}
+
+// a shared node is copied before it changes
+LineRope::Node* LineRope::own(NodePtr& node)
+{
+    if(node.use_count() > 1)
+        node = std::make_shared<Node>(*node);
+    return node.get();
+}
+
+void LineRope::summarize(Node* node)
+{
+    Summary summary;
+    if(node->isLeaf)
+    {
+        summary.lines = node->ends.size();
+        summary.bytes = node->text.size() + summary.lines;
+        summary.utf16 = summary.lines;
+        for(uint32_t units : node->utf16)
+            summary.utf16 += units;
+        for(uint32_t columns : node->columns)
+            summary.maxColumns = std::max(summary.maxColumns, columns);
+    }
+    else
+    {
+        for(auto& child : node->children)
+        {
+            summary.bytes += child->summary.bytes;
+            summary.utf16 += child->summary.utf16;
+            summary.lines += child->summary.lines;
+            summary.maxColumns = std::max(summary.maxColumns, child->summary.maxColumns);
+        }
+    }
+    node->summary = summary;
+}
+
+void LineRope::leafAppend(Node* leaf, std::string_view line)
+{
+    leaf->text.append(line);
+    leaf->ends.push_back(leaf->text.size());
+    leaf->columns.push_back(utf8_width(line.data(), line.size()));
+    leaf->utf16.push_back(utf8_utf16_length(line.data(), line.size()));
+}
+
+namespace
+{
+
+// line i of src to the end of dst, with its measures
+template <typename Node>
+void leafTake(Node* dst, const Node& src, size_t i)
+{
+    uint32_t start = i == 0 ? 0 : src.ends[i - 1];
+    dst->text.append(src.text, start, src.ends[i] - start);
+    dst->ends.push_back(dst->text.size());
+    dst->columns.push_back(src.columns[i]);
+    dst->utf16.push_back(src.utf16[i]);
+}
+
+}
+
+// An overfull leaf is cut in even pieces, the first one stays in leaf.
+LineRope::Nodes LineRope::splitLeaf(Node* leaf)
+{
+    size_t lines = leaf->ends.size();
+    size_t bytes = leaf->text.size();
+    if(lines <= 1 || (lines <= kLeafLines && bytes <= kLeafBytes))
+        return {};
+
+    size_t pieces      = std::max((lines + kLeafLines - 1) / kLeafLines, (bytes + kLeafBytes - 1) / kLeafBytes);
+    size_t targetLines = (lines + pieces - 1) / pieces;
+    size_t targetBytes = (bytes + pieces - 1) / pieces;
+
+    Node old;
+    std::swap(old.text, leaf->text);
+    std::swap(old.ends, leaf->ends);
+    std::swap(old.columns, leaf->columns);
+    std::swap(old.utf16, leaf->utf16);
+
+    Nodes extras;
+    Node* piece = leaf;
+    for(size_t i = 0; i < lines; i++)
+    {
+        if(!piece->ends.empty() && (piece->ends.size() >= targetLines || piece->text.size() >= targetBytes))
+        {
+            summarize(piece);
+            extras.push_back(std::make_shared<Node>());
+            piece = extras.back().get();
+        }
+        leafTake(piece, old, i);
+    }
+    summarize(piece);
+    return extras;
+}
+
+LineRope::Nodes LineRope::splitInner(Node* node)
+{
+    size_t count = node->children.size();
+    if(count <= kMaxChildren)
+        return {};
+
+    size_t pieces = (count + kMaxChildren - 1) / kMaxChildren;
+    Nodes children;
+    children.swap(node->children);
+
+    Nodes extras;
+    Node* piece = node;
+    size_t taken = 0;
+    for(size_t p = 0; p < pieces; p++)
+    {
+        size_t take = (count - taken) / (pieces - p);
+        if(p > 0)
+        {
+            extras.push_back(std::make_shared<Node>());
+            piece = extras.back().get();
+            piece->isLeaf = false;
+        }
+        piece->children.assign(children.begin() + taken, children.begin() + taken + take);
+        summarize(piece);
+        taken += take;
+    }
+    return extras;
+}
+
+// after an erase : empty children go, small neighbours are joined
+void LineRope::mergeChildren(Node* node)
+{
+    auto& children = node->children;
+    children.erase(std::remove_if(children.begin(), children.end(),
+                                  [](const NodePtr& child){ return child->summary.lines == 0; }),
+                   children.end());
+
+    for(size_t i = 0; i + 1 < children.size(); )
+    {
+        const Node* left  = children[i].get();
+        const Node* right = children[i + 1].get();
+        bool isMerged = false;
+        if(left->isLeaf && right->isLeaf)
+        {
+            size_t lines = left->ends.size() + right->ends.size();
+            size_t bytes = left->text.size() + right->text.size();
+            bool isSmall = (left->ends.size() < kLeafLines / 2 && left->text.size() < kLeafBytes / 2)
+                        || (right->ends.size() < kLeafLines / 2 && right->text.size() < kLeafBytes / 2);
+            if(isSmall && lines <= kLeafLines && bytes <= kLeafBytes)
+            {
+                Node* merged = own(children[i]);
+                for(size_t k = 0; k < right->ends.size(); k++)
+                    leafTake(merged, *right, k);
+                summarize(merged);
+                isMerged = true;
+            }
+        }
+        else if(!left->isLeaf && !right->isLeaf)
+        {
+            size_t count = left->children.size() + right->children.size();
+            bool isSmall = left->children.size() < kMaxChildren / 2 || right->children.size() < kMaxChildren / 2;
+            if(isSmall && count <= kMaxChildren)
+            {
+                Node* merged = own(children[i]);
+                merged->children.insert(merged->children.end(), right->children.begin(), right->children.end());
+                summarize(merged);
+                isMerged = true;
+            }
+        }
+
+        if(isMerged)
+            children.erase(children.begin() + i + 1);
+        else
+            i++;
+    }
+}
+
+void LineRope::growRoot(Nodes extras)
+{
+    while(!extras.empty())
+    {
+        NodePtr root = std::make_shared<Node>();
+        root->isLeaf = false;
+        root->children.push_back(m_root);
+        root->children.insert(root->children.end(), extras.begin(), extras.end());
+        summarize(root.get());
+        extras = splitInner(root.get());
+        m_root = root;
+    }
+}
+
+const LineRope::Node* LineRope::leafAt(size_t row, size_t* firstRow) const
+{
+    if(row >= size())
+        return nullptr;
+
+    const Node* node = m_root.get();
+    size_t first = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(row < child->summary.lines)
+            {
+                node = child.get();
+                break;
+            }
+            row   -= child->summary.lines;
+            first += child->summary.lines;
+        }
+    }
+
+    *firstRow = first;
+    return node;
+}
+
+std::string_view LineRope::operator[](size_t row) const
+{
+    size_t first;
+    const Node* leaf = leafAt(row, &first);
+    uint32_t start = lineStart(leaf, row - first);
+    return {leaf->text.data() + start, leaf->ends[row - first] - start};
+}
+
+std::string_view LineRope::const_iterator::operator*() const
+{
+    if(!m_leaf || m_row < m_leafFirst || m_row >= m_leafFirst + m_leaf->ends.size())
+        m_leaf = m_rope->leafAt(m_row, &m_leafFirst);
+
+    size_t index = m_row - m_leafFirst;
+    uint32_t start = lineStart(m_leaf, index);
+    return {m_leaf->text.data() + start, m_leaf->ends[index] - start};
+}
+
+LineRope::Nodes LineRope::insertLines(NodePtr& ptr, size_t row, std::vector<std::string>& lines)
+{
+    Node* node = own(ptr);
+    if(node->isLeaf)
+    {
+        Node old;
+        std::swap(old.text, node->text);
+        std::swap(old.ends, node->ends);
+        std::swap(old.columns, node->columns);
+        std::swap(old.utf16, node->utf16);
+
+        for(size_t i = 0; i < row; i++)
+            leafTake(node, old, i);
+        for(auto& line : lines)
+            leafAppend(node, line);
+        for(size_t i = row; i < old.ends.size(); i++)
+            leafTake(node, old, i);
+
+        summarize(node);
+        return splitLeaf(node);
+    }
+
+    size_t i = 0;
+    for(; i + 1 < node->children.size(); i++)
+    {
+        if(row < node->children[i]->summary.lines)
+            break;
+        row -= node->children[i]->summary.lines;
+    }
+
+    Nodes extras = insertLines(node->children[i], row, lines);
+    node->children.insert(node->children.begin() + i + 1, extras.begin(), extras.end());
+    summarize(node);
+    return splitInner(node);
+}
+
+LineRope::Nodes LineRope::changeLine(NodePtr& ptr, size_t row, size_t byte, size_t eraseCount, std::string_view text)
+{
+    Node* node = own(ptr);
+    if(node->isLeaf)
+    {
+        uint32_t start  = lineStart(node, row);
+        size_t   length = node->ends[row] - start;
+        byte       = std::min(byte, length);
+        eraseCount = std::min(eraseCount, length - byte);
+
+        // the widths change by what leaves and what comes in, but a tab in
+        // or after the edit moves to other tab stops : the line is measured
+        const char* erased = node->text.data() + start + byte;
+        bool hasTab = memchr(erased, '\t', length - byte) || memchr(text.data(), '\t', text.size());
+        if(!hasTab)
+            node->columns[row] += utf8_width(text.data(), text.size()) - utf8_width(erased, eraseCount);
+        node->utf16[row]   += utf8_utf16_length(text.data(), text.size()) - utf8_utf16_length(erased, eraseCount);
+
+        node->text.replace(start + byte, eraseCount, text);
+        if(hasTab)
+            node->columns[row] = utf8_width(node->text.data() + start, length - eraseCount + text.size());
+        int64_t delta = static_cast<int64_t>(text.size()) - eraseCount;
+        for(size_t i = row; i < node->ends.size(); i++)
+            node->ends[i] += delta;
+
+        summarize(node);
+        return splitLeaf(node);
+    }
+
+    size_t i = 0;
+    for(; i + 1 < node->children.size(); i++)
+    {
+        if(row < node->children[i]->summary.lines)
+            break;
+        row -= node->children[i]->summary.lines;
+    }
+
+    Nodes extras = changeLine(node->children[i], row, byte, eraseCount, text);
+    node->children.insert(node->children.begin() + i + 1, extras.begin(), extras.end());
+    summarize(node);
+    return splitInner(node);
+}
+
+void LineRope::eraseLines(NodePtr& ptr, size_t row, size_t count)
+{
+    Node* node = own(ptr);
+    if(node->isLeaf)
+    {
+        Node old;
+        std::swap(old.text, node->text);
+        std::swap(old.ends, node->ends);
+        std::swap(old.columns, node->columns);
+        std::swap(old.utf16, node->utf16);
+
+        for(size_t i = 0; i < old.ends.size(); i++)
+        {
+            if(i < row || i >= row + count)
+                leafTake(node, old, i);
+        }
+        summarize(node);
+        return;
+    }
+
+    for(size_t i = 0; i < node->children.size() && count > 0; i++)
+    {
+        size_t lines = node->children[i]->summary.lines;
+        if(row >= lines)
+        {
+            row -= lines;
+            continue;
+        }
+
+        size_t take = std::min(count, lines - row);
+        eraseLines(node->children[i], row, take);
+        count -= take;
+        row    = 0;
+    }
+
+    mergeChildren(node);
+    summarize(node);
+}
+
+void LineRope::push_back(std::string_view line)
+{
+    insert(size(), std::string(line));
+}
+
+// levels of nodes above the leaves
+size_t LineRope::height(const Node* node)
+{
+    size_t height = 0;
+    for(; !node->isLeaf; node = node->children[0].get())
+        height++;
+    return height;
+}
+
+LineRope::NodePtr LineRope::buildTree(Nodes level)
+{
+    while(level.size() > 1)
+    {
+        size_t pieces = (level.size() + kMaxChildren - 1) / kMaxChildren;
+        Nodes  parents;
+        size_t taken = 0;
+        for(size_t p = 0; p < pieces; p++)
+        {
+            size_t take = (level.size() - taken) / (pieces - p);
+            NodePtr parent = std::make_shared<Node>();
+            parent->isLeaf = false;
+            parent->children.assign(level.begin() + taken, level.begin() + taken + take);
+            summarize(parent.get());
+            parents.push_back(parent);
+            taken += take;
+        }
+        level.swap(parents);
+    }
+    return level[0];
+}
+
+// tree is depth levels lower than node, it becomes its last descendant there
+LineRope::Nodes LineRope::hangTree(NodePtr& ptr, size_t depth, NodePtr tree)
+{
+    Node* node = own(ptr);
+    if(depth == 1)
+    {
+        node->children.push_back(tree);
+    }
+    else
+    {
+        Nodes extras = hangTree(node->children.back(), depth - 1, tree);
+        node->children.insert(node->children.end(), extras.begin(), extras.end());
+    }
+    summarize(node);
+    return splitInner(node);
+}
+
+void LineRope::appendText(std::string&& text)
+{
+    // the new lines go to new leaves in order, then the levels above are
+    // built; that tree is hung on the right edge of this one, so appending
+    // costs the new lines only (stdin comes in that way, a chunk at a time)
+    Nodes  level;
+    NodePtr leaf = std::make_shared<Node>();
+    auto add = [&](std::string_view line){
+        if(!leaf->ends.empty() && (leaf->ends.size() >= kLeafLines || leaf->text.size() + line.size() > kLeafBytes))
+        {
+            summarize(leaf.get());
+            level.push_back(leaf);
+            leaf = std::make_shared<Node>();
+        }
+        leafAppend(leaf.get(), line);
+    };
+
+    size_t begin = 0;
+    while(true)
+    {
+        size_t end = text.find('\n', begin);
+        if(end == std::string::npos)
+            end = text.size();
+
+        add(std::string_view(text.data() + begin, end - begin));
+        if(end == text.size())
+            break;
+        begin = end + 1;
+    }
+    summarize(leaf.get());
+    level.push_back(leaf);
+
+    LineRope tail;
+    tail.m_root = buildTree(std::move(level));
+    size_t rootHeight = height(m_root.get());
+    size_t tailHeight = height(tail.m_root.get());
+    if(rootHeight < tailHeight || empty())
+    {
+        // this one is the smaller, both are built again as one
+        level.clear();
+        leaf = std::make_shared<Node>();
+        for(auto line : *this)
+            add(line);
+        for(auto line : tail)
+            add(line);
+        summarize(leaf.get());
+        level.push_back(leaf);
+        m_root = buildTree(std::move(level));
+    }
+    else if(rootHeight == tailHeight)
+    {
+        growRoot({tail.m_root});
+    }
+    else
+    {
+        growRoot(hangTree(m_root, rootHeight - tailHeight, tail.m_root));
+    }
+}
+
+void LineRope::set(size_t row, std::string line)
+{
+    growRoot(changeLine(m_root, row, 0, std::string::npos, line));
+}
+
+void LineRope::insert(size_t row, std::string line)
+{
+    std::vector<std::string> lines;
+    lines.push_back(std::move(line));
+    insert(row, std::move(lines));
+}
+
+void LineRope::insert(size_t row, std::vector<std::string>&& lines)
+{
+    if(lines.empty())
+        return;
+    growRoot(insertLines(m_root, std::min(row, size()), lines));
+}
+
+void LineRope::erase(size_t row, size_t count)
+{
+    if(row >= size())
+        return;
+
+    eraseLines(m_root, row, std::min(count, size() - row));
+    while(!m_root->isLeaf && m_root->children.size() == 1)
+        m_root = m_root->children[0];
+    if(!m_root->isLeaf && m_root->children.empty())
+        m_root = std::make_shared<Node>();
+}
+
+void LineRope::insertBytes(size_t row, size_t byte, std::string_view text)
+{
+    growRoot(changeLine(m_root, row, byte, 0, text));
+}
+
+void LineRope::eraseBytes(size_t row, size_t byte, size_t count)
+{
+    growRoot(changeLine(m_root, row, byte, count, std::string_view()));
+}
+
+uint64_t LineRope::byteOffset(size_t row) const
+{
+    if(row >= size())
+        return m_root->summary.bytes;
+
+    const Node* node = m_root.get();
+    uint64_t offset = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(row < child->summary.lines)
+            {
+                node = child.get();
+                break;
+            }
+            row    -= child->summary.lines;
+            offset += child->summary.bytes;
+        }
+    }
+    return offset + lineStart(node, row) + row;
+}
+
+size_t LineRope::rowAtByte(uint64_t offset) const
+{
+    if(empty())
+        return 0;
+    if(offset >= m_root->summary.bytes)
+        return size() - 1;
+
+    const Node* node = m_root.get();
+    size_t row = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(offset < child->summary.bytes)
+            {
+                node = child.get();
+                break;
+            }
+            offset -= child->summary.bytes;
+            row    += child->summary.lines;
+        }
+    }
+
+    for(size_t i = 0; i < node->ends.size(); i++)
+    {
+        uint64_t bytes = node->ends[i] - lineStart(node, i) + 1;
+        if(offset < bytes)
+            return row + i;
+        offset -= bytes;
+    }
+    return row + node->ends.size() - 1;
+}
+
+uint64_t LineRope::utf16Offset(size_t row) const
+{
+    if(row >= size())
+        return m_root->summary.utf16;
+
+    const Node* node = m_root.get();
+    uint64_t offset = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(row < child->summary.lines)
+            {
+                node = child.get();
+                break;
+            }
+            row    -= child->summary.lines;
+            offset += child->summary.utf16;
+        }
+    }
+
+    for(size_t i = 0; i < row; i++)
+        offset += node->utf16[i] + 1;
+    return offset;
+}
+
+size_t LineRope::rowAtUtf16(uint64_t offset) const
+{
+    if(empty())
+        return 0;
+    if(offset >= m_root->summary.utf16)
+        return size() - 1;
+
+    const Node* node = m_root.get();
+    size_t row = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(offset < child->summary.utf16)
+            {
+                node = child.get();
+                break;
+            }
+            offset -= child->summary.utf16;
+            row    += child->summary.lines;
+        }
+    }
+
+    for(size_t i = 0; i < node->ends.size(); i++)
+    {
+        uint64_t units = node->utf16[i] + 1;
+        if(offset < units)
+            return row + i;
+        offset -= units;
+    }
+    return row + node->ends.size() - 1;
+}
+
+size_t LineRope::longestLine(int* columns) const
+{
+    const Node* node = m_root.get();
+    uint32_t widest = node->summary.maxColumns;
+    if(columns)
+        *columns = widest;
+
+    size_t row = 0;
+    while(!node->isLeaf)
+    {
+        for(auto& child : node->children)
+        {
+            if(child->summary.maxColumns == widest)
+            {
+                node = child.get();
+                break;
+            }
+            row += child->summary.lines;
+        }
+    }
+
+    for(size_t i = 0; i < node->columns.size(); i++)
+    {
+        if(node->columns[i] == widest)
+            return row + i;
+    }
+    return row;
+}
+
+namespace
+{
+
+template <typename Node>
+size_t nodeBytes(const Node* node)
+{
+    size_t bytes = sizeof(Node) + 16     // the shared_ptr control block
+                 + node->children.capacity() * sizeof(node->children[0])
+                 + node->text.capacity()
+                 + (node->ends.capacity() + node->columns.capacity() + node->utf16.capacity()) * sizeof(uint32_t);
+    for(auto& child : node->children)
+        bytes += nodeBytes(child.get());
+    return bytes;
+}
+
+}
+
+size_t LineRope::memoryUsage() const
+{
+    return nodeBytes(m_root.get());
+}
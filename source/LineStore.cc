@@ -0,0 +1,263 @@
+#include "LineStore.h"
+#include <cstring>
+#include <utility>
+#include <algorithm>
+
+LineStore::LineStore()
+{
+    m_isLastChunkOpen = false;
+    m_deadBytes = 0;
+    m_textBytes = 0;
+}
+
+LineStore::LineStore(const LineStore& other)
+{
+    *this = other;
+}
+
+LineStore& LineStore::operator=(const LineStore& other)
+{
+    if(this == &other)
+        return *this;
+
+    // the chunks are shared, appending to one would move it
+    other.m_isLastChunkOpen = false;
+    m_isLastChunkOpen = false;
+    m_lines      = other.m_lines;
+    m_chunks     = other.m_chunks;
+    m_chunkBases = other.m_chunkBases;
+    m_pageChunks = other.m_pageChunks;
+    m_pool       = other.m_pool;
+    m_freeSlots  = other.m_freeSlots;
+    m_deadBytes  = other.m_deadBytes;
+    m_textBytes  = other.m_textBytes;
+    return *this;
+}
+
+void LineStore::clear()
+{
+    LineStore empty;
+    swap(empty);
+}
+
+void LineStore::swap(LineStore& other)
+{
+    m_lines.swap(other.m_lines);
+    m_chunks.swap(other.m_chunks);
+    m_chunkBases.swap(other.m_chunkBases);
+    m_pageChunks.swap(other.m_pageChunks);
+    std::swap(m_isLastChunkOpen, other.m_isLastChunkOpen);
+    m_pool.swap(other.m_pool);
+    m_freeSlots.swap(other.m_freeSlots);
+    std::swap(m_deadBytes, other.m_deadBytes);
+    std::swap(m_textBytes, other.m_textBytes);
+}
+
+// the chunk takes the next free pages, returns its index
+size_t LineStore::addChunk(std::string&& chunk)
+{
+    size_t index = m_chunks.size();
+    size_t pages = chunk.size() / kChunkBytes + 1;
+    m_chunkBases.push_back(static_cast<uint64_t>(m_pageChunks.size()) << kPageBits);
+    m_pageChunks.insert(m_pageChunks.end(), pages, index);
+    m_chunks.push_back(std::make_shared<std::string>(std::move(chunk)));
+    return index;
+}
+
+uint64_t LineStore::packArena(std::string_view line)
+{
+    if(line.size() <= kInlineBytes)
+    {
+        uint64_t entry = static_cast<uint64_t>(kInlineTag | line.size()) << 56;
+        memcpy(&entry, line.data(), line.size());
+        return entry;
+    }
+
+    if(line.size() > kMaxArenaLine)
+        return packOwned(std::string(line));
+
+    if(!m_isLastChunkOpen || m_chunks.back()->size() + line.size() > kChunkBytes)
+    {
+        addChunk(std::string());
+        m_isLastChunkOpen = true;
+    }
+
+    // grown in powers of two up to the page, std::string would go past it
+    std::string& chunk = *m_chunks.back();
+    if(chunk.size() + line.size() > chunk.capacity())
+    {
+        size_t capacity = 1 << 16;
+        while(capacity < chunk.size() + line.size())
+            capacity *= 2;
+        chunk.reserve(std::min(capacity, kChunkBytes));
+    }
+
+    uint64_t address = m_chunkBases.back() + chunk.size();
+    chunk.append(line);
+    return static_cast<uint64_t>(line.size()) << 40 | address;
+}
+
+uint64_t LineStore::packOwned(std::string&& line)
+{
+    if(line.size() <= kInlineBytes)
+        return packArena(line);
+
+    uint32_t slot = takeSlot();
+    m_pool[slot] = std::move(line);
+    return static_cast<uint64_t>(kPoolTag) << 56 | slot;
+}
+
+uint32_t LineStore::takeSlot()
+{
+    if(m_freeSlots.empty())
+    {
+        m_pool.emplace_back();
+        return m_pool.size() - 1;
+    }
+
+    uint32_t slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+}
+
+void LineStore::release(uint64_t entry)
+{
+    uint8_t tag = entry >> 56;
+    if(tag < kInlineTag)
+    {
+        m_deadBytes += (entry >> 40) & kLengthMask;
+    }
+    else if(tag == kPoolTag)
+    {
+        uint32_t slot = entry & 0xFFFFFFFF;
+        std::string().swap(m_pool[slot]);
+        m_freeSlots.push_back(slot);
+    }
+}
+
+void LineStore::push_back(std::string_view line)
+{
+    m_textBytes += line.size();
+    m_lines.push_back(packArena(line));
+}
+
+void LineStore::appendText(std::string&& text)
+{
+    size_t newlines = 0;
+    for(const char* p = text.data(); (p = (const char*)memchr(p, '\n', text.data() + text.size() - p)); p++)
+        newlines++;
+    // grows by doubling, a stream appends many chunks
+    size_t lineCount = m_lines.size() + newlines + 1;
+    if(lineCount > m_lines.capacity())
+        m_lines.reserve(std::max(lineCount, m_lines.capacity() * 2));
+    m_textBytes += text.size() - newlines;
+
+    // the lines point into text where it will be, as a chunk
+    uint64_t base = static_cast<uint64_t>(m_pageChunks.size()) << kPageBits;
+    bool hasArenaLine = false;
+    size_t begin = 0;
+    while(true)
+    {
+        size_t end = text.find('\n', begin);
+        if(end == std::string::npos)
+            end = text.size();
+
+        std::string_view line(text.data() + begin, end - begin);
+        if(line.size() <= kInlineBytes || line.size() > kMaxArenaLine)
+        {
+            m_lines.push_back(line.size() <= kInlineBytes ? packArena(line) : packOwned(std::string(line)));
+        }
+        else
+        {
+            m_lines.push_back(static_cast<uint64_t>(line.size()) << 40 | (base + begin));
+            hasArenaLine = true;
+        }
+
+        if(end == text.size())
+            break;
+        begin = end + 1;
+    }
+
+    if(hasArenaLine)
+    {
+        addChunk(std::move(text));
+        m_isLastChunkOpen = false;
+    }
+}
+
+std::string& LineStore::edit(size_t row)
+{
+    uint64_t& entry = m_lines[row];
+    if(entry >> 56 == kPoolTag)
+        return m_pool[entry & 0xFFFFFFFF];
+
+    uint32_t slot = takeSlot();
+    m_pool[slot] = (*this)[row];
+    release(entry);
+    entry = static_cast<uint64_t>(kPoolTag) << 56 | slot;
+    return m_pool[slot];
+}
+
+void LineStore::set(size_t row, std::string line)
+{
+    m_textBytes += line.size() - (*this)[row].size();
+    release(m_lines[row]);
+    m_lines[row] = packOwned(std::move(line));
+}
+
+void LineStore::insertBytes(size_t row, size_t byte, std::string_view text)
+{
+    m_textBytes += text.size();
+    edit(row).insert(byte, text);
+}
+
+void LineStore::eraseBytes(size_t row, size_t byte, size_t count)
+{
+    std::string& line = edit(row);
+    count = std::min(count, line.size() - byte);
+    m_textBytes -= count;
+    line.erase(byte, count);
+}
+
+void LineStore::insert(size_t row, std::string line)
+{
+    m_textBytes += line.size();
+    m_lines.insert(m_lines.begin() + row, packOwned(std::move(line)));
+}
+
+void LineStore::insert(size_t row, std::vector<std::string>&& lines)
+{
+    std::vector<uint64_t> entries;
+    entries.reserve(lines.size());
+    for(auto& line : lines)
+    {
+        m_textBytes += line.size();
+        entries.push_back(packOwned(std::move(line)));
+    }
+    m_lines.insert(m_lines.begin() + row, entries.begin(), entries.end());
+}
+
+void LineStore::erase(size_t row, size_t count)
+{
+    for(size_t i = row; i < row + count; i++)
+    {
+        m_textBytes -= (*this)[i].size();
+        release(m_lines[i]);
+    }
+    m_lines.erase(m_lines.begin() + row, m_lines.begin() + row + count);
+}
+
+size_t LineStore::memoryUsage() const
+{
+    size_t bytes = m_lines.capacity() * sizeof(uint64_t)
+                 + m_chunkBases.capacity() * sizeof(uint64_t)
+                 + m_pageChunks.capacity() * sizeof(uint32_t)
+                 + m_freeSlots.capacity() * sizeof(uint32_t)
+                 + m_chunks.capacity() * sizeof(std::shared_ptr<std::string>)
+                 + m_pool.capacity() * sizeof(std::string);
+    for(auto& chunk : m_chunks)
+        bytes += chunk->capacity() + sizeof(std::string);
+    for(auto& line : m_pool)
+        bytes += line.capacity() > 15 ? line.capacity() + 1 : 0;
+    return bytes;
+}
@@ -0,0 +1,242 @@
+#include "LineWidths.h"
+#include "utils/utf8Utils.hpp"
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+
+// Walks the characters of line from (byte, col). Stops at untilByte, or
+// before the first character that would end past untilCol; zero width
+// characters never stop it. col counts from the line start, where the tab
+// stops are.
+void walk(std::string_view line, int& byte, int& col, int untilByte, int untilCol)
+{
+    const char* data = line.data();
+    int size = line.size();
+    while(byte < size && byte < untilByte)
+    {
+        int run = utf8_plain_prefix(data + byte, size - byte);
+        if(run > 0)
+        {
+            int take = std::min(run, std::min(untilByte - byte, untilCol - col));
+            byte += take;
+            col  += take;
+            if(take < run)
+                return;
+            continue;
+        }
+
+        int width = utf8_column_width(data + byte, size - byte, col);
+        if(width > 0 && col + width > untilCol)
+            return;
+        col  += width;
+        byte += utf8_step(data + byte, size - byte);
+    }
+}
+
+}
+
+LineWidths::LineWidths()
+{
+    m_text = nullptr;
+}
+
+void LineWidths::attach(const TextBuffer* text)
+{
+    m_text = text;
+}
+
+void LineWidths::reset(int lineCount, bool isAllAscii)
+{
+    m_kinds.assign(lineCount, isAllAscii ? kAscii : kUnknown);
+    m_indexes.clear();
+}
+
+void LineWidths::lineChanged(int row, int fromByte)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return;
+
+    // a line that lost its last non ASCII character or tab stays kUtf8 :
+    // still right, only not on the fast path
+    if(m_kinds[row] != kUtf8 || fromByte <= 0)
+    {
+        m_kinds[row] = kUnknown;
+        m_indexes.erase(row);
+        return;
+    }
+
+    auto it = m_indexes.find(row);
+    if(it == m_indexes.end())
+        return;
+
+    Index& index = it->second;
+    while(index.points.size() > 1 && index.points.back().byte >= fromByte)
+        index.points.pop_back();
+    index.isComplete = false;
+}
+
+void LineWidths::shiftIndexes(int row, int delta)
+{
+    std::vector<std::pair<int, Index>> moved;
+    for(auto it = m_indexes.lower_bound(row); it != m_indexes.end(); )
+    {
+        moved.push_back({it->first + delta, std::move(it->second)});
+        it = m_indexes.erase(it);
+    }
+
+    for(auto& item : moved)
+        m_indexes[item.first] = std::move(item.second);
+}
+
+void LineWidths::linesInserted(int row, int count)
+{
+    row = std::min<int>(std::max(row, 0), m_kinds.size());
+    m_kinds.insert(m_kinds.begin() + row, count, kUnknown);
+    shiftIndexes(row, count);
+}
+
+void LineWidths::linesErased(int row, int count)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return;
+
+    count = std::min<int>(count, m_kinds.size() - row);
+    m_kinds.erase(m_kinds.begin() + row, m_kinds.begin() + row + count);
+    m_indexes.erase(m_indexes.lower_bound(row), m_indexes.lower_bound(row + count));
+    shiftIndexes(row + count, -count);
+}
+
+bool LineWidths::isAscii(int row)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return true;
+
+    if(m_kinds[row] == kUnknown)
+    {
+        std::string_view line = (*m_text)[row];
+        m_kinds[row] = utf8_plain_prefix(line.data(), line.size()) == line.size() ? kAscii : kUtf8;
+    }
+    return m_kinds[row] == kAscii;
+}
+
+// lays checkpoints down until one is past byte or col, or the line ends
+void LineWidths::extend(Index& index, std::string_view line, int byte, int col)
+{
+    if(index.points.empty())
+        index.points.push_back({0, 0});
+
+    while(!index.isComplete && index.points.back().byte <= byte && index.points.back().col <= col)
+    {
+        Checkpoint point = index.points.back();
+        walk(line, point.byte, point.col, point.byte + kCheckpointBytes, INT_MAX);
+        index.points.push_back(point);
+
+        if(point.byte >= (int)line.size())
+        {
+            index.isComplete = true;
+            index.columns    = point.col;
+        }
+    }
+}
+
+// the last known character start at or before both byte and col
+LineWidths::Checkpoint LineWidths::startFor(int row, int byte, int col)
+{
+    std::string_view line = (*m_text)[row];
+    if(line.size() < kIndexedLineBytes)
+        return {0, 0};
+
+    Index& index = m_indexes[row];
+    extend(index, line, byte, col);
+
+    auto it = std::upper_bound(index.points.begin(), index.points.end(), Checkpoint{byte, col},
+                               [](const Checkpoint& target, const Checkpoint& point){
+                                   return point.byte > target.byte || point.col > target.col;
+                               });
+    return *(it - 1);
+}
+
+int LineWidths::columns(int row)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return 0;
+
+    std::string_view line = (*m_text)[row];
+    if(isAscii(row))
+        return line.size();
+    if(line.size() < kIndexedLineBytes)
+        return utf8_width(line.data(), line.size());
+
+    Index& index = m_indexes[row];
+    extend(index, line, INT_MAX, INT_MAX);
+    return index.columns;
+}
+
+int LineWidths::byteAt(int row, int col, int* startCol, int* charWidth)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return 0;
+
+    std::string_view line = (*m_text)[row];
+    int size = line.size();
+    Checkpoint pos;
+    if(isAscii(row))
+    {
+        pos.byte = std::min(std::max(col, 0), size);
+        pos.col  = pos.byte;
+    }
+    else
+    {
+        col = std::max(col, 0);
+        pos = startFor(row, INT_MAX, col);
+        walk(line, pos.byte, pos.col, INT_MAX, col);
+    }
+
+    if(startCol)
+        *startCol = pos.col;
+    if(charWidth)
+        *charWidth = pos.byte < size ? utf8_column_width(line.data() + pos.byte, size - pos.byte, pos.col) : 0;
+    return pos.byte;
+}
+
+int LineWidths::columnAt(int row, int byte)
+{
+    if(row < 0 || row >= (int)m_kinds.size())
+        return 0;
+
+    std::string_view line = (*m_text)[row];
+    if(isAscii(row))
+        return std::min<int>(std::max(byte, 0), line.size());
+
+    byte = std::max(byte, 0);
+    Checkpoint pos = startFor(row, byte, INT_MAX);
+    walk(line, pos.byte, pos.col, byte, INT_MAX);
+    return pos.col;
+}
+
+int LineWidths::nextColumn(int row, int col)
+{
+    int start;
+    int width;
+    byteAt(row, col, &start, &width);
+    return start + width;
+}
+
+int LineWidths::prevColumn(int row, int col)
+{
+    if(col <= 0)
+        return 0;
+
+    int start;
+    byteAt(row, col - 1, &start);
+    return start;
+}
+
+int LineWidths::snapColumn(int row, int col)
+{
+    int start;
+    byteAt(row, col, &start);
+    return start;
+}
@@ -0,0 +1,345 @@
+#include "SyntaxConfig.h"
+#include "utils/json11.hpp"
+#include <map>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SYNTAX_CACHE_MAGIC 0x5953434b  // "KCSY"
+
+// the image starts with it, the tables follow in this order : pairs
+// (int16, padded to 4 bytes), keywords, rules, strings
+struct SyntaxCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t  jsonMtimeNs;   // the json it was made from
+    int64_t  jsonSize;
+    uint64_t jsonHash;
+    int32_t  colorComment;
+    int32_t  colorString;
+    int32_t  colorUserDef;
+    int32_t  viewerMinMb;
+    uint32_t isDirectOutput;
+    uint32_t isSoftWrap;
+    uint32_t pairCount;
+    uint32_t keywordCount;
+    uint32_t ruleCount;
+    uint32_t stringBytes;
+};
+
+static uint64_t hashBytes(const std::string& bytes)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(unsigned char byte : bytes)
+        hash = (hash ^ byte) * 1099511628211ull;
+    return hash;
+}
+
+static size_t pairBytes(uint32_t pairCount)
+{
+    return (pairCount * sizeof(int16_t) + 3) & ~(size_t)3;
+}
+
+SyntaxConfig::SyntaxConfig()
+{
+    m_map         = nullptr;
+    m_mapBytes    = 0;
+    m_header      = nullptr;
+    m_pairs       = nullptr;
+    m_keywords    = nullptr;
+    m_rules       = nullptr;
+    m_strings     = nullptr;
+    m_isFromCache = false;
+}
+
+SyntaxConfig::~SyntaxConfig()
+{
+    unmap();
+}
+
+void SyntaxConfig::unmap()
+{
+    if(m_map)
+        munmap(m_map, m_mapBytes);
+    m_map      = nullptr;
+    m_mapBytes = 0;
+}
+
+// points the tables into data, false if it is not a whole image
+bool SyntaxConfig::bind(const char* data, size_t size)
+{
+    m_header = nullptr;
+    if(size < sizeof(SyntaxCacheHeader))
+        return false;
+
+    const SyntaxCacheHeader* header = (const SyntaxCacheHeader*)data;
+    if(header->magic != SYNTAX_CACHE_MAGIC || header->version != kVersion)
+        return false;
+
+    size_t keywordsAt = sizeof(SyntaxCacheHeader) + pairBytes(header->pairCount);
+    size_t rulesAt    = keywordsAt + (size_t)header->keywordCount * sizeof(Keyword);
+    size_t stringsAt  = rulesAt + (size_t)header->ruleCount * sizeof(Rule);
+    if(stringsAt + header->stringBytes != size)
+        return false;
+
+    const Keyword* keywords = (const Keyword*)(data + keywordsAt);
+    const Rule*    rules    = (const Rule*)(data + rulesAt);
+    auto isInside = [&](uint32_t offset, uint32_t length) {
+        return offset <= header->stringBytes && length <= header->stringBytes - offset;
+    };
+    for(uint32_t i = 0; i < header->keywordCount; i++)
+    {
+        if(!isInside(keywords[i].offset, keywords[i].length))
+            return false;
+    }
+    for(uint32_t i = 0; i < header->ruleCount; i++)
+    {
+        if(!isInside(rules[i].nameOffset, rules[i].nameLength) ||
+           !isInside(rules[i].patternOffset, rules[i].patternLength))
+            return false;
+    }
+
+    m_header   = header;
+    m_pairs    = (const int16_t*)(data + sizeof(SyntaxCacheHeader));
+    m_keywords = keywords;
+    m_rules    = rules;
+    m_strings  = data + stringsAt;
+    return true;
+}
+
+// json11 parse and walk, only when the cache does not hold
+std::string SyntaxConfig::compile(const std::string& json, std::string* error)
+{
+    std::string parseError;
+    json11::Json config = json11::Json::parse(json, parseError);
+    if(!parseError.empty())
+    {
+        if(error)
+            *error = parseError;
+        return {};
+    }
+
+    SyntaxCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic          = SYNTAX_CACHE_MAGIC;
+    header.version        = kVersion;
+    header.jsonSize       = -1;
+    header.jsonHash       = hashBytes(json);
+    header.colorComment   = config["comment"].int_value();
+    header.colorString    = config["string"].int_value();
+    header.colorUserDef   = config["user_def"].int_value();
+    header.viewerMinMb    = config["viewer_min_mb"].int_value();
+    header.isDirectOutput = config["direct_output"].bool_value();
+    header.isSoftWrap     = config["soft_wrap"].bool_value();
+
+    // "configurations" entry i is color pair i + 1, a later entry wins a keyword
+    std::vector<int16_t> pairs;
+    std::map<std::string, int> keywords;
+    for(auto& item : config["configurations"].array_items())
+    {
+        pairs.push_back(item["fg"].int_value());
+        for(auto& key : item["keys"].array_items())
+            keywords[key.string_value()] = pairs.size();
+    }
+
+    std::string strings;
+    auto addString = [&](const std::string& text, uint32_t* offset, uint32_t* length) {
+        *offset = strings.size();
+        *length = text.size();
+        strings += text;
+    };
+
+    std::vector<Keyword> keywordTable;
+    for(auto& keyword : keywords)
+    {
+        Keyword entry;
+        addString(keyword.first, &entry.offset, &entry.length);
+        entry.color = keyword.second;
+        keywordTable.push_back(entry);
+    }
+
+    std::vector<Rule> ruleTable;
+    for(auto& item : config["rules"].array_items())
+    {
+        Rule entry;
+        addString(item["name"].string_value(), &entry.nameOffset, &entry.nameLength);
+        addString(item["pattern"].string_value(), &entry.patternOffset, &entry.patternLength);
+        entry.color  = item["color"].int_value();
+        entry.isWord = item["keywords"].bool_value();
+        ruleTable.push_back(entry);
+    }
+
+    header.pairCount    = pairs.size();
+    header.keywordCount = keywordTable.size();
+    header.ruleCount    = ruleTable.size();
+    header.stringBytes  = strings.size();
+
+    std::string image((const char*)&header, sizeof(header));
+    image.append((const char*)pairs.data(), pairs.size() * sizeof(int16_t));
+    image.resize(sizeof(header) + pairBytes(header.pairCount), '\0');
+    image.append((const char*)keywordTable.data(), keywordTable.size() * sizeof(Keyword));
+    image.append((const char*)ruleTable.data(), ruleTable.size() * sizeof(Rule));
+    image += strings;
+    return image;
+}
+
+bool SyntaxConfig::load(const std::string& jsonPath, const std::string& cachePath, std::string* error)
+{
+    unmap();
+    m_image.clear();
+    m_header      = nullptr;
+    m_isFromCache = false;
+
+    struct stat info;
+    bool hasJson = stat(jsonPath.c_str(), &info) == 0;
+    int64_t mtimeNs = hasJson ? (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec : -1;
+    int64_t size    = hasJson ? (int64_t)info.st_size : -1;
+
+    int fd = open(cachePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd >= 0)
+    {
+        struct stat cacheInfo;
+        if(fstat(fd, &cacheInfo) == 0 && cacheInfo.st_size >= (off_t)sizeof(SyntaxCacheHeader))
+        {
+            void* map = mmap(nullptr, cacheInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED)
+            {
+                m_map      = map;
+                m_mapBytes = cacheInfo.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    bool isCached = m_map && hasJson && bind((const char*)m_map, m_mapBytes);
+    if(isCached && m_header->jsonMtimeNs == mtimeNs && m_header->jsonSize == size)
+    {
+        m_isFromCache = true;
+        return true;
+    }
+
+    std::string json;
+    if(hasJson)
+    {
+        std::ifstream file(jsonPath);
+        json.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::string parseError;
+    if(isCached && m_header->jsonHash == hashBytes(json))
+    {
+        // the same text with a new mtime : only the stamp of the cache changes
+        m_image.assign((const char*)m_map, m_mapBytes);
+        m_isFromCache = true;
+    }
+    else if(hasJson)
+    {
+        m_image = compile(json, &parseError);
+    }
+    unmap();
+
+    bool isValid = !m_image.empty();
+    if(!isValid)
+        m_image = compile("{}", nullptr);
+
+    SyntaxCacheHeader* header = (SyntaxCacheHeader*)&m_image[0];
+    if(isValid)
+    {
+        header->jsonMtimeNs = mtimeNs;
+        header->jsonSize    = size;
+
+        // rename so a concurrent start never reads a half written cache
+        std::string tmpPath = cachePath + ".tmp";
+        FILE* file = fopen(tmpPath.c_str(), "wb");
+        bool isWritten = file && fwrite(m_image.data(), 1, m_image.size(), file) == m_image.size();
+        isWritten = file && fclose(file) == 0 && isWritten;
+        if(!isWritten || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+            remove(tmpPath.c_str());
+    }
+    bind(m_image.data(), m_image.size());
+
+    if(!parseError.empty())
+    {
+        if(error)
+            *error = parseError;
+        return false;
+    }
+    return true;
+}
+
+uint64_t SyntaxConfig::hash() const
+{
+    return m_header ? m_header->jsonHash : 0;
+}
+
+int SyntaxConfig::colorComment() const
+{
+    return m_header ? m_header->colorComment : 0;
+}
+
+int SyntaxConfig::colorString() const
+{
+    return m_header ? m_header->colorString : 0;
+}
+
+int SyntaxConfig::colorUserDef() const
+{
+    return m_header ? m_header->colorUserDef : 0;
+}
+
+bool SyntaxConfig::isDirectOutput() const
+{
+    return m_header && m_header->isDirectOutput;
+}
+
+bool SyntaxConfig::isSoftWrap() const
+{
+    return m_header && m_header->isSoftWrap;
+}
+
+int SyntaxConfig::viewerMinMb() const
+{
+    return m_header ? m_header->viewerMinMb : 0;
+}
+
+size_t SyntaxConfig::pairCount() const
+{
+    return m_header ? m_header->pairCount : 0;
+}
+
+int SyntaxConfig::colorOf(std::string_view word) const
+{
+    if(!m_header)
+        return 0;
+
+    auto keyOf = [this](const Keyword& keyword) {
+        return std::string_view(m_strings + keyword.offset, keyword.length);
+    };
+    const Keyword* end = m_keywords + m_header->keywordCount;
+    const Keyword* it  = std::lower_bound(m_keywords, end, word, [&](const Keyword& keyword, std::string_view value) {
+        return keyOf(keyword) < value;
+    });
+    return it != end && keyOf(*it) == word ? it->color : 0;
+}
+
+std::vector<TokenRule> SyntaxConfig::rules() const
+{
+    std::vector<TokenRule> rules;
+    for(uint32_t i = 0; m_header && i < m_header->ruleCount; i++)
+    {
+        const Rule& entry = m_rules[i];
+        TokenRule rule;
+        rule.name    = std::string(m_strings + entry.nameOffset, entry.nameLength);
+        rule.pattern = std::string(m_strings + entry.patternOffset, entry.patternLength);
+        rule.color   = entry.color;
+        rule.isWord  = entry.isWord;
+        rules.push_back(rule);
+    }
+    return rules;
+}
@@ -0,0 +1,374 @@
+#include "TermWriter.h"
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define SYNC_OUTPUT_BEGIN "\x1b[?2026h"
+#define SYNC_OUTPUT_END   "\x1b[?2026l"
+#define UNKNOWN_COLOR     -2
+
+TermWriter::TermWriter(int fd)
+{
+    m_fd = fd;
+    m_isSyncOutput = false;
+    m_buffer.reserve(kBufferBytes);
+    m_rowStart   = 0;
+    m_rowBody    = 0;
+    m_rowCol     = 0;
+    m_row        = -1;
+    m_frameStart = 0;
+    m_frames = 0;
+    m_writes = 0;
+    m_bytes  = 0;
+    invalidate();
+}
+
+void TermWriter::invalidate()
+{
+    m_rowHashes.clear();
+    m_fg = UNKNOWN_COLOR;
+    m_bg = UNKNOWN_COLOR;
+    m_cursorRow = -1;
+    m_cursorCol = -1;
+}
+
+void TermWriter::appendNumber(int value)
+{
+    char digits[12];
+    int  count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while(value > 0);
+
+    while(count > 0)
+        m_buffer.push_back(digits[--count]);
+}
+
+// base 30 : foreground, 40 : background
+void TermWriter::appendColor(short color, int base)
+{
+    if(color < 0)
+    {
+        appendNumber(base + 9);
+    }
+    else if(color < 8)
+    {
+        appendNumber(base + color);
+    }
+    else if(color < 16)
+    {
+        appendNumber(base + 60 + color - 8);
+    }
+    else
+    {
+        appendNumber(base + 8);
+        m_buffer.append(";5;");
+        appendNumber(color);
+    }
+}
+
+void TermWriter::beginFrame()
+{
+    m_buffer.clear();
+    if(m_isSyncOutput)
+        m_buffer.append(SYNC_OUTPUT_BEGIN);
+    m_frameStart = m_buffer.size();
+
+    if(m_fg == UNKNOWN_COLOR || m_bg == UNKNOWN_COLOR)
+    {
+        m_buffer.append("\x1b[0m");
+        m_fg = kDefaultColor;
+        m_bg = kDefaultColor;
+    }
+}
+
+void TermWriter::beginRow(int row, int col)
+{
+    m_row      = row;
+    m_rowStart = m_buffer.size();
+
+    m_buffer.append("\x1b[");
+    appendNumber(row + 1);
+    m_buffer.push_back(';');
+    appendNumber(col + 1);
+    m_buffer.push_back('H');
+    m_rowBody = m_buffer.size();
+    m_rowCol  = col;
+}
+
+void TermWriter::setColor(short fg, short bg)
+{
+    if(fg == m_fg && bg == m_bg)
+        return;
+
+    m_buffer.append("\x1b[");
+    if(fg != m_fg)
+        appendColor(fg, 30);
+    if(fg != m_fg && bg != m_bg)
+        m_buffer.push_back(';');
+    if(bg != m_bg)
+        appendColor(bg, 40);
+    m_buffer.push_back('m');
+
+    m_fg = fg;
+    m_bg = bg;
+}
+
+void TermWriter::text(const char* str, int len)
+{
+    if(len > 0)
+        m_buffer.append(str, len);
+}
+
+void TermWriter::fill(char ch, int count)
+{
+    if(count > 0)
+        m_buffer.append(count, ch);
+}
+
+void TermWriter::lineDrawing(const char* chars)
+{
+    m_buffer.append("\x1b(0");
+    m_buffer.append(chars);
+    m_buffer.append("\x1b(B");
+}
+
+void TermWriter::scrollRows(int top, int bottom, int count)
+{
+    int height = bottom - top + 1;
+    if(count == 0 || height <= 0)
+        return;
+
+    if(count >= height || -count >= height)
+    {
+        // nothing survives, the rows are simply repainted
+        for(int row = top; row <= bottom && row < (int)m_rowHashes.size(); row++)
+            m_rowHashes[row] = 0;
+        return;
+    }
+
+    // DECSTBM, SU or SD, then back to the full screen. Cleared rows take
+    // the current background, the colors are always default between rows.
+    m_buffer.append("\x1b[");
+    appendNumber(top + 1);
+    m_buffer.push_back(';');
+    appendNumber(bottom + 1);
+    m_buffer.append("r\x1b[");
+    appendNumber(count > 0 ? count : -count);
+    m_buffer.push_back(count > 0 ? 'S' : 'T');
+    m_buffer.append("\x1b[r");
+    m_cursorRow = -1;
+
+    if((int)m_rowHashes.size() <= bottom)
+        m_rowHashes.resize(bottom + 1, 0);
+
+    std::vector<uint64_t> moved(height, 0);
+    for(int i = 0; i < height; i++)
+    {
+        int from = i + count;
+        if(from >= 0 && from < height)
+            moved[i] = m_rowHashes[top + from];
+    }
+    std::copy(moved.begin(), moved.end(), m_rowHashes.begin() + top);
+}
+
+void TermWriter::endRow()
+{
+    setColor(kDefaultColor, kDefaultColor);
+    if(m_row < 0)
+        return;
+
+    // FNV-1a of the row bytes and column, not of the row number so the
+    // hash still matches after a scroll
+    uint64_t hash = 14695981039346656037ULL ^ m_rowCol;
+    for(size_t i = m_rowBody; i < m_buffer.size(); i++)
+    {
+        hash ^= (unsigned char)m_buffer[i];
+        hash *= 1099511628211ULL;
+    }
+
+    if(m_row >= (int)m_rowHashes.size())
+        m_rowHashes.resize(m_row + 1, 0);
+
+    if(m_rowHashes[m_row] == hash)
+        m_buffer.resize(m_rowStart);
+    else
+        m_rowHashes[m_row] = hash;
+
+    m_row = -1;
+}
+
+bool TermWriter::endFrame(int cursorRow, int cursorCol)
+{
+    bool hasRows = m_buffer.size() > m_frameStart;
+    if(!hasRows && cursorRow == m_cursorRow && cursorCol == m_cursorCol)
+    {
+        m_buffer.clear();
+        return false;
+    }
+
+    m_buffer.append("\x1b[");
+    appendNumber(cursorRow + 1);
+    m_buffer.push_back(';');
+    appendNumber(cursorCol + 1);
+    m_buffer.push_back('H');
+    m_cursorRow = cursorRow;
+    m_cursorCol = cursorCol;
+
+    if(m_isSyncOutput)
+        m_buffer.append(SYNC_OUTPUT_END);
+
+    m_frames++;
+    bool isOk = flush();
+    m_buffer.clear();
+    if(!isOk)
+        invalidate();
+    return isOk;
+}
+
+bool TermWriter::flush()
+{
+    const char* data = m_buffer.data();
+    size_t left = m_buffer.size();
+    while(left > 0)
+    {
+        ssize_t written = write(m_fd, data, left);
+        m_writes++;
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            if(errno == EAGAIN)
+            {
+                pollfd pfd = {m_fd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+
+        data  += written;
+        left  -= written;
+        m_bytes += written;
+    }
+    return true;
+}
+
+bool TermWriter::probeSyncOutput(int inFd, int timeoutMs, std::string& pending)
+{
+    const char* query = "\x1b[?2026$p\x1b[c";
+    if(write(m_fd, query, strlen(query)) < 0)
+        return false;
+
+    bool isSupported = false;
+    bool isDone      = false;
+    std::string input;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    while(!isDone)
+    {
+        int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+        if(left <= 0)
+            break;
+
+        pollfd pfd = {inFd, POLLIN, 0};
+        if(poll(&pfd, 1, left) <= 0)
+            continue;
+
+        char chunk[256];
+        ssize_t count = read(inFd, chunk, sizeof(chunk));
+        if(count <= 0)
+            break;
+        input.append(chunk, count);
+
+        // take the "ESC [ ? params final" replies out, keep everything else
+        size_t pos = 0;
+        while(pos < input.size())
+        {
+            size_t start = input.find("\x1b[?", pos);
+            if(start == std::string::npos)
+            {
+                // a reply may be cut right after its ESC or "ESC ["
+                size_t keep = input.size();
+                if(keep - pos >= 1 && input[keep - 1] == '\x1b')
+                    keep -= 1;
+                else if(keep - pos >= 2 && input.compare(keep - 2, 2, "\x1b[") == 0)
+                    keep -= 2;
+
+                pending.append(input, pos, keep - pos);
+                pos = keep;
+                break;
+            }
+            pending.append(input, pos, start - pos);
+
+            size_t end = start + 3;
+            while(end < input.size() && !(input[end] >= 0x40 && input[end] <= 0x7e))
+                end++;
+            if(end >= input.size())
+            {
+                pos = start;    // incomplete, wait for the rest
+                break;
+            }
+
+            std::string reply = input.substr(start + 3, end - start - 3);
+            if(input[end] == 'y' && reply.compare(0, 5, "2026;") == 0)
+            {
+                // 1 set, 2 reset : the mode is known. 0 or 4 : it is not
+                int value = atoi(reply.c_str() + 5);
+                isSupported = value == 1 || value == 2;
+            }
+            else if(input[end] == 'c')
+            {
+                isDone = true;
+            }
+            else
+            {
+                pending.append(input, start, end - start + 1);
+            }
+            pos = end + 1;
+        }
+        input.erase(0, pos);
+    }
+
+    pending.append(input);
+
+    // do not hand back a key sequence cut in the middle
+    auto isCut = [&pending]() {
+        size_t esc = pending.rfind('\x1b');
+        if(esc == std::string::npos)
+            return false;
+        if(esc + 1 == pending.size())
+            return true;
+        if(pending[esc + 1] == 'O')
+            return esc + 2 == pending.size();
+        if(pending[esc + 1] != '[')
+            return false;
+        for(size_t i = esc + 2; i < pending.size(); i++)
+        {
+            if(pending[i] >= 0x40 && pending[i] <= 0x7e)
+                return false;
+        }
+        return true;
+    };
+
+    pollfd pfd = {inFd, POLLIN, 0};
+    while(isCut() && poll(&pfd, 1, 20) > 0)
+    {
+        char chunk[64];
+        ssize_t count = read(inFd, chunk, sizeof(chunk));
+        if(count <= 0)
+            break;
+        pending.append(chunk, count);
+    }
+
+    m_isSyncOutput = isSupported;
+    return isSupported;
+}
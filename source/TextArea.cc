@@ -1,20 +1,100 @@
 #include "TextArea.h"
 #include "utils/lexerUtils.hpp"
-#include "utils/json11.hpp"
+#include "utils/replaceUtils.hpp"
+#include "utils/utf8Utils.hpp"
+#include "utils/lineDiff.hpp"
 #include <fstream>
 #include <queue>
 #include <regex>
-#include <chrono>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cstring>
+#include <algorithm>
 
 #define MY_KEY_RETURN 10
 #define MY_KEY_BACK 127
 #define MY_KEY_TAB 9
+#define MY_KEY_ESC 27
+#define MY_KEY_UNDO 26
+#define MY_KEY_CR 13
+
+// how long a lone ESC waits for the status reply before it is taken as
+// the Esc key, only reached on terminals that do not answer DSR
+#define ESC_FALLBACK_MS 250
+
+// user types are parsed again once the typing pauses this long
+#define USER_DEF_DELAY_MS 500
+
+// undo keeps at most this many records and this much of their text, the
+// newest step is kept whatever its size
+#define UNDO_MAX_RECORDS 10000
+#define UNDO_MAX_BYTES   (256 << 20)
+
+// viewer : files from this size on open read only ("viewer_min_mb"), the
+// slice keeps this many lines above and below the view
+#define VIEWER_MIN_MB      1024
+#define VIEWER_SLACK_LINES 512
+
+// the open file's stamp is checked once its directory was quiet this long
+#define FILE_DELAY_MS 50
+
+// follow mode : a growing file is taken in at most this often
+#define FOLLOW_DELAY_MS 50
+
+// syntax.json is read again once its directory was quiet this long
+#define CONFIG_DELAY_MS 100
+
+// stdin : at most this much is read per wakeup, keys go in between; past
+// the first screen the lines go in at most this often
+#define STREAM_CHUNK_BYTES (1 << 20)
+#define STREAM_DELAY_MS    20
+
+#define BRACKETED_PASTE_ON  "\x1b[?2004h"
+#define BRACKETED_PASTE_OFF "\x1b[?2004l"
 
 extern int g_exitApp;
 
-TextArea::TextArea(/* args */)
+static FileStamp fileStamp(const std::string& fileName)
+{
+    struct stat info;
+    if(stat(fileName.c_str(), &info) != 0)
+        return {-1, -1};
+    return {(int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec, (int64_t)info.st_size};
+}
+
+TextArea::TextArea(EventLoop& loop) : m_loop(loop), m_fileIo(loop)
 {
+    // before any thread starts, so they all keep SIGWINCH blocked
+    m_resizeSignal = m_loop.addSignal(SIGWINCH, [this](){ onResize(); });
+    m_escTimer     = m_loop.addTimer([this](){ onEscTimer(); });
+    m_userDefTimer = m_loop.addTimer([this](){
+        {
+            std::lock_guard<std::mutex> lock(m_userDefMutex);
+            m_isUserDefRequested = true;
+        }
+        m_userDefWakeup.notify_one();
+    });
+    m_followTimer  = m_loop.addTimer([this](){
+        m_isFollowArmed = false;
+        {
+            std::lock_guard<std::mutex> lock(m_viewMutex);
+            followTail();
+        }
+        requestFrame();
+    });
+    m_streamTimer  = m_loop.addTimer([this](){
+        m_isStreamArmed = false;
+        takeStream();
+    });
+    m_configTimer  = m_loop.addTimer([this](){ reloadConfig(); });
+    m_fileTimer    = m_loop.addTimer([this](){ checkFileStamp(); });
+
     lineNumberWidth = 2;
     m_windPos.row = 2;
     m_windPos.col = 4;
@@ -33,57 +113,264 @@ TextArea::TextArea(/* args */)
 
     // scrollok(m_window, TRUE);
     keypad(m_window, TRUE);
+
+    // lets ncurses scroll with insert/delete line when the view moves
+    idlok(m_window, TRUE);
     wclear(m_window);
     wmove(m_window, 0, 0);
     wrefresh(m_window);
     
-    m_text.push_back("");
+    m_inputDecoder.loadTerminfo();
 
-    // load syntax file
+    m_text.push_back("");
+    m_version         = 1;
+    m_paintedVersion  = 0;
+    m_isRenderRunning = true;
+    m_highlighter.attach(&m_docMutex, &m_text);
+    m_wrap.attach(&m_text, &m_widths);
+    m_widths.attach(&m_text);
+    m_wrap.reset(m_text.size());
+    m_widths.reset(m_text.size());
+    m_wrap.setWidth(m_scrollView.size.width);
+    m_wrapTopRow = 0;
+    m_highlighter.setUpdateCallback([this](){ requestFrame(); });
+
+    // load syntax file, from its compiled cache when that is up to date
     char* curUser = getenv ("USER");
-    std::string pathFileSyntax = "/home/" + std::string(curUser) + "/" + ".keditor/syntax.json";
-    std::ifstream t(pathFileSyntax);
-    std::string str((std::istreambuf_iterator<char>(t)),
-                  std::istreambuf_iterator<char>());
-  
-    std::string err_comment;
-    auto json_comment = json11::Json::parse(str.c_str(), err_comment);
-    auto listC = json_comment["configurations"].array_items();
-
-    colorComment = json_comment["comment"].int_value();
-    colorUserDef = json_comment["user_def"].int_value();
-
-    int idColor = 1;
-    init_color(0, 1000, 0, 0);
+    std::string pathConfigDir  = "/home/" + std::string(curUser) + "/" + ".keditor/";
+    std::string syntaxError;
+    auto syntax = std::make_shared<SyntaxConfig>();
+    if(!syntax->load(pathConfigDir + "syntax.json", pathConfigDir + "syntax.cache", &syntaxError))
+        setStatus("syntax.json: " + syntaxError);
+    m_syntax      = syntax;
+    m_configDir   = pathConfigDir;
+    m_configStamp = fileStamp(pathConfigDir + "syntax.json");
+    m_isConfigLoading = false;
+    m_isConfigPending = false;
+
+    // editors save by renaming over the file, so the directory is watched
+    m_configWatch = m_loop.watchPath(pathConfigDir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE,
+                                     [this](uint32_t mask, const std::string&){
+        if(!(mask & IN_IGNORED))
+            m_loop.armTimer(m_configTimer, CONFIG_DELAY_MS);
+    });
+
+    colorComment = m_syntax->colorComment();
+    colorString  = m_syntax->colorString();
+    colorUserDef = m_syntax->colorUserDef();
 
-    for(auto iItem : listC)
+    init_color(0, 1000, 0, 0);
+    for(size_t i = 0; i < m_syntax->pairCount(); i++)
+        init_pair(i + 1, m_syntax->pairColor(i), -1);
+
+    m_highlighter.setBuiltinColors(colorComment, colorString);
+
+    m_isDirectOutput = m_syntax->isDirectOutput();
+    m_paintedPos     = {-1, -1};
+    m_paintedSubRow  = -1;
+    m_termSize       = {COLS, LINES};
+    m_isRelayout     = false;
+    m_isSoftWrap     = m_syntax->isSoftWrap();
+
+    int viewerMinMb  = m_syntax->viewerMinMb();
+    m_viewerMinBytes = (uint64_t)(viewerMinMb > 0 ? viewerMinMb : VIEWER_MIN_MB) << 20;
+    m_isViewer       = false;
+    m_isFollowing    = false;
+    m_isFollowArmed  = false;
+    m_streamFd       = -1;
+    m_isStreaming    = false;
+    m_isStreamArmed  = false;
+    m_viewEnd        = 0;
+    m_viewCursor     = UINT64_MAX;
+    if(m_isDirectOutput)
     {
-      int colorN  = iItem["fg"].int_value();
-      init_pair(idColor, colorN, -1);
+        // keys typed during the probe are decoded like any other input
+        std::string pending;
+        m_termWriter.probeSyncOutput(STDIN_FILENO, 200, pending);
 
-      json11::Json::array keys  = iItem["keys"].array_items();
-      for(auto& key : keys)
-      {
-          m_colorMap[key.string_value()]  = idColor;
-      }
+        std::vector<KeyEvent> events;
+        m_inputDecoder.feed(pending.data(), pending.size(), events);
+        m_keys.insert(m_keys.end(), events.begin(), events.end());
+    }
 
-      idColor++;
+    std::vector<TokenRule> rules = m_syntax->rules();
+    if(!rules.empty())
+    {
+        m_highlighter.setDfa(loadSyntaxRules(rules, pathConfigDir + "syntax.dfa", &syntaxError));
+        if(!syntaxError.empty())
+            setStatus(syntaxError);
     }
 
-    m_threadParseSyntax = std::thread([&](){
-        while (m_isRunThreadPraseSyntax)
+    m_highlighter.startWorker();
+
+    m_editCount       = 0;
+    m_undoGroupCount  = 0;
+    m_undoGroup       = 0;
+    m_undoBytes       = 0;
+    m_parsedEditCount = 0;
+    m_fileWatch       = -1;
+    m_savedStamp      = {-1, -1};
+    m_isLoading       = false;
+    m_savesInFlight   = 0;
+    m_compression     = Compression::None;
+    m_savedEditCount  = 0;
+    m_isDiskChanged    = false;
+    m_isOverwriteAsked = false;
+    m_isReloading      = false;
+    m_isReloadPending  = false;
+    m_isReplacing      = false;
+
+    m_isRunThreadPraseSyntax = true;
+    m_isUserDefRequested     = false;
+    m_threadParseSyntax = std::thread([this](){
+        while(true)
         {
-            this->parseUserDefColor();
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            {
+                std::unique_lock<std::mutex> lock(m_userDefMutex);
+                m_userDefWakeup.wait(lock, [this](){
+                    return !m_isRunThreadPraseSyntax || m_isUserDefRequested;
+                });
+                if(!m_isRunThreadPraseSyntax)
+                    break;
+                m_isUserDefRequested = false;
+            }
+
+            if(parseUserDefColor())
+                m_loop.post([this](){ requestFrame(); });
         }
-        
     });
 
     DrawBoder();
+
+    // a paste arrives as one event instead of being typed key by key
+    write(STDOUT_FILENO, BRACKETED_PASTE_ON, strlen(BRACKETED_PASTE_ON));
+
+    m_renderThread = std::thread([this](){ renderLoop(); });
+
+    m_loop.addFd(STDIN_FILENO, [this](){ onInput(); });
+
+    // keys typed during the probe, once the file is open
+    if(!m_keys.empty())
+        m_loop.post([this](){ processKeys(); });
+}
+
+// from the cache next to syntax.json when it was made from these rules,
+// an empty (not ready) lexer with error when they do not compile
+DfaLexer TextArea::loadSyntaxRules(const std::vector<TokenRule>& rules, const std::string& cachePath,
+                                   std::string* error)
+{
+    DfaLexer dfa;
+    if(!dfa.load(cachePath, rules))
+    {
+        if(!dfa.compile(rules))
+        {
+            *error = "syntax rules: " + dfa.error();
+            return DfaLexer();
+        }
+        dfa.save(cachePath);
+    }
+    return dfa;
+}
+
+// syntax.json may have changed (or only something else in its directory) :
+// it is parsed and its rules compiled on m_configThread, applyConfig swaps
+// them in
+void TextArea::reloadConfig()
+{
+    FileStamp stamp = fileStamp(m_configDir + "syntax.json");
+    if(stamp.mtimeNs == m_configStamp.mtimeNs && stamp.size == m_configStamp.size)
+        return;
+
+    // one load at a time, a change meanwhile is read once it is done
+    if(m_isConfigLoading)
+    {
+        m_isConfigPending = true;
+        return;
+    }
+    m_configStamp     = stamp;
+    m_isConfigLoading = true;
+
+    // the last load posted its result, its thread is done
+    if(m_configThread.joinable())
+        m_configThread.join();
+    m_configThread = std::thread([this, dir = m_configDir]() {
+        auto syntax = std::make_shared<SyntaxConfig>();
+        std::string error;
+        DfaLexer dfa;
+        if(syntax->load(dir + "syntax.json", dir + "syntax.cache", &error))
+        {
+            std::vector<TokenRule> rules = syntax->rules();
+            if(!rules.empty())
+                dfa = loadSyntaxRules(rules, dir + "syntax.dfa", &error);
+        }
+        else
+        {
+            error = "syntax.json: " + error;
+        }
+
+        m_loop.post([this, syntax, error, dfa = std::move(dfa)]() mutable {
+            // a broken file keeps the config there is
+            if(error.empty())
+                applyConfig(syntax, std::move(dfa));
+            else
+                postStatus(error + ", not reloaded");
+
+            m_isConfigLoading = false;
+            if(m_isConfigPending)
+            {
+                m_isConfigPending = false;
+                reloadConfig();
+            }
+        });
+    });
+}
+
+// Only what changed is redone : the pairs whose color changed, the cached
+// spans of the rules whose color changed (all of them for new patterns),
+// the user types when their color changed. Keywords are looked up at paint
+// time, one frame shows everything.
+void TextArea::applyConfig(std::shared_ptr<const SyntaxConfig> syntax, DfaLexer&& dfa)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_termMutex);
+        for(size_t i = 0; i < syntax->pairCount(); i++)
+        {
+            if(i >= m_syntax->pairCount() || m_syntax->pairColor(i) != syntax->pairColor(i))
+                init_pair(i + 1, syntax->pairColor(i), -1);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        m_syntax     = syntax;
+        colorComment = syntax->colorComment();
+        colorString  = syntax->colorString();
+        m_highlighter.setLexing(std::move(dfa), colorComment, colorString);
+        setStatus("syntax.json reloaded");
+    }
+
+    bool isUserDefChanged = false;
+    {
+        std::lock_guard<std::mutex> lock(m_userDefMutex);
+        isUserDefChanged     = colorUserDef != syntax->colorUserDef();
+        colorUserDef         = syntax->colorUserDef();
+        m_isUserDefRequested = m_isUserDefRequested || isUserDefChanged;
+    }
+    if(isUserDefChanged)
+        m_userDefWakeup.notify_one();
+
+    requestFrame();
 }
 
 void TextArea::moveCurUp()
 {
+    if(m_isSoftWrap)
+    {
+        wrapMove(KEY_UP);
+        return;
+    }
+
     bool isUp = false;
     if(m_cursor.row > 0)
     {
@@ -104,39 +391,47 @@ void TextArea::moveCurUp()
         int rowIndex = m_scrollView.pos.row + m_cursor.row;
         if(rowIndex >= 0)
         {
-            if(m_scrollView.pos.col + m_cursor.col > m_text[rowIndex].size())
+            int lenLine = m_widths.columns(rowIndex);
+            if(m_scrollView.pos.col + m_cursor.col > lenLine)
             {
-                if(m_scrollView.pos.col < m_text[rowIndex].size())
+                if(m_scrollView.pos.col < lenLine)
                 {
-                    m_cursor.col = m_text[rowIndex].size() - m_scrollView.pos.col;
+                    m_cursor.col = lenLine - m_scrollView.pos.col;
                 }
                 else
                 {
-                    if(m_text[rowIndex].size() > m_scrollView.size.width)
+                    if(lenLine > m_scrollView.size.width)
                     {
-                        m_scrollView.pos.col = m_text[rowIndex].size() - 3;
+                        m_scrollView.pos.col = lenLine - 3;
                         m_cursor.col = 3;
                     }
                     else
                     {
                         m_scrollView.pos.col = 0;
-                        m_cursor.col = m_text[rowIndex].size();
+                        m_cursor.col = lenLine;
                     }
                     
                 }
             }
+            snapCursor();
         }
     }
 }
 
 void TextArea::moveCurDown()
 {
-    if(m_cursor.row <  m_text.size() - 1)
+    if(m_isSoftWrap)
+    {
+        wrapMove(KEY_DOWN);
+        return;
+    }
+
+    if(m_cursor.row <  (int)m_text.size() - 1)
     {
         bool isDown = false;
         if(m_cursor.row < m_scrollView.size.height - 1)
         {
-            if(m_scrollView.pos.row + m_cursor.row + 1 < m_text.size())
+            if(m_scrollView.pos.row + m_cursor.row + 1 < (int)m_text.size())
             {
                 m_cursor.row++;
                 isDown = true;
@@ -144,7 +439,7 @@ void TextArea::moveCurDown()
         }
         else if(m_cursor.row == m_scrollView.size.height - 1)
         {
-            if(m_scrollView.pos.row < m_text.size() - m_scrollView.size.height)
+            if(m_scrollView.pos.row < (int)m_text.size() - m_scrollView.size.height)
             {
                 m_scrollView.pos.row++;
                 isDown = true;
@@ -154,25 +449,26 @@ void TextArea::moveCurDown()
         if(isDown)
         {
             int rowIndex = m_scrollView.pos.row + m_cursor.row;
-            if(rowIndex < m_text.size())
+            if(rowIndex < (int)m_text.size())
             {
-                if(m_scrollView.pos.col + m_cursor.col > m_text[rowIndex].size())
+                int lenLine = m_widths.columns(rowIndex);
+                if(m_scrollView.pos.col + m_cursor.col > lenLine)
                 {
-                    if(m_scrollView.pos.col < m_text[rowIndex].size())
+                    if(m_scrollView.pos.col < lenLine)
                     {
-                        m_cursor.col = m_text[rowIndex].size() - m_scrollView.pos.col;
+                        m_cursor.col = lenLine - m_scrollView.pos.col;
                     }
                     else
                     {
-                        if(m_text[rowIndex].size() > m_scrollView.size.width)
+                        if(lenLine > m_scrollView.size.width)
                         {
-                            m_scrollView.pos.col = m_text[rowIndex].size() - 3;
+                            m_scrollView.pos.col = lenLine - 3;
                             m_cursor.col = 3;
                         }
                         else
                         {
                             m_scrollView.pos.col = 0;
-                            m_cursor.col = m_text[rowIndex].size();
+                            m_cursor.col = lenLine;
                         }
                         
                     }
@@ -182,7 +478,7 @@ void TextArea::moveCurDown()
                 //     if(m_)
                     
                 // }
-                
+                snapCursor();
             }
         }
     }
@@ -190,58 +486,197 @@ void TextArea::moveCurDown()
 
 void TextArea::moveCurLeft()
 {
-    if(m_cursor.col > 0)
+    int index = m_cursor.row + m_scrollView.pos.row;
+    if(index >= (int)m_text.size())
+        return;
+
+    setCursorColumn(m_widths.prevColumn(index, m_scrollView.pos.col + m_cursor.col));
+}
+
+void TextArea::moveCurRight()
+{
+    int index = m_cursor.row + m_scrollView.pos.row;
+    if(index >= (int)m_text.size())
+        return;
+
+    setCursorColumn(m_widths.nextColumn(index, m_scrollView.pos.col + m_cursor.col));
+}
+
+// puts the cursor on column col of its line, the view scrolls sideways to
+// it (soft wrap : wrapFollowCursor places it later)
+void TextArea::setCursorColumn(int col)
+{
+    if(m_isSoftWrap)
     {
-        m_cursor.col--;
+        m_cursor.col = col;
+        m_scrollView.pos.col = 0;
+        return;
     }
-    else if(m_cursor.col == 0)
+
+    if(col < m_scrollView.pos.col)
+        m_scrollView.pos.col = col;
+    else if(col - m_scrollView.pos.col > m_scrollView.size.width)
+        m_scrollView.pos.col = col - m_scrollView.size.width;
+    m_cursor.col = col - m_scrollView.pos.col;
+}
+
+// a cursor inside a wide character goes to its start
+void TextArea::snapCursor()
+{
+    int index = m_cursor.row + m_scrollView.pos.row;
+    if(index < 0 || index >= (int)m_text.size())
+        return;
+
+    int col = m_scrollView.pos.col + m_cursor.col;
+    int start = m_widths.snapColumn(index, col);
+    if(start != col)
+        setCursorColumn(start);
+}
+
+// soft wrap : up and down move by visual rows, the view follows later in
+// wrapFollowCursor. Left and right are the same as without it.
+void TextArea::wrapMove(int key)
+{
+    int line = m_scrollView.pos.row + m_cursor.row;
+    int col  = m_scrollView.pos.col + m_cursor.col;
+    if(line < 0 || line >= (int)m_text.size())
+        return;
+
+    int sub = m_wrap.subRow(line, col);
+    int x   = col - m_wrap.rowStart(line, sub);
+    m_wrap.advance(line, sub, key == KEY_UP ? -1 : 1);
+    col = wrapColumn(line, sub, x);
+
+    m_cursor.row = line - m_scrollView.pos.row;
+    m_cursor.col = col;
+    m_scrollView.pos.col = 0;
+}
+
+// column x of visual row subRow, on a character start. A wide character
+// cut by the row end shows on the row before, then the cursor goes past it.
+int TextArea::wrapColumn(int line, int subRow, int x)
+{
+    int col   = std::min<int>(m_wrap.rowStart(line, subRow) + x, m_widths.columns(line));
+    int start = m_widths.snapColumn(line, col);
+    if(start < m_wrap.rowStart(line, subRow))
+        return m_widths.nextColumn(line, start);
+    return start;
+}
+
+// soft wrap : folds the column into m_cursor.col and scrolls the least
+// number of rows that shows the cursor
+void TextArea::wrapFollowCursor()
+{
+    int maxLine = m_text.size() - 1;
+    int line    = std::min(std::max(m_scrollView.pos.row + m_cursor.row, 0), maxLine);
+    int col     = m_scrollView.pos.col + m_cursor.col;
+    int sub     = m_wrap.subRow(line, col);
+    int height  = m_scrollView.size.height;
+
+    int top    = std::min(std::max(m_scrollView.pos.row, 0), maxLine);
+    int topSub = std::min(m_wrapTopRow, m_wrap.rowCount(top) - 1);
+    int rows   = m_wrap.distance(top, topSub, line, sub, height);
+    if(rows < 0 || rows >= height)
     {
-        if(m_scrollView.pos.col > 0)
-        {
-            m_scrollView.pos.col--;
-        }
+        top    = line;
+        topSub = sub;
+        if(rows > 0)
+            m_wrap.advance(top, topSub, -(height - 1));
     }
+
+    m_scrollView.pos = {top, 0};
+    m_wrapTopRow = topSub;
+    m_cursor = {line - top, col};
 }
 
-void TextArea::moveCurRight()
+void TextArea::movePage(int direction)
 {
-    int index = m_cursor.row + m_scrollView.pos.row;
-    if(index >= m_text.size())
+    int height  = m_scrollView.size.height;
+    int maxLine = m_text.size() - 1;
+    if(!m_isSoftWrap)
+    {
+        int maxTop = std::max(maxLine + 1 - height, 0);
+        int top    = std::min(std::max(m_scrollView.pos.row + direction * height, 0), maxTop);
+        int line   = std::min(std::max(m_scrollView.pos.row + m_cursor.row + direction * height, 0), maxLine);
+        m_scrollView.pos.row = top;
+        m_cursor.row = line - top;
+        clampCursor();
         return;
-        
-    if(m_cursor.col < m_text[index].size())
+    }
+
+    // a page of visual rows from the top and the cursor, only the lines
+    // walked over are laid out
+    int line   = m_scrollView.pos.row + m_cursor.row;
+    int col    = m_cursor.col;
+    int sub    = m_wrap.subRow(line, col);
+    int x      = col - m_wrap.rowStart(line, sub);
+    int top    = m_scrollView.pos.row;
+    int topSub = m_wrapTopRow;
+    m_wrap.advance(top, topSub, direction * height);
+    m_wrap.advance(line, sub, direction * height);
+
+    // the last page stays full
+    int endLine = maxLine;
+    int endSub  = m_wrap.rowCount(endLine) - 1;
+    if(direction > 0 && m_wrap.distance(top, topSub, endLine, endSub, height) < height - 1)
     {
-        if(m_cursor.col < m_scrollView.size.width)
-        {
-            m_cursor.col++;
-        }
-        else if(m_cursor.col == m_scrollView.size.width)
-        {
-            if(m_scrollView.pos.col < m_text[index].size() - m_scrollView.size.width)
-            {
-                m_scrollView.pos.col++;
-            }
-        }
+        top    = endLine;
+        topSub = endSub;
+        m_wrap.advance(top, topSub, -(height - 1));
     }
+
+    m_scrollView.pos.row = top;
+    m_wrapTopRow = topSub;
+    m_cursor.row = line - m_scrollView.pos.row;
+    m_cursor.col = wrapColumn(line, sub, x);
+    wrapFollowCursor();
 }
 
-void TextArea::breakNewLine()
+// the caller holds m_viewMutex
+void TextArea::setSoftWrap(bool isSoftWrap)
 {
-    int rowIndex = m_cursor.row  + m_scrollView.pos.row;
-    if(rowIndex > m_text.size() + 1)
+    m_isSoftWrap = isSoftWrap;
+    if(isSoftWrap)
+    {
+        wrapFollowCursor();
+        setStatus("Soft wrap on");
         return;
+    }
 
-    m_text.insert(m_text.begin() + rowIndex + 1, "");
-    
-    std::string newStr = "";
+    // back to a horizontal scroll : the cursor must fit the window
+    int line   = m_scrollView.pos.row + m_cursor.row;
+    int col    = m_scrollView.pos.col + m_cursor.col;
+    int height = m_scrollView.size.height;
+    m_scrollView.pos.col = col > m_scrollView.size.width ? col - 3 : 0;
+    m_cursor.col = col - m_scrollView.pos.col;
+    if(m_cursor.row >= height)
+    {
+        m_scrollView.pos.row = line - height + 1;
+        m_cursor.row = height - 1;
+    }
+    m_wrapTopRow = 0;
+    setStatus("Soft wrap off");
+}
 
-    int colIndex = m_cursor.col + m_scrollView.pos.col;
-    newStr = m_text[rowIndex].substr(colIndex);
-    m_text[rowIndex].erase(colIndex);
+void TextArea::breakNewLine()
+{
+    int rowIndex = m_cursor.row  + m_scrollView.pos.row;
+    if(rowIndex > (int)m_text.size() + 1)
+        return;
 
-    clearRow(rowIndex);
+    std::lock_guard<std::mutex> lock(m_docMutex);
+    pushUndo(rowIndex, 2, {std::string(m_text[rowIndex])});
 
-    m_text[rowIndex + 1] = newStr;
+    int byteIndex = m_widths.byteAt(rowIndex, m_cursor.col + m_scrollView.pos.col);
+    std::string newStr(m_text[rowIndex].substr(byteIndex));
+    m_text.eraseBytes(rowIndex, byteIndex);
+    m_text.insert(rowIndex + 1, std::move(newStr));
+    m_highlighter.lineChanged(rowIndex);
+    m_wrap.lineChanged(rowIndex);
+    m_widths.lineChanged(rowIndex, byteIndex);
+    m_highlighter.linesInserted(rowIndex + 1, 1);
+    m_wrap.linesInserted(rowIndex + 1, 1);
+    m_widths.linesInserted(rowIndex + 1, 1);
 
     if(m_cursor.row < m_scrollView.size.height - 1)
     {
@@ -254,7 +689,7 @@ void TextArea::breakNewLine()
 
     m_cursor.col = 0;
     m_scrollView.pos.col = 0;
-    for(int i = m_cursor.row - 1; i < m_text.size(); i++)
+    for(int i = m_cursor.row - 1; i < (int)m_text.size(); i++)
         m_linesShouldRender.push_back(i);
 }
 
@@ -263,28 +698,31 @@ bool TextArea::appendCharCurPos(char c)
     if(c < 32 or c > 126)
         return false;
 
+    return insertCharCurPos(std::string(1, c));
+}
+
+// ch : the bytes of one character
+bool TextArea::insertCharCurPos(const std::string& ch)
+{
     int maxRow   = m_text.size();
     int rowIndex = m_scrollView.pos.row + m_cursor.row;
     if(rowIndex > maxRow)
         return  false;
 
     int colIndex = m_cursor.col + m_scrollView.pos.col;
-    if(colIndex > m_text[rowIndex].size())
+    int startCol;
+    int byteIndex = m_widths.byteAt(rowIndex, colIndex, &startCol);
+    if(startCol != colIndex)
         return false;
 
-    if(m_text[rowIndex].size() == 0)
-    {
-        m_text[rowIndex].push_back(c);
-        return true;
-    }
-    else
-    {
-        m_text[rowIndex].insert(colIndex, 1, c);
-        return true;
-    }  
+    std::lock_guard<std::mutex> lock(m_docMutex);
+    pushUndo(rowIndex, 1, {std::string(m_text[rowIndex])}, true);
+    m_highlighter.lineChanged(rowIndex);
+    m_wrap.lineChanged(rowIndex);
+    m_widths.lineChanged(rowIndex, byteIndex);
 
-    return false;
-     
+    m_text.insertBytes(rowIndex, byteIndex, ch);
+    return true;
 }
 
 bool TextArea::deleteCharCurPos()
@@ -295,16 +733,28 @@ bool TextArea::deleteCharCurPos()
         return  false;
 
     int colIndex = m_cursor.col + m_scrollView.pos.col;
-    if(colIndex > m_text[rowIndex].size())
+    int startCol;
+    int end = m_widths.byteAt(rowIndex, colIndex, &startCol);
+    if(startCol != colIndex)
         return false;
 
+    std::lock_guard<std::mutex> lock(m_docMutex);
     if(colIndex == 0)
     {
         if(rowIndex - 1 >= 0)
         {
-            int lenPreLine = m_text[rowIndex - 1].size();
-            m_text[rowIndex - 1].append(m_text[rowIndex]);
-            m_text.erase( m_text.begin() + rowIndex);
+            pushUndo(rowIndex - 1, 1, {std::string(m_text[rowIndex - 1]), std::string(m_text[rowIndex])});
+
+            int lenPreLine = m_widths.columns(rowIndex - 1);
+            std::string line(m_text[rowIndex]);
+            m_text.insertBytes(rowIndex - 1, m_text[rowIndex - 1].size(), line);
+            m_text.erase(rowIndex);
+            m_highlighter.linesErased(rowIndex, 1);
+            m_wrap.linesErased(rowIndex, 1);
+            m_widths.linesErased(rowIndex, 1);
+            m_highlighter.lineChanged(rowIndex - 1);
+            m_wrap.lineChanged(rowIndex - 1);
+            m_widths.lineChanged(rowIndex - 1);
             
             // move cursor up
             if(m_cursor.row > 0)
@@ -339,8 +789,15 @@ bool TextArea::deleteCharCurPos()
     }
     else
     {
-        m_text[rowIndex].erase(colIndex - 1, 1);
-        moveCurLeft();
+        // the whole character before the cursor, with its combining marks
+        int prevCol = m_widths.prevColumn(rowIndex, colIndex);
+        int start   = m_widths.byteAt(rowIndex, prevCol);
+        pushUndo(rowIndex, 1, {std::string(m_text[rowIndex])}, true);
+        m_text.eraseBytes(rowIndex, start, end - start);
+        m_highlighter.lineChanged(rowIndex);
+        m_wrap.lineChanged(rowIndex);
+        m_widths.lineChanged(rowIndex, start);
+        setCursorColumn(prevCol);
     }
 
     return true;
@@ -351,258 +808,2091 @@ void TextArea::appendChar(int row, int col, char c)
     
 }
 
-void TextArea::HanldeEvents()
+void TextArea::pushUndo(int row, int rowCount, std::vector<std::string> lines, bool isTyping)
 {
-    int c = wgetch(m_window);
+    m_editCount++;
 
-    switch (c)
+    // consecutive typing on the same line is undone in one step
+    if(isTyping && !m_undoStack.empty())
     {
-    case KEY_UP:
-        moveCurUp();
-        break;
+        UndoRecord& last = m_undoStack.back();
+        if(last.isTyping && last.row == row && last.rowCount == 1)
+            return;
+    }
 
-    case KEY_DOWN:
-        moveCurDown();
-        break;
+    UndoRecord record;
+    record.row        = row;
+    record.rowCount   = rowCount;
+    record.isTyping   = isTyping;
+    record.group      = m_undoGroup;
+    record.lines      = std::move(lines);
+    record.cursor     = m_cursor;
+    record.scrollView = m_scrollView;
+    record.bytes      = sizeof(UndoRecord);
+    for(auto& line : record.lines)
+        record.bytes += line.size();
+    m_undoBytes += record.bytes;
+    m_undoStack.push_back(std::move(record));
+    trimUndo();
+}
 
-    case KEY_LEFT:
-        moveCurLeft();
-        break;
+void TextArea::pushUndo(TextBuffer document)
+{
+    m_editCount++;
+
+    UndoRecord record;
+    record.row        = 0;
+    record.rowCount   = document.size();
+    record.isTyping   = false;
+    record.isDocument = true;
+    record.group      = m_undoGroup;
+    record.document   = std::move(document);
+    record.cursor     = m_cursor;
+    record.scrollView = m_scrollView;
+    record.bytes      = sizeof(UndoRecord) + record.document.byteCount();
+    m_undoBytes += record.bytes;
+    m_undoStack.push_back(std::move(record));
+    trimUndo();
+}
 
-    case KEY_RIGHT:
-        moveCurRight();
-        break;
+// drops the oldest records, a group whole, never the newest step or the
+// group being pushed
+void TextArea::trimUndo()
+{
+    size_t dropped = 0;
+    while(m_undoBytes > UNDO_MAX_BYTES || m_undoStack.size() - dropped > UNDO_MAX_RECORDS)
+    {
+        uint64_t group = m_undoStack[dropped].group;
+        size_t end = dropped + 1;
+        while(group != 0 && end < m_undoStack.size() && m_undoStack[end].group == group)
+            end++;
+        if(end == m_undoStack.size() || (group != 0 && group == m_undoGroup))
+            break;
 
-    case MY_KEY_RETURN:
-        breakNewLine();
-        break;
+        for(size_t i = dropped; i < end; i++)
+            m_undoBytes -= m_undoStack[i].bytes;
+        dropped = end;
+    }
+    m_undoStack.erase(m_undoStack.begin(), m_undoStack.begin() + dropped);
+}
 
-    case MY_KEY_BACK:
-        deleteCharCurPos();
-        break;
+void TextArea::undo()
+{
+    if(m_undoStack.empty())
+    {
+        setStatus("Nothing to undo");
+        return;
+    }
 
-    case MY_KEY_TAB:
-        for(int i = 0; i < 4; i++) {
-            if(appendCharCurPos(' '))
-            moveCurRight();
+    m_editCount++;
+    std::lock_guard<std::mutex> lock(m_docMutex);
+    UndoRecord record;
+    do
+    {
+        record = std::move(m_undoStack.back());
+        m_undoStack.pop_back();
+        m_undoBytes -= record.bytes;
+
+        if(record.isDocument)
+        {
+            // whole document edit (replace all), just swap the stores back
+            m_text.swap(record.document);
+            m_highlighter.reset(m_text.size());
+            m_wrap.reset(m_text.size());
+            m_widths.reset(m_text.size());
         }
-        break;
+        else
+        {
+            int lineCount = record.lines.size();
+            m_text.erase(record.row, record.rowCount);
+            m_text.insert(record.row, std::move(record.lines));
+            m_highlighter.linesErased(record.row, record.rowCount);
+            m_wrap.linesErased(record.row, record.rowCount);
+            m_widths.linesErased(record.row, record.rowCount);
+            m_highlighter.linesInserted(record.row, lineCount);
+            m_wrap.linesInserted(record.row, lineCount);
+            m_widths.linesInserted(record.row, lineCount);
+        }
+    }
+    while(record.group != 0 && !m_undoStack.empty() && m_undoStack.back().group == record.group);
 
-    case KEY_CLOSE:
-        g_exitApp = true;
-        break;
-    
-    case KEY_F(2):
-        SaveToFile(m_fileName);
-        break;
+    if(m_text.empty())
+    {
+        m_text.push_back("");
+        m_highlighter.reset(1);
+        m_wrap.reset(1);
+        m_widths.reset(1);
+    }
 
-    case KEY_RESIZE:
-        
-        break;
+    m_cursor     = record.cursor;
+    m_scrollView = record.scrollView;
+    clampCursor();
+}
 
-    case KEY_F(4):
-        g_exitApp = true;
-        break;
+void TextArea::clampCursor()
+{
+    int maxRow = m_text.size() - 1;
+    if(m_scrollView.pos.row > maxRow)
+        m_scrollView.pos.row = maxRow;
 
-    default:
-        if(appendCharCurPos(c))
-            moveCurRight();
-        break;
+    if(m_scrollView.pos.row + m_cursor.row > maxRow)
+        m_cursor.row = maxRow - m_scrollView.pos.row;
+
+    int rowIndex = m_scrollView.pos.row + m_cursor.row;
+    int lenLine  = m_widths.columns(rowIndex);
+    if(m_scrollView.pos.col + m_cursor.col > lenLine)
+    {
+        if(m_scrollView.pos.col > lenLine)
+            m_scrollView.pos.col = lenLine < 3 ? 0 : lenLine - 3;
+        m_cursor.col = lenLine - m_scrollView.pos.col;
     }
+    snapCursor();
+
+    if(m_isSoftWrap)
+        wrapFollowCursor();
 }
 
-void TextArea::clearRow(int row)
+void TextArea::replaceAll(bool useRegex)
 {
-    wmove(m_window, row, 0);
-    for(int i=0;i<COLS;i++) 
+    if(m_isViewer || m_isLoading)
     {
-        waddch(m_window, ' ');
+        postStatus("Read only view");
+        return;
     }
-    wmove(m_window, m_windPos.row, m_windPos.col);
-}
-    
-void TextArea::clearScreen(int fromRow, int toRow)
-{
 
+    beginPrompt(useRegex ? "Replace regex: " : "Replace: ", [this, useRegex](const std::string& pattern){
+        if(pattern.empty())
+            return;
+
+        beginPrompt("With: ", [this, useRegex, pattern](const std::string& replacement){
+            applyReplace(pattern, replacement, useRegex);
+        });
+    });
 }
 
-void TextArea::renderRow(int row)
+void TextArea::applyReplace(const std::string& pattern, const std::string& replacement, bool useRegex)
 {
-    if(row > m_text.size() || row < 0)
+    auto engine = std::make_shared<ReplaceEngine>(pattern, replacement, useRegex);
+    if(!engine->isValid())
+    {
+        postStatus("Invalid pattern: " + engine->error());
+        return;
+    }
+    if(m_isReplacing)
+    {
+        postStatus("A replace is still running");
         return;
+    }
 
-    wmove(m_window, row, 0);
-    wprintw(m_window, m_text[row].c_str());
-    wmove(m_window, m_cursor.row, m_cursor.col);
+    // only this thread changes m_text, reading it needs no lock
+    auto snapshot = std::make_shared<TextBuffer>(m_text);
+    m_isReplacing = true;
+    postStatus("Replacing " + pattern);
+
+    if(m_replaceThread.joinable())
+        m_replaceThread.join();
+    m_replaceThread = std::thread([this, engine, snapshot, editCount = m_editCount,
+                                   pattern, replacement, useRegex]() {
+        auto result = std::make_shared<TextBuffer>();
+        size_t count = engine->replaceAll(*snapshot, *result, [this](size_t done, size_t total){
+            postProgress("Replacing in ", done, total);
+        });
+        m_loop.post([this, result, count, editCount, pattern, replacement, useRegex]() {
+            finishReplace(result, count, editCount, pattern, replacement, useRegex);
+        });
+    });
 }
 
-void TextArea::DrawBoder()
+// the result of m_replaceThread, on the loop thread
+void TextArea::finishReplace(std::shared_ptr<TextBuffer> result, size_t count, uint64_t editCount,
+                             const std::string& pattern, const std::string& replacement, bool useRegex)
 {
-    for(int iRow = 0; iRow < m_windSize.height; iRow++)
+    m_isReplacing = false;
+    if(count == 0)
     {
-        mvaddch(iRow + m_windPos.row, m_windPos.col - lineNumberWidth - 1, ACS_VLINE); // ─ ┌ ┐ ┘ └
-        mvaddch(iRow + m_windPos.row, m_windPos.col + m_windSize.width, ACS_VLINE);
+        postStatus("No match: " + pattern);
+        return;
+    }
+    if(m_editCount != editCount)
+    {
+        applyReplace(pattern, replacement, useRegex);
+        return;
     }
 
-    for (int iCol = 0; iCol < m_windSize.width + lineNumberWidth; iCol++)
+    // the old buffer becomes the undo record, no per line bookkeeping
     {
-        mvaddch(m_windPos.row - 1 , iCol + m_windPos.col - lineNumberWidth, ACS_HLINE); // ─ ┌ ┐ ┘ └
-        mvaddch(m_windPos.row + m_windSize.height, iCol + m_windPos.col - lineNumberWidth, ACS_HLINE);
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        std::lock_guard<std::mutex> docLock(m_docMutex);
+        m_text.swap(*result);
+        pushUndo(std::move(*result));
+        m_highlighter.reset(m_text.size());
+        m_wrap.reset(m_text.size());
+        m_widths.reset(m_text.size());
+        clampCursor();
     }
 
-    mvaddch(m_windPos.row - 1, m_windPos.col - lineNumberWidth - 1, ACS_ULCORNER);
-    mvaddch(m_windPos.row - 1, m_windPos.col + m_windSize.width, ACS_URCORNER);
-    mvaddch(m_windPos.row + m_windSize.height, m_windPos.col - lineNumberWidth - 1, ACS_LLCORNER);
-    mvaddch(m_windPos.row + m_windSize.height, m_windPos.col + m_windSize.width, ACS_LRCORNER);
+    postStatus("Replaced " + std::to_string(count) + " occurrence(s)");
+}
 
-    
+// keys handled by processKeys outside the view lock, they open a prompt
+bool TextArea::startsPrompt(int key) const
+{
+    return key == KEY_F(5) || key == KEY_F(6) || (key == KEY_F(8) && m_isViewer) ||
+           (key == KEY_F(2) && m_fileName.empty());
+}
+
+void TextArea::beginPrompt(const std::string& label, std::function<void(const std::string&)> onDone)
+{
+    m_promptLabel = label;
+    m_promptInput.clear();
+    m_onPromptDone = onDone;
+    {
+        std::lock_guard<std::mutex> lock(m_viewMutex);
+        m_prompt = label;
+    }
+    requestFrame();
+}
+
+void TextArea::promptKey(const KeyEvent& event)
+{
+    int c = event.key;
+    if(c == MY_KEY_RETURN || c == MY_KEY_ESC)
+    {
+        std::string input = c == MY_KEY_ESC ? std::string() : m_promptInput;
+        std::function<void(const std::string&)> onDone;
+        onDone.swap(m_onPromptDone);
+        {
+            std::lock_guard<std::mutex> lock(m_viewMutex);
+            m_prompt.clear();
+            setStatus("");
+        }
+        requestFrame();
+
+        // may open the next prompt
+        onDone(input);
+        return;
+    }
+
+    if(c == KeyEvent::kKeyPaste)
+    {
+        const std::string& text = event.text;
+        for(size_t i = 0; i < text.size(); )
+        {
+            int n = utf8_char_length(text.data() + i, text.size() - i);
+            if(n > 1 || (text[i] >= 32 && text[i] <= 126))
+                m_promptInput.append(text, i, n);
+            i += std::max(n, 1);
+        }
+    }
+    else if(c == KeyEvent::kKeyChar)
+    {
+        m_promptInput.append(event.text);
+    }
+    else if(c == MY_KEY_BACK || c == KEY_BACKSPACE)
+    {
+        // the last character, with its continuation bytes
+        while(!m_promptInput.empty() && ((unsigned char)m_promptInput.back() & 0xC0) == 0x80)
+            m_promptInput.pop_back();
+        if(!m_promptInput.empty())
+            m_promptInput.pop_back();
+    }
+    else if(c >= 32 && c <= 126 && event.mods == 0)
+    {
+        m_promptInput.push_back(c);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_viewMutex);
+        m_prompt = m_promptLabel + m_promptInput;
+    }
+    requestFrame();
+}
+
+// the caller holds m_viewMutex, the status shows on the next frame
+void TextArea::setStatus(const std::string& status)
+{
+    m_status = status;
+}
+
+void TextArea::postStatus(const std::string& status)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_viewMutex);
+        setStatus(status);
+    }
+    requestFrame();
+}
+
+void TextArea::paintStatus(const std::string& text)
+{
+    if(!m_isDirectOutput)
+    {
+        move(LINES - 1, 0);
+        clrtoeol();
+        printw("%s", utf8_placeholder(text.data(), text.size()).c_str());
+        return;
+    }
+
+    // the last column is left alone, writing there may scroll the screen
+    int width   = utf8_width_prefix(text.data(), text.size(), COLS - 1);
+    int columns = utf8_width(text.data(), width);
+    m_termWriter.beginRow(LINES - 1, 0);
+    m_termWriter.text(text.c_str(), width);
+    m_termWriter.fill(' ', COLS - 1 - columns);
+    m_termWriter.endRow();
+}
+
+// stdin is readable : decodes what the terminal has sent so far
+void TextArea::onInput()
+{
+    std::vector<KeyEvent> events;
+    char buffer[4096];
+    ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if(count == 0 || (count < 0 && errno != EINTR && errno != EAGAIN))
+    {
+        events.push_back({KEY_CLOSE, 0, ""});   // the terminal is gone
+        m_loop.removeFd(STDIN_FILENO);
+    }
+    else if(count > 0 && m_inputDecoder.feed(buffer, count, events))
+    {
+        // the reply lands behind the ESC : it was the Esc key
+        std::lock_guard<std::mutex> lock(m_termMutex);
+        write(STDOUT_FILENO, InputDecoder::kStatusQuery, strlen(InputDecoder::kStatusQuery));
+    }
+
+    // the timeout is only a fallback for terminals that do not answer DSR
+    m_loop.armTimer(m_escTimer, m_inputDecoder.hasPendingEscape() ? ESC_FALLBACK_MS : 0);
+
+    m_keys.insert(m_keys.end(), events.begin(), events.end());
+    processKeys();
+}
+
+void TextArea::onEscTimer()
+{
+    std::vector<KeyEvent> events;
+    m_inputDecoder.flushEscape(events);
+    m_keys.insert(m_keys.end(), events.begin(), events.end());
+    processKeys();
+}
+
+// SIGWINCH : a drag sends many, the signalfd folds those not read yet and
+// the renderer only paints the newest layout
+void TextArea::onResize()
+{
+    m_keys.push_back({KEY_RESIZE, 0, ""});
+    processKeys();
+}
+
+KeyEvent TextArea::nextKey()
+{
+    KeyEvent event = m_keys.front();
+    m_keys.pop_front();
+
+    // raw mode : Enter comes in as CR
+    if(event.key == MY_KEY_CR && event.mods == 0)
+        event.key = MY_KEY_RETURN;
+    return event;
+}
+
+// Applies the decoded keys. Everything decoded so far goes into the same
+// frame, the prompt and the replace run without the view lock held.
+void TextArea::processKeys()
+{
+    while(!m_keys.empty() && !g_exitApp)
+    {
+        if(m_onPromptDone)
+        {
+            promptKey(nextKey());
+            continue;
+        }
+
+        int key = m_keys.front().key;
+        if(key == KEY_F(5) || key == KEY_F(6))
+        {
+            nextKey();
+            replaceAll(key == KEY_F(6));
+            continue;
+        }
+
+        if(key == KEY_F(8) && m_isViewer)
+        {
+            nextKey();
+            viewerGoTo();
+            continue;
+        }
+
+        if(key == KEY_F(2) && m_fileName.empty())
+        {
+            nextKey();
+            saveAs();
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_viewMutex);
+            while(!m_keys.empty() && !g_exitApp && !m_onPromptDone)
+            {
+                key = m_keys.front().key;
+                if(startsPrompt(key))
+                    break;
+                applyEvent(nextKey());
+
+                // a burst of page downs must not run into the slice end
+                if(m_isViewer)
+                    followViewer();
+            }
+
+            if(m_isSoftWrap)
+                wrapFollowCursor();
+            if(m_isViewer)
+            {
+                followViewer();
+                viewerStatus();
+            }
+        }
+        requestFrame();
+    }
+
+    // user types are parsed again once the typing pauses
+    if(m_editCount != m_parsedEditCount)
+    {
+        m_parsedEditCount = m_editCount;
+        m_loop.armTimer(m_userDefTimer, USER_DEF_DELAY_MS);
+    }
+}
+
+// keys that do not change the text
+static bool isViewerKey(int key)
+{
+    switch(key)
+    {
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_LEFT:
+    case KEY_RIGHT:
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+    case KEY_RESIZE:
+    case KEY_CLOSE:
+    case KEY_F(4):
+    case KEY_F(7):
+    case KEY_F(9):
+        return true;
+    }
+    return false;
+}
+
+// the caller holds m_viewMutex
+void TextArea::applyEvent(const KeyEvent& event)
+{
+    if((m_isViewer || m_isLoading) && !isViewerKey(event.key))
+    {
+        setStatus(m_isLoading ? "Still loading " + m_fileName : "Read only view, F8 goes to a line or a percentage");
+        return;
+    }
+
+    if(event.key == KeyEvent::kKeyPaste)
+    {
+        insertText(event.text);
+        return;
+    }
+
+    if(event.key == KeyEvent::kKeyChar)
+    {
+        // a combining mark joins the character before the cursor
+        if(insertCharCurPos(event.text) && utf8_char_width(event.text.data(), event.text.size()) > 0)
+            moveCurRight();
+        return;
+    }
+
+    // no Alt bindings yet, and the key must not be typed as text
+    if(event.mods & KeyEvent::kAlt)
+        return;
+
+    applyKey(event.key);
+}
+
+// the caller holds m_viewMutex
+void TextArea::insertText(const std::string& text)
+{
+    for(size_t i = 0; i < text.size(); i++)
+    {
+        char ch = text[i];
+        if(ch == '\r' && i + 1 < text.size() && text[i + 1] == '\n')
+            continue;
+
+        if(ch == '\n' || ch == '\r')
+        {
+            applyKey(MY_KEY_RETURN);
+        }
+        else if(ch == MY_KEY_TAB || (ch >= 32 && ch <= 126))
+        {
+            applyKey(ch);
+        }
+        else if((unsigned char)ch >= 0x80)
+        {
+            // a whole UTF-8 character, invalid bytes are dropped
+            int n = utf8_char_length(text.data() + i, text.size() - i);
+            if(n > 1 && insertCharCurPos(text.substr(i, n)) && utf8_char_width(text.data() + i, n) > 0)
+                moveCurRight();
+            if(n > 1)
+                i += n - 1;
+        }
+    }
+}
+
+// the caller holds m_viewMutex
+void TextArea::applyKey(int c)
+{
+    switch (c)
+    {
+    case KEY_UP:
+        moveCurUp();
+        break;
+
+    case KEY_DOWN:
+        moveCurDown();
+        break;
+
+    case KEY_LEFT:
+        moveCurLeft();
+        break;
+
+    case KEY_RIGHT:
+        moveCurRight();
+        break;
+
+    case MY_KEY_RETURN:
+        breakNewLine();
+        break;
+
+    case MY_KEY_BACK:
+        deleteCharCurPos();
+        break;
+
+    case MY_KEY_TAB:
+        for(int i = 0; i < 4; i++) {
+            if(appendCharCurPos(' '))
+            moveCurRight();
+        }
+        break;
+
+    case KEY_CLOSE:
+        g_exitApp = true;
+        break;
+    
+    case KEY_F(2):
+        SaveToFile(m_fileName);
+        break;
+
+    case KEY_RESIZE:
+        relayout();
+        break;
+
+    case KEY_F(4):
+        g_exitApp = true;
+        break;
+
+    case KEY_F(7):
+        setSoftWrap(!m_isSoftWrap);
+        break;
+
+    case KEY_F(9):
+        if(m_isViewer)
+        {
+            setFollow(!m_isFollowing);
+        }
+        else if(!m_isLoading)
+        {
+            setStatus("Reloading " + m_fileName);
+            reloadFile();
+        }
+        break;
+
+    case KEY_PPAGE:
+        movePage(-1);
+        break;
+
+    case KEY_NPAGE:
+        movePage(1);
+        break;
+
+    case MY_KEY_UNDO:
+        undo();
+        break;
+
+    default:
+        if(appendCharCurPos(c))
+            moveCurRight();
+        break;
+    }
+}
+
+void TextArea::clearRow(int row)
+{
+    wmove(m_window, row, 0);
+    for(int i=0;i<COLS;i++) 
+    {
+        waddch(m_window, ' ');
+    }
+    wmove(m_window, m_windPos.row, m_windPos.col);
+}
+    
+void TextArea::clearScreen(int fromRow, int toRow)
+{
+
+}
+
+void TextArea::beginPaintRow(int row)
+{
+    if(m_isDirectOutput)
+    {
+        // the borders are part of the row, a scrolled row must not lose them
+        int borderCol = m_windPos.col - lineNumberWidth - 1;
+        m_termWriter.beginRow(m_windPos.row + row, borderCol);
+        m_termWriter.lineDrawing("x");
+        m_termWriter.fill(' ', m_windPos.col - borderCol - 1);
+        return;
+    }
+
+    clearRow(row);
+    wmove(m_window, row, 0);
+}
+
+void TextArea::paintText(const char* text, int len, int colorId)
+{
+    if(len <= 0)
+        return;
+
+    if(m_isDirectOutput)
+    {
+        writeText(text, len, colorId);
+        return;
+    }
+
+    if(colorId != 0)
+    {
+        wattron(m_window, COLOR_PAIR(colorId));
+        waddnstr(m_window, text, len);
+        wattroff(m_window, COLOR_PAIR(colorId));
+    }
+    else
+    {
+        waddnstr(m_window, text, len);
+    }
+}
+
+// through m_termWriter, the caller holds m_termMutex
+void TextArea::writeText(const char* text, int len, int colorId)
+{
+    if(len <= 0)
+        return;
+
+    short fg = TermWriter::kDefaultColor;
+    short bg = TermWriter::kDefaultColor;
+    if(colorId != 0)
+        pair_content(colorId, &fg, &bg);
+    m_termWriter.setColor(fg, bg);
+    m_termWriter.text(text, len);
+}
+
+// The bundled ncurses is the narrow build, it takes a byte for a column.
+// Rows with other characters are handed to it as one ASCII placeholder per
+// column, so its idea of the screen stays right, and the real text is
+// written over them once ncurses is done. The cursor goes back where
+// ncurses left it.
+void TextArea::overlayUtf8(const FrameSnapshot& frame)
+{
+    bool isAsciiStatus = utf8_ascii_prefix(frame.status.data(), frame.status.size()) == frame.status.size();
+    bool hasOverlay = !isAsciiStatus;
+    for(auto& frameRow : frame.rows)
+        hasOverlay = hasOverlay || !frameRow.isAscii;
+    if(!hasOverlay)
+        return;
+
+    // ncurses may have painted over the previous overlay
+    m_termWriter.invalidate();
+    m_termWriter.beginFrame();
+    for(int row = 0; row < (int)frame.rows.size(); row++)
+    {
+        const FrameRow& frameRow = frame.rows[row];
+        if(frameRow.isAscii)
+            continue;
+
+        const char* text = frameRow.text.c_str();
+        int printed = 0;
+        m_termWriter.beginRow(m_windPos.row + row, m_windPos.col);
+        for(auto& segment : frameRow.segments)
+        {
+            writeText(text + printed, segment.start - printed, 0);
+            writeText(text + segment.start, segment.length, segment.colorId);
+            printed = segment.start + segment.length;
+        }
+        writeText(text + printed, frameRow.text.size() - printed, 0);
+        m_termWriter.endRow();
+    }
+
+    int statusColumns = utf8_width(frame.status.data(), frame.status.size());
+    if(!isAsciiStatus)
+    {
+        int width = utf8_width_prefix(frame.status.data(), frame.status.size(), COLS - 1);
+        m_termWriter.beginRow(LINES - 1, 0);
+        m_termWriter.text(frame.status.c_str(), width);
+        m_termWriter.endRow();
+    }
+
+    if(frame.isPrompt)
+        m_termWriter.endFrame(LINES - 1, std::min(statusColumns, COLS - 1));
+    else
+        m_termWriter.endFrame(m_windPos.row + frame.cursor.row, m_windPos.col + frame.cursor.col);
+}
+
+// width : columns painted so far, the rest of the row is blanked
+void TextArea::endPaintRow(int width, int windowWidth)
+{
+    if(!m_isDirectOutput)
+        return;
+
+    m_termWriter.setColor(TermWriter::kDefaultColor, TermWriter::kDefaultColor);
+    m_termWriter.fill(' ', windowWidth - width);
+    m_termWriter.lineDrawing("x");
+    m_termWriter.endRow();
+}
+
+void TextArea::renderRow(int row)
+{
+    if(row >= (int)m_text.size() || row < 0)
+        return;
+
+    std::string_view line = m_text[row];
+    wmove(m_window, row, 0);
+    waddnstr(m_window, line.data(), line.size());
+    wmove(m_window, m_cursor.row, m_cursor.col);
+}
+
+void TextArea::paintBorder(Size windSize)
+{
+    for(int iRow = 0; iRow < windSize.height; iRow++)
+    {
+        mvaddch(iRow + m_windPos.row, m_windPos.col - lineNumberWidth - 1, ACS_VLINE); // ─ ┌ ┐ ┘ └
+        mvaddch(iRow + m_windPos.row, m_windPos.col + windSize.width, ACS_VLINE);
+    }
+
+    for (int iCol = 0; iCol < windSize.width + lineNumberWidth; iCol++)
+    {
+        mvaddch(m_windPos.row - 1 , iCol + m_windPos.col - lineNumberWidth, ACS_HLINE); // ─ ┌ ┐ ┘ └
+        mvaddch(m_windPos.row + windSize.height, iCol + m_windPos.col - lineNumberWidth, ACS_HLINE);
+    }
+
+    mvaddch(m_windPos.row - 1, m_windPos.col - lineNumberWidth - 1, ACS_ULCORNER);
+    mvaddch(m_windPos.row - 1, m_windPos.col + windSize.width, ACS_URCORNER);
+    mvaddch(m_windPos.row + windSize.height, m_windPos.col - lineNumberWidth - 1, ACS_LLCORNER);
+    mvaddch(m_windPos.row + windSize.height, m_windPos.col + windSize.width, ACS_LRCORNER);
+}
+
+void TextArea::DrawBoder()
+{
+    paintBorder(m_windSize);
+    
     wmove(m_window, 0, 0);
     refresh();
 }
 
-void TextArea::Render()
+// the caller holds m_viewMutex. Only the view is laid out here, nothing
+// is cached per width but the wrap layout, which is redone lazily from the
+// visible rows. The renderer applies the new size with the next frame.
+void TextArea::relayout()
+{
+    winsize size;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_row == 0 || size.ws_col == 0)
+        return;
+
+    m_termSize = {size.ws_col, size.ws_row};
+    m_windSize.height = std::max(m_termSize.height - 4, 1);
+    m_windSize.width  = std::max(m_termSize.width - 4 - lineNumberWidth, 2);
+    m_scrollView.size = {m_windSize.width - 1, m_windSize.height};
+    m_isRelayout = true;
+    m_paintedPos = {-1, -1};
+
+    m_wrap.setWidth(m_scrollView.size.width);
+    if(m_isSoftWrap)
+    {
+        wrapFollowCursor();
+        return;
+    }
+
+    // keep the cursor inside the window
+    int height = m_scrollView.size.height;
+    int width  = m_scrollView.size.width;
+    if(m_cursor.row >= height)
+    {
+        m_scrollView.pos.row += m_cursor.row - height + 1;
+        m_cursor.row = height - 1;
+    }
+    if(m_cursor.col > width)
+    {
+        m_scrollView.pos.col += m_cursor.col - width;
+        m_cursor.col = width;
+    }
+}
+
+void TextArea::requestFrame()
+{
+    std::lock_guard<std::mutex> lock(m_viewMutex);
+    m_version++;
+    m_frameRequested.notify_one();
+}
+
+// one screen row : bytes [start, start + length) of line with its colors,
+// after leftPad blanks, the row starting at column col of the line. Tabs
+// become blanks up to their tab stop, so ncurses and the direct output
+// paint the same columns.
+void TextArea::snapshotRow(FrameRow& frameRow, std::string_view line, int start, int length,
+                           int leftPad, int col, bool isAscii, const std::vector<TokenSpan>* spans)
+{
+    std::string& lineTruncate = frameRow.text;
+    if(start < (int)line.size())
+        lineTruncate.assign(leftPad, ' ').append(line, start, length);
+
+    if(!lineTruncate.empty() && lineTruncate[lineTruncate.size() -1] == '\n')
+    {
+        lineTruncate.pop_back();
+    }
+
+    // the byte each tab was at and the blanks added up to it
+    std::vector<std::pair<int, int>> tabs;
+    if(!isAscii && memchr(lineTruncate.data(), '\t', lineTruncate.size()))
+    {
+        const char* data = lineTruncate.data();
+        int size = lineTruncate.size();
+        std::string expanded;
+        int columns = 0;
+        for(int i = 0; i < size; )
+        {
+            int run = utf8_plain_prefix(data + i, size - i);
+            if(run == 0 && data[i] == '\t')
+            {
+                int width = utf8_tab_width(col + columns);
+                expanded.append(width, ' ');
+                columns += width;
+                tabs.push_back({i, (int)expanded.size() - i - 1});
+                i++;
+                continue;
+            }
+
+            run = std::max(run, utf8_step(data + i, size - i));
+            expanded.append(data + i, run);
+            columns += utf8_width(data + i, run);
+            i += run;
+        }
+        lineTruncate.swap(expanded);
+        isAscii = utf8_ascii_prefix(lineTruncate.data(), lineTruncate.size()) == lineTruncate.size();
+    }
+
+    frameRow.isAscii = isAscii;
+    frameRow.columns = lineTruncate.size();
+    if(!isAscii)
+    {
+        // raw invalid bytes would garble the terminal
+        utf8_sanitize(lineTruncate);
+        frameRow.columns = utf8_width(lineTruncate.data(), lineTruncate.size());
+    }
+
+    if(!spans)
+        return;
+
+    // a byte of the row before the tabs were expanded to one after
+    auto expandedByte = [&tabs](int byte) {
+        auto it = std::lower_bound(tabs.begin(), tabs.end(), std::make_pair(byte, 0));
+        return it == tabs.begin() ? byte : byte + (it - 1)->second;
+    };
+
+    int printed = leftPad;
+    for(auto& span : *spans)
+    {
+        int begin = std::max(expandedByte(span.start - start + leftPad), printed);
+        int end   = std::min<int>(expandedByte(span.start + span.length - start + leftPad), lineTruncate.size());
+        if(begin >= end)
+            continue;
+
+        int colorId = span.color;
+        if(span.isWord)
+            colorId = wordColor(std::string(line.substr(span.start, span.length)));
+
+        if(colorId != 0)
+            frameRow.segments.push_back({begin, end - begin, colorId});
+        printed = end;
+    }
+}
+
+// renderer side, takes m_viewMutex then m_docMutex
+void TextArea::takeSnapshot(FrameSnapshot& frame)
+{
+    std::lock_guard<std::mutex> viewLock(m_viewMutex);
+    int height = m_scrollView.size.height;
+    int width  = m_scrollView.size.width;
+    int top    = m_scrollView.pos.row;
+    int topSub = m_isSoftWrap ? m_wrapTopRow : 0;
+
+    frame.version    = m_version;
+    frame.cursor     = m_cursor;
+    frame.scrollView = m_scrollView;
+    frame.isPrompt   = !m_prompt.empty();
+    frame.status     = frame.isPrompt ? m_prompt : m_status;
+    frame.isRelayout = m_isRelayout;
+    frame.termSize   = m_termSize;
+    frame.rows.assign(height, FrameRow());
+    m_isRelayout = false;
+
+    if(m_isSoftWrap)
+    {
+        int line = top + m_cursor.row;
+        int sub  = m_wrap.subRow(line, m_cursor.col);
+        frame.cursor.row = m_wrap.distance(top, topSub, line, sub, height);
+        frame.cursor.col = m_cursor.col - m_wrap.rowStart(line, sub);
+    }
+
+    // how far the painted rows moved, the direct output scrolls them
+    frame.scrollRows = 0;
+    if(m_paintedPos.row >= 0 && (m_paintedSubRow >= 0) == m_isSoftWrap)
+    {
+        if(m_isSoftWrap)
+            frame.scrollRows = m_wrap.distance(m_paintedPos.row, m_paintedSubRow, top, topSub, height);
+        else if(m_paintedPos.col == m_scrollView.pos.col)
+            frame.scrollRows = top - m_paintedPos.row;
+    }
+    m_paintedPos    = m_scrollView.pos;
+    m_paintedSubRow = m_isSoftWrap ? topSub : -1;
+
+    // lexed from the line start (or nearest checkpoint) so tokens cut by
+    // the left edge keep their color, spans are in line offsets. A row
+    // not highlighted yet stays plain, the worker asks for a new frame.
+    // The spans of a short line serve all of its wrapped rows.
+    std::lock_guard<std::mutex> docLock(m_docMutex);
+    std::vector<TokenSpan> spans;
+    int  spansLine = -1;
+    bool hasSpans  = false;
+    int  line = top;
+    int  sub  = topSub;
+    for(int row = 0; row < height && line < (int)m_text.size(); row++)
+    {
+        std::string_view text = m_text[line];
+        int col = m_isSoftWrap ? m_wrap.rowStart(line, sub) : m_scrollView.pos.col;
+
+        // the characters starting in [col, col + width), the last one may
+        // run into the spare column; one cut by the left edge leaves a blank
+        int startCol  = 0;
+        int charWidth = 0;
+        int leftPad   = 0;
+        int start     = col == 0 ? 0 : m_widths.byteAt(line, col, &startCol, &charWidth);
+        if(startCol < col && start < (int)text.size())
+        {
+            leftPad = startCol + charWidth - col;
+            start   = m_widths.byteAt(line, startCol + charWidth);
+        }
+
+        // a tab cut by the right edge is left out, the row ends blank anyway
+        int endCol;
+        int end = m_widths.byteAt(line, col + width, &endCol, &charWidth);
+        if(endCol < col + width && end < (int)text.size() && text[end] != '\t')
+            end = m_widths.byteAt(line, endCol + charWidth);
+
+        int length = std::max(end - start, 0);
+        if(line != spansLine || text.size() >= Highlighter::kLongLineBytes)
+        {
+            hasSpans  = m_highlighter.windowSpans(line, text, start, length, spans);
+            spansLine = line;
+        }
+        snapshotRow(frame.rows[row], text, start, length, leftPad, col, m_widths.isAscii(line),
+                    hasSpans ? &spans : nullptr);
+
+        if(m_isSoftWrap && ++sub < m_wrap.rowCount(line))
+            continue;
+        line++;
+        sub = 0;
+    }
+}
+
+// renderer side, no lock but m_termMutex
+void TextArea::paintFrame(const FrameSnapshot& frame)
+{
+    std::lock_guard<std::mutex> lock(m_termMutex);
+
+    if(frame.isRelayout)
+    {
+        // the border and the window follow the new size in this same frame,
+        // the title row is left to its own window
+        if(is_term_resized(frame.termSize.height, frame.termSize.width))
+            resizeterm(frame.termSize.height, frame.termSize.width);
+        wtouchln(stdscr, 0, 1, 0);
+        wresize(m_window, frame.scrollView.size.height, frame.scrollView.size.width + 1);
+        move(1, 0);
+        clrtobot();
+        paintBorder({frame.scrollView.size.width + 1, frame.scrollView.size.height});
+
+        // now, so the cleared stdscr does not cover the window below
+        wnoutrefresh(stdscr);
+        if(m_isDirectOutput)
+        {
+            doupdate();
+            m_termWriter.invalidate();
+        }
+    }
+
+    if(m_isDirectOutput)
+    {
+        m_termWriter.beginFrame();
+
+        // a vertical scroll moves the painted rows on the terminal, the
+        // rows that did not change are then skipped by their hash
+        if(frame.scrollRows != 0)
+        {
+            m_termWriter.scrollRows(m_windPos.row, m_windPos.row + frame.scrollView.size.height - 1,
+                                    frame.scrollRows);
+        }
+    }
+
+    for(int row = 0; row < (int)frame.rows.size(); row++)
+    {
+        const FrameRow& frameRow = frame.rows[row];
+        const char* text = frameRow.text.c_str();
+
+        beginPaintRow(row);
+        if(!m_isDirectOutput && !frameRow.isAscii)
+        {
+            // colored by overlayUtf8
+            std::string placeholder = utf8_placeholder(text, frameRow.text.size());
+            paintText(placeholder.c_str(), placeholder.size(), 0);
+            continue;
+        }
+
+        int printed = 0;
+        for(auto& segment : frameRow.segments)
+        {
+            paintText(text + printed, segment.start - printed, 0);
+            paintText(text + segment.start, segment.length, segment.colorId);
+            printed = segment.start + segment.length;
+        }
+        paintText(text + printed, frameRow.text.size() - printed, 0);
+        endPaintRow(frameRow.columns, frame.scrollView.size.width + 1);
+    }
+
+    if(m_isDirectOutput)
+    {
+        // one write for the whole frame, ncurses never sees these rows
+        paintStatus(frame.status);
+        int statusColumns = utf8_width(frame.status.data(), frame.status.size());
+        if(frame.isPrompt)
+            m_termWriter.endFrame(LINES - 1, std::min(statusColumns, COLS - 1));
+        else
+            m_termWriter.endFrame(m_windPos.row + frame.cursor.row, m_windPos.col + frame.cursor.col);
+        return;
+    }
+
+    // the window refreshed last places the cursor
+    paintStatus(frame.status);
+    wmove(m_window, frame.cursor.row, frame.cursor.col);
+    if(frame.isPrompt)
+    {
+        wnoutrefresh(m_window);
+        wnoutrefresh(stdscr);
+    }
+    else
+    {
+        wnoutrefresh(stdscr);
+        wnoutrefresh(m_window);
+    }
+    doupdate();
+    overlayUtf8(frame);
+}
+
+void TextArea::renderLoop()
+{
+    FrameSnapshot frame;
+    while(true)
+    {
+        Rect scrollView;
+        {
+            std::unique_lock<std::mutex> lock(m_viewMutex);
+            m_frameRequested.wait(lock, [this](){
+                return !m_isRenderRunning || m_version != m_paintedVersion;
+            });
+            if(!m_isRenderRunning)
+                break;
+            scrollView = m_scrollView;
+        }
+
+        // a short head start for the highlighter so a frame right after an
+        // edit does not flash plain text
+        m_highlighter.setViewport(scrollView.pos.row, scrollView.size.height);
+        m_highlighter.waitViewport(4);
+
+        // the newest state : versions requested meanwhile are never painted
+        takeSnapshot(frame);
+        paintFrame(frame);
+
+        std::lock_guard<std::mutex> lock(m_viewMutex);
+        m_paintedVersion = frame.version;
+    }
+}
+
+int TextArea::wordColor(const std::string& word)
+{
+    int color = m_syntax->colorOf(word);
+    if(color != 0)
+        return color;
+
+    std::lock_guard<std::mutex> lock(m_userDefMutex);
+    auto it = m_cmUserTypeDef.find(word);
+    if(it != m_cmUserTypeDef.end())
+        return it->second;
+
+    return 0;
+}
+
+bool TextArea::parseUserDefColor()
+{
+    int color;
+    {
+        std::lock_guard<std::mutex> lock(m_userDefMutex);
+        color = colorUserDef;
+    }
+
+    std::map<std::string, int> mapTemp;
+    std::match_results<std::string_view::const_iterator> typeMatch;
+    std::regex  typeRegx(R"(class\s([A-Za-z0-9]+))");
+    TextBuffer textClone;
+    {
+        // O(1) with the rope, the line table with the LineStore
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        textClone = m_text;
+    }
+
+    for(auto iLine : textClone)
+    {
+        if(std::regex_search(iLine.begin(), iLine.end(), typeMatch, typeRegx)) {
+            if (typeMatch.size() > 1) {
+                mapTemp[typeMatch[1].str()] = color;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_userDefMutex);
+    if(mapTemp == m_cmUserTypeDef)
+        return false;
+
+    m_cmUserTypeDef.swap(mapTemp);
+    return true;
+}
+
+// Saves a copy of the document, O(1) with the rope, the line table with
+// the LineStore : the lines are joined and written on the FileIo thread
+// while editing goes on. The caller holds m_viewMutex.
+void TextArea::SaveToFile(std::string fileName)
+{
+    // someone else's version would be lost
+    if(m_isDiskChanged && !m_isOverwriteAsked)
+    {
+        m_isOverwriteAsked = true;
+        setStatus(fileName + " changed on disk, F2 again overwrites it, F9 reloads it");
+        return;
+    }
+
+    auto snapshot = std::make_shared<TextBuffer>();
+    {
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        *snapshot = m_text;
+    }
+
+    // every line and its '\n', a line may be cut between two batches
+    uint64_t total = snapshot->byteCount() + 1;
+    auto source = [snapshot, line = snapshot->begin(), byte = (size_t)0](char* buffer, size_t capacity) mutable {
+        size_t filled = 0;
+        while(filled < capacity && line != snapshot->end())
+        {
+            std::string_view text = *line;
+            if(byte < text.size())
+            {
+                size_t count = std::min(text.size() - byte, capacity - filled);
+                memcpy(buffer + filled, text.data() + byte, count);
+                filled += count;
+                byte   += count;
+                continue;
+            }
+
+            buffer[filled++] = '\n';
+            ++line;
+            byte = 0;
+        }
+        return filled;
+    };
+
+    // compressed again as it is written, the progress would count
+    // compressed bytes against the text
+    FileIo::Source output = std::move(source);
+    if(m_compression != Compression::None)
+    {
+        output = CompressedFile::compressing(m_compression, std::move(output));
+        total  = 0;
+    }
+
+    m_savesInFlight++;
+    setStatus("Saving " + fileName);
+    m_fileIo.write(fileName, total, std::move(output),
+        [this](uint64_t done, uint64_t total){ postProgress("Saving ", done, total); },
+        [this, fileName, editCount = m_editCount](int error){
+            m_savesInFlight--;
+            if(error != 0)
+            {
+                postStatus("Could not save " + fileName + ": " + strerror(error));
+                return;
+            }
+
+            m_savedStamp       = fileStamp(fileName);
+            m_savedEditCount   = editCount;
+            m_isDiskChanged    = false;
+            m_isOverwriteAsked = false;
+            postStatus("Saved " + fileName);
+        });
+}
+
+void TextArea::postProgress(const std::string& label, uint64_t done, uint64_t total)
 {
-    // wclear(m_window);
-    // renderRow(m_cursor.row);
+    postStatus(label + m_fileName + " " + std::to_string(total ? done * 100 / total : 100) + "%");
+}
 
-    // if(!m_linesShouldRender.empty())
-    // {
-    //     for(auto row : m_linesShouldRender)
-    //     {
-    //         clearRow(row);
-    //         renderRow(row);
-    //     }
+// inotify on the open file's directory : editors that save by renaming
+// over the file leave the old inode behind, a watch on it would go quiet
+void TextArea::watchFile()
+{
+    if(m_fileWatch >= 0)
+        m_loop.unwatch(m_fileWatch);
+
+    size_t slash = m_fileName.rfind('/');
+    std::string dir  = slash == std::string::npos ? "." : m_fileName.substr(0, std::max<size_t>(slash, 1));
+    std::string name = slash == std::string::npos ? m_fileName : m_fileName.substr(slash + 1);
+    m_fileWatch = m_loop.watchPath(dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE,
+                                   [this, name](uint32_t mask, const std::string& eventName){
+        if((mask & IN_IGNORED) || eventName == name)
+            onFileEvent(mask);
+    });
+}
 
-    //     m_linesShouldRender.clear();
-    // }
+void TextArea::onFileEvent(uint32_t mask)
+{
+    if(mask & IN_IGNORED)
+    {
+        m_fileWatch = -1;
+        return;
+    }
 
-    for(int row = 0; row < m_scrollView.size.height; row++)
+    // renamed away or deleted, unless a new file already took its name
+    if((mask & (IN_MOVED_FROM | IN_DELETE)) && access(m_fileName.c_str(), F_OK) != 0)
     {
-        int rowInText = row + m_scrollView.pos.row;
-        if(rowInText >= m_text.size())
-            break;
-        
-        std::string lineTruncate = "";
-        int colInText = m_scrollView.pos.col;
-        if(colInText < m_text[rowInText].size())
-            lineTruncate = m_text[rowInText].substr(colInText, m_scrollView.size.width);
+        postStatus(m_fileName + " was moved or deleted");
+        return;
+    }
 
-        if(!lineTruncate.empty() && lineTruncate[lineTruncate.size() -1] == '\n')
-        {
-            lineTruncate.pop_back();
-        }
-        
-        clearRow(row);
-        wmove(m_window, row, 0);
+    // a new file is created, then written : the stamp is taken after both
+    m_loop.armTimer(m_fileTimer, FILE_DELAY_MS);
+}
 
-        // wprintw(m_window, lineTruncate.c_str());
+// our own saves are told apart by their stamp
+void TextArea::checkFileStamp()
+{
+    FileStamp stamp = fileStamp(m_fileName);
+    if(m_savesInFlight > 0 || (stamp.mtimeNs == m_savedStamp.mtimeNs && stamp.size == m_savedStamp.size))
+        return;
 
-        // parseUserDefColor();
+    m_savedStamp    = stamp;
+    m_isDiskChanged = true;
+    if(m_editCount == m_savedEditCount)
+        reloadFile();
+    else
+        postStatus(m_fileName + " changed on disk, F9 reloads it");
+}
 
-        Lexer lex(lineTruncate.c_str());
-        for (auto token = lex.next();
-            token.is_not(Token::Kind::End);
-            token = lex.next()) 
-        {
-            std::string strToken = token.lexeme();
-            int colorId = 0;
+// Reads the file again for diffReload, one reload at a time. The caller
+// may hold m_viewMutex.
+void TextArea::reloadFile()
+{
+    if(m_isReloading)
+    {
+        m_isReloadPending = true;
+        return;
+    }
 
-            if(token.kind() == Token::Kind::Comment) 
-            {
-                colorId = colorComment;
-            }
-            else
-            {
-                colorId = m_colorMap[strToken];
-                if(colorId == 0)
-                    colorId = m_cmUserTypeDef[strToken];
-            }
+    m_isReloading = true;
+    m_fileIo.read(m_fileName, nullptr,
+        [this](std::string&& content, int error){ diffReload(std::move(content), error); },
+        fileDecoder());
+}
 
-            if(colorId != 0)
-            {
-                wattron(m_window, COLOR_PAIR(colorId));
-                wprintw(m_window, strToken.c_str());
-                wattroff(m_window, COLOR_PAIR(colorId));
-            }
-            else
+// The new content is diffed against a copy of the text on m_reloadThread,
+// editing goes on meanwhile
+void TextArea::diffReload(std::string&& content, int error)
+{
+    if(error != 0)
+    {
+        m_isReloading = false;
+        postStatus("Could not reload " + m_fileName + ": " + strerror(error));
+        return;
+    }
+
+    auto snapshot = std::make_shared<TextBuffer>();
+    {
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        *snapshot = m_text;
+    }
+
+    if(m_reloadThread.joinable())
+        m_reloadThread.join();
+    m_reloadThread = std::thread([this, snapshot, content = std::move(content),
+                                  editCount = m_editCount, stamp = fileStamp(m_fileName)]() {
+        // the lines as a load makes them, after the blank first one
+        std::vector<std::string_view> lines(1);
+        for(size_t begin = 0; ; )
+        {
+            size_t end = content.find('\n', begin);
+            if(end == std::string::npos)
             {
-                wprintw(m_window, strToken.c_str());
+                lines.emplace_back(content.data() + begin, content.size() - begin);
+                break;
             }
+            lines.emplace_back(content.data() + begin, end - begin);
+            begin = end + 1;
+        }
+
+        std::vector<ReloadHunk> hunks;
+        for(const DiffHunk& diff : diff_lines(*snapshot, lines))
+            hunks.push_back({(int)diff.oldRow, (int)diff.oldCount,
+                             std::vector<std::string>(lines.begin() + diff.newRow,
+                                                      lines.begin() + diff.newRow + diff.newCount)});
+
+        m_loop.post([this, hunks = std::move(hunks), editCount, stamp]() mutable {
+            applyReload(std::move(hunks), editCount, stamp);
+        });
+    });
+}
+
+// Applies the hunks of diffReload bottom up, each one is an undo record;
+// lines above the view move it, the cursor stays on its line. Text edited
+// since the copy is diffed again.
+void TextArea::applyReload(std::vector<ReloadHunk>&& hunks, uint64_t editCount, FileStamp stamp)
+{
+    m_isReloading = false;
+    if(m_editCount != editCount)
+    {
+        reloadFile();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        int top  = m_scrollView.pos.row;
+        int line = top + m_cursor.row;
+        int painted = m_paintedPos.row;
+        // where a row is once rows [from, from + erased) became inserted rows
+        auto follow = [](int row, int from, int erased, int inserted) {
+            if(row >= from + erased)
+                return row + inserted - erased;
+            if(row >= from)
+                return from + std::min(row - from, std::max(inserted - 1, 0));
+            return row;
+        };
+
+        // the hunks are one undo step
+        m_undoGroup = ++m_undoGroupCount;
+        for(auto hunk = hunks.rbegin(); hunk != hunks.rend(); ++hunk)
+        {
+            int count = hunk->lines.size();
+            std::vector<std::string> oldLines;
+            for(int i = 0; i < hunk->rowCount; i++)
+                oldLines.emplace_back(m_text[hunk->row + i]);
+            pushUndo(hunk->row, count, std::move(oldLines));
+
+            m_text.erase(hunk->row, hunk->rowCount);
+            m_text.insert(hunk->row, std::move(hunk->lines));
+            m_highlighter.linesErased(hunk->row, hunk->rowCount);
+            m_wrap.linesErased(hunk->row, hunk->rowCount);
+            m_widths.linesErased(hunk->row, hunk->rowCount);
+            m_highlighter.linesInserted(hunk->row, count);
+            m_wrap.linesInserted(hunk->row, count);
+            m_widths.linesInserted(hunk->row, count);
+
+            line    = follow(line, hunk->row, hunk->rowCount, count);
+            top     = follow(top, hunk->row, hunk->rowCount, count);
+            painted = follow(painted, hunk->row, hunk->rowCount, count);
         }
+        m_undoGroup = 0;
+        trimUndo();
+
+        // m_paintedPos moved with the view : the frame does not scroll for
+        // lines changed above it
+        int height = m_scrollView.size.height;
+        m_scrollView.pos.row = std::min(std::max(top, line - height + 1), line);
+        m_cursor.row         = line - m_scrollView.pos.row;
+        m_paintedPos.row     = painted;
+        clampCursor();
+
+        m_savedStamp       = stamp;
+        m_savedEditCount   = m_editCount;
+        m_isDiskChanged    = false;
+        m_isOverwriteAsked = false;
+        if(hunks.empty())
+            setStatus("");
+        else
+            setStatus("Reloaded " + m_fileName + ", " + std::to_string(hunks.size()) + " change(s), undo reverts them");
     }
+    requestFrame();
 
-    wmove(m_window, m_cursor.row, m_cursor.col);
-    // box(m_window, 0, 0);
-    wrefresh(m_window);
+    if(!hunks.empty())
+        m_loop.armTimer(m_userDefTimer, USER_DEF_DELAY_MS);
+    if(m_isReloadPending)
+    {
+        m_isReloadPending = false;
+        reloadFile();
+    }
 }
 
-void TextArea::parseUserDefColor()
+void TextArea::OpenFile(std::string fileName)
 {
-    std::map<std::string, int> mapTemp;
-    std::smatch typeMatch;
-    std::regex  typeRegx(R"(class\s([A-Za-z0-9]+))");
-    std::vector<std::string> textClone  = m_text;
+    FileStamp stamp = fileStamp(fileName);
+    if(stamp.size >= 0 && (uint64_t)stamp.size >= m_viewerMinBytes)
+    {
+        OpenViewer(fileName);
+        return;
+    }
 
-    for(auto iLine : textClone)
+    m_fileName    = fileName;
+    m_isLoading   = true;
+    m_compression = CompressedFile::detect(fileName);
+    postStatus("Loading " + fileName);
+    m_fileIo.read(fileName,
+        [this](uint64_t done, uint64_t total){ postProgress("Loading ", done, total); },
+        [this](std::string&& content, int error){ onFileLoaded(std::move(content), error); },
+        fileDecoder());
+}
+
+// "kceditor -" : fd is the pipe that was stdin (main moved the terminal
+// there), read on the loop as data comes so the first screen shows as soon
+// as its lines are in
+void TextArea::OpenStream(int fd)
+{
+    m_fileName      = "";
+    m_streamFd      = fd;
+    m_isStreaming   = true;
+    m_isStreamValid = true;
+    m_streamError   = 0;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
     {
-        if(std::regex_search(iLine, typeMatch, typeRegx)) {
-            if (typeMatch.size() > 1) {
-                mapTemp[typeMatch[1].str()] = colorUserDef;
-            }
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        m_highlighter.reset(m_text.size());
+        m_wrap.reset(m_text.size());
+        m_widths.reset(m_text.size());
+    }
+    postStatus("Reading stdin");
+    m_loop.addFd(fd, [this](){ onStreamInput(); });
+}
+
+// reads what the pipe has; the first screen of lines goes in at once,
+// later lines every STREAM_DELAY_MS (m_streamTimer)
+void TextArea::onStreamInput()
+{
+    size_t start = m_streamPending.size();
+    while(m_streamPending.size() < start + STREAM_CHUNK_BYTES)
+    {
+        size_t used = m_streamPending.size();
+        m_streamPending.resize(used + (64 << 10));
+        ssize_t count = read(m_streamFd, &m_streamPending[used], 64 << 10);
+        int error = count < 0 ? errno : 0;
+        m_streamPending.resize(used + std::max<ssize_t>(count, 0));
+        if(count > 0 || error == EINTR)
+            continue;
+        if(error != EAGAIN)
+        {
+            m_streamError = error;
+            m_loop.removeFd(m_streamFd);
+            close(m_streamFd);
+            m_streamFd = -1;
         }
+        break;
     }
 
-    m_cmUserTypeDef.clear();
-    m_cmUserTypeDef = mapTemp;
+    if(m_streamFd < 0 || (int)m_text.size() <= m_windSize.height)
+    {
+        takeStream();
+    }
+    else if(!m_isStreamArmed)
+    {
+        m_isStreamArmed = true;
+        m_loop.armTimer(m_streamTimer, STREAM_DELAY_MS);
+    }
 }
 
-void TextArea::SaveToFile(std::string fileName)
+// the complete lines read go to the end of the text in one insert, the
+// highlighter, wrap and widths only learn about the new rows
+void TextArea::takeStream()
 {
-    std::ofstream fileSave;
-    fileSave.open(fileName);
-    if(fileSave.is_open())
+    if(!m_isStreaming)
+        return;
+
+    // the last line goes in without its '\n' at the end, as a loaded file's
+    bool isEnd = m_streamFd < 0;
+    size_t cut = isEnd ? m_streamPending.size() : m_streamPending.rfind('\n');
+    if(cut == std::string::npos)
+        return;
+
+    std::string data;
+    if(isEnd)
+    {
+        data.swap(m_streamPending);
+        m_isStreaming = false;
+    }
+    else
+    {
+        data.assign(m_streamPending, cut + 1, std::string::npos);
+        data.swap(m_streamPending);
+        data.resize(cut);
+    }
+
+    m_isStreamValid = m_isStreamValid && utf8_validate(data.data(), data.size());
     {
-        for(auto& line : m_text)
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        std::unique_lock<std::mutex> lock(m_docMutex);
+        int row = m_text.size();
+        m_text.appendText(std::move(data));
+        int count = m_text.size() - row;
+        m_highlighter.linesInserted(row, count);
+        m_wrap.linesInserted(row, count);
+        m_widths.linesInserted(row, count);
+        int lineCount = m_text.size() - 1;
+        lock.unlock();
+
+        if(m_streamError != 0)
+            setStatus(std::string("stdin: ") + strerror(m_streamError));
+        else if(!m_isStreamValid)
+            setStatus("stdin is not valid UTF-8, bad bytes show as ?");
+        else
+            setStatus("stdin: " + std::to_string(lineCount) + (isEnd ? " lines" : " lines, reading"));
+    }
+
+    if(isEnd)
+    {
+        {
+            std::lock_guard<std::mutex> userDefLock(m_userDefMutex);
+            m_isUserDefRequested = true;
+        }
+        m_userDefWakeup.notify_one();
+    }
+    requestFrame();
+}
+
+// a text without a file (stdin) : F2 asks for its name
+void TextArea::saveAs()
+{
+    beginPrompt("Save as: ", [this](const std::string& fileName){
+        if(fileName.empty())
+            return;
+
         {
-            fileSave <<  line << '\n';
+            std::lock_guard<std::mutex> lock(m_viewMutex);
+            m_fileName = fileName;
+            SaveToFile(fileName);
+            watchFile();
         }
+        requestFrame();
+    });
+}
+
+// .gz / .zst : the text is decompressed on the FileIo thread, past
+// "viewer_min_mb" of it the file goes to the viewer (EFBIG)
+FileIo::Decode TextArea::fileDecoder()
+{
+    if(m_compression == Compression::None)
+        return nullptr;
+
+    return [format = m_compression, limit = m_viewerMinBytes](std::string& content) {
+        return CompressedFile::decompress(format, content, limit);
+    };
+}
 
-        fileSave.close();
+// the read of OpenFile is done, a missing file is created
+void TextArea::onFileLoaded(std::string&& content, int error)
+{
+    if(error == EFBIG)
+    {
+        m_isLoading = false;
+        OpenViewer(m_fileName);
+        return;
+    }
+
+    if(error == ENOENT)
+    {
+        std::ofstream filenew;
+        filenew.open(m_fileName);
+    }
+
+    std::unique_lock<std::mutex> viewLock(m_viewMutex);
+    std::unique_lock<std::mutex> lock(m_docMutex);
+    bool isAscii = true;
+    bool isValid = true;
+    if(error == 0)
+    {
+        // checked as one buffer, which then becomes the line store arena
+        isValid = utf8_validate(content.data(), content.size(), &isAscii);
+        isAscii = isAscii && !memchr(content.data(), '\t', content.size());    // a tab is wider
+        m_text.appendText(std::move(content));
+    }
+
+    m_highlighter.reset(m_text.size());
+    m_wrap.reset(m_text.size());
+    m_widths.reset(m_text.size(), isAscii);
+    m_isLoading = false;
+    if(error == ENOSYS)
+        setStatus(m_fileName + ": zstd needs libzstd.so.1");
+    else if(error == EILSEQ && m_compression != Compression::None)
+        setStatus(m_fileName + ": corrupt compressed data");
+    else if(error != 0 && error != ENOENT)
+        setStatus(m_fileName + ": " + strerror(error));
+    else if(!isValid)
+        setStatus(m_fileName + " is not valid UTF-8, bad bytes show as ?");
+    else
+        setStatus("");
+    lock.unlock();
+    viewLock.unlock();
+
+    m_savedStamp     = fileStamp(m_fileName);
+    m_savedEditCount = m_editCount;
+    watchFile();
+
+    {
+        std::lock_guard<std::mutex> userDefLock(m_userDefMutex);
+        m_isUserDefRequested = true;
     }
+    m_userDefWakeup.notify_one();
+
+    requestFrame();
 }
 
-void TextArea::OpenFile(std::string fileName)
+// read only, the file is mapped a window at a time (FileViewer), so its
+// size does not matter; isFollowing starts at its end, in follow mode
+void TextArea::OpenViewer(std::string fileName, bool isFollowing)
 {
     m_fileName = fileName;
 
-    std::ifstream fileOpen;
-    fileOpen.open(fileName);
-    if(fileOpen.is_open())
+    std::string error;
+    {
+        std::lock_guard<std::mutex> viewLock(m_viewMutex);
+        if(m_viewer.open(fileName, &error))
+        {
+            m_isViewer = true;
+            jumpViewer(0);
+            if(isFollowing)
+                setFollow(true);
+            followTail();
+            viewerStatus();
+        }
+        else
+        {
+            setStatus(error);
+        }
+    }
+
+    requestFrame();
+}
+
+// viewer : a new slice from the line holding offset, on the first row.
+// Near the end of the file the last row is the last line.
+// The caller holds m_viewMutex.
+void TextArea::jumpViewer(uint64_t offset)
+{
+    uint64_t start = m_viewer.lineStart(offset);
+    if(start == m_viewer.size())
+        start = m_viewer.prevLine(start);
+
+    // a new store, so the old slice leaves no dead arena bytes
+    TextBuffer slice;
+    m_viewLines.clear();
+    m_viewEnd = start;
+    int count = VIEWER_SLACK_LINES + m_scrollView.size.height;
+    for(int i = 0; i < count && m_viewEnd < m_viewer.size(); i++)
+    {
+        std::string line;
+        m_viewLines.push_back(m_viewEnd);
+        m_viewEnd = m_viewer.nextLine(m_viewEnd, &line);
+        slice.push_back(line);
+    }
+
+    if(slice.empty())
+    {
+        m_viewLines.push_back(start);
+        slice.push_back("");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        m_text.swap(slice);
+        m_highlighter.reset(m_text.size());
+        m_wrap.reset(m_text.size());
+        m_widths.reset(m_text.size());
+    }
+
+    m_scrollView.pos = {0, 0};
+    m_cursor         = {0, 0};
+    m_wrapTopRow     = 0;
+    m_paintedPos     = {-1, -1};
+    followViewer();
+
+    int maxTop = std::max((int)m_text.size() - m_scrollView.size.height, 0);
+    if(m_scrollView.pos.row > maxTop)
+    {
+        m_cursor.row = m_scrollView.pos.row - maxTop;
+        m_scrollView.pos.row = maxTop;
+    }
+    if(m_isSoftWrap)
+        wrapFollowCursor();
+}
+
+// viewer : keeps between half the slack and the slack of lines above and
+// below the view, what goes past the other side is dropped.
+// The caller holds m_viewMutex.
+void TextArea::followViewer()
+{
+    int slack  = std::max(VIEWER_SLACK_LINES, 2 * m_scrollView.size.height);
+    int top    = m_scrollView.pos.row;
+    int bottom = top + m_scrollView.size.height;
+
+    if((int)m_text.size() - bottom < slack / 2 && m_viewEnd < m_viewer.size())
+    {
+        std::vector<std::string> lines;
+        while((int)(m_text.size() + lines.size()) - bottom < slack && m_viewEnd < m_viewer.size())
+        {
+            m_viewLines.push_back(m_viewEnd);
+            lines.emplace_back();
+            m_viewEnd = m_viewer.nextLine(m_viewEnd, &lines.back());
+        }
+        viewerInsert(m_text.size(), std::move(lines));
+        if(top > slack)
+            viewerErase(0, top - slack);
+    }
+
+    top = m_scrollView.pos.row;
+    if(top < slack / 2 && m_viewLines.front() > 0)
+    {
+        std::vector<std::string> lines;
+        uint64_t start = m_viewLines.front();
+        while(top + (int)lines.size() < slack && start > 0)
+        {
+            start = m_viewer.prevLine(start);
+            m_viewLines.push_front(start);
+            lines.emplace_back();
+            m_viewer.nextLine(start, &lines.back());
+        }
+        std::reverse(lines.begin(), lines.end());
+        viewerInsert(0, std::move(lines));
+
+        bottom = m_scrollView.pos.row + m_scrollView.size.height;
+        if((int)m_text.size() - bottom > slack)
+            viewerErase(bottom + slack, m_text.size() - bottom - slack);
+    }
+}
+
+// viewer : lines read into the slice at row, their offsets are already in
+// m_viewLines. The view stays on the same text.
+void TextArea::viewerInsert(int row, std::vector<std::string>&& lines)
+{
+    int count = lines.size();
+    {
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        m_text.insert(row, std::move(lines));
+        m_highlighter.linesInserted(row, count);
+        m_wrap.linesInserted(row, count);
+        m_widths.linesInserted(row, count);
+    }
+
+    if(row <= m_scrollView.pos.row)
+    {
+        m_scrollView.pos.row += count;
+        if(m_paintedPos.row >= 0)
+            m_paintedPos.row += count;
+    }
+}
+
+// viewer : drops lines above or below the view from the slice
+void TextArea::viewerErase(int row, int count)
+{
+    if(row + count == (int)m_text.size())
+        m_viewEnd = m_viewLines[row];
+    m_viewLines.erase(m_viewLines.begin() + row, m_viewLines.begin() + row + count);
+
+    {
+        std::lock_guard<std::mutex> lock(m_docMutex);
+        m_text.erase(row, count);
+        m_highlighter.linesErased(row, count);
+        m_wrap.linesErased(row, count);
+        m_widths.linesErased(row, count);
+    }
+
+    if(row < m_scrollView.pos.row)
     {
-        while (!fileOpen.eof())
+        m_scrollView.pos.row -= count;
+        if(m_paintedPos.row >= 0)
+            m_paintedPos.row -= count;
+    }
+}
+
+// viewer : where the cursor line is in the file. The line index follows
+// the view forward; after a jump far ahead of it only the percentage is
+// known. The caller holds m_viewMutex.
+void TextArea::viewerStatus()
+{
+    int row = std::min(std::max(m_scrollView.pos.row + m_cursor.row, 0), (int)m_viewLines.size() - 1);
+    uint64_t offset = m_viewLines[row];
+    if(offset == m_viewCursor)
+        return;
+    m_viewCursor = offset;
+
+    if(offset - std::min(offset, m_viewer.indexedEnd()) <= FileViewer::kIndexStepBytes)
+        m_viewer.extendIndex(m_viewEnd);
+
+    char percent[16];
+    snprintf(percent, sizeof(percent), "%.1f%%", m_viewer.size() ? offset * 100.0 / m_viewer.size() : 100.0);
+    std::string status = m_fileName + "  " + percent;
+    if(m_viewer.isIndexed(offset))
+        status += "  line " + std::to_string(m_viewer.lineNumber(offset) + 1);
+    if(m_isFollowing)
+        status += "  (read only, following)";
+    else if(m_viewer.isDecompressing())
+        status += "  (read only, decompressing)";
+    else
+        status += "  (read only)";
+    setStatus(status);
+}
+
+// viewer : F8 goes to a percentage of the file ("50%") or to a line, as
+// far as the index can get in a few steps
+void TextArea::viewerGoTo()
+{
+    beginPrompt("Go to (line or %): ", [this](const std::string& input){
+        if(input.empty())
+            return;
+
+        char* end;
+        double value = strtod(input.c_str(), &end);
+        bool isPercent = *end == '%';
+        if(end == input.c_str() || (*end && !(isPercent && end[1] == 0)) || value < 0)
+        {
+            postStatus("Not a line or a percentage: " + input);
+            return;
+        }
+
+        uint64_t offset = 0;
+        if(isPercent)
+        {
+            offset = std::min(value, 100.0) / 100 * m_viewer.size();
+        }
+        else
         {
-            std::string line;
-            std::getline(fileOpen, line);
-            if (!line.empty() && line[line.size() - 1] == '\n')
+            uint64_t line = value >= 1 ? (uint64_t)value - 1 : 0;
+            uint64_t counted;
             {
-                line.pop_back();
+                std::lock_guard<std::mutex> lock(m_viewMutex);
+                for(int step = 0; step < 16 && line > m_viewer.indexedLines() && !m_viewer.isIndexComplete(); step++)
+                    m_viewer.extendIndex(m_viewer.size());
+                offset  = m_viewer.lineOffset(line);
+                counted = m_viewer.isIndexComplete() ? 0 : m_viewer.indexedLines();
             }
-            
-            m_text.push_back(line);
+
+            if(offset == m_viewer.size() && counted > 0)
+            {
+                postStatus("Line " + input + " is past the " + std::to_string(counted)
+                           + " lines counted so far, go to a percentage");
+                return;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_viewMutex);
+            jumpViewer(offset);
+            m_viewCursor = UINT64_MAX;
+            viewerStatus();
         }
-        
+        requestFrame();
+    });
+}
+
+// viewer : F9 follows the file as it grows, from its end.
+// The caller holds m_viewMutex.
+void TextArea::setFollow(bool isFollowing)
+{
+    m_isFollowing = isFollowing;
+    if(m_fileWatch >= 0)
+        m_loop.unwatch(m_fileWatch);
+    m_fileWatch = -1;
+
+    if(isFollowing)
+    {
+        m_fileWatch = m_loop.watchPath(m_fileName, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF,
+                                       [this](uint32_t mask, const std::string&){ onFollowEvent(mask); });
+        m_viewer.refresh();
+        jumpViewer(m_viewer.size());
     }
-    else
+    m_viewCursor = UINT64_MAX;
+    viewerStatus();
+}
+
+// a write to the followed file : taken in by m_followTimer, a burst of
+// them once
+void TextArea::onFollowEvent(uint32_t mask)
+{
+    if(mask & (IN_MOVE_SELF | IN_DELETE_SELF))
     {
-        std::ofstream filenew;
-        filenew.open(fileName);
+        postStatus(m_fileName + " was moved or deleted, no longer followed");
+        return;
+    }
+
+    if(mask & IN_IGNORED)
+    {
+        m_fileWatch = -1;
+        return;
+    }
+
+    if(!m_isFollowArmed)
+    {
+        m_isFollowArmed = true;
+        m_loop.armTimer(m_followTimer, FOLLOW_DELAY_MS);
+    }
+}
+
+// Takes in the bytes appended since the last tick, or decompressed. When
+// the slice reaches the old end its last line is read again (it may have
+// been cut short), then the new lines; at the end, when they are more
+// than the slice holds, the view jumps to the end instead. A truncated
+// file is opened again.
+// The caller holds m_viewMutex.
+void TextArea::followTail()
+{
+    if(!m_isViewer || (!m_isFollowing && !m_viewer.isCompressed()))
+        return;
+
+    // a compressed file grows while it is decompressed
+    if(m_viewer.isDecompressing() && !m_isFollowArmed)
+    {
+        m_isFollowArmed = true;
+        m_loop.armTimer(m_followTimer, FOLLOW_DELAY_MS);
+    }
+
+    uint64_t oldSize = m_viewer.size();
+    int last = m_text.size() - 1;
+    bool isAtEnd = m_isFollowing && m_viewEnd == oldSize && m_scrollView.pos.row + m_cursor.row == last;
+    if(!m_viewer.refresh())
+    {
+        std::string error;
+        if(!m_viewer.open(m_fileName, &error))
+        {
+            m_isViewer = false;
+            setStatus(error);
+            return;
+        }
+        jumpViewer(m_viewer.size());
+        m_viewCursor = UINT64_MAX;
+        viewerStatus();
+        return;
+    }
+
+    uint64_t size = m_viewer.size();
+    if(size == oldSize)
+        return;
+    m_viewCursor = UINT64_MAX;
+    if(m_viewEnd != oldSize)
+    {
+        // read when the view gets there
+        viewerStatus();
+        return;
+    }
+
+    int height = m_scrollView.size.height;
+    int limit  = VIEWER_SLACK_LINES + height;
+    uint64_t offset = m_viewLines.back();
+    std::vector<std::string> lines;
+    std::vector<uint64_t> starts;
+    while(offset < size && (int)lines.size() < limit)
+    {
+        starts.push_back(offset);
+        lines.emplace_back();
+        offset = m_viewer.nextLine(offset, &lines.back());
+    }
+    if(offset < size && isAtEnd)
+    {
+        jumpViewer(size);
+        viewerStatus();
+        return;
     }
 
-    this->Render();
+    viewerErase(last, 1);
+    m_viewLines.insert(m_viewLines.end(), starts.begin(), starts.end());
+    m_viewEnd = offset;
+    viewerInsert(m_text.size(), std::move(lines));
+
+    // the last line on the last row, the rows above scroll up
+    if(isAtEnd)
+    {
+        int line = m_text.size() - 1;
+        int top  = std::max(m_scrollView.pos.row, line - height + 1);
+        int slack = std::max(VIEWER_SLACK_LINES, 2 * height);
+        m_scrollView.pos.row = top;
+        m_cursor = {line - top, 0};
+        if(top > slack)
+            viewerErase(0, top - slack);
+    }
+    if(m_isSoftWrap)
+        wrapFollowCursor();
+    viewerStatus();
 }
 
 TextArea::~TextArea()
 {
-    m_isRunThreadPraseSyntax = false;
+    {
+        std::lock_guard<std::mutex> lock(m_viewMutex);
+        m_isRenderRunning = false;
+    }
+    m_frameRequested.notify_one();
+    m_renderThread.join();
+    write(STDOUT_FILENO, BRACKETED_PASTE_OFF, strlen(BRACKETED_PASTE_OFF));
+
+    m_highlighter.stop();
+
+    {
+        std::lock_guard<std::mutex> lock(m_userDefMutex);
+        m_isRunThreadPraseSyntax = false;
+    }
+    m_userDefWakeup.notify_one();
     m_threadParseSyntax.join();
+    if(m_reloadThread.joinable())
+        m_reloadThread.join();
+    if(m_replaceThread.joinable())
+        m_replaceThread.join();
+    if(m_configThread.joinable())
+        m_configThread.join();
+
+    m_loop.removeFd(STDIN_FILENO);
+    m_loop.removeFd(m_escTimer);
+    m_loop.removeFd(m_userDefTimer);
+    m_loop.removeFd(m_fileTimer);
+    m_loop.removeFd(m_followTimer);
+    m_loop.removeFd(m_streamTimer);
+    m_loop.removeFd(m_configTimer);
+    if(m_configWatch >= 0)
+        m_loop.unwatch(m_configWatch);
+    m_loop.removeFd(m_resizeSignal);
+    if(m_fileWatch >= 0)
+        m_loop.unwatch(m_fileWatch);
+    if(m_streamFd >= 0)
+    {
+        m_loop.removeFd(m_streamFd);
+        close(m_streamFd);
+    }
 }
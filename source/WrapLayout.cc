@@ -0,0 +1,457 @@
+#include "WrapLayout.h"
+#include <algorithm>
+
+WrapLayout::WrapLayout()
+{
+    m_text   = nullptr;
+    m_widths = nullptr;
+    m_width = 0;
+    m_lineCount = 0;
+    m_hintChunk = -1;
+    m_hintStart = 0;
+}
+
+void WrapLayout::attach(const TextBuffer* text, LineWidths* widths)
+{
+    m_text   = text;
+    m_widths = widths;
+}
+
+// the old rows of each chunk, scaled to the new width, stand in for its
+// lines until they are laid out again
+void WrapLayout::setWidth(int width)
+{
+    if(width == m_width)
+        return;
+
+    for(auto& chunk : m_chunks)
+    {
+        int lines = chunk.counts.size();
+        if(m_width > 0 && width > 0 && lines > 0)
+        {
+            int64_t estimate = (int64_t)chunk.rows * kEstimateOne * m_width / ((int64_t)width * lines);
+            chunk.estimate = std::max<int64_t>(estimate, kEstimateOne);
+        }
+        else
+        {
+            chunk.estimate = kEstimateOne;
+        }
+        chunk.isStale   = true;
+        chunk.laidLines = 0;
+        chunk.laidRows  = 0;
+        chunk.rows      = chunkRows(chunk);
+    }
+    m_width = width;
+    rebuildTrees();
+}
+
+void WrapLayout::reset(int lineCount)
+{
+    m_chunks.clear();
+    for(int line = 0; line < lineCount; line += kChunkLines)
+    {
+        Chunk chunk;
+        chunk.counts.assign(std::min(kChunkLines, lineCount - line), 0);
+        chunk.rows = chunk.counts.size();
+        m_chunks.push_back(std::move(chunk));
+    }
+    m_lineCount = std::max(lineCount, 0);
+    rebuildTrees();
+}
+
+void WrapLayout::lineChanged(int line)
+{
+    if(line < 0 || line >= m_lineCount)
+        return;
+
+    int start;
+    int index = findChunk(line, start);
+    Chunk& chunk = m_chunks[index];
+    freshen(chunk);
+    int& count = chunk.counts[line - start];
+    if(count != 0)
+    {
+        chunk.laidLines--;
+        chunk.laidRows -= count;
+        count = 0;
+        refresh(index);
+    }
+}
+
+// the lines go into the chunk of line (the last one past the end), a chunk
+// grown past twice kChunkLines is split
+void WrapLayout::linesInserted(int line, int count)
+{
+    if(count <= 0)
+        return;
+
+    line = std::min(std::max(line, 0), m_lineCount);
+    if(m_chunks.empty())
+    {
+        reset(count);
+        return;
+    }
+
+    int start;
+    int index = line < m_lineCount ? findChunk(line, start) : (int)m_chunks.size() - 1;
+    if(line == m_lineCount)
+        start = m_lineCount - m_chunks[index].counts.size();
+
+    Chunk& chunk = m_chunks[index];
+    freshen(chunk);
+    chunk.counts.insert(chunk.counts.begin() + (line - start), count, 0);
+    m_lineCount += count;
+    m_hintChunk = -1;
+
+    if(chunk.counts.size() <= 2 * (size_t)kChunkLines)
+    {
+        treeAdd(m_lineTree, index, count);
+        refresh(index);
+        return;
+    }
+
+    std::vector<int> counts;
+    counts.swap(chunk.counts);
+    int estimate = chunk.estimate;
+    std::vector<Chunk> pieces;
+    for(size_t from = 0; from < counts.size(); from += kChunkLines)
+    {
+        Chunk piece;
+        piece.estimate = estimate;
+        piece.counts.assign(counts.begin() + from, counts.begin() + std::min(from + kChunkLines, counts.size()));
+        for(int rows : piece.counts)
+        {
+            if(rows != 0)
+            {
+                piece.laidLines++;
+                piece.laidRows += rows;
+            }
+        }
+        piece.rows = chunkRows(piece);
+        pieces.push_back(std::move(piece));
+    }
+    m_chunks.erase(m_chunks.begin() + index);
+    m_chunks.insert(m_chunks.begin() + index, std::make_move_iterator(pieces.begin()),
+                    std::make_move_iterator(pieces.end()));
+    rebuildTrees();
+}
+
+void WrapLayout::linesErased(int line, int count)
+{
+    if(line < 0 || line >= m_lineCount)
+        return;
+
+    count = std::min(count, m_lineCount - line);
+    m_lineCount -= count;
+    m_hintChunk = -1;
+
+    // the chunks from the one of line on, a chunk left empty goes
+    int start;
+    int first = findChunk(line, start);
+    int from  = line - start;
+    int last  = first;
+    bool isRemoved = false;
+    for(; count > 0; last++, from = 0)
+    {
+        Chunk& chunk = m_chunks[last];
+        freshen(chunk);
+        int erased = std::min<int>(count, chunk.counts.size() - from);
+        for(int i = from; i < from + erased; i++)
+        {
+            if(chunk.counts[i] != 0)
+            {
+                chunk.laidLines--;
+                chunk.laidRows -= chunk.counts[i];
+            }
+        }
+        chunk.counts.erase(chunk.counts.begin() + from, chunk.counts.begin() + from + erased);
+        count -= erased;
+        isRemoved = isRemoved || chunk.counts.empty();
+        if(!isRemoved)
+        {
+            treeAdd(m_lineTree, last, -erased);
+            refresh(last);
+        }
+    }
+
+    if(isRemoved)
+    {
+        for(int i = first; i < last; i++)
+            m_chunks[i].rows = chunkRows(m_chunks[i]);
+        m_chunks.erase(std::remove_if(m_chunks.begin() + first, m_chunks.begin() + last,
+                                      [](const Chunk& chunk){ return chunk.counts.empty(); }),
+                       m_chunks.begin() + last);
+        rebuildTrees();
+    }
+}
+
+// the cursor may stand after the last char, so a full row opens the next one
+int WrapLayout::layoutLine(int line) const
+{
+    if(m_width <= 0 || !m_widths || (size_t)line >= m_text->size())
+        return 1;
+
+    return m_widths->columns(line) / m_width + 1;
+}
+
+void WrapLayout::rebuildTrees()
+{
+    int count = m_chunks.size();
+    m_lineTree.assign(count + 1, 0);
+    m_rowTree.assign(count + 1, 0);
+    for(int i = 1; i <= count; i++)
+    {
+        m_lineTree[i] += m_chunks[i - 1].counts.size();
+        m_rowTree[i]  += m_chunks[i - 1].rows;
+        int parent = i + (i & -i);
+        if(parent <= count)
+        {
+            m_lineTree[parent] += m_lineTree[i];
+            m_rowTree[parent]  += m_rowTree[i];
+        }
+    }
+    m_hintChunk = -1;
+}
+
+void WrapLayout::treeAdd(std::vector<int>& tree, int chunk, int delta)
+{
+    for(size_t i = chunk + 1; i < tree.size(); i += i & -i)
+        tree[i] += delta;
+}
+
+// the sum over the chunks before chunk
+int WrapLayout::treePrefix(const std::vector<int>& tree, int chunk) const
+{
+    int sum = 0;
+    for(int i = chunk; i > 0; i -= i & -i)
+        sum += tree[i];
+    return sum;
+}
+
+// the chunk holding value, prefix gets the sum before it; the chunk count
+// when value is past the end
+int WrapLayout::treeFind(const std::vector<int>& tree, int value, int& prefix) const
+{
+    int count = m_chunks.size();
+    int pos   = 0;
+    int step  = 1;
+    prefix = 0;
+    while(step * 2 <= count)
+        step *= 2;
+    for(; step > 0; step /= 2)
+    {
+        if(pos + step <= count && prefix + tree[pos + step] <= value)
+        {
+            pos    += step;
+            prefix += tree[pos];
+        }
+    }
+    return pos;
+}
+
+// line must be in the document
+int WrapLayout::findChunk(int line, int& start)
+{
+    if(m_hintChunk >= 0 && line >= m_hintStart &&
+       line < m_hintStart + (int)m_chunks[m_hintChunk].counts.size())
+    {
+        start = m_hintStart;
+        return m_hintChunk;
+    }
+
+    int index = treeFind(m_lineTree, line, start);
+    m_hintChunk = index;
+    m_hintStart = start;
+    return index;
+}
+
+// the counts of an old width are dropped once the chunk is touched, its
+// rows stay the estimate
+void WrapLayout::freshen(Chunk& chunk)
+{
+    if(!chunk.isStale)
+        return;
+
+    std::fill(chunk.counts.begin(), chunk.counts.end(), 0);
+    chunk.isStale = false;
+}
+
+int WrapLayout::chunkRows(const Chunk& chunk)
+{
+    int rest = chunk.counts.size() - chunk.laidLines;
+    return chunk.laidRows + ((int64_t)rest * chunk.estimate + kEstimateOne / 2) / kEstimateOne;
+}
+
+// the rows of a chunk changed, so does the row tree
+void WrapLayout::refresh(int index)
+{
+    Chunk& chunk = m_chunks[index];
+    int rows = chunkRows(chunk);
+    if(rows != chunk.rows)
+    {
+        treeAdd(m_rowTree, index, rows - chunk.rows);
+        chunk.rows = rows;
+    }
+}
+
+void WrapLayout::layoutChunk(int index, int start)
+{
+    Chunk& chunk = m_chunks[index];
+    if(!chunk.isStale && chunk.laidLines == (int)chunk.counts.size())
+        return;
+
+    freshen(chunk);
+    for(size_t i = 0; i < chunk.counts.size(); i++)
+    {
+        if(chunk.counts[i] == 0)
+        {
+            chunk.counts[i] = layoutLine(start + i);
+            chunk.laidLines++;
+            chunk.laidRows += chunk.counts[i];
+        }
+    }
+    refresh(index);
+}
+
+int WrapLayout::rowCount(int line)
+{
+    if(line < 0 || line >= m_lineCount)
+        return 1;
+
+    int start;
+    int index = findChunk(line, start);
+    Chunk& chunk = m_chunks[index];
+    freshen(chunk);
+    int& count = chunk.counts[line - start];
+    if(count == 0)
+    {
+        count = layoutLine(line);
+        chunk.laidLines++;
+        chunk.laidRows += count;
+        refresh(index);
+    }
+    return count;
+}
+
+int WrapLayout::subRow(int, int col) const
+{
+    return m_width > 0 ? col / m_width : 0;
+}
+
+int WrapLayout::rowStart(int, int subRow) const
+{
+    return subRow * m_width;
+}
+
+void WrapLayout::advance(int& line, int& subRow, int delta)
+{
+    while(delta > 0)
+    {
+        int left = rowCount(line) - 1 - subRow;
+        if(delta <= left)
+        {
+            subRow += delta;
+            return;
+        }
+
+        if(line + 1 >= m_lineCount)
+        {
+            subRow = rowCount(line) - 1;
+            return;
+        }
+
+        delta -= left + 1;
+        line++;
+        subRow = 0;
+    }
+
+    while(delta < 0)
+    {
+        if(-delta <= subRow)
+        {
+            subRow += delta;
+            return;
+        }
+
+        if(line == 0)
+        {
+            subRow = 0;
+            return;
+        }
+
+        delta += subRow + 1;
+        line--;
+        subRow = rowCount(line) - 1;
+    }
+}
+
+int WrapLayout::distance(int fromLine, int fromSub, int toLine, int toSub, int limit)
+{
+    if(toLine < fromLine || (toLine == fromLine && toSub < fromSub))
+        return -distance(toLine, toSub, fromLine, fromSub, limit);
+
+    int rows = -fromSub;
+    for(int line = fromLine; line < toLine; line++)
+    {
+        rows += rowCount(line);
+        if(rows >= limit)
+            return limit;
+    }
+    return std::min(rows + toSub, limit);
+}
+
+int WrapLayout::visualRow(int line)
+{
+    if(line >= m_lineCount)
+        return totalRows();
+
+    line = std::max(line, 0);
+    int start;
+    int index = findChunk(line, start);
+    layoutChunk(index, start);
+
+    int rows = treePrefix(m_rowTree, index);
+    const Chunk& chunk = m_chunks[index];
+    for(int i = 0; i < line - start; i++)
+        rows += chunk.counts[i];
+    return rows;
+}
+
+int WrapLayout::lineAt(int visualRow, int& subRow)
+{
+    if(m_lineCount == 0)
+    {
+        subRow = 0;
+        return 0;
+    }
+
+    // laying a chunk out may shrink it, the row then lies in a later one
+    int left = std::max(visualRow, 0);
+    int prefix;
+    int index = treeFind(m_rowTree, left, prefix);
+    int start = treePrefix(m_lineTree, index);
+    for(; index < (int)m_chunks.size(); index++)
+    {
+        layoutChunk(index, start);
+        const Chunk& chunk = m_chunks[index];
+        if(left - prefix < chunk.rows)
+        {
+            left -= prefix;
+            int i = 0;
+            while(left >= chunk.counts[i])
+                left -= chunk.counts[i++];
+            subRow = left;
+            return start + i;
+        }
+        prefix += chunk.rows;
+        start  += chunk.counts.size();
+    }
+
+    subRow = rowCount(m_lineCount - 1) - 1;
+    return m_lineCount - 1;
+}
+
+int WrapLayout::totalRows()
+{
+    return treePrefix(m_rowTree, m_chunks.size());
+}
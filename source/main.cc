@@ -1,5 +1,9 @@
 #include "TextArea.h"
+#include "EventLoop.h"
 #include <string>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 bool g_exitApp = false;
 
@@ -15,6 +19,20 @@ int main(int argc, char** args)
 	WINDOW* titlebar;
 	WINDOW* statusbar;
 	
+	// "-" : the text comes from the pipe on stdin, the keys from the
+	// terminal, which takes its place as fd 0
+	int streamFd = -1;
+	if(argc > 1 && std::string(args[1]) == "-")
+	{
+		int tty = isatty(STDIN_FILENO) ? -1 : open("/dev/tty", O_RDWR | O_CLOEXEC);
+		if(tty < 0) {
+			fprintf(stderr, "kceditor -: stdin must be a pipe, with a terminal to type in\n");
+			return 1;
+		}
+		streamFd = dup(STDIN_FILENO);
+		dup2(tty, STDIN_FILENO);
+		close(tty);
+	}
 
 	initscr();
 	noecho();
@@ -42,13 +60,24 @@ int main(int argc, char** args)
 	wrefresh(titlebar);
 	
 	{
-		TextArea textArea;
-		textArea.OpenFile(std::string(args[1]));
+		// input, timers, file watches and worker results all come through
+		// the loop, frames are painted by the TextArea render thread
+		EventLoop loop;
+		TextArea textArea(loop);
+		// -v : read only view, for files of any size; -f : the view follows
+		// the file as it grows (tail -f); - : stdin, read as it comes
+		if(streamFd >= 0)
+			textArea.OpenStream(streamFd);
+		else if(argc > 2 && std::string(args[1]) == "-v")
+			textArea.OpenViewer(std::string(args[2]));
+		else if(argc > 2 && std::string(args[1]) == "-f")
+			textArea.OpenViewer(std::string(args[2]), true);
+		else
+			textArea.OpenFile(std::string(args[1]));
 		// textArea.DrawBoder();
 
 		while(!g_exitApp) {
-			textArea.HanldeEvents();
-			textArea.Render();
+			loop.dispatch();
 		}
 	}
 
@@ -0,0 +1,792 @@
+// Unit tests for the editor internals, registered with ctest one group
+// per entry.
+//
+//   ./build/testEditor             run every group
+//   ./build/testEditor replace     run the groups whose name contains "replace"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <functional>
+#include <string>
+#include <vector>
+#include "utils/replaceUtils.hpp"
+#include "utils/utf8Utils.hpp"
+#include "utils/lineDiff.hpp"
+#include "DfaLexer.h"
+#include "InputDecoder.h"
+#include "LineStore.h"
+#include "LineRope.h"
+#include "ncurses/curses.h"
+
+struct Test
+{
+    const char* name;
+    std::function<void()> run;
+};
+
+static std::vector<Test>& testList()
+{
+    static std::vector<Test> list;
+    return list;
+}
+
+static int g_failures = 0;
+
+static void testFail(const char* file, int line, const std::string& what)
+{
+    printf("  %s:%d: %s\n", file, line, what.c_str());
+    g_failures++;
+}
+
+#define CHECK(cond) \
+    do { if(!(cond)) testFail(__FILE__, __LINE__, #cond); } while(0)
+
+// a and b are compared as std::string or as numbers, printed when they differ
+#define CHECK_EQ(a, b) \
+    do { if(!((a) == (b))) testFail(__FILE__, __LINE__, #a " == " #b " : " + \
+                                    testShow(a) + " vs " + testShow(b)); } while(0)
+
+static std::string testShow(const std::string& value) { return "\"" + value + "\""; }
+static std::string testShow(const char* value) { return testShow(std::string(value)); }
+template <typename T>
+static std::string testShow(T value) { return std::to_string(value); }
+
+// ---------------------------------------------------------------------------
+
+// the substituted line, or "(none)" when nothing matched
+static std::string replaced(const std::string& pattern, const std::string& replacement,
+                            bool useRegex, const std::string& line, size_t* count = nullptr)
+{
+    ReplaceEngine engine(pattern, replacement, useRegex);
+    std::string out;
+    size_t n = engine.replaceLine(line, out);
+    if(count)
+        *count = n;
+    return n == 0 ? "(none)" : out;
+}
+
+static void testReplace()
+{
+    // $n, $&, $0 and $$
+    size_t count;
+    CHECK_EQ(replaced("(\\w+)=(\\w+)", "$2=$1", true, "a=b, c=d", &count), "b=a, d=c");
+    CHECK_EQ(count, 2u);
+    CHECK_EQ(replaced("b+", "[$&]", true, "abbc"), "a[bb]c");
+    CHECK_EQ(replaced("b+", "[$0]", true, "abbc"), "a[bb]c");
+    CHECK_EQ(replaced("b", "$$", true, "abc"), "a$c");
+
+    // two digits make one group; a group that does not exist or did not
+    // take part expands to nothing; anything else after $ is literal
+    CHECK_EQ(replaced("(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)(k)", "$11$10", true, "abcdefghijk"), "kj");
+    CHECK_EQ(replaced("(a)", "<$7>", true, "xa"), "x<>");
+    CHECK_EQ(replaced("(a)|(b)", "<$2>", true, "a"), "<>");
+    CHECK_EQ(replaced("a", "$x$", true, "a"), "$x$");
+
+    // empty matches advance one character, as in JavaScript
+    CHECK_EQ(replaced("x*", "-", true, "abc", &count), "-a-b-c-");
+    CHECK_EQ(count, 4u);
+    CHECK_EQ(replaced("a*", "-", true, "baaac"), "-b--c-");
+    CHECK_EQ(replaced("^", ">", true, "abc", &count), ">abc");
+    CHECK_EQ(count, 1u);
+    CHECK_EQ(replaced("$", "<", true, "abc"), "abc<");
+    CHECK_EQ(replaced("x*", "-", true, ""), "-");
+
+    // no match leaves out untouched
+    ReplaceEngine engine("z", "y", true);
+    std::string out = "kept";
+    CHECK_EQ(engine.replaceLine("abc", out), 0u);
+    CHECK_EQ(out, "kept");
+
+    // a pattern without an operator goes to the literal search, with the
+    // same expansion
+    CHECK_EQ(replaced("foo", "[$&]", true, "a foo foo"), "a [foo] [foo]");
+    CHECK_EQ(replaced("foo", "[$1$$]", true, "foo"), "[$]");
+    CHECK_EQ(replaced("a.b", "X", false, "a.b axb"), "X axb");
+    CHECK_EQ(replaced("a.b", "X", true, "a.b axb"), "X X");
+    CHECK_EQ(replaced("$", "X", false, "a$"), "aX");
+
+    CHECK(!ReplaceEngine("", "x", true).isValid());
+    CHECK(!ReplaceEngine("(", "x", true).isValid());
+    CHECK(!ReplaceEngine("(", "x", true).error().empty());
+    CHECK(ReplaceEngine("(", "x", false).isValid());
+
+    // the whole document : lines without a match are copied, progress is
+    // reported every kProgressLines lines
+    std::vector<std::string> src(ReplaceEngine::kProgressLines + 3, "none");
+    src[1] = "one a";
+    src[5] = "a and a";
+    std::vector<std::string> dst;
+    std::vector<std::pair<size_t, size_t>> progress;
+    size_t total = ReplaceEngine("a", "b", true).replaceAll(src, dst, [&](size_t done, size_t all){
+        progress.push_back({done, all});
+    });
+    CHECK_EQ(total, 4u);
+    CHECK_EQ(dst.size(), src.size());
+    CHECK_EQ(dst[0], "none");
+    CHECK_EQ(dst[1], "one b");
+    CHECK_EQ(dst[5], "b bnd b");
+    CHECK_EQ(progress.size(), 1u);
+    CHECK(progress.size() == 1 && progress[0].first == ReplaceEngine::kProgressLines);
+    CHECK(progress.size() == 1 && progress[0].second == src.size());
+}
+
+// ---------------------------------------------------------------------------
+
+// the spans of one line as "start:length:color" words
+static std::string lexed(const DfaLexer& lexer, const std::string& line, uint32_t entry = 0,
+                         uint32_t* exit = nullptr)
+{
+    std::vector<TokenSpan> spans;
+    uint32_t state = lexer.lex(line.data(), line.size(), entry, &spans);
+    if(exit)
+        *exit = state;
+
+    std::string out;
+    for(auto& span : spans)
+    {
+        out += out.empty() ? "" : " ";
+        out += std::to_string(span.start) + ":" + std::to_string(span.length) + ":" +
+               std::to_string(span.color) + (span.isWord ? "w" : "");
+    }
+    return out;
+}
+
+static std::vector<TokenRule> testRules()
+{
+    return {
+        {"if",      "if",                            3,  false},
+        {"comment", "/\\*([^*]|\\*+[^*/])*\\*+/",    14, false},
+        {"number",  "[0-9]+(\\.[0-9]+)?",            5,  false},
+        {"ident",   "[A-Za-z_]\\w*",                 0,  true},
+        {"space",   "\\s+",                          0,  false},
+        {"op",      "=|==|\\+\\+?",                  6,  false},
+    };
+}
+
+static void testDfa()
+{
+    DfaLexer lexer;
+    CHECK(!lexer.isReady());
+    CHECK(lexer.compile(testRules()));
+    CHECK(lexer.isReady());
+
+    // longest match first, a tie goes to the rule listed first; a rule
+    // without color nor keywords gives no span
+    CHECK_EQ(lexed(lexer, "if ifx"), "0:2:3 3:3:0w");
+    CHECK_EQ(lexed(lexer, "x == 12.5 + 7."), "0:1:0w 2:2:6 5:4:5 10:1:6 12:1:5");
+    CHECK_EQ(lexed(lexer, "a++"), "0:1:0w 1:2:6");
+    CHECK_EQ(lexed(lexer, "?x"), "1:1:0w");
+
+    // a token alive at the line end is carried, with its color
+    uint32_t state;
+    CHECK_EQ(lexed(lexer, "a /* b", 0, &state), "0:1:0w 2:4:14");
+    CHECK(state != 0);
+    uint32_t carried = state;
+    CHECK_EQ(lexed(lexer, "still", carried, &state), "0:5:14");
+    CHECK_EQ(state, carried);
+    CHECK_EQ(lexed(lexer, "c */ d", carried, &state), "0:4:14 5:1:0w");
+    CHECK_EQ(state, 0u);
+
+    // checkpoints fall on token boundaries, lexing from one gives the same
+    // spans as lexing the whole line
+    std::string line;
+    for(int i = 0; i < 300; i++)
+        line += "abc 12 ";
+    std::vector<TokenSpan> spans;
+    std::vector<LexCheckpoint> checkpoints;
+    lexer.lex(line.data(), line.size(), 0, &spans, &checkpoints, 100);
+    CHECK(checkpoints.size() > 10);
+    for(auto& point : checkpoints)
+    {
+        std::vector<TokenSpan> tail;
+        lexer.lex(line.data() + point.offset, line.size() - point.offset, point.state, &tail);
+        size_t first = 0;
+        while(first < spans.size() && spans[first].start < point.offset)
+            first++;
+        CHECK_EQ(tail.size(), spans.size() - first);
+        CHECK(!tail.empty() && tail[0].start + point.offset == spans[first].start);
+    }
+
+    DfaLexer bad;
+    CHECK(!bad.compile({{"open", "(a", 1, false}}));
+    CHECK(!bad.error().empty());
+    CHECK(!bad.isReady());
+    CHECK(!bad.compile({{"class", "[a-", 1, false}}));
+}
+
+static void testDfaCache()
+{
+    const char* path = "testEditor.dfa";
+    DfaLexer lexer;
+    lexer.compile(testRules());
+    CHECK(lexer.save(path));
+
+    DfaLexer cached;
+    CHECK(cached.load(path, testRules()));
+    CHECK_EQ(cached.stateCount(), lexer.stateCount());
+    CHECK_EQ(lexed(cached, "if x == 1.5 /* c"), lexed(lexer, "if x == 1.5 /* c"));
+
+    // a color edit keeps the cache, a pattern edit does not
+    std::vector<TokenRule> rules = testRules();
+    rules[0].color = 9;
+    DfaLexer recolored;
+    CHECK(recolored.load(path, rules));
+    CHECK_EQ(lexed(recolored, "if"), "0:2:9");
+    rules[0].pattern = "iff";
+    CHECK(!DfaLexer().load(path, rules));
+    rules = testRules();
+    rules.pop_back();
+    CHECK(!DfaLexer().load(path, rules));
+    CHECK(!DfaLexer().load("testEditor.missing", testRules()));
+
+    std::string body;
+    {
+        std::ifstream file(path, std::ios::binary);
+        body.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    auto write = [&](const std::string& data) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+    };
+
+    // a cut or damaged body is refused, the lexer keeps what it had
+    write(body.substr(0, body.size() - 1));
+    CHECK(!cached.load(path, testRules()));
+    CHECK(cached.isReady());
+    CHECK_EQ(lexed(cached, "if"), "0:2:3");
+
+    std::string damaged = body;
+    damaged[damaged.size() - 1] = 0x7F;     // a rule index past the rules
+    write(damaged);
+    CHECK(!cached.load(path, testRules()));
+    CHECK_EQ(lexed(cached, "if"), "0:2:3");
+
+    DfaLexer empty;
+    CHECK(!empty.load(path, testRules()));
+    CHECK(!empty.isReady());
+
+    remove(path);
+}
+
+// ---------------------------------------------------------------------------
+
+// the events as words : a printable ASCII key is itself, a named key
+// "#code", "+mods" when there are some, the text of a paste or character
+static std::string describe(const std::vector<KeyEvent>& events)
+{
+    std::string out;
+    for(auto& event : events)
+    {
+        out += out.empty() ? "" : " ";
+        if(event.key == KeyEvent::kKeyPaste)
+            out += "paste[" + event.text + "]";
+        else if(event.key == KeyEvent::kKeyChar)
+            out += "char[" + event.text + "]";
+        else if(event.key > ' ' && event.key < 0x7F)
+            out += (char)event.key;
+        else
+            out += "#" + std::to_string(event.key);
+        if(event.mods)
+            out += "+" + std::to_string(event.mods);
+    }
+    return out;
+}
+
+static std::string named(int key, int mods = 0)
+{
+    return "#" + std::to_string(key) + (mods ? "+" + std::to_string(mods) : "");
+}
+
+static std::string decoded(const std::string& input)
+{
+    InputDecoder decoder;
+    std::vector<KeyEvent> events;
+    decoder.feed(input.data(), input.size(), events);
+    return describe(events);
+}
+
+// fed one byte at a time, a sequence cut anywhere must decode the same
+static std::string decodedByBytes(const std::string& input)
+{
+    InputDecoder decoder;
+    std::vector<KeyEvent> events;
+    for(char byte : input)
+        decoder.feed(&byte, 1, events);
+    return describe(events);
+}
+
+static void testInput()
+{
+    CHECK_EQ(decoded("ab"), "a b");
+    CHECK_EQ(decoded("\x1b[A\x1bOB"), named(KEY_UP) + " " + named(KEY_DOWN));
+    CHECK_EQ(decoded("\x1bOP\x1b[15~"), named(KEY_F(1)) + " " + named(KEY_F(5)));
+
+    // CSI parameters : the modifier is the second one minus one
+    CHECK_EQ(decoded("\x1b[1;5C"), named(KEY_RIGHT, KeyEvent::kCtrl));
+    CHECK_EQ(decoded("\x1b[15;2~"), named(KEY_F(5), KeyEvent::kShift));
+    CHECK_EQ(decoded("\x1b[3;3~"), named(KEY_DC, KeyEvent::kAlt));
+    CHECK_EQ(decoded("\x1b[1;6H"), named(KEY_HOME, KeyEvent::kShift | KeyEvent::kCtrl));
+    CHECK_EQ(decodedByBytes("\x1b[1;5C\x1b[24~x"), named(KEY_RIGHT, KeyEvent::kCtrl) + " " +
+                                                      named(KEY_F(12)) + " x");
+
+    // unknown sequences and replies to queries are swallowed whole
+    CHECK_EQ(decoded("\x1b[99~a\x1b[?1;2cb\x1b[>0;95;0cc\x1b[1 qd"), "a b c d");
+
+    // ESC + key is Alt
+    CHECK_EQ(decoded("\x1bx"), "x+" + std::to_string(KeyEvent::kAlt));
+
+    // a lone ESC asks for a status report once; the reply coming in behind
+    // it (or the Esc key again) makes it the Esc key
+    InputDecoder decoder;
+    std::vector<KeyEvent> events;
+    CHECK(decoder.feed("\x1b", 1, events));
+    CHECK(decoder.hasPendingEscape());
+    CHECK(events.empty());
+    CHECK(!decoder.feed("", 0, events));
+    CHECK(!decoder.feed("\x1b[0n", 4, events));
+    CHECK_EQ(describe(events), named(27));
+    CHECK(!decoder.hasPendingEscape());
+    events.clear();
+    CHECK(decoder.feed("\x1b", 1, events));
+    decoder.flushEscape(events);
+    CHECK_EQ(describe(events), named(27));
+    CHECK(!decoder.hasPendingEscape());
+
+    // bracketed paste is one event, whatever it holds and wherever the
+    // reads cut it
+    std::string paste = "\x1b[200~if(a)\x1b[A\n\x1b[201\x1b[201~x";
+    CHECK_EQ(decoded(paste), "paste[if(a)\x1b[A\n\x1b[201] x");
+    CHECK_EQ(decodedByBytes(paste), "paste[if(a)\x1b[A\n\x1b[201] x");
+    CHECK_EQ(decoded("\x1b[200~\x1b[201~"), "paste[]");
+
+    // a UTF-8 character is one event, bytes that do not make one are dropped
+    CHECK_EQ(decoded("\xc3\xa9\xe4\xb8\xad"), "char[\xc3\xa9] char[\xe4\xb8\xad]");
+    CHECK_EQ(decodedByBytes("\xf0\x9f\x98\x80z"), "char[\xf0\x9f\x98\x80] z");
+    CHECK_EQ(decoded("\xff\x80" "a"), "a");
+    CHECK_EQ(decodedByBytes("\xe4\xb8" "a"), "a");
+    CHECK_EQ(decoded("\xed\xa0\x80" "b"), "b");     // a surrogate
+}
+
+// ---------------------------------------------------------------------------
+
+static void testUtf8()
+{
+    // sequence lengths, 0 for what is not a valid sequence
+    CHECK_EQ(utf8_char_length("a", 1), 1);
+    CHECK_EQ(utf8_char_length("\xc3\xa9", 2), 2);
+    CHECK_EQ(utf8_char_length("\xe4\xb8\xad", 3), 3);
+    CHECK_EQ(utf8_char_length("\xf0\x9f\x98\x80", 4), 4);
+    CHECK_EQ(utf8_char_length("\xf4\x8f\xbf\xbf", 4), 4);      // U+10FFFF
+    CHECK_EQ(utf8_char_length("\x80", 1), 0);                      // continuation
+    CHECK_EQ(utf8_char_length("\xc0\xaf", 2), 0);                  // overlong
+    CHECK_EQ(utf8_char_length("\xe0\x80\xaf", 3), 0);              // overlong
+    CHECK_EQ(utf8_char_length("\xed\xa0\x80", 3), 0);              // surrogate
+    CHECK_EQ(utf8_char_length("\xf4\x90\x80\x80", 4), 0);          // past U+10FFFF
+    CHECK_EQ(utf8_char_length("\xf5\x80\x80\x80", 4), 0);
+    CHECK_EQ(utf8_char_length("\xe4\xb8\xad", 2), 0);              // cut
+    CHECK_EQ(utf8_char_length("\xe4" "a" "\xad", 3), 0);
+
+    // the vector loops against the byte ones : an invalid byte or a
+    // character at every offset around the 16 and 64 byte blocks
+    for(size_t at = 0; at < 140; at++)
+    {
+        std::string text(140, 'x');
+        bool isAscii = false;
+        CHECK(utf8_validate(text.data(), text.size(), &isAscii) && isAscii);
+
+        text[at] = '\xff';
+        CHECK_EQ(utf8_ascii_prefix(text.data(), text.size()), at);
+        CHECK(!utf8_validate(text.data(), text.size(), &isAscii));
+        CHECK(!isAscii);
+
+        text.replace(at, 1, "\xc3\xa9");
+        CHECK_EQ(utf8_ascii_prefix(text.data(), text.size()), at);
+        CHECK(utf8_validate(text.data(), text.size(), &isAscii));
+        CHECK(!isAscii);
+        CHECK_EQ(utf8_length(text.data(), text.size()), 140u);
+
+        text.erase(at + 1, 1);     // a cut sequence
+        CHECK(!utf8_validate(text.data(), text.size()));
+    }
+
+    // sanitize keeps the length and every offset
+    std::string text = "a\xff" "b\xc3\xa9\xe4\xb8" "c\xed\xa0\x80";
+    std::string clean = text;
+    utf8_sanitize(clean);
+    CHECK_EQ(clean, "a?b\xc3\xa9??c???");
+    CHECK_EQ(clean.size(), text.size());
+    CHECK(utf8_validate(clean.data(), clean.size()));
+    std::string valid = "\xe4\xb8\xad and \xc3\xa9";
+    clean = valid;
+    utf8_sanitize(clean);
+    CHECK_EQ(clean, valid);
+
+    // terminal columns : wide and zero width characters, tabs to their
+    // tab stop from the line start, an invalid byte takes one
+    CHECK_EQ(utf8_width("a\xe4\xb8\xad\xc3\xa9", 6), 4u);
+    CHECK_EQ(utf8_width("e\xcc\x81", 3), 1u);
+    CHECK_EQ(utf8_width("\xff", 1), 1u);
+    CHECK_EQ(utf8_width("ab\tc", 4), 9u);
+    CHECK_EQ(utf8_width("\xe4\xb8\xad\t\t", 5), 16u);
+    CHECK_EQ(utf8_width("1234567\t", 8), 8u);
+    CHECK_EQ(utf8_width_prefix("ab\tc", 4, 8), 3u);
+    CHECK_EQ(utf8_width_prefix("ab\tc", 4, 7), 2u);
+    CHECK_EQ(utf8_width_prefix("a\xe4\xb8\xad" "b", 5, 2), 1u);
+    CHECK_EQ(utf8_offset("a\xe4\xb8\xad" "b", 5, 2), 4u);
+}
+
+// ---------------------------------------------------------------------------
+
+// a line of n pieces, ASCII or not; lengths from empty through the inline
+// ones to past a rope leaf
+static std::string randomLine(std::mt19937& random, int n)
+{
+    static const char* pieces[] = {"a", "bc", "\xc3\xa9", "\xe4\xb8\xad", "\t", "xyz0123456789"};
+    std::string line;
+    for(int i = 0; i < n; i++)
+        line += pieces[random() % 6];
+    return line;
+}
+
+static int randomLength(std::mt19937& random)
+{
+    int kind = random() % 10;
+    return kind < 2 ? 0 : kind < 5 ? 1 + random() % 3 : kind < 9 ? random() % 40 : random() % 2000;
+}
+
+// the same edits on lines and on a plain vector, compared after each one
+template <typename Lines>
+static bool editLikeVector(Lines& lines, std::vector<std::string>& model, std::mt19937& random, int edits)
+{
+    for(int edit = 0; edit < edits; edit++)
+    {
+        size_t row  = model.empty() ? 0 : random() % model.size();
+        int    kind = random() % 8;
+        if(kind == 0 || model.empty())
+        {
+            std::string line = randomLine(random, randomLength(random));
+            lines.insert(row, line);
+            model.insert(model.begin() + row, line);
+        }
+        else if(kind == 1)
+        {
+            std::vector<std::string> block;
+            for(int i = random() % 50; i >= 0; i--)
+                block.push_back(randomLine(random, randomLength(random)));
+            model.insert(model.begin() + row, block.begin(), block.end());
+            lines.insert(row, std::move(block));
+        }
+        else if(kind == 2 && model.size() > 1)
+        {
+            size_t count = std::min<size_t>(1 + random() % 30, model.size() - row);
+            lines.erase(row, count);
+            model.erase(model.begin() + row, model.begin() + row + count);
+        }
+        else if(kind == 3)
+        {
+            std::string line = randomLine(random, randomLength(random));
+            lines.set(row, line);
+            model[row] = line;
+        }
+        else if(kind <= 5)
+        {
+            // on a character boundary, the pieces start with a lead byte
+            std::string& line = model[row];
+            size_t byte = line.empty() ? 0 : random() % (line.size() + 1);
+            while(byte < line.size() && ((unsigned char)line[byte] & 0xC0) == 0x80)
+                byte++;
+            std::string text = randomLine(random, 1 + random() % 3);
+            lines.insertBytes(row, byte, text);
+            line.insert(byte, text);
+        }
+        else
+        {
+            std::string& line = model[row];
+            size_t byte = line.empty() ? 0 : random() % line.size();
+            while(byte > 0 && ((unsigned char)line[byte] & 0xC0) == 0x80)
+                byte--;
+            size_t end = std::min(line.size(), byte + random() % 8);
+            while(end < line.size() && ((unsigned char)line[end] & 0xC0) == 0x80)
+                end++;
+            lines.eraseBytes(row, byte, end - byte);
+            line.erase(byte, end - byte);
+        }
+
+        // the edited row each time, every line now and then
+        if(lines.size() != model.size())
+            return false;
+        if(row < model.size() && lines[row] != model[row])
+            return false;
+        if(edit % 16 != 15 && edit != edits - 1)
+            continue;
+
+        uint64_t bytes = model.empty() ? 0 : model.size() - 1;
+        for(size_t i = 0; i < model.size(); i++)
+        {
+            if(lines[i] != model[i])
+                return false;
+            bytes += model[i].size();
+        }
+        if(lines.byteCount() != bytes)
+            return false;
+    }
+    return true;
+}
+
+template <typename Lines>
+static void checkLines(Lines& lines)
+{
+    std::mt19937 random(40);
+    std::vector<std::string> model;
+    std::string text;
+    for(int i = 0; i < 1000; i++)
+    {
+        model.push_back(randomLine(random, randomLength(random)));
+        text += (i ? "\n" : "") + model.back();
+    }
+
+    lines.appendText(std::string(text));
+    CHECK_EQ(lines.size(), model.size());
+    CHECK(editLikeVector(lines, model, random, 1000));
+
+    // a copy and the original change apart
+    Lines copy = lines;
+    std::vector<std::string> copyModel = model;
+    CHECK(editLikeVector(copy, copyModel, random, 300));
+    CHECK(editLikeVector(lines, model, random, 300));
+    CHECK(std::equal(copy.begin(), copy.end(), copyModel.begin(), copyModel.end()));
+    CHECK(std::equal(lines.begin(), lines.end(), model.begin(), model.end()));
+
+    lines.push_back("last");
+    CHECK_EQ(std::string(lines[lines.size() - 1]), "last");
+    lines.clear();
+    CHECK(lines.empty());
+    CHECK_EQ(lines.byteCount(), 0u);
+
+    // one more line than there are '\n'
+    lines.appendText("a\n\nb\n");
+    CHECK_EQ(lines.size(), 4u);
+    CHECK_EQ(std::string(lines[1]), "");
+    CHECK_EQ(std::string(lines[2]), "b");
+    CHECK_EQ(std::string(lines[3]), "");
+}
+
+static void testLineStore()
+{
+    LineStore store;
+    checkLines(store);
+
+    // an edited arena line moves to the pool, its bytes are dead
+    LineStore lines;
+    lines.appendText("a line long enough for the arena\nshort");
+    CHECK_EQ(lines.deadBytes(), 0u);
+    lines.insertBytes(0, 0, ">");
+    CHECK(lines.deadBytes() > 0);
+    CHECK_EQ(std::string(lines[0]), ">a line long enough for the arena");
+}
+
+// ---------------------------------------------------------------------------
+
+// the rope summaries against the lines measured one by one
+static bool checkSummaries(const LineRope& rope, const std::vector<std::string>& model)
+{
+    uint64_t bytes   = 0;
+    uint64_t units   = 0;
+    int      widest  = 0;
+    for(size_t row = 0; row < model.size(); row++)
+    {
+        const std::string& line = model[row];
+        if(rope.byteOffset(row) != bytes || rope.rowAtByte(bytes) != row ||
+           rope.rowAtByte(bytes + line.size()) != row)
+            return false;
+        if(rope.utf16Offset(row) != units || rope.rowAtUtf16(units) != row)
+            return false;
+
+        bytes  += line.size() + 1;
+        units  += utf8_utf16_length(line.data(), line.size()) + 1;
+        widest  = std::max<int>(widest, utf8_width(line.data(), line.size()));
+    }
+
+    int columns = -1;
+    size_t longest = rope.longestLine(&columns);
+    return columns == widest && longest < model.size() &&
+           (int)utf8_width(model[longest].data(), model[longest].size()) == widest;
+}
+
+static void testLineRope()
+{
+    LineRope rope;
+    checkLines(rope);
+
+    // a tab in or after an edit moves to another tab stop, a 4 byte
+    // character is two UTF-16 units
+    std::mt19937 random(41);
+    std::vector<std::string> model;
+    LineRope lines;
+    for(int i = 0; i < 600; i++)
+    {
+        model.push_back(randomLine(random, randomLength(random)) + (i % 7 ? "" : "\xf0\x9f\x98\x80"));
+        lines.push_back(model.back());
+    }
+    CHECK(checkSummaries(lines, model));
+    for(int round = 0; round < 10; round++)
+    {
+        CHECK(editLikeVector(lines, model, random, 30));
+        CHECK(checkSummaries(lines, model));
+    }
+
+    LineRope tabs;
+    tabs.appendText("short\n" + std::string(64, '\t') + "\nshort");
+    tabs.insertBytes(1, 10, "a");
+    int columns;
+    CHECK_EQ(tabs.longestLine(&columns), 1u);
+    CHECK_EQ(columns, 64 * 8);
+    tabs.eraseBytes(1, 0, 1);
+    tabs.longestLine(&columns);
+    CHECK_EQ(columns, 63 * 8);
+
+    // a copy shares the nodes, an edit on it leaves the original
+    LineRope copy = lines;
+    copy.set(0, "changed");
+    copy.erase(1, 100);
+    CHECK_EQ(std::string(lines[0]), model[0]);
+    CHECK_EQ(lines.size(), model.size());
+    CHECK_EQ(copy.size(), model.size() - 100);
+}
+
+// ---------------------------------------------------------------------------
+
+// before with the hunks applied, or a note when they overlap or go past it
+static std::vector<std::string> applyHunks(const std::vector<std::string>& before,
+                                           const std::vector<std::string>& after,
+                                           const std::vector<DiffHunk>& hunks)
+{
+    std::vector<std::string> out;
+    size_t row = 0;
+    for(auto& hunk : hunks)
+    {
+        if(hunk.oldRow < row || hunk.oldRow + hunk.oldCount > before.size() ||
+           hunk.newRow != out.size() + (hunk.oldRow - row) || hunk.newRow + hunk.newCount > after.size())
+            return {"(bad hunk)"};
+        out.insert(out.end(), before.begin() + row, before.begin() + hunk.oldRow);
+        out.insert(out.end(), after.begin() + hunk.newRow, after.begin() + hunk.newRow + hunk.newCount);
+        row = hunk.oldRow + hunk.oldCount;
+    }
+    out.insert(out.end(), before.begin() + row, before.end());
+    return out;
+}
+
+// the fewest inserted plus erased lines, from the longest common subsequence
+static size_t editDistance(const std::vector<std::string>& before, const std::vector<std::string>& after)
+{
+    std::vector<std::vector<size_t>> common(before.size() + 1, std::vector<size_t>(after.size() + 1, 0));
+    for(size_t i = 1; i <= before.size(); i++)
+    {
+        for(size_t j = 1; j <= after.size(); j++)
+        {
+            common[i][j] = before[i - 1] == after[j - 1] ? common[i - 1][j - 1] + 1 :
+                           std::max(common[i - 1][j], common[i][j - 1]);
+        }
+    }
+    return before.size() + after.size() - 2 * common[before.size()][after.size()];
+}
+
+static void testLineDiff()
+{
+    std::vector<std::string> before = {"a", "b", "c", "d", "e"};
+    CHECK(diff_lines(before, before).empty());
+
+    auto hunks = diff_lines(before, std::vector<std::string>{"a", "b", "X", "d", "e"});
+    CHECK_EQ(hunks.size(), 1u);
+    CHECK(hunks.size() == 1 && hunks[0].oldRow == 2 && hunks[0].oldCount == 1 &&
+          hunks[0].newRow == 2 && hunks[0].newCount == 1);
+
+    hunks = diff_lines(before, std::vector<std::string>{"new", "a", "b", "c", "d"});
+    CHECK_EQ(hunks.size(), 2u);
+    CHECK(hunks.size() == 2 && hunks[0].oldCount == 0 && hunks[0].newCount == 1 &&
+          hunks[1].oldRow == 4 && hunks[1].oldCount == 1 && hunks[1].newCount == 0);
+
+    hunks = diff_lines(before, std::vector<std::string>{});
+    CHECK(hunks.size() == 1 && hunks[0].oldCount == 5 && hunks[0].newCount == 0);
+
+    // random edits over few distinct lines, so many lines match : the
+    // hunks rebuild the new lines, touch nothing twice and are minimal
+    std::mt19937 random(45);
+    for(int round = 0; round < 300; round++)
+    {
+        std::vector<std::string> old;
+        for(int i = random() % 60; i > 0; i--)
+            old.push_back(std::string(1, 'a' + random() % 4));
+
+        std::vector<std::string> now = old;
+        for(int i = random() % 8; i > 0; i--)
+        {
+            size_t row = random() % (now.size() + 1);
+            if(random() % 2 && row < now.size())
+                now.erase(now.begin() + row);
+            else
+                now.insert(now.begin() + row, std::string(1, 'a' + random() % 5));
+        }
+
+        hunks = diff_lines(old, now);
+        CHECK(applyHunks(old, now, hunks) == now);
+        size_t changed = 0;
+        for(size_t i = 0; i < hunks.size(); i++)
+        {
+            changed += hunks[i].oldCount + hunks[i].newCount;
+            CHECK(hunks[i].oldCount + hunks[i].newCount > 0);
+            CHECK(i == 0 || hunks[i - 1].oldRow + hunks[i - 1].oldCount < hunks[i].oldRow ||
+                  hunks[i - 1].newRow + hunks[i - 1].newCount < hunks[i].newRow);
+        }
+        CHECK_EQ(changed, editDistance(old, now));
+    }
+
+    // past maxEdits the changed middle becomes one hunk
+    std::vector<std::string> old, now;
+    for(int i = 0; i < 100; i++)
+    {
+        old.push_back("line " + std::to_string(i));
+        now.push_back(i >= 10 && i < 90 ? "other " + std::to_string(i) : old.back());
+    }
+    hunks = diff_lines(old, now, 20);
+    CHECK(hunks.size() == 1 && hunks[0].oldRow == 10 && hunks[0].oldCount == 80 && hunks[0].newCount == 80);
+    CHECK(applyHunks(old, now, hunks) == now);
+    CHECK_EQ(diff_lines(old, now).size(), 1u);
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char** args)
+{
+    testList().push_back({"replace", testReplace});
+    testList().push_back({"dfa", testDfa});
+    testList().push_back({"dfacache", testDfaCache});
+    testList().push_back({"input", testInput});
+    testList().push_back({"utf8", testUtf8});
+    testList().push_back({"linestore", testLineStore});
+    testList().push_back({"linerope", testLineRope});
+    testList().push_back({"linediff", testLineDiff});
+
+    const char* filter = argc > 1 ? args[1] : nullptr;
+    int groups = 0;
+    for(auto& test : testList())
+    {
+        if(filter && !strstr(test.name, filter))
+            continue;
+
+        int failures = g_failures;
+        test.run();
+        printf("[%s] %s\n", test.name, g_failures == failures ? "ok" : "FAILED");
+        groups++;
+    }
+
+    if(groups == 0)
+    {
+        printf("no test group matches \"%s\"\n", filter);
+        return 1;
+    }
+    return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Writes include/utils/charWidth.hpp : the terminal column width of every
+# code point from the Unicode database of this Python (unicodedata).
+#
+#   python3 tools/genCharWidth.py > include/utils/charWidth.hpp
+#
+# 2 : East Asian Wide and Fullwidth, and the unassigned code points of the
+#     CJK blocks, which default to wide
+# 0 : nonspacing and enclosing marks, format characters but the soft
+#     hyphen, Hangul medial vowels and final consonants
+# 1 : everything else, only the ranges that are not 1 are written
+
+import unicodedata
+
+
+def width(cp):
+    if 0x1160 <= cp <= 0x11FF:
+        return 0
+
+    ch  = chr(cp)
+    cat = unicodedata.category(ch)
+    if cat == 'Cn':
+        cjk = (0x3400 <= cp <= 0x4DBF or 0x4E00 <= cp <= 0x9FFF or 0xF900 <= cp <= 0xFAFF
+               or 0x20000 <= cp <= 0x2FFFD or 0x30000 <= cp <= 0x3FFFD)
+        return 2 if cjk else 1
+    if cp != 0xAD and cat in ('Mn', 'Me', 'Cf'):
+        return 0
+    if unicodedata.east_asian_width(ch) in ('W', 'F'):
+        return 2
+    return 1
+
+
+def main():
+    ranges = []
+    for cp in range(0x300, 0x110000):
+        if 0xD800 <= cp <= 0xDFFF:
+            continue
+        w = width(cp)
+        if w == 1:
+            continue
+        if ranges and ranges[-1][2] == w and ranges[-1][1] == cp - 1:
+            ranges[-1][1] = cp
+        else:
+            ranges.append([cp, cp, w])
+
+    rows = []
+    for i in range(0, len(ranges), 3):
+        rows.append('    ' + ', '.join('{0x%05X, 0x%05X, %d}' % tuple(r) for r in ranges[i:i + 3]) + ',')
+
+    print('''#ifndef __CHAR_WIDTH__
+#define __CHAR_WIDTH__
+// Generated by tools/genCharWidth.py from Unicode %s, do not edit.
+//
+// Terminal columns of a code point : 2 for East Asian wide and fullwidth,
+// 0 for combining marks and format characters, 1 for the rest. Below
+// U+0300 everything is 1.
+
+#include <cstdint>
+
+struct CharWidthRange
+{
+    std::uint32_t first;
+    std::uint32_t last;
+    std::uint8_t  width;
+};
+
+constexpr CharWidthRange kCharWidthRanges[] =
+{
+%s
+};
+
+constexpr int kCharWidthRangeCount = sizeof(kCharWidthRanges) / sizeof(kCharWidthRanges[0]);
+
+// binary search over the ranges, constexpr so the table is checked at compile time
+constexpr int char_width(std::uint32_t cp) {
+    if(cp < 0x300)
+        return 1;
+
+    int low  = 0;
+    int high = kCharWidthRangeCount - 1;
+    while(low <= high) {
+        int mid = (low + high) / 2;
+        if(cp < kCharWidthRanges[mid].first)
+            high = mid - 1;
+        else if(cp > kCharWidthRanges[mid].last)
+            low = mid + 1;
+        else
+            return kCharWidthRanges[mid].width;
+    }
+    return 1;
+}
+
+static_assert(char_width('a') == 1, "ASCII is one column");
+static_assert(char_width(0x0301) == 0, "combining acute accent");
+static_assert(char_width(0x4E2D) == 2, "CJK ideograph");
+static_assert(char_width(0xFF21) == 2, "fullwidth A");
+static_assert(char_width(0x1F600) == 2, "emoji");
+
+#endif''' % (unicodedata.unidata_version, '\n'.join(rows)))
+
+
+if __name__ == '__main__':
+    main()